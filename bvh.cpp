@@ -13,7 +13,7 @@ BVH::BVH(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth, size_t
         return;
 
     for(int i = 0; i < DrawPriority::__DRAW_PRIO_LAST; i++) {
-        m_ways[i] = std::vector<std::shared_ptr<Way>>();
+        m_ways[i] = std::vector<WayHandle>();
     }
 
     glm::vec2 size = bbox_size();
@@ -39,66 +39,86 @@ BVH::BVH(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth, size_t
     }
 }
 
-void BVH::add_way(std::shared_ptr<Way> way) {
+void BVH::add_way(const WayArena& ways, WayHandle handle) {
+    find_node(ways[handle])->insert_way(ways, handle);
+}
+
+auto BVH::find_node(const BBox& bbox) -> BVH* {
     auto& [ a, b ] = m_children;
 
-    auto priority = way->get_metadata().draw_priority();
-    if(!a || !b) {
-        m_ways[priority].push_back(std::move(way));
-        return;
-    }
+    if(!a || !b)
+        return this;
 
-    bool in_a = way->intersects(*a);
-    bool in_b = way->intersects(*b);
+    bool in_a = bbox.intersects(*a);
+    bool in_b = bbox.intersects(*b);
 
     if(in_a == in_b)
-        m_ways[priority].push_back(std::move(way));
+        return this;
     else if(in_a)
-        a->add_way(std::move(way));
-    else if(in_b)
-        b->add_way(std::move(way));
+        return a->find_node(bbox);
+    else
+        return b->find_node(bbox);
 }
 
-void BVH::draw(BBox& viewport, DrawPriority priority, size_t max_depth, size_t depth)
+void BVH::collect(const WayArena& ways, const BBox& viewport, DrawPriority priority, DrawList& list) const
 {
-    if(depth >= max_depth)
-        return;
-    
+    // the ways of a node that is partly in view are culled one by one, which matters for
+    // views as narrow as the strips a pan uncovers
+    const bool inside = viewport.contains(min_coord()) && viewport.contains(max_coord());
+
     for(int i = 0; i < static_cast<int>(priority); i++) {
-        auto& ways = m_ways[i];
-        for(auto& way : ways) {
-            way->draw_buffers();
+        for(auto handle : m_ways[i]) {
+            auto& way = ways[handle];
+            if(inside || way.intersects(viewport))
+                list.add(way);
         }
     }
 
+    // the children of a node above the tile depth start tiles of their own
     auto& [ a, b ] = m_children;
-    if(a != nullptr && a->intersects(viewport))
-        a->draw(viewport, priority, max_depth, depth + 1);
-    if(b != nullptr && b->intersects(viewport))
-        b->draw(viewport, priority, max_depth, depth + 1);
+    if(a != nullptr && a->m_tile == m_tile && a->intersects(viewport))
+        a->collect(ways, viewport, priority, list);
+    if(b != nullptr && b->m_tile == m_tile && b->intersects(viewport))
+        b->collect(ways, viewport, priority, list);
 }
 
-std::pair<float, std::shared_ptr<Way>> BVH::get_nearest_way(glm::vec2 coords, DrawPriority priority) const {
+std::pair<float, WayHandle> BVH::get_nearest_way(const WayArena& ways, glm::vec2 coords, DrawPriority priority) const {
     float min_dist = std::numeric_limits<float>::infinity();
-    std::shared_ptr<Way> way_ptr = nullptr;
+    WayHandle nearest = no_way;
 
     auto& [ a, b ] = m_children;
     if(a != nullptr && a->contains(coords)) {
-        auto inner = a->get_nearest_way(coords, priority);
+        auto inner = a->get_nearest_way(ways, coords, priority);
         min_dist = inner.first;
-        way_ptr = inner.second;
+        nearest = inner.second;
     }
     else if(b != nullptr && b->contains(coords)) {
-        auto inner = b->get_nearest_way(coords, priority);
+        auto inner = b->get_nearest_way(ways, coords, priority);
         min_dist = inner.first;
-        way_ptr = inner.second;
+        nearest = inner.second;
     }
 
     for(int i = 0; i < priority; i++) {
-        for(auto& way : m_ways[i]) {
-            for(size_t j = 1; j < way->get_nodes().size(); j++) {
-                auto v = way->get_nodes()[j - 1].m_coord;
-                auto w = way->get_nodes()[j].m_coord;
+        for(auto handle : m_ways[i]) {
+            auto& way = ways[handle];
+
+            // no segment can be closer than the bounding box, which is stored in the arena
+            if(way.distance2(coords) > min_dist)
+                continue;
+
+            auto way_coords = ways.coords(handle);
+            auto& ring_ends = way.get_ring_ends();
+            auto ring_end = ring_ends.begin();
+
+            for(size_t j = 1; j < way_coords.size(); j++) {
+                // no segment connects two rings of a multipolygon
+                if(ring_end != ring_ends.end() && j == *ring_end) {
+                    ring_end++;
+                    continue;
+                }
+
+                auto v = way_coords[j - 1];
+                auto w = way_coords[j];
 
                 float length_sq = glm::distance2(v, w);
                 float dist_sq = 0.0f;
@@ -112,12 +132,36 @@ std::pair<float, std::shared_ptr<Way>> BVH::get_nearest_way(glm::vec2 coords, Dr
 
                 if(dist_sq < min_dist) {
                     min_dist = dist_sq;
-                    way_ptr = way;
+                    nearest = handle;
                 }
             }
         }
     }
     
-    return std::make_pair(min_dist, way_ptr);
+    return std::make_pair(min_dist, nearest);
 }
 
+void BVH::flatten(std::vector<BVH*>& nodes) {
+    nodes.push_back(this);
+
+    auto& [ a, b ] = m_children;
+    if(a)
+        a->flatten(nodes);
+    if(b)
+        b->flatten(nodes);
+}
+
+void BVH::assign_tiles(size_t tile_depth, size_t depth, uint32_t tile, std::vector<BVH*>& tiles) {
+    if(depth <= tile_depth) {
+        tile = tiles.size();
+        tiles.push_back(this);
+    }
+
+    m_tile = tile;
+
+    auto& [ a, b ] = m_children;
+    if(a)
+        a->assign_tiles(tile_depth, depth + 1, tile, tiles);
+    if(b)
+        b->assign_tiles(tile_depth, depth + 1, tile, tiles);
+}
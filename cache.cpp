@@ -0,0 +1,530 @@
+#include "cache.hpp"
+#include "bvh.hpp"
+#include "log.hpp"
+#include "mappedfile.hpp"
+#include "wayarena.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr char cache_magic[8] = {'M', 'A', 'P', 'C', 'A', 'C', 'H', 'E'};
+// 2: coordinates are projected in double precision
+// 3: multipolygon rings
+// 4: levels of detail and fills, tag tables
+static constexpr uint32_t cache_version = 4;
+static constexpr uint32_t cache_byte_order = 0x01020304;
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t source_hash;
+
+    float min_x, min_y, max_x, max_y;
+    uint32_t bvh_max_depth;
+    // 0 in caches from before filter profiles, which were unfiltered
+    uint32_t filter_hash;
+
+    uint64_t way_count;
+    uint64_t data_size;
+
+    // the tag tables follow the way records
+    uint64_t string_count;
+    uint64_t tag_set_count;
+    uint64_t table_size;
+};
+
+static_assert(sizeof(CacheHeader) == 104);
+
+struct WayRecord {
+    uint64_t id;
+    uint32_t bvh_index;
+    uint32_t node_count;
+    uint32_t tag_set;
+    uint8_t classification;
+    int8_t line_width;
+    uint16_t reserved;
+    // 0 for plain ways
+    uint32_t ring_count;
+    uint32_t outer_ring_count;
+    // 0 unless the way is an area
+    uint32_t fill_size;
+    uint32_t reserved2;
+    float min_x, min_y, max_x, max_y;
+};
+
+static_assert(sizeof(WayRecord) == 56);
+
+static inline auto padding(uint64_t size) -> uint64_t {
+    return (8 - size % 8) % 8;
+}
+
+static inline void fnv1a(uint64_t& hash, const void* data, size_t size) {
+    auto bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+}
+
+// hashes evenly spaced samples of the file, including its head and tail;
+// hashing all of it would make a warm start as slow as reading the source
+auto SourceFingerprint::of(const char* path) -> std::optional<SourceFingerprint> {
+    constexpr size_t sample_count = 64;
+    constexpr size_t sample_size = 64 * 1024;
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0)
+        return std::nullopt;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return std::nullopt;
+    }
+
+    SourceFingerprint fingerprint;
+    fingerprint.m_size = st.st_size;
+    fingerprint.m_mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    fingerprint.m_hash = 0xcbf29ce484222325ull;
+
+    std::vector<char> sample(sample_size);
+    const uint64_t last_offset = fingerprint.m_size > sample_size ? fingerprint.m_size - sample_size : 0;
+
+    for(size_t i = 0; i < sample_count; i++) {
+        off_t offset = last_offset * i / (sample_count - 1);
+        ssize_t bytes_read = pread(fd, sample.data(), sample_size, offset);
+        if(bytes_read < 0) {
+            close(fd);
+            return std::nullopt;
+        }
+
+        fnv1a(fingerprint.m_hash, sample.data(), bytes_read);
+    }
+
+    close(fd);
+    return fingerprint;
+}
+
+auto default_cache_path(const char* source_path) -> std::string {
+    return std::string(source_path) + ".mapcache";
+}
+
+CacheWriter::CacheWriter(const std::string& cache_path, const SourceFingerprint& source, std::pair<glm::vec2, glm::vec2> bounds, uint32_t bvh_max_depth)
+    : m_path(cache_path), m_temp_path(cache_path + ".tmp"), m_output(m_temp_path, std::ios::binary | std::ios::trunc)
+{
+    CacheHeader header = {};
+    std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = cache_version;
+    header.byte_order = cache_byte_order;
+    header.source_size = source.m_size;
+    header.source_mtime_ns = source.m_mtime_ns;
+    header.source_hash = source.m_hash;
+    header.filter_hash = source.m_filter_hash;
+    header.min_x = bounds.first.x;
+    header.min_y = bounds.first.y;
+    header.max_x = bounds.second.x;
+    header.max_y = bounds.second.y;
+    header.bvh_max_depth = bvh_max_depth;
+
+    // way count and data size are patched in by `finish()`
+    m_output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+CacheWriter::~CacheWriter() {
+    if(!m_finished) {
+        m_output.close();
+        std::remove(m_temp_path.c_str());
+    }
+}
+
+auto CacheWriter::string_index(Tag::Id id) -> uint32_t {
+    auto [it, inserted] = m_string_indices.try_emplace(id, m_strings.size());
+    if(inserted)
+        m_strings.push_back(id);
+    return it->second;
+}
+
+auto CacheWriter::tag_set_index(const TagSet* set) -> uint32_t {
+    auto [it, inserted] = m_tag_set_indices.try_emplace(set, m_tag_sets.size());
+    if(inserted) {
+        m_tag_sets.push_back(set);
+        for(auto& tag : *set) {
+            string_index(tag.m_key);
+            string_index(tag.m_value);
+        }
+    }
+    return it->second;
+}
+
+void CacheWriter::add_way(const Way& way, CoordSpan coords, const uint8_t* lod, FillSpan fill, uint32_t bvh_index) {
+    static const char zeros[8] = {};
+
+    WayRecord record = {};
+    record.id = way.get_id();
+    record.bvh_index = bvh_index;
+    record.node_count = coords.size();
+    record.tag_set = tag_set_index(&way.get_tags());
+    record.classification = way.get_metadata().m_classification;
+    record.line_width = way.get_metadata().m_line_width;
+    record.ring_count = way.get_ring_ends().size();
+    record.outer_ring_count = way.get_outer_ring_count();
+    record.fill_size = fill.size();
+    record.min_x = way.min_coord().x;
+    record.min_y = way.min_coord().y;
+    record.max_x = way.max_coord().x;
+    record.max_y = way.max_coord().y;
+
+    uint64_t size = sizeof(record);
+    m_output.write(reinterpret_cast<const char*>(&record), sizeof(record));
+
+    m_output.write(reinterpret_cast<const char*>(coords.begin()), coords.size() * sizeof(glm::vec2));
+    size += coords.size() * sizeof(glm::vec2);
+
+    auto& ring_ends = way.get_ring_ends();
+    m_output.write(reinterpret_cast<const char*>(ring_ends.data()), ring_ends.size() * sizeof(uint32_t));
+    size += ring_ends.size() * sizeof(uint32_t);
+
+    m_output.write(reinterpret_cast<const char*>(fill.data()), fill.size() * sizeof(uint32_t));
+    size += fill.size() * sizeof(uint32_t);
+
+    m_output.write(reinterpret_cast<const char*>(lod), coords.size());
+    size += coords.size();
+
+    m_output.write(zeros, padding(size));
+
+    m_data_size += size + padding(size);
+    m_way_count++;
+}
+
+auto CacheWriter::finish() -> bool {
+    static const char zeros[8] = {};
+    uint64_t table_size = 0;
+
+    for(auto id : m_strings) {
+        uint32_t length = TagPool::instance().string(id).size();
+        m_output.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        table_size += sizeof(length);
+    }
+
+    for(auto id : m_strings) {
+        auto string = TagPool::instance().string(id);
+        m_output.write(string.data(), string.size());
+        table_size += string.size();
+    }
+
+    for(auto set : m_tag_sets) {
+        uint32_t count = set->size();
+        m_output.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+        for(auto& tag : *set) {
+            uint32_t indices[2] = {m_string_indices[tag.m_key], m_string_indices[tag.m_value]};
+            m_output.write(reinterpret_cast<const char*>(indices), sizeof(indices));
+        }
+        table_size += sizeof(count) + set->size() * 2 * sizeof(uint32_t);
+    }
+
+    m_output.write(zeros, padding(table_size));
+    table_size += padding(table_size);
+
+    const uint64_t string_count = m_strings.size(), tag_set_count = m_tag_sets.size();
+
+    m_output.seekp(offsetof(CacheHeader, way_count));
+    m_output.write(reinterpret_cast<const char*>(&m_way_count), sizeof(m_way_count));
+    m_output.write(reinterpret_cast<const char*>(&m_data_size), sizeof(m_data_size));
+    m_output.write(reinterpret_cast<const char*>(&string_count), sizeof(string_count));
+    m_output.write(reinterpret_cast<const char*>(&tag_set_count), sizeof(tag_set_count));
+    m_output.write(reinterpret_cast<const char*>(&table_size), sizeof(table_size));
+    m_output.close();
+
+    if(m_output.fail() || std::rename(m_temp_path.c_str(), m_path.c_str()) != 0) {
+        std::remove(m_temp_path.c_str());
+        m_finished = true;
+        return false;
+    }
+
+    m_finished = true;
+    return true;
+}
+
+auto write_map_cache(const std::string& cache_path, const SourceFingerprint& source, const Map& map) -> bool {
+    const auto start = Clock::now();
+
+    if(!map.has_bvh())
+        return false;
+
+    std::vector<BVH*> nodes;
+    map.get_bvh().flatten(nodes);
+
+    CacheWriter writer(cache_path, source, map.get_minmax_coord(), map.get_max_bvh_depth());
+    if(!writer.good()) {
+        mlog::logln(mlog::WARN, "Could not create map cache `%s`", cache_path.c_str());
+        return false;
+    }
+
+    auto& ways = map.get_ways();
+    for(size_t i = 0; i < nodes.size(); i++) {
+        for(int priority = 0; priority < DrawPriority::__DRAW_PRIO_LAST; priority++) {
+            for(auto handle : nodes[i]->get_ways(priority))
+                writer.add_way(ways[handle], ways.coords(handle), ways.lod(handle), ways.fill(handle), i);
+        }
+    }
+
+    if(!writer.finish()) {
+        mlog::logln(mlog::WARN, "Could not write map cache `%s`", cache_path.c_str());
+        return false;
+    }
+
+    mlog::logln(mlog::INFO, "Wrote map cache `%s` in %.2fs", cache_path.c_str(), std::chrono::duration<double>(Clock::now() - start).count());
+    return true;
+}
+
+// bounds-checked cursor over the mapped records
+class CacheReader {
+public:
+    CacheReader(const char* data, size_t size)
+        : m_pos(data), m_end(data + size)
+    {}
+
+    template<typename T>
+    inline bool read(T& value) {
+        if(size_t(m_end - m_pos) < sizeof(T))
+            return false;
+        std::memcpy(&value, m_pos, sizeof(T));
+        m_pos += sizeof(T);
+        return true;
+    }
+
+    inline auto bytes(size_t size) -> const char* {
+        if(size_t(m_end - m_pos) < size)
+            return nullptr;
+        auto data = m_pos;
+        m_pos += size;
+        return data;
+    }
+
+private:
+    const char* m_pos;
+    const char* m_end;
+};
+
+// a way record and where its arrays are in the mapping
+struct WayView {
+    WayRecord m_record;
+    const glm::vec2* m_coords;
+    const uint32_t* m_ring_ends;
+    const uint32_t* m_fill;
+    const uint8_t* m_lod;
+};
+
+static auto read_way(CacheReader& reader, WayView& view) -> bool {
+    auto& record = view.m_record;
+    if(!reader.read(record))
+        return false;
+
+    auto coords = reader.bytes(record.node_count * sizeof(glm::vec2));
+    auto ring_ends = reader.bytes(record.ring_count * sizeof(uint32_t));
+    auto fill = reader.bytes(record.fill_size * sizeof(uint32_t));
+    auto lod = reader.bytes(record.node_count);
+    if(!coords || !ring_ends || !fill || !lod)
+        return false;
+
+    const uint64_t size = sizeof(record) + record.node_count * (sizeof(glm::vec2) + 1) + (uint64_t(record.ring_count) + record.fill_size) * sizeof(uint32_t);
+    if(!reader.bytes(padding(size)))
+        return false;
+
+    // every array is aligned, the records are and so is everything ahead of the levels of detail
+    view.m_coords = reinterpret_cast<const glm::vec2*>(coords);
+    view.m_ring_ends = reinterpret_cast<const uint32_t*>(ring_ends);
+    view.m_fill = reinterpret_cast<const uint32_t*>(fill);
+    view.m_lod = reinterpret_cast<const uint8_t*>(lod);
+    return true;
+}
+
+// what drawing the way relies on
+static bool check_way(const WayView& view, size_t bvh_size, size_t tag_set_count) {
+    auto& record = view.m_record;
+    if(record.bvh_index >= bvh_size || record.classification >= Metadata::__CLASSIFICATION_LAST || record.tag_set >= tag_set_count)
+        return false;
+
+    // levels index per-level arrays when the way is drawn
+    if(std::any_of(view.m_lod, view.m_lod + record.node_count, [](uint8_t level) { return level >= lod_levels; }))
+        return false;
+
+    if(record.ring_count) {
+        if(record.outer_ring_count > record.ring_count || !std::is_sorted(view.m_ring_ends, view.m_ring_ends + record.ring_count)
+            || view.m_ring_ends[record.ring_count - 1] != record.node_count)
+            return false;
+    }
+
+    if(record.fill_size) {
+        if(record.fill_size < 2 * lod_levels)
+            return false;
+
+        FillSpan fill(view.m_fill, record.fill_size);
+        for(int level = 0; level < lod_levels; level++) {
+            if(uint64_t(fill.first(level)) + fill.count(level) > fill.index_count())
+                return false;
+        }
+
+        auto indices = view.m_fill + 2 * lod_levels;
+        if(std::any_of(indices, indices + fill.index_count(), [&](uint32_t index) { return index >= record.node_count; }))
+            return false;
+    }
+
+    return true;
+}
+
+static auto load_way(const WayView& view, const std::vector<const TagSet*>& tag_sets) -> Way {
+    auto& record = view.m_record;
+
+    Metadata metadata;
+    metadata.m_classification = static_cast<Metadata::Classification>(record.classification);
+    metadata.m_line_width = record.line_width;
+
+    Way way(record.id);
+    way.set_metadata(metadata);
+    way.set_tags(tag_sets[record.tag_set]);
+    way.set_minmax_coord(std::make_pair(glm::vec2(record.min_x, record.min_y), glm::vec2(record.max_x, record.max_y)));
+
+    if(record.ring_count) {
+        way.set_rings(std::vector<uint32_t>(view.m_ring_ends, view.m_ring_ends + record.ring_count), record.outer_ring_count);
+        way.index_rings(view.m_lod);
+    }
+
+    return way;
+}
+
+// interns the strings and tag sets of the tables once, the records refer to them by index
+static auto load_tag_sets(CacheReader& reader, const CacheHeader& header, std::vector<const TagSet*>& tag_sets) -> bool {
+    // every string and set takes at least 4 bytes, which bounds what is allocated for a damaged header
+    if(header.string_count > header.table_size / 4 || header.tag_set_count > header.table_size / 4)
+        return false;
+
+    auto lengths = reader.bytes(header.string_count * sizeof(uint32_t));
+    if(!lengths)
+        return false;
+
+    std::vector<std::string_view> strings(header.string_count);
+    for(size_t i = 0; i < strings.size(); i++) {
+        uint32_t length;
+        std::memcpy(&length, lengths + i * sizeof(uint32_t), sizeof(length));
+
+        auto string = reader.bytes(length);
+        if(!string)
+            return false;
+        strings[i] = std::string_view(string, length);
+    }
+
+    // checked before anything is interned
+    std::vector<std::pair<const char*, uint32_t>> sets(header.tag_set_count);
+    for(auto& set : sets) {
+        if(!reader.read(set.second) || !(set.first = reader.bytes(set.second * 2 * sizeof(uint32_t))))
+            return false;
+
+        for(uint32_t i = 0; i < set.second * 2; i++) {
+            uint32_t index;
+            std::memcpy(&index, set.first + i * sizeof(uint32_t), sizeof(index));
+            if(index >= strings.size())
+                return false;
+        }
+    }
+
+    auto& pool = TagPool::instance();
+    std::vector<Tag::Id> ids(strings.size());
+    for(size_t i = 0; i < strings.size(); i++)
+        ids[i] = pool.intern(strings[i]);
+
+    std::vector<Tag> tags;
+    tag_sets.resize(sets.size());
+    for(size_t i = 0; i < sets.size(); i++) {
+        tags.clear();
+        for(uint32_t j = 0; j < sets[i].second; j++) {
+            uint32_t indices[2];
+            std::memcpy(indices, sets[i].first + j * sizeof(indices), sizeof(indices));
+            tags.push_back({ids[indices[0]], ids[indices[1]]});
+        }
+        tag_sets[i] = pool.intern_set(tags);
+    }
+
+    return true;
+}
+
+auto load_map_cache(const std::string& cache_path, const SourceFingerprint& source, WaySink& sink) -> CacheStatus {
+    const auto start = Clock::now();
+
+    std::shared_ptr<const MappedFile> mapped = MappedFile::open(cache_path.c_str());
+    if(!mapped)
+        return CACHE_MISS;
+
+    CacheHeader header;
+    if(mapped->size() < sizeof(header))
+        return CACHE_MISS;
+    std::memcpy(&header, mapped->data(), sizeof(header));
+
+    if(std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version || header.byte_order != cache_byte_order) {
+        mlog::logln(mlog::INFO, "Map cache `%s` has an incompatible format, rebuilding", cache_path.c_str());
+        return CACHE_MISS;
+    }
+
+    SourceFingerprint cached = {header.source_size, header.source_mtime_ns, header.source_hash, header.filter_hash};
+    if(cached.m_filter_hash != source.m_filter_hash) {
+        mlog::logln(mlog::INFO, "Map cache `%s` was built with other filter rules, rebuilding", cache_path.c_str());
+        return CACHE_MISS;
+    }
+    if(!(cached == source)) {
+        mlog::logln(mlog::INFO, "Map cache `%s` is out of date, rebuilding", cache_path.c_str());
+        return CACHE_MISS;
+    }
+
+    const uint64_t body_size = mapped->size() - sizeof(header);
+    if(header.bvh_max_depth < 1 || header.bvh_max_depth > 24 || header.data_size > body_size || header.table_size != body_size - header.data_size) {
+        mlog::logln(mlog::WARN, "Map cache `%s` is damaged, rebuilding", cache_path.c_str());
+        return CACHE_MISS;
+    }
+
+    const size_t bvh_size = BVH::node_count(header.bvh_max_depth);
+    const char* records = mapped->data() + sizeof(header);
+
+    // the whole cache is checked before the sink gets any of it, so that a damaged one is rebuilt
+    CacheReader reader(records, header.data_size);
+    WayView view;
+    for(uint64_t i = 0; i < header.way_count; i++) {
+        if(!read_way(reader, view) || !check_way(view, bvh_size, header.tag_set_count)) {
+            mlog::logln(mlog::WARN, "Map cache `%s` is corrupt at way %lu, rebuilding", cache_path.c_str(), i);
+            return CACHE_MISS;
+        }
+    }
+
+    CacheReader table_reader(records + header.data_size, header.table_size);
+    std::vector<const TagSet*> tag_sets;
+    if(!load_tag_sets(table_reader, header, tag_sets)) {
+        mlog::logln(mlog::WARN, "Map cache `%s` has corrupt tag tables, rebuilding", cache_path.c_str());
+        return CACHE_MISS;
+    }
+
+    sink.init_bvh(std::make_pair(glm::vec2(header.min_x, header.min_y), glm::vec2(header.max_x, header.max_y)), header.bvh_max_depth);
+
+    reader = CacheReader(records, header.data_size);
+    for(uint64_t i = 0; i < header.way_count; i++) {
+        read_way(reader, view);
+
+        MappedGeometry geometry = {CoordSpan(view.m_coords, view.m_record.node_count), view.m_lod, FillSpan(view.m_fill, view.m_record.fill_size), mapped};
+        sink.add_mapped_way_at(view.m_record.bvh_index, load_way(view, tag_sets), std::move(geometry));
+    }
+
+    mlog::logln(mlog::INFO, "Loaded %lu ways from map cache `%s` in %.2fs", header.way_count, cache_path.c_str(),
+        std::chrono::duration<double>(Clock::now() - start).count());
+    return CACHE_LOADED;
+}
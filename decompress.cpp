@@ -0,0 +1,401 @@
+#include "decompress.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#ifdef HAVE_BZIP2
+#include <bzlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+class GzipDecoder : public InputPipeline::Decoder {
+public:
+    GzipDecoder() {
+        // 16 + MAX_WBITS accepts the gzip wrapper only
+        inflateInit2(&m_stream, 16 + MAX_WBITS);
+    }
+
+    ~GzipDecoder() {
+        inflateEnd(&m_stream);
+    }
+
+    bool decode(std::string_view& input, char*& output, char* output_end) override {
+        // concatenated members, as written by parallel compressors, form one stream
+        if(m_stream_end && !input.empty()) {
+            inflateReset(&m_stream);
+            m_stream_end = false;
+        }
+
+        m_stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+        m_stream.avail_in = input.size();
+        m_stream.next_out = reinterpret_cast<Bytef*>(output);
+        m_stream.avail_out = output_end - output;
+
+        int ret = inflate(&m_stream, Z_NO_FLUSH);
+
+        input.remove_prefix(input.size() - m_stream.avail_in);
+        output = output_end - m_stream.avail_out;
+
+        if(ret == Z_STREAM_END)
+            m_stream_end = true;
+
+        return ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR;
+    }
+
+    bool complete() const override {
+        return m_stream_end;
+    }
+
+private:
+    z_stream m_stream = {};
+    bool m_stream_end = false;
+};
+
+#ifdef HAVE_BZIP2
+class Bzip2Decoder : public InputPipeline::Decoder {
+public:
+    Bzip2Decoder() {
+        BZ2_bzDecompressInit(&m_stream, 0, 0);
+    }
+
+    ~Bzip2Decoder() {
+        BZ2_bzDecompressEnd(&m_stream);
+    }
+
+    bool decode(std::string_view& input, char*& output, char* output_end) override {
+        // multi-stream files like the ones from pbzip2
+        if(m_stream_end && !input.empty()) {
+            BZ2_bzDecompressEnd(&m_stream);
+            BZ2_bzDecompressInit(&m_stream, 0, 0);
+            m_stream_end = false;
+        }
+
+        m_stream.next_in = const_cast<char*>(input.data());
+        m_stream.avail_in = input.size();
+        m_stream.next_out = output;
+        m_stream.avail_out = output_end - output;
+
+        int ret = BZ2_bzDecompress(&m_stream);
+
+        input.remove_prefix(input.size() - m_stream.avail_in);
+        output = output_end - m_stream.avail_out;
+
+        if(ret == BZ_STREAM_END)
+            m_stream_end = true;
+
+        return ret == BZ_OK || ret == BZ_STREAM_END;
+    }
+
+    bool complete() const override {
+        return m_stream_end;
+    }
+
+private:
+    bz_stream m_stream = {};
+    bool m_stream_end = false;
+};
+#endif
+
+#ifdef HAVE_ZSTD
+class ZstdDecoder : public InputPipeline::Decoder {
+public:
+    ZstdDecoder()
+        : m_stream(ZSTD_createDStream())
+    {}
+
+    ~ZstdDecoder() {
+        ZSTD_freeDStream(m_stream);
+    }
+
+    bool decode(std::string_view& input, char*& output, char* output_end) override {
+        ZSTD_inBuffer in = {input.data(), input.size(), 0};
+        ZSTD_outBuffer out = {output, size_t(output_end - output), 0};
+
+        size_t ret = ZSTD_decompressStream(m_stream, &out, &in);
+
+        input.remove_prefix(in.pos);
+        output += out.pos;
+
+        if(ZSTD_isError(ret))
+            return false;
+
+        // 0 means that a frame was completed and flushed
+        m_frame_end = ret == 0;
+        return true;
+    }
+
+    bool complete() const override {
+        return m_frame_end;
+    }
+
+private:
+    ZSTD_DStream* m_stream;
+    bool m_frame_end = false;
+};
+#endif
+
+auto InputPipeline::detect(std::string_view head) -> Compression {
+    if(head.size() >= 2 && uint8_t(head[0]) == 0x1f && uint8_t(head[1]) == 0x8b)
+        return Compression::GZIP;
+    if(head.size() >= 3 && head.substr(0, 3) == "BZh")
+        return Compression::BZIP2;
+    if(head.size() >= 4 && head.substr(0, 4) == std::string_view("\x28\xb5\x2f\xfd", 4))
+        return Compression::ZSTD;
+
+    return Compression::NONE;
+}
+
+auto InputPipeline::compression_name(Compression compression) -> const char* {
+    switch(compression) {
+        case Compression::NONE:
+            return "uncompressed";
+        case Compression::GZIP:
+            return "gzip";
+        case Compression::BZIP2:
+            return "bzip2";
+        case Compression::ZSTD:
+            return "zstd";
+    }
+
+    return "?";
+}
+
+auto InputPipeline::sniff(const char* path) -> Compression {
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0)
+        return Compression::NONE;
+
+    struct stat st;
+    char head[4];
+    ssize_t bytes_read = 0;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        bytes_read = read(fd, head, sizeof(head));
+
+    close(fd);
+    return detect(std::string_view(head, std::max(bytes_read, ssize_t(0))));
+}
+
+static auto make_decoder(InputPipeline::Compression compression) -> std::unique_ptr<InputPipeline::Decoder> {
+    switch(compression) {
+        case InputPipeline::GZIP:
+            return std::make_unique<GzipDecoder>();
+#ifdef HAVE_BZIP2
+        case InputPipeline::BZIP2:
+            return std::make_unique<Bzip2Decoder>();
+#endif
+#ifdef HAVE_ZSTD
+        case InputPipeline::ZSTD:
+            return std::make_unique<ZstdDecoder>();
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+static auto read_some(int fd, char* data, size_t size) -> ssize_t {
+    ssize_t bytes_read;
+    do {
+        bytes_read = read(fd, data, size);
+    } while(bytes_read < 0 && errno == EINTR);
+
+    return bytes_read;
+}
+
+auto InputPipeline::open(const char* path) -> std::unique_ptr<InputPipeline> {
+    const bool is_stdin = std::strcmp(path, "-") == 0;
+
+    int fd = is_stdin ? STDIN_FILENO : ::open(path, O_RDONLY);
+    if(fd < 0) {
+        mlog::logln(mlog::ERROR, "Could not open `%s`: %s", path, std::strerror(errno));
+        return nullptr;
+    }
+
+    // the first block decides the format, which also works for pipes
+    std::vector<char> head(read_size);
+    size_t head_size = 0;
+    for(;;) {
+        ssize_t bytes_read = read_some(fd, head.data() + head_size, head.size() - head_size);
+        if(bytes_read < 0) {
+            mlog::logln(mlog::ERROR, "Could not read `%s`: %s", path, std::strerror(errno));
+            if(!is_stdin)
+                close(fd);
+            return nullptr;
+        }
+
+        head_size += bytes_read;
+        if(bytes_read == 0 || head_size >= 4)
+            break;
+    }
+    head.resize(head_size);
+
+    auto compression = detect(std::string_view(head.data(), head.size()));
+    auto decoder = make_decoder(compression);
+    if(compression != Compression::NONE && !decoder) {
+        mlog::logln(mlog::ERROR, "`%s` is %s compressed, which this build does not support", path, compression_name(compression));
+        if(!is_stdin)
+            close(fd);
+        return nullptr;
+    }
+
+    return std::unique_ptr<InputPipeline>(new InputPipeline(fd, compression, std::move(decoder), std::move(head)));
+}
+
+InputPipeline::InputPipeline(int fd, Compression compression, std::unique_ptr<Decoder> decoder, std::vector<char> head)
+    : m_fd(fd), m_compression(compression), m_decoder(std::move(decoder)), m_input(std::move(head)), m_start(Clock::now())
+{
+    for(auto& buffer : m_ring)
+        buffer.m_data.resize(buffer_size);
+
+    m_thread = std::thread([this]() { produce(); });
+}
+
+InputPipeline::~InputPipeline() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+
+    m_free_cond.notify_all();
+    m_thread.join();
+
+    if(m_fd != STDIN_FILENO)
+        close(m_fd);
+}
+
+auto InputPipeline::acquire() -> Buffer* {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    auto start = Clock::now();
+    m_free_cond.wait(lock, [this]() { return m_stopping || m_filled < ring_size; });
+    m_producer_stall += Clock::now() - start;
+
+    return m_stopping ? nullptr : &m_ring[m_write_index];
+}
+
+void InputPipeline::publish(size_t size) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ring[m_write_index].m_size = size;
+        m_write_index = (m_write_index + 1) % ring_size;
+        m_filled++;
+    }
+
+    m_filled_cond.notify_one();
+}
+
+void InputPipeline::fail(const char* message) {
+    mlog::logln(mlog::ERROR, "%s", message);
+    m_failed = true;
+}
+
+void InputPipeline::produce() {
+    std::string_view input(m_input.data(), m_input.size());
+    m_input_bytes = m_input.size();
+    bool eof = m_input.empty();
+
+    m_input.resize(read_size);
+
+    Buffer* buffer = acquire();
+    char* output = buffer ? buffer->m_data.data() : nullptr;
+
+    while(buffer) {
+        if(input.empty() && !eof) {
+            ssize_t bytes_read = read_some(m_fd, m_input.data(), m_input.size());
+            if(bytes_read < 0) {
+                fail("Could not read the input");
+                break;
+            }
+
+            eof = bytes_read == 0;
+            input = std::string_view(m_input.data(), bytes_read);
+            m_input_bytes += bytes_read;
+        }
+
+        char* const output_end = buffer->m_data.data() + buffer->m_data.size();
+        char* const before = output;
+
+        // a finished stream has flushed everything, only new input can continue it
+        if(m_decoder && !(input.empty() && m_decoder->complete())) {
+            if(!m_decoder->decode(input, output, output_end)) {
+                fail("The input is corrupt");
+                break;
+            }
+        }
+        else if(!m_decoder) {
+            size_t length = std::min(input.size(), size_t(output_end - output));
+            std::memcpy(output, input.data(), length);
+            input.remove_prefix(length);
+            output += length;
+        }
+
+        if(output == output_end) {
+            m_output_bytes += output - buffer->m_data.data();
+            publish(output - buffer->m_data.data());
+
+            buffer = acquire();
+            output = buffer ? buffer->m_data.data() : nullptr;
+        }
+        else if(eof && input.empty() && output == before) {
+            break;
+        }
+    }
+
+    if(buffer && output != buffer->m_data.data()) {
+        m_output_bytes += output - buffer->m_data.data();
+        publish(output - buffer->m_data.data());
+    }
+
+    if(buffer && !m_failed && m_decoder && !m_decoder->complete())
+        fail("The compressed input is truncated");
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = true;
+    }
+
+    m_filled_cond.notify_all();
+}
+
+auto InputPipeline::next() -> std::string_view {
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if(m_holding) {
+        m_read_index = (m_read_index + 1) % ring_size;
+        m_filled--;
+        m_holding = false;
+        m_free_cond.notify_one();
+    }
+
+    auto start = Clock::now();
+    m_filled_cond.wait(lock, [this]() { return m_filled > 0 || m_finished; });
+    m_consumer_stall += Clock::now() - start;
+
+    if(m_filled == 0)
+        return std::string_view();
+
+    m_holding = true;
+    auto& buffer = m_ring[m_read_index];
+    return std::string_view(buffer.m_data.data(), buffer.m_size);
+}
+
+void InputPipeline::log_stats() const {
+    const double elapsed = std::chrono::duration<double>(Clock::now() - m_start).count();
+    const double producer_stall = std::chrono::duration<double>(m_producer_stall).count();
+    const double consumer_stall = std::chrono::duration<double>(m_consumer_stall).count();
+
+    mlog::logln(mlog::INFO, "  input:   %.1f MiB %s -> %.1f MiB in %.2fs (%.1f MiB/s)", m_input_bytes / 1024.0 / 1024.0,
+        compression_name(m_compression), m_output_bytes / 1024.0 / 1024.0, elapsed, m_output_bytes / 1024.0 / 1024.0 / elapsed);
+    mlog::logln(mlog::INFO, "  stalls:  reader %.2fs on a full ring, parser %.2fs on an empty ring", producer_stall, consumer_stall);
+}
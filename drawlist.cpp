@@ -0,0 +1,50 @@
+#include "drawlist.hpp"
+
+void DrawList::add(const Way& way, bool fill) {
+    const auto priority = way.get_metadata().draw_priority();
+    auto& batch = m_batches[priority];
+    auto range = way.get_vertex_range();
+    m_way_count++;
+
+    if(fill && range.m_fill_count[m_lod_level] > 0) {
+        const GLuint count = range.m_fill_count[m_lod_level];
+        m_fill_batches[priority].push_back({ count, 1, range.m_fill_first[m_lod_level], 0, range.m_draw_id + 1 });
+        m_command_count++;
+        m_fill_command_count++;
+        m_triangle_count += count / 3;
+    }
+
+    const GLuint start = range.m_first[m_lod_level];
+    if(!way.is_multipolygon()) {
+        add_command(batch, start, range.m_count[m_lod_level], range.m_draw_id);
+        return;
+    }
+
+    // every ring is padded by its two vertices of adjacency
+    GLuint first = 0, padding = 0;
+    for(auto end : way.get_ring_ends(m_lod_level)) {
+        add_command(batch, start + first + padding, end - first + 2, range.m_draw_id);
+        first = end;
+        padding += 2;
+    }
+}
+
+void DrawList::add_command(std::vector<Command>& batch, GLuint first, GLuint count, GLuint draw_id) {
+    batch.push_back({ count, 1, first, is_indexed() ? 0 : draw_id, draw_id });
+    m_command_count++;
+    m_vertex_count += count;
+}
+
+void DrawList::clear() {
+    for(auto& batch : m_batches)
+        batch.clear();
+
+    for(auto& batch : m_fill_batches)
+        batch.clear();
+
+    m_way_count = 0;
+    m_command_count = 0;
+    m_fill_command_count = 0;
+    m_vertex_count = 0;
+    m_triangle_count = 0;
+}
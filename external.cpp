@@ -0,0 +1,227 @@
+#include "external.hpp"
+#include "bvh.hpp"
+#include "log.hpp"
+#include "phasetimer.hpp"
+
+#include <chrono>
+#include <limits>
+#include <unordered_map>
+
+#include <glm/common.hpp>
+
+using Clock = std::chrono::steady_clock;
+
+static inline double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+ExternalIngest::ExternalIngest(size_t memory_budget, const std::string& spill_dir, const FilterProfile* filter)
+    : m_memory_budget(memory_budget), m_spill_dir(spill_dir),
+      m_nodes(std::make_unique<ExternalSorter<NodeRecord>>(spill_dir, memory_budget / 2)),
+      m_refs(std::make_unique<ExternalSorter<RefRecord>>(spill_dir, memory_budget / 2)),
+      m_way_headers(spill_dir), m_filter(filter)
+{}
+
+void ExternalIngest::add_chunk(IngestChunk& chunk) {
+    if(chunk.m_bounds && !m_bounds)
+        m_bounds = chunk.m_bounds;
+
+    for(auto& [ id, node ] : chunk.m_nodes) {
+        m_node_min = glm::min(m_node_min, node.m_coord);
+        m_node_max = glm::max(m_node_max, node.m_coord);
+        m_nodes->push(NodeRecord{id, node.m_coord});
+    }
+
+    for(auto& way : chunk.m_ways) {
+        uint32_t counts[2] = {uint32_t(way.m_refs.size()), uint32_t(way.m_tags.size())};
+        m_way_headers.append(&way.m_id, sizeof(way.m_id));
+        m_way_headers.append(counts, sizeof(counts));
+
+        for(auto& [ key, value ] : way.m_tags) {
+            uint32_t lengths[2] = {uint32_t(key.size()), uint32_t(value.size())};
+            m_way_headers.append(lengths, sizeof(lengths));
+            m_way_headers.append(key.data(), key.size());
+            m_way_headers.append(value.data(), value.size());
+        }
+
+        for(uint32_t i = 0; i < way.m_refs.size(); i++)
+            m_refs->push(RefRecord{way.m_refs[i], m_way_count, i});
+
+        m_way_count++;
+    }
+
+    // relations are small enough to stay in memory
+    for(auto& relation : chunk.m_relations)
+        m_multipolygons.add_relation(std::move(relation));
+
+    m_filter_stats += chunk.m_filter_stats;
+    chunk.m_filter_stats = {};
+
+    chunk.m_nodes.clear();
+    chunk.m_ways.clear();
+    chunk.m_relations.clear();
+}
+
+// walks both sorted streams in lockstep and gives every reference the coordinate of its node
+void ExternalIngest::join() {
+    PhaseTimer timer(PHASE_LOOKUP);
+
+    const size_t resident = m_nodes->memory_usage() + m_refs->memory_usage();
+    const size_t located_budget = m_memory_budget > resident + m_memory_budget / 4
+        ? m_memory_budget - resident - m_memory_budget / 4
+        : m_memory_budget / 8;
+
+    m_located = std::make_unique<ExternalSorter<LocatedRef>>(m_spill_dir, located_budget);
+
+    auto nodes = m_nodes->reader(m_memory_budget / 8);
+    auto refs = m_refs->reader(m_memory_budget / 8);
+
+    NodeRecord node;
+    RefRecord ref;
+    bool has_node = nodes.next(node);
+    size_t missing = 0;
+
+    while(refs.next(ref)) {
+        while(has_node && node.m_id < ref.m_node)
+            has_node = nodes.next(node);
+
+        if(has_node && node.m_id == ref.m_node)
+            m_located->push(LocatedRef{ref.m_way, ref.m_position, node.m_coord});
+        else
+            missing++;
+    }
+
+    if(missing)
+        mlog::logln(mlog::WARN, "%zu way node references point to nodes missing from the input", missing);
+}
+
+auto ExternalIngest::write_cache(const std::string& cache_path, const SourceFingerprint& source, size_t bvh_max_depth) -> bool {
+    m_nodes->finish();
+    m_refs->finish();
+    m_way_headers.flush();
+
+    mlog::logln(mlog::INFO, "external ingest: %lu nodes in %zu runs, %lu references in %zu runs, %lu ways",
+        m_nodes->size(), m_nodes->run_count(), m_refs->size(), m_refs->run_count(), m_way_count);
+
+    auto join_start = Clock::now();
+    join();
+    m_nodes = nullptr;
+    m_refs = nullptr;
+    m_located->finish();
+    mlog::logln(mlog::INFO, "  join:     %.2fs, %zu runs", seconds_since(join_start), m_located->run_count());
+
+    auto bounds = m_bounds.value_or(std::make_pair(m_node_min, m_node_max));
+
+    // only used to place ways, the viewer builds its own when loading the cache
+    BVH bvh(bounds, bvh_max_depth, 0);
+    std::vector<BVH*> bvh_nodes;
+    bvh.flatten(bvh_nodes);
+
+    std::unordered_map<const BVH*, uint32_t> bvh_indices;
+    for(size_t i = 0; i < bvh_nodes.size(); i++)
+        bvh_indices[bvh_nodes[i]] = i;
+
+    CacheWriter writer(cache_path, source, bounds, bvh_max_depth);
+    if(!writer.good()) {
+        mlog::logln(mlog::ERROR, "Could not create map cache `%s`", cache_path.c_str());
+        return false;
+    }
+
+    auto assemble_start = Clock::now();
+
+    // the viewer keeps the levels of detail and fills where it mapped the cache, so they are built here
+    auto write_way = [&](Way& way) {
+        way.build_lod();
+        way.build_fill();
+        writer.add_way(way, way.get_coords(), way.get_lod().data(), way.get_fill(), bvh_indices[bvh.find_node(way)]);
+    };
+
+    // tagged ways first, like the in-memory parsers; untagged ones wait for the multipolygons
+    m_multipolygons.index_members();
+    size_t untagged = 0;
+
+    size_t empty = for_each_way([&](Way& way) {
+        m_multipolygons.add_way(way.get_id(), way.get_coords());
+
+        if(way.get_tags().empty()) {
+            untagged++;
+            return;
+        }
+
+        write_way(way);
+    });
+
+    TagBuilder tags;
+    auto polygons = m_multipolygons.assemble(tags);
+
+    if(untagged) {
+        for_each_way([&](Way& way) {
+            if(way.get_tags().empty() && !m_multipolygons.consumed(way.get_id()) && admit_untagged_way(way.get_coords().size(), m_filter, m_filter_stats))
+                write_way(way);
+        });
+    }
+
+    for(auto& polygon : polygons)
+        write_way(polygon);
+
+    m_located = nullptr;
+
+    if(empty)
+        mlog::logln(mlog::WARN, "Dropped %zu ways without any known node", empty);
+
+    if(!writer.finish()) {
+        mlog::logln(mlog::ERROR, "Could not write map cache `%s`", cache_path.c_str());
+        return false;
+    }
+
+    mlog::logln(mlog::INFO, "  assemble: %.2fs", seconds_since(assemble_start));
+    return true;
+}
+
+auto ExternalIngest::for_each_way(const std::function<void(Way&)>& consume) -> size_t {
+    PhaseTimer timer(PHASE_GEOMETRY);
+    auto located = m_located->reader(m_memory_budget / 4);
+    SpillReader headers(m_way_headers, 0, m_way_headers.size(), 4 * 1024 * 1024);
+
+    LocatedRef ref;
+    bool has_ref = located.next(ref);
+    size_t empty = 0;
+
+    TagBuilder tags;
+    std::string key, value;
+
+    for(uint64_t seq = 0; seq < m_way_count; seq++) {
+        Way::Id id;
+        uint32_t counts[2];
+        headers.read(&id, sizeof(id));
+        headers.read(counts, sizeof(counts));
+
+        Way way(id);
+        way.get_coords().reserve(counts[0]);
+
+        for(uint32_t i = 0; i < counts[1]; i++) {
+            uint32_t lengths[2];
+            headers.read(lengths, sizeof(lengths));
+
+            key.resize(lengths[0]);
+            value.resize(lengths[1]);
+            headers.read(key.data(), key.size());
+            headers.read(value.data(), value.size());
+            tags.add(key, value);
+        }
+        way.set_tags(tags.build());
+
+        for(; has_ref && ref.m_way == seq; has_ref = located.next(ref))
+            way.add_coord(ref.m_coord);
+
+        if(way.get_coords().empty()) {
+            empty++;
+            continue;
+        }
+
+        way.parse_metadata();
+        consume(way);
+    }
+
+    return empty;
+}
@@ -0,0 +1,118 @@
+#include "extsort.hpp"
+#include "log.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+
+static constexpr size_t spill_buffer_size = 4 * 1024 * 1024;
+
+[[noreturn]] static void spill_error(const char* action) {
+    mlog::logln(mlog::ERROR, "Could not %s spill file: %s", action, std::strerror(errno));
+    std::exit(1);
+}
+
+SpillFile::SpillFile(const std::string& dir) {
+    std::string path = dir + "/map-spill-XXXXXX";
+
+    m_fd = mkstemp(path.data());
+    if(m_fd < 0)
+        spill_error("create");
+
+    unlink(path.c_str());
+}
+
+SpillFile::~SpillFile() {
+    close(m_fd);
+}
+
+void SpillFile::append(const void* data, size_t size) {
+    auto bytes = static_cast<const char*>(data);
+    m_size += size;
+
+    if(m_buffer.size() + size <= spill_buffer_size) {
+        m_buffer.insert(m_buffer.end(), bytes, bytes + size);
+        return;
+    }
+
+    flush();
+
+    // large appends like whole runs bypass the buffer
+    while(size > 0) {
+        ssize_t written = write(m_fd, bytes, size);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            spill_error("write");
+        }
+
+        bytes += written;
+        size -= written;
+    }
+}
+
+void SpillFile::flush() {
+    size_t pos = 0;
+    while(pos < m_buffer.size()) {
+        ssize_t written = write(m_fd, m_buffer.data() + pos, m_buffer.size() - pos);
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            spill_error("write");
+        }
+
+        pos += written;
+    }
+
+    m_buffer.clear();
+}
+
+void SpillFile::read(uint64_t offset, void* data, size_t size) const {
+    auto bytes = static_cast<char*>(data);
+
+    while(size > 0) {
+        ssize_t bytes_read = pread(m_fd, bytes, size, offset);
+        if(bytes_read <= 0) {
+            if(bytes_read < 0 && errno == EINTR)
+                continue;
+            spill_error("read");
+        }
+
+        bytes += bytes_read;
+        size -= bytes_read;
+        offset += bytes_read;
+    }
+}
+
+SpillReader::SpillReader(const SpillFile& file, uint64_t begin, uint64_t end, size_t buffer_size)
+    : m_file(file), m_offset(begin), m_end(end)
+{
+    m_buffer.reserve(std::max(buffer_size, size_t(4096)));
+}
+
+bool SpillReader::read(void* data, size_t size) {
+    auto bytes = static_cast<char*>(data);
+
+    while(size > 0) {
+        if(m_pos == m_buffer.size()) {
+            if(m_offset == m_end)
+                return false;
+
+            const size_t length = std::min<uint64_t>(m_buffer.capacity(), m_end - m_offset);
+            m_buffer.resize(length);
+            m_file.read(m_offset, m_buffer.data(), length);
+            m_offset += length;
+            m_pos = 0;
+        }
+
+        const size_t length = std::min(size, m_buffer.size() - m_pos);
+        std::memcpy(bytes, m_buffer.data() + m_pos, length);
+        m_pos += length;
+        bytes += length;
+        size -= length;
+    }
+
+    return true;
+}
@@ -0,0 +1,212 @@
+#include "filter.hpp"
+#include "log.hpp"
+
+#include <fstream>
+#include <sstream>
+
+static const char* const classification_names[] = {
+    "unknown",
+    "highway_motorway",
+    "highway_trunk",
+    "highway_primary",
+    "highway_secondary",
+    "highway_tertiary",
+    "highway_unclassified",
+    "highway_residential",
+    "highway_living_street",
+    "highway_service",
+    "highway_pedestrian",
+    "highway_track",
+    "highway_busway",
+    "highway_footway",
+    "highway_cycleway",
+    "footway_sidewalk",
+    "footway_crossing",
+    "railway",
+    "waterway",
+    "lake",
+    "landuse_agricultural",
+    "landuse_forest",
+    "landuse_industrial",
+    "landuse_recreational",
+    "landuse_transport",
+    "landuse_commercial",
+    "landuse_residential",
+    "power_line",
+    "power_distribution",
+};
+
+static_assert(sizeof(classification_names) / sizeof(const char*) == Metadata::__CLASSIFICATION_LAST);
+
+static const std::pair<const char*, const char*> builtin_profiles[] = {
+    {"roads", "allow highway_* footway_*"},
+    {"roads-water", "allow highway_* footway_* waterway lake"},
+    {"classified", "deny unknown"},
+    {"no-buildings", "drop-if building"},
+};
+
+FilterStats& FilterStats::operator+=(const FilterStats& other) {
+    m_ways_kept += other.m_ways_kept;
+    m_ways_dropped += other.m_ways_dropped;
+    m_refs_dropped += other.m_refs_dropped;
+    m_nodes_kept += other.m_nodes_kept;
+    m_nodes_dropped += other.m_nodes_dropped;
+    m_relations_kept += other.m_relations_kept;
+    m_relations_dropped += other.m_relations_dropped;
+    return *this;
+}
+
+static inline void fnv1a(uint32_t& hash, std::string_view data) {
+    for(char c : data) {
+        hash ^= uint8_t(c);
+        hash *= 0x01000193u;
+    }
+}
+
+auto FilterProfile::load(const std::string& name_or_path) -> std::optional<FilterProfile> {
+    for(auto& [ name, text ] : builtin_profiles) {
+        if(name_or_path == name)
+            return parse(name, text);
+    }
+
+    std::ifstream input(name_or_path);
+    if(!input) {
+        mlog::logln(mlog::ERROR, "`%s` is neither a filter profile file nor one of [%s]", name_or_path.c_str(), builtin_names().c_str());
+        return std::nullopt;
+    }
+
+    std::stringstream text;
+    text << input.rdbuf();
+    return parse(name_or_path, text.str());
+}
+
+auto FilterProfile::parse(std::string name, std::string_view text) -> std::optional<FilterProfile> {
+    FilterProfile profile;
+    profile.m_name = std::move(name);
+
+    std::bitset<Metadata::__CLASSIFICATION_LAST> allowed, denied;
+    bool has_allow = false;
+
+    size_t line_number = 0;
+    while(!text.empty()) {
+        line_number++;
+
+        auto line = text.substr(0, text.find('\n'));
+        text.remove_prefix(std::min(line.size() + 1, text.size()));
+        line = line.substr(0, line.find('#'));
+
+        std::istringstream words{std::string(line)};
+        std::string rule, word;
+        if(!(words >> rule))
+            continue;
+
+        if(rule == "allow" || rule == "deny") {
+            auto& classes = rule == "allow" ? allowed : denied;
+            has_allow |= rule == "allow";
+
+            while(words >> word) {
+                const bool is_prefix = word.back() == '*';
+                const auto pattern = std::string_view(word).substr(0, word.size() - is_prefix);
+
+                bool matched = false;
+                for(size_t i = 0; i < Metadata::__CLASSIFICATION_LAST; i++) {
+                    std::string_view class_name = classification_names[i];
+                    if(is_prefix ? class_name.substr(0, pattern.size()) == pattern : class_name == pattern) {
+                        classes.set(i);
+                        matched = true;
+                    }
+                }
+
+                if(!matched) {
+                    mlog::logln(mlog::ERROR, "%s:%zu: unknown classification `%s`", profile.m_name.c_str(), line_number, word.c_str());
+                    return std::nullopt;
+                }
+            }
+        }
+        else if(rule == "keep-if" || rule == "drop-if") {
+            auto& predicates = rule == "keep-if" ? profile.m_keep_if : profile.m_drop_if;
+
+            while(words >> word) {
+                auto separator = word.find('=');
+                if(separator == std::string::npos)
+                    predicates.push_back({word, std::nullopt});
+                else
+                    predicates.push_back({word.substr(0, separator), word.substr(separator + 1)});
+            }
+        }
+        else {
+            mlog::logln(mlog::ERROR, "%s:%zu: unknown rule `%s`, expect one of [allow,deny,keep-if,drop-if]", profile.m_name.c_str(),
+                line_number, rule.c_str());
+            return std::nullopt;
+        }
+    }
+
+    if(!has_allow)
+        allowed.set();
+    profile.m_allowed = allowed & ~denied;
+
+    // the rules as they are applied, so that equivalent profiles share a cache
+    uint32_t hash = 0x811c9dc5u;
+    fnv1a(hash, profile.m_allowed.to_string());
+    for(auto predicates : {&profile.m_keep_if, &profile.m_drop_if}) {
+        fnv1a(hash, "|");
+        for(auto& predicate : *predicates) {
+            fnv1a(hash, predicate.m_key);
+            fnv1a(hash, predicate.m_value ? "=" + *predicate.m_value : "");
+            fnv1a(hash, ",");
+        }
+    }
+    profile.m_hash = hash ? hash : 1;
+
+    return profile;
+}
+
+auto FilterProfile::builtin_names() -> std::string {
+    std::string names;
+    for(auto& [ name, text ] : builtin_profiles) {
+        if(!names.empty())
+            names += ",";
+        names += name;
+    }
+
+    return names;
+}
+
+bool FilterProfile::TagPredicate::matches(const RawTags& tags) const {
+    auto value = tags.find(m_key);
+    return value && (!m_value || *value == *m_value);
+}
+
+bool FilterProfile::any_matches(const std::vector<TagPredicate>& predicates, const RawTags& tags) {
+    for(auto& predicate : predicates) {
+        if(predicate.matches(tags))
+            return true;
+    }
+
+    return false;
+}
+
+bool FilterProfile::keep(const RawTags& tags, Metadata metadata) const {
+    if(any_matches(m_drop_if, tags))
+        return false;
+    if(any_matches(m_keep_if, tags))
+        return true;
+
+    return m_allowed.test(metadata.m_classification);
+}
+
+void FilterProfile::log_stats(const FilterStats& stats) const {
+    // a dropped reference would have been a node in the way and a vertex in its buffer
+    const double geometry_saved = stats.m_refs_dropped * 2.0 * sizeof(Node) + stats.m_ways_dropped * double(sizeof(Way));
+    const double nodes_saved = stats.m_nodes_dropped * double(sizeof(Node::Id) + sizeof(glm::vec2));
+
+    mlog::logln(mlog::INFO, "filter `%s`: kept %lu ways, dropped %lu with %lu node references (~%.1f MiB)", m_name.c_str(),
+        stats.m_ways_kept, stats.m_ways_dropped, stats.m_refs_dropped, geometry_saved / 1024.0 / 1024.0);
+
+    if(stats.m_nodes_kept || stats.m_nodes_dropped)
+        mlog::logln(mlog::INFO, "  nodes: kept %lu, dropped %lu unreferenced (~%.1f MiB)", stats.m_nodes_kept, stats.m_nodes_dropped,
+            nodes_saved / 1024.0 / 1024.0);
+
+    if(stats.m_relations_kept || stats.m_relations_dropped)
+        mlog::logln(mlog::INFO, "  multipolygons: kept %lu, dropped %lu", stats.m_relations_kept, stats.m_relations_dropped);
+}
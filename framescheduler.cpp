@@ -0,0 +1,146 @@
+#include "framescheduler.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+// an input gets this many frames, the UI only reacts to hovering in the frame after
+constexpr unsigned input_frames = 3;
+
+// a latency fence that has not signalled after this is given up on
+constexpr auto latency_timeout = std::chrono::milliseconds(100);
+
+// how often the wait checks on a latency fence, without events coming in
+constexpr auto fence_poll_interval = std::chrono::milliseconds(1);
+
+// set by `wake`, an empty event alone does not tell why it was posted
+static std::atomic<bool> woken = false;
+
+FrameScheduler::FrameScheduler(unsigned max_fps, VsyncPolicy vsync)
+    : m_frame_interval(max_fps ? std::chrono::duration_cast<Clock::duration>(std::chrono::seconds(1)) / max_fps : Clock::duration::zero()),
+      m_vsync(vsync), m_next_frame(Clock::now()), m_stats_start(Clock::now()), m_stats_cpu_start(std::clock())
+{
+    // the first frame
+    m_pending_frames = 1;
+}
+
+void FrameScheduler::apply_vsync() const {
+    int interval = m_vsync == VSYNC_OFF ? 0 : 1;
+    if(m_vsync == VSYNC_ADAPTIVE && (glfwExtensionSupported("GLX_EXT_swap_control_tear") || glfwExtensionSupported("WGL_EXT_swap_control_tear")))
+        interval = -1;
+
+    glfwSwapInterval(interval);
+}
+
+void FrameScheduler::wake() {
+    woken.store(true, std::memory_order_release);
+    glfwPostEmptyEvent();
+}
+
+void FrameScheduler::request_input_frame() {
+    if(!m_input_time)
+        m_input_time = Clock::now();
+
+    m_pending_frames = std::max(m_pending_frames, input_frames);
+}
+
+void FrameScheduler::request_frame() {
+    m_pending_frames = std::max(m_pending_frames, 1u);
+}
+
+bool FrameScheduler::wait(Clock::duration timeout) {
+    const auto deadline = Clock::now() + timeout;
+
+    // what came in while the last frame was drawn
+    glfwPollEvents();
+
+    for(;;) {
+        if(woken.exchange(false, std::memory_order_acquire))
+            request_frame();
+
+        poll_fence();
+
+        const auto now = Clock::now();
+        roll_stats(now);
+
+        if(m_pending_frames > 0 && now >= m_next_frame) {
+            m_pending_frames--;
+            m_next_frame = now + m_frame_interval;
+            return true;
+        }
+
+        if(now >= deadline)
+            return false;
+
+        // the cap holds frames back, but events are still handled in the meantime
+        auto until = m_pending_frames > 0 ? std::min(deadline, m_next_frame) : deadline;
+        if(m_fence)
+            until = std::min(until, now + fence_poll_interval);
+        glfwWaitEventsTimeout(std::chrono::duration<double>(until - now).count());
+        m_current.m_wakeups++;
+    }
+}
+
+void FrameScheduler::frame_presented() {
+    m_current.m_frames++;
+    poll_fence();
+
+    if(!m_input_time)
+        return;
+
+    // one measurement at a time, inputs shown while one is out are not measured
+    if(m_fence) {
+        m_input_time.reset();
+        return;
+    }
+
+    // signalled once the GPU is done with the frame, scanning it out comes on top
+    m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_fence_input_time = *m_input_time;
+    m_input_time.reset();
+
+    // without the flush the fence might not reach the GPU before the next frame
+    glFlush();
+}
+
+void FrameScheduler::poll_fence() {
+    if(!m_fence)
+        return;
+
+    const auto now = Clock::now();
+
+    GLint status = GL_UNSIGNALED;
+    glGetSynciv(m_fence, GL_SYNC_STATUS, 1, nullptr, &status);
+    if(status != GL_SIGNALED) {
+        if(now - m_fence_input_time > latency_timeout) {
+            glDeleteSync(m_fence);
+            m_fence = nullptr;
+        }
+        return;
+    }
+
+    glDeleteSync(m_fence);
+    m_fence = nullptr;
+
+    m_stats.m_latency_ms = std::chrono::duration<double, std::milli>(now - m_fence_input_time).count();
+    m_current.m_max_latency_ms = std::max(m_current.m_max_latency_ms, m_stats.m_latency_ms);
+}
+
+void FrameScheduler::roll_stats(Clock::time_point now) {
+    const auto wall = std::chrono::duration<double>(now - m_stats_start).count();
+    if(wall < 1.0)
+        return;
+
+    const auto cpu = std::clock();
+
+    m_stats.m_frames = m_current.m_frames;
+    m_stats.m_wakeups = m_current.m_wakeups;
+    m_stats.m_cpu_load = double(cpu - m_stats_cpu_start) / CLOCKS_PER_SEC / wall;
+    m_stats.m_max_latency_ms = m_current.m_max_latency_ms;
+
+    m_current = Stats();
+    m_stats_start = now;
+    m_stats_cpu_start = cpu;
+}
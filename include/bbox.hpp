@@ -40,7 +40,7 @@ public:
         return m_max_coord - m_min_coord;
     }
 
-    inline bool intersects(BBox& other) {
+    inline bool intersects(const BBox& other) const {
         return m_min_coord.x < other.m_max_coord.x && m_max_coord.x > other.m_min_coord.x &&
             m_min_coord.y < other.m_max_coord.y && m_max_coord.y > other.m_min_coord.y;
     }
@@ -50,6 +50,13 @@ public:
             && coord.y > m_min_coord.y && coord.y < m_max_coord.y;
     }
 
+    // squared distance from `coord` to the box, 0 inside
+    inline float distance2(glm::vec2 coord) const {
+        float dx = std::max({m_min_coord.x - coord.x, 0.0f, coord.x - m_max_coord.x});
+        float dy = std::max({m_min_coord.y - coord.y, 0.0f, coord.y - m_max_coord.y});
+        return dx * dx + dy * dy;
+    }
+
 protected:
     inline void increase_bbox(glm::vec2& coord) {
         m_min_coord.x = std::min(m_min_coord.x, coord.x);
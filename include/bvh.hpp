@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -7,19 +9,54 @@
 #include <glm/vec2.hpp>
 
 #include "bbox.hpp"
+#include "drawlist.hpp"
 #include "way.hpp"
+#include "wayarena.hpp"
 
 class BVH : public BBox {
 public:
     BVH(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth, size_t depth);
 
-    void add_way(std::shared_ptr<Way> way);
-    void draw(BBox& viewport, DrawPriority priority, size_t max_depth, size_t depth);
+    // ways are kept as handles into the arena of the map
+    void add_way(const WayArena& ways, WayHandle handle);
 
-    std::pair<float, std::shared_ptr<Way>> get_nearest_way(glm::vec2 coords, DrawPriority priority) const;
+    // the node `add_way` stores a way with this bounding box in
+    auto find_node(const BBox& bbox) -> BVH*;
+    // adds the ways in view below `priority` to `list`, from the nodes of the tile this node is in
+    void collect(const WayArena& ways, const BBox& viewport, DrawPriority priority, DrawList& list) const;
+
+    // `no_way` if there is none below `priority`
+    std::pair<float, WayHandle> get_nearest_way(const WayArena& ways, glm::vec2 coords, DrawPriority priority) const;
+
+    // every level below `max_depth` is split, so the tree is complete
+    static inline auto node_count(size_t max_depth) -> size_t {
+        return (size_t(1) << std::max(max_depth, size_t(1))) - 1;
+    }
+
+    // appends this subtree in pre-order; the position of a node in this list is its flattened index
+    void flatten(std::vector<BVH*>& nodes);
+
+    // every node above `tile_depth` starts a tile of its own, every node at `tile_depth` one that
+    // takes in its subtree; appends the node each tile starts at to `tiles`, in the order of their numbers
+    void assign_tiles(size_t tile_depth, size_t depth, uint32_t tile, std::vector<BVH*>& tiles);
+
+    // the tile the ways of this node are drawn with, see `TileCache`
+    inline auto get_tile() const -> uint32_t {
+        return m_tile;
+    }
+
+    // stores `way` in this node without descending
+    inline void insert_way(const WayArena& ways, WayHandle handle) {
+        m_ways[ways.metadata(handle).draw_priority()].push_back(handle);
+    }
+
+    inline auto& get_ways(int priority) const {
+        return m_ways[priority];
+    }
 
 private:
     std::pair<std::unique_ptr<BVH>, std::unique_ptr<BVH>> m_children;
-    std::vector<std::shared_ptr<Way>> m_ways[__DRAW_PRIO_LAST];
+    std::vector<WayHandle> m_ways[__DRAW_PRIO_LAST];
+    uint32_t m_tile = 0;
 };
 
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "map.hpp"
+#include "way.hpp"
+#include "waysink.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// identifies the state of an input file without reading all of it,
+// and the filter profile the map was ingested with
+struct SourceFingerprint {
+    uint64_t m_size;
+    int64_t m_mtime_ns;
+    uint64_t m_hash;
+    // `FilterProfile::hash()`, 0 without a filter
+    uint32_t m_filter_hash = 0;
+
+    // returns `std::nullopt` for anything but regular files
+    static auto of(const char* path) -> std::optional<SourceFingerprint>;
+
+    inline bool operator==(const SourceFingerprint& other) const {
+        return m_size == other.m_size && m_mtime_ns == other.m_mtime_ns && m_hash == other.m_hash && m_filter_hash == other.m_filter_hash;
+    }
+};
+
+// On-disk map cache, stored next to the source as `<source>.mapcache`.
+//
+// layout (native byte order):
+//   CacheHeader
+//   way records, each 8-byte aligned:
+//     WayRecord, node_count * vec2 coordinates, ring_count * u32 ring ends,
+//     fill_size * u32 fill (see `FillSpan`), node_count * u8 levels of detail
+//   string table: string_count * u32 lengths, the strings back to back
+//   tag set table: per set a u32 tag count, then per tag the u32 string indices of key and value
+//
+// A record's `bvh_index` is the pre-order index of the BVH node holding the way,
+// so loading skips both classification and the BVH descent. Every distinct tag set
+// and string is stored once and the records refer to their set by index. The loaded
+// ways keep their geometry in the mapped cache, which is only ever replaced by renaming
+// a new file over it.
+class CacheWriter {
+public:
+    CacheWriter(const std::string& cache_path, const SourceFingerprint& source, std::pair<glm::vec2, glm::vec2> bounds, uint32_t bvh_max_depth);
+    ~CacheWriter();
+
+    inline bool good() const {
+        return m_output.good();
+    }
+
+    // `lod` and `fill` as built by `Way::build_lod` and `Way::build_fill`
+    void add_way(const Way& way, CoordSpan coords, const uint8_t* lod, FillSpan fill, uint32_t bvh_index);
+
+    // writes the tag tables, completes the header and moves the file into place
+    auto finish() -> bool;
+
+private:
+    // the index of `set` in the tag set table, which it is added to the first time
+    auto tag_set_index(const TagSet* set) -> uint32_t;
+    auto string_index(Tag::Id id) -> uint32_t;
+
+    std::string m_path, m_temp_path;
+    std::ofstream m_output;
+
+    uint64_t m_way_count = 0;
+    uint64_t m_data_size = 0;
+    bool m_finished = false;
+
+    std::unordered_map<const TagSet*, uint32_t> m_tag_set_indices;
+    std::vector<const TagSet*> m_tag_sets;
+    std::unordered_map<Tag::Id, uint32_t> m_string_indices;
+    std::vector<Tag::Id> m_strings;
+};
+
+auto default_cache_path(const char* source_path) -> std::string;
+
+enum CacheStatus {
+    CACHE_LOADED,
+    CACHE_MISS,
+};
+
+// CACHE_MISS means that the cache is absent, stale, of another version or damaged, and `sink` is untouched
+auto load_map_cache(const std::string& cache_path, const SourceFingerprint& source, WaySink& sink) -> CacheStatus;
+
+auto write_map_cache(const std::string& cache_path, const SourceFingerprint& source, const Map& map) -> bool;
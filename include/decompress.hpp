@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Reads a file or stdin on a background thread, decompressing it on the fly,
+// and hands the output to the parser through a ring of buffers so that
+// reading, decompression and parsing overlap.
+class InputPipeline {
+public:
+    enum Compression {
+        NONE,
+        GZIP,
+        BZIP2,
+        ZSTD,
+    };
+
+    // `path` "-" reads stdin; returns nullptr if the input cannot be opened
+    // or is compressed in a format this build does not support
+    static auto open(const char* path) -> std::unique_ptr<InputPipeline>;
+
+    ~InputPipeline();
+
+    InputPipeline(const InputPipeline&) = delete;
+
+    // blocks until the next buffer is filled and returns it; the previous one
+    // goes back to the decompressor. An empty view marks the end of the input.
+    auto next() -> std::string_view;
+
+    // the input was corrupt, truncated or unreadable
+    inline bool failed() const {
+        return m_failed;
+    }
+
+    inline auto compression() const -> Compression {
+        return m_compression;
+    }
+
+    // throughput and how long each side of the ring waited for the other
+    void log_stats() const;
+
+    static auto detect(std::string_view head) -> Compression;
+    static auto compression_name(Compression compression) -> const char*;
+
+    // the compression of a regular file, NONE for stdin
+    static auto sniff(const char* path) -> Compression;
+
+    class Decoder {
+    public:
+        virtual ~Decoder() = default;
+
+        // decompresses from `input` into [`output`, `output_end`), advancing both; false on corrupt input
+        virtual bool decode(std::string_view& input, char*& output, char* output_end) = 0;
+
+        // false if the input stopped in the middle of a stream
+        virtual bool complete() const = 0;
+    };
+
+private:
+    static constexpr size_t ring_size = 4;
+    static constexpr size_t buffer_size = 4 * 1024 * 1024;
+    static constexpr size_t read_size = 1024 * 1024;
+
+    struct Buffer {
+        std::vector<char> m_data;
+        size_t m_size = 0;
+    };
+
+    InputPipeline(int fd, Compression compression, std::unique_ptr<Decoder> decoder, std::vector<char> head);
+
+    void produce();
+
+    // waits for a free buffer, returns nullptr when the consumer went away
+    auto acquire() -> Buffer*;
+    void publish(size_t size);
+    void fail(const char* message);
+
+    int m_fd;
+    Compression m_compression;
+    std::unique_ptr<Decoder> m_decoder;
+    std::vector<char> m_input;
+
+    Buffer m_ring[ring_size];
+    size_t m_read_index = 0, m_write_index = 0, m_filled = 0;
+    bool m_holding = false, m_finished = false, m_stopping = false;
+
+    std::mutex m_mutex;
+    std::condition_variable m_filled_cond, m_free_cond;
+    std::thread m_thread;
+
+    std::atomic<bool> m_failed = false;
+    std::chrono::steady_clock::time_point m_start;
+    uint64_t m_input_bytes = 0, m_output_bytes = 0;
+    std::chrono::nanoseconds m_producer_stall{0}, m_consumer_stall{0};
+};
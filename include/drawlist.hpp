@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "way.hpp"
+
+// the fills of every list in a frame are drawn before the lines, so that lines are never covered
+enum DrawPass {
+    DRAW_FILLS,
+    DRAW_LINES,
+};
+
+// The ways to draw in one frame, as draw commands into the buffers of a `VertexPool`.
+// Commands are batched by draw priority, each batch is drawn with one indirect
+// multi-draw call, and so is the batch of the triangles of areas per draw priority.
+// Lines are widened in the geometry shader from the metadata of their way, so their
+// width does not split batches.
+// Ways are added at the level of detail of the list. Filling a list makes no GL calls.
+class DrawList {
+public:
+    // one line strip, in the layout the draw call reads: `glMultiDrawElementsIndirect`
+    // reads `count, instanceCount, firstIndex, baseVertex, baseInstance` and
+    // `glMultiDrawArraysIndirect` the first four as `count, instanceCount, first,
+    // baseInstance`; the base instance selects the metadata of the way
+    struct Command {
+        GLuint m_count;
+        GLuint m_instance_count;
+        GLuint m_first;
+        // the base instance of array commands, the base vertex of indexed ones
+        GLuint m_base;
+        GLuint m_base_instance;
+    };
+
+    // `shared_vertices` has to match the `VertexPool`s the list is drawn with
+    DrawList(bool shared_vertices)
+        : m_shared_vertices(shared_vertices)
+    {}
+
+    // one line strip per ring of a multipolygon, and the triangles of an area;
+    // without `fill`, areas are only outlined
+    void add(const Way& way, bool fill = true);
+
+    // the list is left at its level when cleared
+    void clear();
+
+    // before adding ways
+    inline void set_lod_level(int level) {
+        m_lod_level = level;
+    }
+
+    inline auto get_lod_level() const -> int {
+        return m_lod_level;
+    }
+
+    // commands index into the vertices with shared vertices, and at the levels of detail above 0
+    inline bool is_indexed() const {
+        return m_shared_vertices || m_lod_level > 0;
+    }
+
+    inline auto batch(int priority) const -> const std::vector<Command>& {
+        return m_batches[priority];
+    }
+
+    // always indexed
+    inline auto fill_batch(int priority) const -> const std::vector<Command>& {
+        return m_fill_batches[priority];
+    }
+
+    inline auto way_count() const -> size_t {
+        return m_way_count;
+    }
+
+    // of both passes
+    inline auto command_count() const -> size_t {
+        return m_command_count;
+    }
+
+    inline auto fill_command_count() const -> size_t {
+        return m_fill_command_count;
+    }
+
+    // of the line strips
+    inline auto vertex_count() const -> size_t {
+        return m_vertex_count;
+    }
+
+    inline auto triangle_count() const -> size_t {
+        return m_triangle_count;
+    }
+
+private:
+    void add_command(std::vector<Command>& batch, GLuint first, GLuint count, GLuint draw_id);
+
+    bool m_shared_vertices;
+    int m_lod_level = 0;
+    std::vector<Command> m_batches[__DRAW_PRIO_LAST];
+    std::vector<Command> m_fill_batches[__DRAW_PRIO_LAST];
+    size_t m_way_count = 0;
+    size_t m_command_count = 0;
+    size_t m_fill_command_count = 0;
+    size_t m_vertex_count = 0;
+    size_t m_triangle_count = 0;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "cache.hpp"
+#include "extsort.hpp"
+#include "preprocess.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+// Out-of-core ingest for extracts that do not fit into memory.
+//
+// Parsed chunks are drained into disk-backed sorted runs instead of a `NodeCache`:
+//  1. nodes sorted by id, way node references sorted by node id, way headers in file order
+//  2. merge join of both sorted streams, giving each reference its coordinate
+//  3. the located references, sorted back into way order, are assembled into ways
+//     and streamed into a map cache, which the viewer then loads like a warm start
+// Multipolygon members are kept in memory during step 3; untagged ways are written
+// by a second pass over the located references, after the multipolygons are assembled.
+class ExternalIngest {
+public:
+    ExternalIngest(size_t memory_budget, const std::string& spill_dir, const FilterProfile* filter);
+
+    // moves the nodes and ways out of `chunk`, leaving it empty for reuse
+    void add_chunk(IngestChunk& chunk);
+
+    auto write_cache(const std::string& cache_path, const SourceFingerprint& source, size_t bvh_max_depth) -> bool;
+
+    inline auto filter_stats() const -> const FilterStats& {
+        return m_filter_stats;
+    }
+
+private:
+    struct NodeRecord {
+        Node::Id m_id;
+        glm::vec2 m_coord;
+
+        inline bool operator<(const NodeRecord& other) const {
+            return m_id < other.m_id;
+        }
+    };
+
+    struct RefRecord {
+        Node::Id m_node;
+        uint64_t m_way;
+        uint32_t m_position;
+
+        inline bool operator<(const RefRecord& other) const {
+            return m_node < other.m_node;
+        }
+    };
+
+    struct LocatedRef {
+        uint64_t m_way;
+        uint32_t m_position;
+        glm::vec2 m_coord;
+
+        inline bool operator<(const LocatedRef& other) const {
+            return m_way < other.m_way || (m_way == other.m_way && m_position < other.m_position);
+        }
+    };
+
+    void join();
+
+    // hands every way with at least one known node to `consume`, in file order;
+    // returns the number of ways without any
+    auto for_each_way(const std::function<void(Way&)>& consume) -> size_t;
+
+    size_t m_memory_budget;
+    std::string m_spill_dir;
+
+    std::unique_ptr<ExternalSorter<NodeRecord>> m_nodes;
+    std::unique_ptr<ExternalSorter<RefRecord>> m_refs;
+    std::unique_ptr<ExternalSorter<LocatedRef>> m_located;
+
+    // per way: id, reference count, tag count, then the length-prefixed tags
+    SpillFile m_way_headers;
+    uint64_t m_way_count = 0;
+
+    const FilterProfile* m_filter;
+    FilterStats m_filter_stats;
+
+    MultipolygonAssembler m_multipolygons;
+
+    std::optional<std::pair<glm::vec2, glm::vec2>> m_bounds;
+    // extent of all nodes, for files without bounds
+    glm::vec2 m_node_min = glm::vec2(std::numeric_limits<float>::infinity());
+    glm::vec2 m_node_max = glm::vec2(-std::numeric_limits<float>::infinity());
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+// Anonymous scratch file; it is unlinked right after creation, so the space
+// is returned as soon as the object goes away, even after a crash.
+// I/O errors are fatal: an ingest cannot continue without its spilled data.
+class SpillFile {
+public:
+    SpillFile(const std::string& dir);
+    ~SpillFile();
+
+    SpillFile(const SpillFile&) = delete;
+
+    void append(const void* data, size_t size);
+
+    // makes everything appended so far visible to `read`
+    void flush();
+
+    void read(uint64_t offset, void* data, size_t size) const;
+
+    inline auto size() const -> uint64_t {
+        return m_size;
+    }
+
+private:
+    int m_fd;
+    uint64_t m_size = 0;
+    std::vector<char> m_buffer;
+};
+
+// buffered sequential reader over a range of a `SpillFile`
+class SpillReader {
+public:
+    SpillReader(const SpillFile& file, uint64_t begin, uint64_t end, size_t buffer_size);
+
+    // returns false if the range holds less than `size` more bytes
+    bool read(void* data, size_t size);
+
+private:
+    const SpillFile& m_file;
+    uint64_t m_offset, m_end;
+
+    std::vector<char> m_buffer;
+    size_t m_pos = 0;
+};
+
+// Sorts trivially copyable records that need not fit into memory.
+// Records are buffered up to the memory budget, sorted and spilled as runs;
+// `reader()` then merges the runs. Equal records keep their insertion order.
+template<typename T, typename Less = std::less<T>>
+class ExternalSorter {
+public:
+    ExternalSorter(const std::string& spill_dir, size_t memory_budget, Less less = Less())
+        : m_spill_dir(spill_dir), m_capacity(std::max(memory_budget / sizeof(T), size_t(1024))), m_less(less)
+    {}
+
+    inline void push(const T& record) {
+        if(m_buffer.empty())
+            m_buffer.reserve(m_capacity);
+
+        m_buffer.push_back(record);
+        m_size++;
+
+        if(m_buffer.size() == m_capacity)
+            spill();
+    }
+
+    // sorts what is left in memory, or spills it if there are runs on disk already
+    void finish() {
+        if(m_file && !m_buffer.empty())
+            spill();
+        else
+            std::stable_sort(m_buffer.begin(), m_buffer.end(), m_less);
+
+        if(m_file)
+            m_file->flush();
+    }
+
+    inline auto size() const -> uint64_t {
+        return m_size;
+    }
+
+    inline auto run_count() const -> size_t {
+        return m_runs.size();
+    }
+
+    // records that stayed in memory because they never needed to spill
+    inline auto memory_usage() const -> size_t {
+        return m_buffer.capacity() * sizeof(T);
+    }
+
+    class Reader {
+    public:
+        // returns false once every record was read
+        bool next(T& record) {
+            if(!m_sorter.m_file) {
+                if(m_memory_pos == m_sorter.m_buffer.size())
+                    return false;
+                record = m_sorter.m_buffer[m_memory_pos++];
+                return true;
+            }
+
+            if(m_heap.empty())
+                return false;
+
+            auto [ top, run ] = m_heap.top();
+            m_heap.pop();
+            record = top;
+
+            T following;
+            if(m_runs[run].read(&following, sizeof(T)))
+                m_heap.emplace(following, run);
+
+            return true;
+        }
+
+    private:
+        friend class ExternalSorter;
+
+        struct HeapOrder {
+            Less m_less;
+
+            // `std::priority_queue` is a max-heap; ties go to the earlier run
+            inline bool operator()(const std::pair<T, size_t>& a, const std::pair<T, size_t>& b) const {
+                if(m_less(b.first, a.first))
+                    return true;
+                if(m_less(a.first, b.first))
+                    return false;
+                return a.second > b.second;
+            }
+        };
+
+        Reader(const ExternalSorter& sorter, size_t buffer_budget)
+            : m_sorter(sorter), m_heap(HeapOrder{sorter.m_less})
+        {
+            if(!sorter.m_file)
+                return;
+
+            const size_t per_run = std::max(buffer_budget / sorter.m_runs.size(), size_t(64 * 1024));
+            m_runs.reserve(sorter.m_runs.size());
+
+            for(size_t i = 0; i < sorter.m_runs.size(); i++) {
+                auto [ begin, end ] = sorter.m_runs[i];
+                m_runs.emplace_back(*sorter.m_file, begin, end, per_run - per_run % sizeof(T));
+
+                T first;
+                if(m_runs.back().read(&first, sizeof(T)))
+                    m_heap.emplace(first, i);
+            }
+        }
+
+        const ExternalSorter& m_sorter;
+        size_t m_memory_pos = 0;
+
+        std::vector<SpillReader> m_runs;
+        std::priority_queue<std::pair<T, size_t>, std::vector<std::pair<T, size_t>>, HeapOrder> m_heap;
+    };
+
+    // `buffer_budget` is split between the read buffers of all runs
+    inline auto reader(size_t buffer_budget) const -> Reader {
+        return Reader(*this, buffer_budget);
+    }
+
+private:
+    void spill() {
+        if(!m_file)
+            m_file = std::make_unique<SpillFile>(m_spill_dir);
+
+        std::stable_sort(m_buffer.begin(), m_buffer.end(), m_less);
+
+        const uint64_t begin = m_file->size();
+        m_file->append(m_buffer.data(), m_buffer.size() * sizeof(T));
+        m_runs.emplace_back(begin, m_file->size());
+
+        m_buffer.clear();
+        m_buffer.shrink_to_fit();
+    }
+
+    std::string m_spill_dir;
+    size_t m_capacity;
+    Less m_less;
+
+    std::vector<T> m_buffer;
+    uint64_t m_size = 0;
+
+    std::unique_ptr<SpillFile> m_file;
+    std::vector<std::pair<uint64_t, uint64_t>> m_runs;
+};
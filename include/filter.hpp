@@ -0,0 +1,73 @@
+#pragma once
+
+#include "tags.hpp"
+#include "way.hpp"
+
+#include <bitset>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// what an ingest kept and dropped, summed up per parser instance
+struct FilterStats {
+    uint64_t m_ways_kept = 0, m_ways_dropped = 0;
+    uint64_t m_refs_dropped = 0;
+    uint64_t m_nodes_kept = 0, m_nodes_dropped = 0;
+    uint64_t m_relations_kept = 0, m_relations_dropped = 0;
+
+    FilterStats& operator+=(const FilterStats& other);
+};
+
+// Decides during the ingest which ways make it into the map, before their
+// geometry is resolved or anything is allocated for them.
+//
+// A profile is a list of rules, one per line; `#` starts a comment:
+//   allow <class>...    keep only ways of these classifications
+//   deny <class>...     drop ways of these classifications
+//   keep-if <tag>...    keep ways with any of these tags, whatever their classification
+//   drop-if <tag>...    drop ways with any of these tags; wins over all other rules
+// A <class> is a lowercase `Metadata::Classification` name, `highway_*` matches by prefix.
+// A <tag> is `key` or `key=value`.
+class FilterProfile {
+public:
+    // `name_or_path` is one of the built-in profiles or a profile file
+    static auto load(const std::string& name_or_path) -> std::optional<FilterProfile>;
+    static auto parse(std::string name, std::string_view text) -> std::optional<FilterProfile>;
+
+    static auto builtin_names() -> std::string;
+
+    bool keep(const RawTags& tags, Metadata metadata) const;
+
+    inline auto name() const -> const std::string& {
+        return m_name;
+    }
+
+    // identifies the rules in the map cache; never 0, which marks an unfiltered map
+    inline auto hash() const -> uint32_t {
+        return m_hash;
+    }
+
+    void log_stats(const FilterStats& stats) const;
+
+private:
+    struct TagPredicate {
+        std::string m_key;
+        std::optional<std::string> m_value;
+
+        bool matches(const RawTags& tags) const;
+    };
+
+    FilterProfile() = default;
+
+    static bool any_matches(const std::vector<TagPredicate>& predicates, const RawTags& tags);
+
+    std::string m_name;
+
+    // `allow` rules, or all classifications without any, minus the `deny` rules
+    std::bitset<Metadata::__CLASSIFICATION_LAST> m_allowed;
+
+    std::vector<TagPredicate> m_keep_if, m_drop_if;
+    uint32_t m_hash = 0;
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <ctime>
+#include <optional>
+
+#include <GL/glew.h>
+
+// Decides when the main loop draws. A frame is only drawn when something asked for one:
+// input, the window, the loader or a view that is still being built. In between, the loop
+// sleeps in the event queue until an event comes in or the next timer is due; background
+// threads wake it with `wake()`.
+//
+// It also measures what idling costs, and the latency from an input to the GPU having
+// drawn the frame that shows it.
+class FrameScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum VsyncPolicy {
+        VSYNC_OFF,
+        VSYNC_ON,
+        // late frames tear rather than wait for the next refresh, where the driver supports it
+        VSYNC_ADAPTIVE,
+    };
+
+    struct Stats {
+        // over the last second
+        unsigned m_frames = 0;
+        unsigned m_wakeups = 0;
+        // CPU time of the process over wall time, 1.0 is one core busy
+        double m_cpu_load = 0.0;
+        double m_max_latency_ms = 0.0;
+
+        // of the last frame drawn for an input
+        double m_latency_ms = 0.0;
+    };
+
+    // `max_fps` 0 leaves the frame rate uncapped
+    FrameScheduler(unsigned max_fps, VsyncPolicy vsync);
+
+    // with the GL context current
+    void apply_vsync() const;
+
+    // thread safe, for background tasks that have something to show
+    static void wake();
+
+    // a few frames, as the UI takes one more frame to react to what it was shown
+    void request_input_frame();
+    void request_frame();
+
+    // handles events until a frame is due, true, or `timeout` passed, false
+    bool wait(Clock::duration timeout);
+
+    // after swapping the buffers of a frame; a frame that answers an input gets a fence,
+    // which is checked on later without waiting for it
+    void frame_presented();
+
+    inline auto get_stats() const -> const Stats& {
+        return m_stats;
+    }
+
+private:
+    // moves on to the next second of statistics once one passed
+    void roll_stats(Clock::time_point now);
+
+    // takes the latency once the fence of the frame that answered an input signalled
+    void poll_fence();
+
+    Clock::duration m_frame_interval;
+    VsyncPolicy m_vsync;
+
+    unsigned m_pending_frames = 0;
+    Clock::time_point m_next_frame;
+
+    // the first input not yet shown
+    std::optional<Clock::time_point> m_input_time;
+
+    // behind the frame that answered `m_fence_input_time`
+    GLsync m_fence = nullptr;
+    Clock::time_point m_fence_input_time;
+
+    Stats m_stats;
+    Stats m_current;
+    Clock::time_point m_stats_start;
+    std::clock_t m_stats_cpu_start;
+};
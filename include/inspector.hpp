@@ -2,14 +2,12 @@
 
 #include "way.hpp"
 
-#include <memory>
-
 class Inspector {
 public:
     Inspector() 
     {}
 
-    void inspect_ui(std::shared_ptr<Way> way);
+    void inspect_ui(const Way& way);
 private:
 
 };
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/vec2.hpp>
+
+#include "renderutil.hpp"
+
+// The map as it was last drawn, kept in a framebuffer and shown again for as long as the
+// view stays the same, so that a frame in which only the UI changes draws no ways at all.
+//
+// Panning by whole pixels shifts the cached image into a second framebuffer and leaves
+// only the strips it uncovers to be drawn; any other change of the view draws everything
+// again. What the cache holds has to be invalidated when the ways in view change.
+class LayerCache {
+public:
+    struct Stats {
+        // since the start, frames shown as they were cached, shifted by a pan, or drawn anew
+        uint64_t m_reused = 0;
+        uint64_t m_panned = 0;
+        uint64_t m_redrawn = 0;
+    };
+
+    // in window pixels, with the origin at the bottom left as in GL
+    struct Region {
+        glm::ivec2 m_min, m_max;
+    };
+
+    // brings the cache to the view of the frame; returns the regions that have to be drawn
+    // anew, each after `begin_region`, none if the cached image is still good
+    auto update(glm::ivec2 window_size, glm::vec2 scale, glm::vec2 translation) -> const std::vector<Region>&;
+
+    // binds the framebuffer, then clears and scissors drawing to `region`
+    void begin_region(const Region& region);
+
+    // copies the cached image to the default framebuffer and leaves that bound
+    void present();
+
+    // draws everything again in the next frame
+    inline void invalidate() {
+        m_valid = false;
+    }
+
+    inline auto get_stats() const -> const Stats& {
+        return m_stats;
+    }
+
+private:
+    // the shifted image goes into the other framebuffer, a blit must not overlap itself
+    void pan(glm::ivec2 shift);
+
+    std::unique_ptr<Framebuffer> m_front, m_back;
+    glm::ivec2 m_size{0};
+
+    // the view the front framebuffer shows
+    bool m_valid = false;
+    glm::vec2 m_scale{0.0f};
+    glm::vec2 m_translation{0.0f};
+
+    std::vector<Region> m_regions;
+    Stats m_stats;
+};
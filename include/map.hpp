@@ -2,48 +2,136 @@
 
 #include "bbox.hpp"
 
+#include <cassert>
+#include <limits>
 #include <memory>
+#include <vector>
 
 #include <glm/vec2.hpp>
 #include <GL/glew.h>
 
 #include "bvh.hpp"
+#include "drawlist.hpp"
 #include "inputstate.hpp"
 #include "renderutil.hpp"
+#include "tilecache.hpp"
 #include "inspector.hpp"
+#include "layercache.hpp"
 #include "way.hpp"
+#include "wayarena.hpp"
+#include "waysink.hpp"
 
-class Map : public BBox, public RenderElement {
+class Map : public BBox, public RenderElement, public WaySink {
 public:
-    Map();
+    // what drawing the map took in the last frame, of which only the parts missing from the
+    // cached image are drawn, see `LayerCache`
+    struct FrameStats {
+        size_t m_draw_calls = 0;
+        size_t m_ways = 0;
+        size_t m_commands = 0;
+        size_t m_vertices = 0;
+        size_t m_triangles = 0;
+        int m_lod_level = 0;
+
+        // culling, batching and issuing the draw calls, without waiting for the GPU
+        double m_submit_ms = 0.0;
+    };
+
+    // `shared_vertices` stores every distinct vertex of a tile once, see `VertexPool`;
+    // `vram_budget` bounds the buffers of resident tiles in bytes, 0 keeps them all, see `TileCache`;
+    // `cull_threads` 0 is one per hardware thread
+    Map(bool shared_vertices = false, size_t vram_budget = 0, unsigned cull_threads = 0);
     
-    void init_bvh(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth);
+    // `WaySink`, GL thread only
+    void init_bvh(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth) override;
 
     virtual void draw_scene(Viewport& viewport, InputState& input) override;
     virtual void draw_ui(InputState& input) override;
 
-    inline void add_way(std::shared_ptr<Way> way) {
+    inline bool has_bvh() const override {
+        return m_bvh != nullptr;
+    }
+
+    void add_way(Way&& way) override;
+    void add_way_at(size_t bvh_index, Way&& way) override;
+    void add_mapped_way_at(size_t bvh_index, Way&& way, MappedGeometry geometry) override;
+
+    // logs the geometry memory
+    void finish_loading() override;
+
+    inline auto& get_bvh() const {
         assert(m_bvh);
-        m_bvh->add_way(std::move(way));
+        return *m_bvh;
+    }
+
+    // every way of the map, the BVH refers to them by handle
+    inline auto& get_ways() const {
+        return m_ways;
+    }
+
+    inline auto& get_frame_stats() const {
+        return m_frame_stats;
+    }
+
+    inline auto& get_tile_stats() const {
+        return m_tiles.get_stats();
+    }
+
+    // 0 without a budget
+    inline auto get_vram_budget() const -> size_t {
+        return m_tiles.get_budget();
+    }
+
+    inline auto get_cull_threads() const -> unsigned {
+        return m_tiles.get_cull_threads();
+    }
+
+    inline auto& get_layer_stats() const {
+        return m_layer.get_stats();
+    }
+
+    // the last frame left tiles in view to be built with the next
+    inline bool wants_frame() const {
+        return !m_tiles.get_stats().m_complete;
+    }
+
+    // draws the whole map again with the next frame, for changes of GL state it does not see
+    inline void invalidate_layer() {
+        m_layer.invalidate();
     }
 
     inline auto get_max_bvh_depth() const -> std::size_t {
         return m_max_bvh_depth;
     }
 
-    inline auto get_nearest_way(glm::vec2 coords) const -> std::pair<float, std::shared_ptr<Way>> {
-        return m_bvh->get_nearest_way(coords, m_draw_priority);
+    inline auto get_nearest_way(glm::vec2 coords) const -> std::pair<float, WayHandle> {
+        if(!m_bvh)
+            return std::make_pair(std::numeric_limits<float>::infinity(), no_way);
+        return m_bvh->get_nearest_way(m_ways, coords, m_draw_priority);
     }
     
 private:
+    // into the BVH node with the flattened index `bvh_index`, and its tile
+    void insert_at(size_t bvh_index, WayHandle handle);
+    void add_to_tile(WayHandle handle, const BVH& node);
+
+    WayArena m_ways;
+    TileCache m_tiles;
+    // carries the level of detail of the frame, and draws the selected way
+    DrawList m_draw_list;
+    FrameStats m_frame_stats;
     std::unique_ptr<BVH> m_bvh;
+    std::vector<BVH*> m_flat_bvh;
+    // areas are filled without the geometry shader that widens the lines
+    std::unique_ptr<Shader> m_fill_shader;
     std::unique_ptr<Shader> m_shader;
     std::unique_ptr<Shader> m_selection_shader;
+    LayerCache m_layer;
     
     Inspector m_inspector;
 
-    std::size_t m_max_bvh_depth, m_render_bvh_depth;
-    std::shared_ptr<Way> m_selected_way;
+    std::size_t m_max_bvh_depth;
+    WayHandle m_selected_way = no_way;
 
     DrawPriority m_draw_priority = DrawPriority::__DRAW_PRIO_LAST;
 };
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "bvh.hpp"
+#include "cache.hpp"
+#include "map.hpp"
+#include "preprocess.hpp"
+#include "spscqueue.hpp"
+#include "threadpool.hpp"
+#include "waysink.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Ingests a map on a background thread while the window is already open.
+// The loader thread is the `WaySink` of the ingest and queues its output;
+// the render thread drains the queue with `upload()` in bounded per-frame
+// batches, creating the GL buffers and inserting the ways into the map.
+// On the way, the levels of detail of the ways are built and areas are
+// triangulated in batches on a thread pool.
+//
+// The map cache is written on the loader thread from the ways before they are
+// queued, never from the map, which belongs to the render thread.
+class MapLoader : public WaySink {
+public:
+    // `wake` is called from the loader thread whenever there is something new to upload
+    MapLoader(std::shared_ptr<Map> map, std::string input_path, IngestOptions options, std::function<void()> wake = nullptr);
+    ~MapLoader();
+
+    MapLoader(const MapLoader&) = delete;
+
+    // render thread: moves queued ways into the map until `budget` is used up;
+    // false if there was nothing to move
+    bool upload(std::chrono::microseconds budget);
+
+    // everything was ingested and uploaded
+    inline bool done() const {
+        return m_drained;
+    }
+
+    // the ingest failed with this exit code
+    inline auto error() const -> std::optional<int> {
+        if(!m_ingest_done.load(std::memory_order_acquire) || m_result == 0)
+            return std::nullopt;
+        return m_result;
+    }
+
+    inline auto uploaded() const -> size_t {
+        return m_uploaded;
+    }
+
+    inline auto seconds_elapsed() const -> double {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+    // `WaySink`, loader thread
+    void init_bvh(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth) override;
+    bool has_bvh() const override;
+    void add_way(Way&& way) override;
+    void add_way_at(size_t bvh_index, Way&& way) override;
+    void add_mapped_way_at(size_t bvh_index, Way&& way, MappedGeometry geometry) override;
+
+private:
+    static constexpr size_t no_bvh_index = std::numeric_limits<size_t>::max();
+
+    // either the BVH bounds or a way
+    struct Item {
+        std::optional<std::pair<glm::vec2, glm::vec2>> m_bounds;
+        size_t m_max_depth = 0;
+
+        std::optional<Way> m_way;
+        size_t m_bvh_index = no_bvh_index;
+        // for ways from the map cache, which come with their levels of detail and fill
+        std::optional<MappedGeometry> m_geometry;
+    };
+
+    void load();
+
+    // builds the levels of detail and fills of the batch where they are missing, adds its ways
+    // to the cache and queues them in order
+    void flush_batch();
+
+    // once the BVH bounds are known, if the ingest asked for a cache
+    void begin_cache(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth);
+
+    std::shared_ptr<Map> m_map;
+    std::string m_input_path;
+    IngestOptions m_options;
+    std::function<void()> m_wake;
+
+    SpscQueue<Item> m_queue;
+    bool m_has_bvh = false;
+
+    std::vector<Item> m_batch;
+    ThreadPool m_lod_pool;
+
+    // places the ways in the cache the way the map's BVH places them, see `CacheWriter`
+    std::optional<CacheTarget> m_cache_target;
+    std::unique_ptr<CacheWriter> m_cache_writer;
+    std::unique_ptr<BVH> m_cache_bvh;
+    std::unordered_map<const BVH*, uint32_t> m_cache_bvh_indices;
+
+    std::atomic<bool> m_ingest_done = false;
+    int m_result = 0;
+
+    // set by the render thread once the queue ran dry after the ingest
+    std::atomic<bool> m_drained = false;
+    // stops the ingest, see `IngestOptions::stop`
+    std::atomic<bool> m_stopping = false;
+
+    size_t m_uploaded = 0;
+    std::chrono::steady_clock::time_point m_start;
+
+    std::thread m_thread;
+};
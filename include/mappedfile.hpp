@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+// read-only memory mapping of a regular file
+class MappedFile {
+public:
+    // returns `nullptr` if `path` is not a regular file or cannot be mapped
+    static auto open(const char* path) -> std::unique_ptr<MappedFile>;
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+
+    inline auto data() const -> const char* {
+        return m_data;
+    }
+
+    inline auto size() const -> size_t {
+        return m_size;
+    }
+
+    inline auto view() const -> std::string_view {
+        return std::string_view(m_data, m_size);
+    }
+
+    void advise_sequential() const;
+
+    // drops the pages within [`begin`, `end`) from the resident set once they were consumed
+    void release(size_t begin, size_t end) const;
+
+private:
+    MappedFile(const char* data, size_t size)
+        : m_data(data), m_size(size)
+    {}
+
+    const char* m_data;
+    size_t m_size;
+};
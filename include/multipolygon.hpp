@@ -0,0 +1,94 @@
+#pragma once
+
+#include "tags.hpp"
+#include "way.hpp"
+
+#include <cstdint>
+#include <vector>
+
+// a multipolygon or boundary relation whose member ways are not stitched yet
+struct PendingRelation {
+    typedef uint64_t Id;
+
+    struct Member {
+        Way::Id m_way;
+        bool m_inner;
+    };
+
+    PendingRelation(Id id)
+        : m_id(id), m_members(), m_tags()
+    {}
+
+    Id m_id;
+    std::vector<Member> m_members;
+    RawTags m_tags;
+    Metadata m_metadata;
+};
+
+// Turns multipolygon relations into single area features.
+//
+// Relations follow the ways in OSM files, so parsers collect all relations,
+// call `index_members()` and only then hand over the geometry of member ways.
+// Untagged member ways only exist to form the polygon, callers hold them back
+// until `consumed()` tells whether a polygon replaced them.
+//
+// The member ways of each role are stitched into closed rings by hashing their
+// endpoints, so that even coastlines with thousands of members take linear time.
+class MultipolygonAssembler {
+public:
+    void add_relation(PendingRelation&& relation);
+
+    inline bool empty() const {
+        return m_relations.empty();
+    }
+
+    // fixes the set of member ways, call before `add_way`
+    void index_members();
+
+    // whether `add_way` keeps the geometry of `id`
+    bool wants(Way::Id id) const;
+
+    void add_way(Way::Id id, CoordSpan coords);
+
+    // stitches every relation into a way, in relation order, and releases the relations and member geometry
+    auto assemble(TagBuilder& tags) -> std::vector<Way>;
+
+    // whether `id` is a member of an assembled relation, which replaces the way if it is untagged
+    bool consumed(Way::Id id) const;
+
+private:
+    struct WayGeometry {
+        Way::Id m_id;
+        uint64_t m_offset;
+        uint32_t m_size;
+
+        inline bool operator<(const WayGeometry& other) const {
+            return m_id < other.m_id;
+        }
+    };
+
+    struct Ring {
+        std::vector<glm::vec2> m_coords;
+        bool m_inner;
+    };
+
+    struct Stats {
+        size_t m_rings = 0, m_inner_rings = 0, m_open_rings = 0;
+        size_t m_missing_members = 0;
+    };
+
+    auto find_way(Way::Id id) const -> const WayGeometry*;
+    auto stitch_relation(const PendingRelation& relation, Stats& stats) const -> std::vector<Ring>;
+
+    std::vector<PendingRelation> m_relations;
+
+    // sorted
+    std::vector<Way::Id> m_member_ids;
+
+    // members of the assembled relations, sorted
+    std::vector<Way::Id> m_consumed_ids;
+
+    std::vector<WayGeometry> m_ways;
+    std::vector<glm::vec2> m_coords;
+    bool m_ways_sorted = true;
+};
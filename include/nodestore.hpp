@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include <glm/vec2.hpp>
+
+// Maps OSM node ids to projected coordinates.
+//
+// Nodes are staged in insertion order until `freeze()` (or the first lookup)
+// picks a layout from the id distribution:
+//  - DENSE:  flat coordinate array indexed by `id - min_id` plus a presence bitmap
+//  - SPARSE: sorted id array with a parallel coordinate array, binary searched
+//  - HASH:   open-addressing table with linear probing
+// Nodes inserted after freezing go into a HASH overflow table.
+class NodeStore {
+public:
+    typedef uint64_t Id;
+
+    enum Mode {
+        AUTO,
+        DENSE,
+        SPARSE,
+        HASH,
+    };
+
+    NodeStore(Mode mode = Mode::AUTO)
+        : m_requested_mode(mode)
+    {}
+
+    NodeStore(const NodeStore&) = delete;
+
+    void insert(Id id, glm::vec2 coord);
+    void freeze();
+
+    inline bool frozen() const {
+        return m_frozen;
+    }
+
+    // returns `nullptr` for unknown ids; the store has to be frozen
+    auto find(Id id) const -> const glm::vec2*;
+
+    // resolves `count` ids at once, interleaving the searches so that
+    // their cache misses overlap; returns false if any id is unknown
+    bool find_batch(const Id* ids, size_t count, glm::vec2* coords) const;
+
+    inline auto size() const -> size_t {
+        return m_size;
+    }
+
+    inline auto mode() const -> Mode {
+        return m_mode;
+    }
+
+    auto memory_usage() const -> size_t;
+
+    static auto mode_name(Mode mode) -> const char*;
+    static auto parse_mode(const char* name) -> std::optional<Mode>;
+
+private:
+    class FlatHash {
+    public:
+        void insert(Id id, glm::vec2 coord);
+        auto find(Id id) const -> const glm::vec2*;
+
+        inline bool empty() const {
+            return m_size == 0;
+        }
+
+        inline auto size() const -> size_t {
+            return m_size;
+        }
+
+        inline auto memory_usage() const -> size_t {
+            return m_keys.capacity() * sizeof(Id) + m_values.capacity() * sizeof(glm::vec2);
+        }
+
+        void reserve(size_t count);
+
+    private:
+        static constexpr Id empty_key = ~Id(0);
+
+        inline auto slot(Id id) const -> size_t {
+            return (id * 0x9E3779B97F4A7C15ull) >> m_shift;
+        }
+
+        std::vector<Id> m_keys;
+        std::vector<glm::vec2> m_values;
+        size_t m_size = 0;
+        unsigned m_shift = 64;
+    };
+
+    auto choose_mode() const -> Mode;
+
+    void build_dense();
+    void build_sparse();
+    void build_hash();
+
+    auto find_frozen(Id id) const -> const glm::vec2*;
+    void find_sparse_batch(const Id* ids, size_t count, const glm::vec2** found) const;
+
+    Mode m_requested_mode;
+    Mode m_mode = Mode::AUTO;
+    bool m_frozen = false;
+    size_t m_size = 0;
+
+    std::vector<std::pair<Id, glm::vec2>> m_staging;
+    Id m_min_id = ~Id(0), m_max_id = 0;
+
+    // DENSE
+    std::vector<glm::vec2> m_dense_coords;
+    std::vector<uint64_t> m_dense_present;
+
+    // SPARSE
+    std::vector<Id> m_sparse_ids;
+    std::vector<glm::vec2> m_sparse_coords;
+
+    // HASH, also takes inserts after freezing
+    FlatHash m_hash;
+};
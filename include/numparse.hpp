@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+// Number parsers for OSM attribute values. Unlike `std::stof` and `std::stoull`
+// they ignore the locale, never throw and reject trailing garbage.
+
+// a decimal degree value like "-12.3456789" as a multiple of 1e-7 degrees,
+// further digits are rounded
+inline auto parse_fixed7(const char* text) -> std::optional<int32_t> {
+    const bool negative = *text == '-';
+    if(*text == '-' || *text == '+')
+        text++;
+
+    int64_t value = 0;
+    unsigned digits = 0;
+    for(; *text >= '0' && *text <= '9'; text++, digits++) {
+        // no coordinate needs more than three integer digits
+        if(digits == 3)
+            return std::nullopt;
+        value = value * 10 + (*text - '0');
+    }
+
+    unsigned fraction_digits = 0;
+    if(*text == '.') {
+        text++;
+        for(; *text >= '0' && *text <= '9'; text++, digits++) {
+            if(fraction_digits < 7)
+                value = value * 10 + (*text - '0');
+            else if(fraction_digits == 7 && *text >= '5')
+                value++;
+            fraction_digits++;
+        }
+    }
+
+    if(digits == 0 || *text != '\0')
+        return std::nullopt;
+
+    for(; fraction_digits < 7; fraction_digits++)
+        value *= 10;
+
+    if(value > INT32_MAX)
+        return std::nullopt;
+
+    return int32_t(negative ? -value : value);
+}
+
+// an element id; negative ids of unsaved edits wrap around like they do with `std::stoull`
+inline auto parse_id(const char* text) -> std::optional<uint64_t> {
+    const bool negative = *text == '-';
+    if(negative)
+        text++;
+
+    uint64_t value = 0;
+    const char* digits = text;
+    for(; *text >= '0' && *text <= '9'; text++) {
+        const uint64_t digit = *text - '0';
+        if(value > (UINT64_MAX - digit) / 10)
+            return std::nullopt;
+        value = value * 10 + digit;
+    }
+
+    if(text == digits || *text != '\0')
+        return std::nullopt;
+
+    return negative ? -value : value;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+
+#include "waysink.hpp"
+
+struct IngestChunk;
+struct IngestOptions;
+
+// minimal protocol buffers wire format reader
+class ProtoReader {
+public:
+    enum WireType {
+        VARINT = 0,
+        FIXED64 = 1,
+        LENGTH_DELIMITED = 2,
+        FIXED32 = 5,
+    };
+
+    ProtoReader(std::string_view data)
+        : m_pos(reinterpret_cast<const uint8_t*>(data.data())), m_end(m_pos + data.size())
+    {}
+
+    // advances to the next field, returns false at the end of the message or on malformed input
+    bool next();
+
+    inline auto field() const -> uint32_t {
+        return m_field;
+    }
+
+    inline auto wire_type() const -> WireType {
+        return m_wire_type;
+    }
+
+    inline bool has_error() const {
+        return m_error;
+    }
+
+    auto varint() -> uint64_t;
+
+    inline auto svarint() -> int64_t {
+        return zigzag(varint());
+    }
+
+    auto bytes() -> std::string_view;
+
+    void skip();
+
+    inline bool at_end() const {
+        return m_pos >= m_end || m_error;
+    }
+
+    // calls `func` with every value of a packed repeated varint field
+    template<typename F>
+    static bool for_each_packed(std::string_view data, F func) {
+        ProtoReader reader(data);
+        while(!reader.at_end()) {
+            uint64_t value = reader.varint();
+            if(reader.m_error)
+                return false;
+            func(value);
+        }
+        return true;
+    }
+
+    static inline auto zigzag(uint64_t value) -> int64_t {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+private:
+    const uint8_t* m_pos;
+    const uint8_t* m_end;
+
+    uint32_t m_field = 0;
+    WireType m_wire_type = VARINT;
+    bool m_error = false;
+};
+
+// true if the file starts with an `OSMHeader` blob header
+bool is_pbf_file(const char* path);
+
+auto preprocess_pbf(const char* pbf_path, WaySink& sink, const IngestOptions& options) -> int;
+
+// decodes the data blocks in file order on `options.jobs` threads and hands each one to `consume`,
+// which has to empty it; the header bounds arrive first, in a chunk of their own
+auto scan_pbf(const char* pbf_path, const IngestOptions& options, const std::function<void(IngestChunk&)>& consume) -> bool;
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Splits ingest time into phases for the headless benchmark.
+//
+// Phases nest: a timer started inside another one pauses the outer phase, so that
+// every phase only counts its own time. A thread that waits for a thread pool charges
+// no phase meanwhile, the workers charge what they do. Times are summed over all threads,
+// with parallel parsers they add up to more than the wall time, but never to more than
+// a single thread's worth on one thread. Until timing is enabled a `PhaseTimer` costs
+// a single branch.
+enum IngestPhase {
+    PHASE_PARSE,
+    PHASE_LOOKUP,
+    PHASE_CLASSIFY,
+    PHASE_GEOMETRY,
+    PHASE_TRIANGULATE,
+    PHASE_INDEX,
+    __PHASE_LAST
+};
+
+void enable_phase_timing();
+// for runs that are not to be counted, once every timer has ended
+void disable_phase_timing();
+bool phase_timing_enabled();
+
+auto phase_name(IngestPhase phase) -> const char*;
+auto phase_seconds(IngestPhase phase) -> double;
+
+// nodes parsed while timing is enabled
+void count_parsed_nodes(uint64_t count);
+auto parsed_node_count() -> uint64_t;
+
+// areas triangulated while timing is enabled, with the slowest one
+struct TriangulationStats {
+    uint64_t m_polygons = 0;
+    uint64_t m_vertices = 0;
+    uint64_t m_triangles = 0;
+
+    double m_worst_seconds = 0.0;
+    uint64_t m_worst_vertices = 0;
+};
+
+void count_triangulated(uint64_t vertices, uint64_t triangles, std::chrono::steady_clock::duration time);
+auto triangulation_stats() -> TriangulationStats;
+
+// the most phase time a single thread was charged, which cannot exceed the wall time
+auto max_thread_phase_seconds() -> double;
+
+class PhaseTimer {
+public:
+    PhaseTimer(IngestPhase phase);
+    ~PhaseTimer();
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    bool m_active;
+    IngestPhase m_outer;
+};
+
+// pauses the phase of the calling thread while it waits for others
+class PhasePause : public PhaseTimer {
+public:
+    PhasePause()
+        : PhaseTimer(__PHASE_LAST)
+    {}
+};
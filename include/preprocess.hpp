@@ -1,33 +1,53 @@
 #pragma once
 
 #include "bbox.hpp"
+#include "cache.hpp"
+#include "filter.hpp"
 #include "map.hpp"
+#include "multipolygon.hpp"
+#include "nodestore.hpp"
+#include "projection.hpp"
+#include "tags.hpp"
 
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <memory>
+#include <optional>
+#include <string>
 #include <utility>
-#include <unordered_map>
+#include <vector>
 
 class NodeCache : public BBox {
 public:
-    NodeCache() 
-        : m_nodes({})
+    NodeCache(NodeStore::Mode mode = NodeStore::Mode::AUTO)
+        : m_store(mode)
     {}
 
     inline void add_node(Node::Id id, Node node) {
         increase_bbox(node.m_coord);
-        this->m_nodes.insert({id, node});
+        m_store.insert(id, node.m_coord);
     }
 
-    inline auto lookup(Node::Id id) -> Node& {
-        auto found = m_nodes.find(id);
-        if(found == m_nodes.end())
-            assert(false);
-        else
-            return found->second;
+    // lookups need a frozen store, which fixes its layout
+    inline void freeze() {
+        m_store.freeze();
     }
 
-    inline auto& get_nodes() {
-        return m_nodes;
+    inline auto lookup(Node::Id id) const -> Node {
+        auto found = m_store.find(id);
+        assert(found);
+        return Node(*found);
+    }
+
+    inline void lookup_batch(const std::vector<Node::Id>& ids, std::vector<glm::vec2>& coords) const {
+        coords.resize(ids.size());
+        [[maybe_unused]] bool found = m_store.find_batch(ids.data(), ids.size(), coords.data());
+        assert(found);
+    }
+
+    inline auto& get_store() const {
+        return m_store;
     }
 
 private:
@@ -38,19 +58,176 @@ private:
         m_max_coord.y = std::max(m_max_coord.y, coord.y);
     }
 
-    std::unordered_map<Node::Id, Node> m_nodes;
+    NodeStore m_store;
+};
+
+struct IngestOptions {
+    // number of parser threads; 1 selects the serial streaming parser, 0 uses every core
+    unsigned jobs = 1;
+
+    // map regular files into memory instead of streaming them; pipes are always streamed
+    bool use_mmap = true;
+
+    NodeStore::Mode node_store = NodeStore::Mode::AUTO;
+
+    // load from / save to a binary map cache; only regular input files are cached
+    bool use_cache = true;
+    // empty selects `<input>.mapcache`
+    std::string cache_path;
+
+    // stay within roughly this many bytes by ingesting out of core; 0 ingests in memory
+    size_t memory_budget = 0;
+    // where out-of-core runs are spilled; empty selects $TMPDIR or /tmp
+    std::string spill_dir;
+
+    // drops ways and unreferenced nodes while parsing; nullptr keeps everything
+    std::shared_ptr<const FilterProfile> filter;
+
+    // ways share their vertices through one vertex buffer and index into it,
+    // instead of each way holding its own copy of every node it references
+    bool shared_vertices = false;
+
+    // the ingest gives up with an error once this is set, checked between slices of the input
+    // and between ways; nullptr runs it to the end
+    const std::atomic<bool>* stop = nullptr;
+};
+
+inline bool stop_requested(const IngestOptions& options) {
+    return options.stop && options.stop->load(std::memory_order_relaxed);
+}
+
+// the command line flags shared by the viewer and the benchmark
+constexpr const char* ingest_usage = "[-j <threads>] [--node-store <layout>] [--no-mmap] [--cache <path> | --no-cache] [--memory-budget <MiB>] [--spill-dir <dir>] [--filter <profile>] [--shared-vertices]";
+
+// consumes the ingest flag at `argv[i]` together with its value;
+// returns 1 if it was one, 0 if it was not and -1 if its value is invalid
+auto parse_ingest_option(int argc, char** argv, int& i, IngestOptions& options) -> int;
+
+// a way whose node references are not resolved yet
+struct PendingWay {
+    PendingWay(Way::Id id)
+        : m_id(id), m_refs(), m_tags()
+    {}
+
+    Way::Id m_id;
+    std::vector<Node::Id> m_refs;
+    RawTags m_tags;
+    Metadata m_metadata;
+};
+
+// classifies `way` and asks `filter` whether to keep it; `ref_count` only feeds `stats`,
+// so that callers can decide before decoding the references.
+// Untagged ways always pass, they are decided on once the relations are known.
+auto admit_way(PendingWay& way, size_t ref_count, const FilterProfile* filter, FilterStats& stats) -> bool;
+
+// whether an untagged way that no relation uses is kept on its own
+auto admit_untagged_way(size_t ref_count, const FilterProfile* filter, FilterStats& stats) -> bool;
+
+// keeps multipolygon and boundary relations that `filter` keeps; call before adding members
+auto admit_relation(PendingRelation& relation, const FilterProfile* filter, FilterStats& stats) -> bool;
+
+// everything one parser instance extracted from its part of the input
+struct IngestChunk {
+    std::vector<std::pair<Node::Id, Node>> m_nodes;
+    std::vector<PendingWay> m_ways;
+    std::vector<PendingRelation> m_relations;
+    std::optional<std::pair<glm::vec2, glm::vec2>> m_bounds;
+    FilterStats m_filter_stats;
+
+    std::vector<Way> m_resolved_ways;
+
+    // nodes are projected a batch at a time before they land in `m_nodes`
+    NodeBatch m_node_batch;
+
+    inline void add_node(Node::Id id, int32_t lon, int32_t lat) {
+        if(m_node_batch.add(id, lon, lat))
+            flush_nodes();
+    }
+
+    // has to run before `m_nodes` is consumed
+    void flush_nodes();
 };
 
 struct PreData {
-    PreData(std::shared_ptr<Map> map)
-        : m_map(map), m_node_cache(std::make_unique<NodeCache>()), m_current_way()
+    PreData(WaySink& sink, NodeStore::Mode node_store, const FilterProfile* filter)
+        : m_sink(sink), m_node_cache(std::make_unique<NodeCache>(node_store)), m_filter(filter), m_current_way(0), m_current_relation(0)
     {}
 
-    std::shared_ptr<Map> m_map;
+    WaySink& m_sink;
     std::unique_ptr<NodeCache> m_node_cache;
 
-    std::shared_ptr<Way> m_current_way;
+    const FilterProfile* m_filter;
+    FilterStats m_filter_stats;
+
+    // reused for every way, it only becomes a `Way` if the filter keeps it
+    PendingWay m_current_way;
+    bool m_in_way = false;
+
+    PendingRelation m_current_relation;
+    bool m_in_relation = false;
+
+    // relations follow the ways and may use any of them as members: untagged ways wait for them,
+    // tagged ones go to the sink right away and leave a copy of their coordinates behind,
+    // as (id, node count) pairs over `m_tagged_coords`
+    std::vector<PendingWay> m_untagged_ways;
+    // sorted, if the members were scanned for ahead of the parse; then only the tagged ways
+    // among them leave their coordinates behind
+    std::optional<std::vector<Way::Id>> m_member_ways;
+    std::vector<std::pair<Way::Id, uint32_t>> m_tagged_ways;
+    std::vector<glm::vec2> m_tagged_coords;
+    MultipolygonAssembler m_multipolygons;
+
+    TagBuilder m_tag_builder;
+    std::vector<glm::vec2> m_lookup_buffer;
+
+    NodeBatch m_node_batch;
+    uint64_t m_node_count = 0;
+    // nodes precede ways, so the node parse is timed up to the first way
+    std::chrono::steady_clock::time_point m_start;
+    double m_node_seconds = 0.0;
+    bool m_nodes_done = false;
+
+    // set on an unparseable id or coordinate, which fails the ingest
+    bool m_malformed = false;
+};
+
+class ThreadPool;
+
+// projects a lon/lat bounding box into map coordinates
+auto project_bounds(glm::dvec2 min_lonlat, glm::dvec2 max_lonlat) -> std::pair<glm::vec2, glm::vec2>;
+
+// sums up the projection time of all chunks
+void log_projection(const std::vector<IngestChunk>& chunks);
+
+// the stages of an ingest that ran on a pool; their summed busy time estimates what
+// they would have taken on one thread
+struct ParallelTimes {
+    double m_wall = 0.0;
+    double m_busy = 0.0;
+
+    // the estimated time of an ingest of `elapsed` seconds on one thread
+    inline auto serial_estimate(double elapsed) const -> double {
+        return elapsed - m_wall + m_busy;
+    }
+};
+
+// logs a stage that ran on `threads` threads, and adds it to `times`
+void log_parallel_stage(const char* name, double wall, double busy, unsigned threads, ParallelTimes& times);
+
+// merges parsed chunks in order, resolves their ways on `pool` and hands them to `sink`,
+// adding the resolve to `times`; false if the ingest was stopped
+auto ingest_chunks(std::vector<IngestChunk>& chunks, WaySink& sink, ThreadPool& pool, const IngestOptions& options, ParallelTimes& times) -> bool;
+
+// where to save the map cache once the sink's map is complete
+struct CacheTarget {
+    std::string m_path;
+    SourceFingerprint m_source;
 };
 
-auto preprocess_data(const char* xml_path, std::shared_ptr<Map> map) -> int;
+// ingests `xml_path` into `sink`, from the map cache if possible; sets `cache_target` before
+// ingesting the source if the cache has to be (re)written, so that the sink may write it as the
+// ways come in, and resets it if the ingest fails
+auto ingest_data(const char* xml_path, WaySink& sink, const IngestOptions& options, std::optional<CacheTarget>& cache_target) -> int;
 
+// ingests on the calling thread, which has to own the GL context, and updates the map cache
+auto preprocess_data(const char* xml_path, std::shared_ptr<Map> map, const IngestOptions& options = {}) -> int;
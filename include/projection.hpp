@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/vec2.hpp>
+
+#include "phasetimer.hpp"
+
+// Web Mercator projection of OSM coordinates.
+//
+// OSM stores coordinates as int32 multiples of 1e-7 degrees. They are parsed
+// into that fixed-point form and projected in batches, in double precision:
+// evaluating `log(tan(...))` in float loses enough bits to make ways jitter
+// at high zoom. The batch kernel uses AVX2 when the CPU has it.
+
+constexpr double fixed_point_scale = 1e-7;
+
+// the name of the kernel `project_fixed` dispatches to
+auto projection_kernel() -> const char*;
+
+// projects `count` fixed-point coordinates into map coordinates
+void project_fixed(const int32_t* lon, const int32_t* lat, glm::vec2* out, size_t count);
+
+// the portable kernel, also used for single coordinates
+void project_fixed_scalar(const int32_t* lon, const int32_t* lat, glm::vec2* out, size_t count);
+
+// a single coordinate in degrees, like the <bounds> of a file
+auto project_degrees(double lon, double lat) -> glm::vec2;
+
+// logs the throughput of the kernel over `count` coordinates
+void log_projection(uint64_t count, double seconds);
+
+// Collects parsed nodes and projects them a batch at a time, so that the kernel
+// runs over full vectors instead of one node per parser callback.
+class NodeBatch {
+public:
+    static constexpr size_t capacity = 1024;
+
+    // returns true once the batch is full and has to be flushed
+    inline bool add(uint64_t id, int32_t lon, int32_t lat) {
+        m_ids[m_size] = id;
+        m_lon[m_size] = lon;
+        m_lat[m_size] = lat;
+        return ++m_size == capacity;
+    }
+
+    inline bool empty() const {
+        return m_size == 0;
+    }
+
+    // projects the staged nodes and hands each one to `consume(id, coord)`
+    template<typename Consume>
+    void flush(Consume&& consume) {
+        const auto start = std::chrono::steady_clock::now();
+        project_fixed(m_lon, m_lat, m_coords, m_size);
+        m_project_time += std::chrono::steady_clock::now() - start;
+        m_projected += m_size;
+        count_parsed_nodes(m_size);
+
+        for(size_t i = 0; i < m_size; i++)
+            consume(m_ids[i], m_coords[i]);
+        m_size = 0;
+    }
+
+    inline auto projected() const -> uint64_t {
+        return m_projected;
+    }
+
+    inline auto project_seconds() const -> double {
+        return std::chrono::duration<double>(m_project_time).count();
+    }
+
+private:
+    uint64_t m_ids[capacity];
+    int32_t m_lon[capacity], m_lat[capacity];
+    glm::vec2 m_coords[capacity];
+    size_t m_size = 0;
+
+    uint64_t m_projected = 0;
+    std::chrono::steady_clock::duration m_project_time{0};
+};
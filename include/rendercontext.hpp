@@ -1,5 +1,6 @@
 #pragma once
 
+#include "framescheduler.hpp"
 #include "map.hpp"
 #include "inputstate.hpp"
 #include "viewport.hpp"
@@ -12,8 +13,8 @@
 
 class RenderContext {
 public:
-    RenderContext(std::shared_ptr<Map> map, glm::vec2 window_size)
-        : m_map(map), m_elements({map}), m_viewport(map->get_minmax_coord()), m_input_state(window_size)
+    RenderContext(std::shared_ptr<Map> map, glm::vec2 window_size, const FrameScheduler& scheduler)
+        : m_map(map), m_elements({map}), m_viewport(map->get_minmax_coord()), m_input_state(window_size), m_scheduler(scheduler)
     {}
 
     void draw_scene();
@@ -39,6 +40,7 @@ private:
     
     Viewport m_viewport;
     InputState m_input_state;
+    const FrameScheduler& m_scheduler;
 
     bool m_disable_fill = false;
 };
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <initializer_list>
 #include <istream>
 #include <optional>
 #include <memory>
@@ -59,9 +60,43 @@ private:
     std::unique_ptr<Texture> m_texture;
 };
 
+// A GL buffer that is only ever appended to. When it is full it is reallocated at
+// twice the size, with the old contents copied over on the GPU. Nothing is created
+// before the first append, which allocates exactly what it needs.
+class GrowableBuffer {
+public:
+    GrowableBuffer() = default;
+    ~GrowableBuffer();
+
+    GrowableBuffer(const GrowableBuffer&) = delete;
+    GrowableBuffer& operator=(const GrowableBuffer&) = delete;
+
+    // returns true if the buffer was reallocated, which changes its id
+    bool append(const void* data, GLsizeiptr bytes);
+
+    inline GLuint id() const {
+        return m_id;
+    }
+
+    // bytes in use
+    inline GLsizeiptr size() const {
+        return m_size;
+    }
+
+    // bytes allocated
+    inline GLsizeiptr capacity() const {
+        return m_capacity;
+    }
+
+private:
+    GLuint m_id = 0;
+    GLsizeiptr m_size = 0, m_capacity = 0;
+};
+
 class Shader {
 public:
     Shader(std::istream& vertex, std::istream& fragment);
+    Shader(std::istream& vertex, std::istream& geometry, std::istream& fragment);
     ~Shader();
     
     bool has_error() const {
@@ -85,6 +120,8 @@ public:
     }
 
 private:
+    void link(std::initializer_list<GLuint> stages);
+
     std::optional<std::string> m_err;
     GLuint m_id;
 };
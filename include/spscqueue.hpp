@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+// Unbounded lock-free queue for exactly one producer and one consumer thread.
+// The consumer frees the nodes it has passed; the producer never blocks.
+template<typename T>
+class SpscQueue {
+public:
+    SpscQueue()
+        : m_head(new Node()), m_tail(m_head)
+    {}
+
+    ~SpscQueue() {
+        while(m_head) {
+            Node* next = m_head->m_next.load(std::memory_order_relaxed);
+            delete m_head;
+            m_head = next;
+        }
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+
+    // producer thread only
+    void push(T value) {
+        Node* node = new Node();
+        node->m_value = std::move(value);
+
+        m_tail->m_next.store(node, std::memory_order_release);
+        m_tail = node;
+    }
+
+    // consumer thread only; returns false if the queue is empty
+    bool pop(T& value) {
+        Node* next = m_head->m_next.load(std::memory_order_acquire);
+        if(!next)
+            return false;
+
+        value = std::move(next->m_value);
+        delete m_head;
+        m_head = next;
+        return true;
+    }
+
+private:
+    // `m_head` is a sentinel whose value was already taken
+    struct Node {
+        std::atomic<Node*> m_next = nullptr;
+        T m_value;
+    };
+
+    // on separate cache lines, the two threads never write the same one
+    alignas(64) Node* m_head;
+    alignas(64) Node* m_tail;
+};
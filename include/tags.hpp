@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Interned OSM tags.
+//
+// Every distinct key and value is stored once in the global `TagPool` and
+// referred to by a 32-bit id. The tags of a way are an immutable `TagSet`,
+// a flat array of id pairs sorted by key, shared by all ways with identical
+// tags. Strings and sets are never freed, the pool only grows.
+struct Tag {
+    typedef uint32_t Id;
+
+    Id m_key;
+    Id m_value;
+
+    auto key() const -> std::string_view;
+    auto value() const -> std::string_view;
+
+    inline bool operator==(const Tag& other) const {
+        return m_key == other.m_key && m_value == other.m_value;
+    }
+};
+
+class TagSet {
+public:
+    inline auto begin() const {
+        return m_tags.begin();
+    }
+
+    inline auto end() const {
+        return m_tags.end();
+    }
+
+    inline auto size() const -> size_t {
+        return m_tags.size();
+    }
+
+    inline bool empty() const {
+        return m_tags.empty();
+    }
+
+    // the value of `key`, an id from `TagPool::intern`
+    auto find(Tag::Id key) const -> std::optional<std::string_view>;
+    auto find(std::string_view key) const -> std::optional<std::string_view>;
+
+    // shared by all untagged ways
+    static auto empty_set() -> const TagSet*;
+
+private:
+    friend class TagPool;
+
+    std::vector<Tag> m_tags;
+    size_t m_hash = 0;
+};
+
+class TagPool {
+public:
+    static auto instance() -> TagPool&;
+
+    TagPool(const TagPool&) = delete;
+
+    auto intern(std::string_view string) -> Tag::Id;
+    // the id of `string` if it was interned before
+    auto lookup(std::string_view string) const -> std::optional<Tag::Id>;
+    auto string(Tag::Id id) const -> std::string_view;
+
+    // sorts `tags` by key, keeps the first of repeated keys and returns the shared set
+    auto intern_set(std::vector<Tag>& tags) -> const TagSet*;
+
+    // what the pool holds, and what the same tags would take as one hash map per way
+    void log_stats(size_t way_count) const;
+
+private:
+    friend class TagBuilder;
+
+    // strings and sets are spread over shards by hash, so that parallel resolvers rarely contend
+    static constexpr size_t shard_bits = 4;
+    static constexpr size_t shard_count = 1 << shard_bits;
+    static constexpr size_t block_size = 64 * 1024;
+
+    struct StringShard {
+        mutable std::shared_mutex m_mutex;
+        std::unordered_map<std::string_view, Tag::Id> m_ids;
+        std::deque<std::string_view> m_strings;
+
+        // character storage for `m_strings`, in blocks that never move
+        std::vector<std::unique_ptr<char[]>> m_blocks;
+        size_t m_block_used = block_size;
+        size_t m_bytes = 0;
+    };
+
+    struct SetHash {
+        inline auto operator()(const TagSet* set) const -> size_t {
+            return set->m_hash;
+        }
+    };
+
+    struct SetEqual {
+        inline bool operator()(const TagSet* a, const TagSet* b) const {
+            return a->m_tags == b->m_tags;
+        }
+    };
+
+    struct SetShard {
+        mutable std::mutex m_mutex;
+        std::unordered_set<const TagSet*, SetHash, SetEqual> m_sets;
+        std::deque<TagSet> m_storage;
+    };
+
+    TagPool() = default;
+
+    StringShard m_string_shards[shard_count];
+    SetShard m_set_shards[shard_count];
+
+    // for the comparison in `log_stats`, fed by `TagBuilder`
+    std::atomic<uint64_t> m_sets_built = 0, m_map_bytes = 0;
+};
+
+// the tags of one element as parsed, before they are interned;
+// `clear()` keeps the strings' storage for the next element
+class RawTags {
+public:
+    void add(std::string_view key, std::string_view value);
+
+    // the value of the first tag with `key`
+    auto find(std::string_view key) const -> std::optional<std::string_view>;
+
+    inline void clear() {
+        m_size = 0;
+    }
+
+    inline auto begin() const {
+        return m_tags.begin();
+    }
+
+    inline auto end() const {
+        return m_tags.begin() + m_size;
+    }
+
+    inline auto size() const -> size_t {
+        return m_size;
+    }
+
+    inline bool empty() const {
+        return m_size == 0;
+    }
+
+private:
+    std::vector<std::pair<std::string, std::string>> m_tags;
+    size_t m_size = 0;
+};
+
+// collects the tags of one way; reusable after `build()`
+class TagBuilder {
+public:
+    void add(std::string_view key, std::string_view value);
+
+    auto build() -> const TagSet*;
+
+private:
+    std::vector<Tag> m_tags;
+    size_t m_map_bytes = 0;
+};
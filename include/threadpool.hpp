@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // `num_threads == 0` spawns one worker per hardware thread
+    ThreadPool(unsigned num_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+
+    void submit(std::function<void()> task);
+
+    // blocks until every submitted task has finished
+    void wait();
+
+    // runs `func(i)` for every `i` in [0, count) and waits for completion
+    template<typename F>
+    void parallel_for(size_t count, F func) {
+        for(size_t i = 0; i < count; i++)
+            submit([&func, i]() { func(i); });
+        wait();
+    }
+
+    // like `parallel_for`, but returns the summed busy time of all tasks in seconds
+    template<typename F>
+    double timed_parallel_for(size_t count, F func) {
+        std::atomic<int64_t> busy_ns(0);
+
+        parallel_for(count, [&](size_t i) {
+            auto start = std::chrono::steady_clock::now();
+            func(i);
+            busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        });
+
+        return busy_ns / 1e9;
+    }
+
+    inline auto size() const -> unsigned {
+        return m_workers.size();
+    }
+
+    static auto default_size() -> unsigned;
+
+private:
+    void work();
+
+    std::vector<std::thread> m_workers;
+    std::queue<std::function<void()>> m_tasks;
+
+    std::mutex m_mutex;
+    std::condition_variable m_task_cond, m_idle_cond;
+
+    size_t m_active = 0;
+    bool m_stopping = false;
+};
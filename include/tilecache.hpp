@@ -0,0 +1,168 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <glm/vec2.hpp>
+
+#include "bbox.hpp"
+#include "bvh.hpp"
+#include "drawlist.hpp"
+#include "threadpool.hpp"
+#include "vertexpool.hpp"
+#include "way.hpp"
+#include "wayarena.hpp"
+
+// Splits a map into spatial tiles and keeps GPU buffers for those that are drawn or
+// about to be, within a budget of video memory.
+//
+// Tiles follow the BVH: every node above `tile_depth` is a tile of its own, holding the
+// ways that cross its split, and every node at `tile_depth` is one together with its
+// subtree. A tile is built into a `VertexPool` of its own when it comes into view, from
+// the coordinates in the `WayArena`, which stay in main memory. Over the budget, the
+// least recently used tiles are evicted. Tiles in view are never evicted, so a view
+// that needs more than the budget goes over it.
+//
+// Tiles the view is heading for, judged by how it panned and zoomed over the last
+// frames, are built ahead of time while there is room and time left in a frame.
+//
+// The ways in view are culled into a draw list per tile, on worker threads, before the
+// GL thread draws the lists in one go.
+class TileCache {
+public:
+    struct Stats {
+        size_t m_tiles = 0;
+
+        // in the last frame
+        size_t m_resident_tiles = 0;
+        size_t m_resident_bytes = 0;
+        size_t m_visible_tiles = 0;
+        // false if building the tiles in view did not fit into the frame
+        bool m_complete = true;
+        size_t m_drawn_ways = 0;
+        size_t m_drawn_commands = 0;
+        size_t m_drawn_vertices = 0;
+        size_t m_drawn_triangles = 0;
+        // collecting the draw lists, and the time the culling threads spent on it in all
+        double m_cull_ms = 0.0;
+        double m_cull_busy_ms = 0.0;
+
+        // since the start; a tile in view that is resident is a hit, one that is not a miss
+        uint64_t m_hits = 0;
+        uint64_t m_misses = 0;
+        // frames drawn with tiles missing, as building them did not fit into the frame
+        uint64_t m_stall_frames = 0;
+        uint64_t m_prefetches = 0;
+        uint64_t m_evictions = 0;
+    };
+
+    // 2^8 tiles of subtrees and 2^8 - 1 above them
+    static constexpr size_t tile_depth = 8;
+
+    // `vram_budget` in bytes, 0 keeps every tile once it is built;
+    // `cull_threads` 0 is one per hardware thread, 1 culls on the GL thread
+    TileCache(WayArena& ways, bool shared_vertices, size_t vram_budget, unsigned cull_threads = 0);
+
+    // numbers the tiles of `bvh`, before any way is added
+    void init(BVH& bvh);
+
+    // `node` is where the BVH stores the way
+    void add_way(WayHandle handle, const BVH& node);
+
+    void finish_loading();
+
+    inline auto get_stats() const -> const Stats& {
+        return m_stats;
+    }
+
+    inline auto get_budget() const -> size_t {
+        return m_budget;
+    }
+
+    inline auto get_cull_threads() const -> unsigned {
+        return m_cull_pool ? m_cull_pool->size() : 1;
+    }
+
+    // GL thread only from here on
+
+    // makes the tiles `view` needs below `priority` resident and prefetches those it is heading for;
+    // true if ways went up to resident tiles or tiles in view were built, which changes what is drawn
+    bool update(const BBox& view, DrawPriority priority);
+
+    // gathers the ways in view from the resident tiles, at `lod_level`, a tile per task
+    void collect(const BBox& view, DrawPriority priority, int lod_level);
+
+    // one pass of what was collected; the fills of all tiles go before the lines of any,
+    // and the two take different shaders. Returns the number of draw calls it took
+    auto draw(DrawPass pass) -> size_t;
+
+    // outlines the way, nothing if its tile is not resident
+    auto draw_way(WayHandle handle, DrawList& list) -> size_t;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Tile {
+        BVH* m_root;
+        BBox m_bounds;
+        std::vector<WayHandle> m_ways;
+
+        // the most important draw priority of its ways, a tile is only needed once that is drawn
+        int m_top_priority = __DRAW_PRIO_LAST;
+        // what building it will take, before it is built
+        size_t m_estimated_bytes = 0;
+
+        // resident while set
+        std::unique_ptr<VertexPool> m_pool;
+        uint64_t m_last_used = 0;
+    };
+
+    inline bool is_wanted(const Tile& tile, const BBox& box, int priority) const {
+        return tile.m_top_priority < priority && tile.m_bounds.intersects(box);
+    }
+
+    // what the buffers of a way will take in a tile
+    auto estimate_bytes(WayHandle handle) const -> size_t;
+
+    // the view in `prefetch_lookahead`, taking in the way there
+    auto predict(const BBox& view) -> BBox;
+
+    void build(uint32_t index);
+    void evict(size_t resident_index);
+
+    // evicts the least recently used tiles until `bytes` more fit into the budget;
+    // tiles used in this frame stay, false if that is not enough
+    bool make_room(size_t bytes);
+
+    WayArena& m_ways;
+    bool m_shared_vertices;
+    size_t m_budget;
+    bool m_loaded = false;
+
+    std::vector<Tile> m_tiles;
+    // the tile of every way, by handle
+    std::vector<uint32_t> m_way_tiles;
+
+    // indices into `m_tiles`
+    std::vector<uint32_t> m_resident;
+    std::vector<uint32_t> m_visible;
+    std::vector<uint32_t> m_pending;
+
+    // one per tile in view, kept between frames
+    std::vector<DrawList> m_lists;
+    // none when culling on the GL thread
+    std::unique_ptr<ThreadPool> m_cull_pool;
+
+    uint64_t m_frame = 0;
+
+    // how the view moved, smoothed over the last frames; per second
+    Clock::time_point m_last_time;
+    glm::vec2 m_last_center{0.0f}, m_last_size{0.0f};
+    glm::vec2 m_velocity{0.0f};
+    float m_zoom_rate = 0.0f;
+
+    Stats m_stats;
+};
@@ -10,10 +10,18 @@ public:
 
     void update(std::chrono::steady_clock::duration& frame_time) {
         m_current += frame_time;
-        while(m_current > m_interval) {
-            m_current = m_current.zero();
-            m_callback(frame_time);
-        }
+        if(m_current < m_interval)
+            return;
+
+        // the overshoot carries over, so the callback keeps its schedule however
+        // irregular the frames are; intervals missed altogether are not made up for
+        m_current %= m_interval;
+        m_callback(frame_time);
+    }
+
+    // how long until the callback is next called
+    inline auto until_due() const -> std::chrono::steady_clock::duration {
+        return m_interval - m_current;
     }
 
 private:
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include "way.hpp"
+
+// Triangulates polygons with holes by ear clipping, after the earcut algorithm of Mapbox.
+//
+// Holes are bridged into their outer ring first, so that each polygon is clipped as a
+// single ring. An ear is checked against the vertices within its bounding box only,
+// found through the vertices sorted along a z-order curve, which keeps clipping close
+// to linear for the rings of real maps instead of quadratic. Rings that touch or cross
+// themselves are cut up until they can be clipped, so bad data gives some triangles
+// rather than none.
+//
+// One triangulator per thread, it keeps its memory between polygons.
+class Triangulator {
+public:
+    // appends three indices into `coords` per triangle to `triangles`;
+    // `ring_ends` splits the coordinates into rings, of which the first `outer_rings`
+    // are outer rings and the others holes in whichever outer ring they are in.
+    // A ring may or may not repeat its first vertex at its end.
+    void triangulate(CoordSpan coords, const std::vector<uint32_t>& ring_ends, uint32_t outer_rings, std::vector<uint32_t>& triangles);
+
+private:
+    struct Node {
+        uint32_t m_index;
+        double m_x, m_y;
+
+        Node* m_prev = nullptr;
+        Node* m_next = nullptr;
+
+        // neighbours along the z-order curve, while hashing
+        uint32_t m_z = 0;
+        Node* m_prev_z = nullptr;
+        Node* m_next_z = nullptr;
+    };
+
+    struct Ring {
+        uint32_t m_first, m_end;
+    };
+
+    // one outer ring with its holes
+    void triangulate_polygon(CoordSpan coords, const Ring* holes, size_t hole_count, Ring outer);
+
+    auto link_ring(CoordSpan coords, Ring ring, bool clockwise) -> Node*;
+    auto insert_node(uint32_t index, glm::vec2 coord, Node* last) -> Node*;
+    void remove_node(Node* node);
+
+    // drops duplicate and collinear vertices from `start` up to `end`
+    auto filter_points(Node* start, Node* end = nullptr) -> Node*;
+
+    auto eliminate_holes(CoordSpan coords, const Ring* holes, size_t hole_count, Node* outer) -> Node*;
+    auto find_hole_bridge(Node* hole, Node* outer) -> Node*;
+
+    // links `a` to `b` through a diagonal, the two sides become separate rings; returns the copy of `b`
+    auto split_polygon(Node* a, Node* b) -> Node*;
+
+    // `pass` 0 clips ears, 1 filters the ring first, 2 cures small self-intersections,
+    // and the last resort splits the ring in two
+    void clip_ears(Node* ear, int pass);
+
+    bool is_ear(const Node* ear) const;
+    bool is_ear_hashed(const Node* ear) const;
+
+    auto cure_local_intersections(Node* start) -> Node*;
+    void split_clip_ears(Node* start);
+
+    void index_curve(Node* start);
+    auto z_order(double x, double y) const -> uint32_t;
+
+    void emit(const Node* a, const Node* b, const Node* c);
+
+    // stable while nodes are added
+    std::deque<Node> m_nodes;
+    std::vector<Node*> m_hole_queue;
+    std::vector<Ring> m_rings, m_holes;
+
+    std::vector<uint32_t>* m_triangles = nullptr;
+
+    // the z-order hash, 0 for polygons too small to bother
+    double m_min_x = 0.0, m_min_y = 0.0, m_inv_size = 0.0;
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/vec2.hpp>
+#include <GL/glew.h>
+
+#include "drawlist.hpp"
+#include "renderutil.hpp"
+#include "way.hpp"
+
+// Holds the vertices of a set of ways, such as a tile of a map, in one vertex buffer,
+// with the metadata of every way in a buffer of its own, and draws them from `DrawList`s.
+//
+// Every strip, a way or a ring of a multipolygon, has a vertex of adjacency at either
+// end for the geometry shader to join the segments with: the vertex it continues with
+// if it is a closed ring, or else its first and last vertex once more.
+//
+// Every level of detail above 0 is a range of indices into the vertices of level 0,
+// shared with the next finer level if that has as many vertices. So are the triangles
+// of areas, which are drawn with a metadata value of their own that has `fill_flag` set.
+//
+// With shared vertices, every distinct vertex gets one index in the vertex buffer
+// and ways draw through ranges of a shared index buffer instead. Vertices are told
+// apart by their projected coordinate, which is the identity the multipolygon
+// assembler stitches rings by: a node referenced by several ways projects to the
+// same coordinate for each of them. Unlike node ids, coordinates survive the map
+// cache and the out-of-core ingest, so every ingest path shares.
+class VertexPool {
+public:
+    // in the padding of `Metadata`, read by the map shader
+    static constexpr GLuint fill_flag = 1u << 16;
+
+    VertexPool(bool share_vertices);
+    ~VertexPool();
+
+    VertexPool(const VertexPool&) = delete;
+    VertexPool& operator=(const VertexPool&) = delete;
+
+    // `lod` holds the coarsest level of detail of each coordinate, see `WayArena::lod`,
+    // `fill` the triangles of an area, see `WayArena::fill`, and `ring_ends` the rings
+    // of a multipolygon at level 0, see `Way::get_ring_ends`
+    auto add(CoordSpan coords, const uint8_t* lod, FillSpan fill, Metadata metadata, const std::vector<uint32_t>& ring_ends) -> VertexRange;
+
+    // no more ways are added, frees the lookup of known vertices
+    void finish();
+
+    inline bool shares_vertices() const {
+        return m_share_vertices;
+    }
+
+    inline auto vertex_count() const -> size_t {
+        return m_vertex_count;
+    }
+
+    // only those of the levels of detail above 0 without shared vertices
+    inline auto index_count() const -> size_t {
+        return m_index_count;
+    }
+
+    // what the vertex and index buffers hold
+    inline auto vertex_bytes() const -> size_t {
+        return m_vertex_count * sizeof(glm::vec2) + m_index_count * sizeof(GLuint);
+    }
+
+    // what the vertex and index buffers would hold without sharing, with the vertices of
+    // adjacency and the indices of the levels of detail and fills
+    inline auto unshared_vertex_bytes() const -> size_t {
+        return m_unshared_vertex_count * sizeof(glm::vec2) + m_unshared_index_count * sizeof(GLuint);
+    }
+
+    // what the GL buffers take up, including room for more
+    inline auto gpu_bytes() const -> size_t {
+        return m_vertices.capacity() + m_indices.capacity() + m_metadata.capacity();
+    }
+
+    // GL thread only from here on
+
+    // appends everything added since the last upload to the GL buffers, false if there was nothing
+    bool upload();
+
+    // one pass of `list`, returns the number of draw calls it took
+    auto draw(const DrawList& list, DrawPass pass) -> size_t;
+
+private:
+    static constexpr uint64_t empty_key = ~uint64_t(0);
+
+    // the adjacency of a strip without vertices, which draws nothing
+    static constexpr uint32_t no_coord = ~uint32_t(0);
+
+    inline auto slot(uint64_t key) const -> size_t {
+        return (key * 0x9E3779B97F4A7C15ull) >> m_shift;
+    }
+
+    // collects the coordinates of every strip at `level` in `m_strip` and calls
+    // `emit(before, after)` with the coordinates of its adjacency
+    template<typename F>
+    void for_each_strip(CoordSpan coords, const uint8_t* lod, int level, const uint32_t* ends, size_t strip_count, F emit);
+
+    inline auto push_vertex(glm::vec2 coord) -> GLuint {
+        m_pending_vertices.push_back(coord);
+        return m_vertex_count++;
+    }
+
+    auto intern(glm::vec2 coord) -> GLuint;
+    void grow_lookup();
+
+    bool m_share_vertices;
+
+    // open addressing with linear probing, from the bits of a coordinate to its index
+    std::vector<uint64_t> m_keys;
+    std::vector<GLuint> m_values;
+    size_t m_lookup_size = 0;
+    unsigned m_shift = 64;
+
+    // of the way being added
+    std::vector<GLuint> m_coord_vertices;
+    std::vector<uint32_t> m_strip;
+
+    // added since the last upload
+    std::vector<glm::vec2> m_pending_vertices;
+    std::vector<GLuint> m_pending_indices;
+    std::vector<GLuint> m_pending_metadata;
+
+    size_t m_vertex_count = 0;
+    size_t m_index_count = 0;
+    size_t m_unshared_vertex_count = 0;
+    size_t m_unshared_index_count = 0;
+    GLuint m_draw_count = 0;
+
+    GLuint m_vao = 0;
+    GrowableBuffer m_vertices;
+    GrowableBuffer m_indices;
+    GrowableBuffer m_metadata;
+
+    // the commands of the last `draw`, rewritten every frame
+    GLuint m_indirect_buffer = 0;
+};
@@ -1,10 +1,12 @@
 #pragma once
 
+#include "tags.hpp"
 #include "viewport.hpp"
 
+#include <cstdint>
+#include <memory>
 #include <optional>
-#include <string>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include <GL/glew.h>
@@ -72,7 +74,8 @@ struct Metadata {
         __CLASSIFICATION_LAST
     };
 
-    Metadata(std::unordered_map<std::string, std::string>& tags);
+    Metadata(const TagSet& tags);
+    Metadata(const RawTags& tags);
     Metadata()
         : m_classification(Classification::UNKNOWN)
     {}
@@ -89,6 +92,11 @@ struct Metadata {
         return m_classification == HIGHWAY_TRACK || m_classification == HIGHWAY_UNCLASSIFIED;
     }
 
+    // closed ways and multipolygons of these are drawn filled
+    inline bool is_filled() const {
+        return m_classification == LAKE || (m_classification >= LANDUSE_AGRICULTURAL && m_classification <= LANDUSE_RESIDENTIAL);
+    }
+
     inline auto draw_priority() const {
         return classification_draw_priorities[m_classification];
     }
@@ -100,7 +108,7 @@ struct Metadata {
     Classification m_classification;
     GLbyte m_line_width = 1;
 
-    GLshort __padding;
+    GLshort __padding = 0;
 };
 
 static_assert(sizeof(Metadata) == sizeof(GLuint));
@@ -109,107 +117,241 @@ struct Node {
     typedef uint64_t Id;
 
     Node(glm::vec2 coord)
-        : m_coord(coord), m_metadata()
-    {}
-    
-    Node(glm::vec2 coord, std::unordered_map<std::string, std::string>& tags)
-        : m_coord(coord), m_metadata(tags)
+        : m_coord(coord)
     {}
 
     inline bool operator==(const Node& other) const {
-        return m_coord == other.m_coord && m_metadata == other.m_metadata;
+        return m_coord == other.m_coord;
     }
 
-/*    void swap(const Node& other) {
-        glm::vec2 aux_coord = other.m_coord;
-        Metadata aux_metadata = other.m_metadata;
-        other.m_coord = m_coord;
-        other.m_metadata = m_metadata;
-        m_coord = aux_coord;
-        m_metadata = aux_metadata;
-    }*/
-    
     glm::vec2 m_coord;
-    Metadata m_metadata;
 };
 
-enum WindingOrder {
-    CLOCKWISE,
-    COUNTER_CLOCKWISE,
+// consecutive coordinates of a way, owned by someone else
+class CoordSpan {
+public:
+    CoordSpan(const glm::vec2* data, size_t size)
+        : m_data(data), m_size(size)
+    {}
+
+    CoordSpan(const std::vector<glm::vec2>& coords)
+        : m_data(coords.data()), m_size(coords.size())
+    {}
+
+    inline auto begin() const { return m_data; }
+    inline auto end() const { return m_data + m_size; }
+
+    inline auto size() const -> size_t { return m_size; }
+    inline bool empty() const { return m_size == 0; }
+
+    inline auto operator[](size_t i) const -> glm::vec2 { return m_data[i]; }
+    inline auto front() const -> glm::vec2 { return m_data[0]; }
+    inline auto back() const -> glm::vec2 { return m_data[m_size - 1]; }
+
+private:
+    const glm::vec2* m_data;
+    size_t m_size;
+};
+
+// Levels of detail of the geometry of a way, level 0 has every vertex. A vertex is in
+// level `k` if leaving it out moves the way by at least `lod_tolerances[k]` map units,
+// as measured by Douglas-Peucker; every level is a subset of the finer ones, and the
+// ends of a way or ring are in every level.
+constexpr int lod_levels = 4;
+
+extern const float lod_tolerances[lod_levels];
+
+// the coarsest level that moves ways by less than `max_error` map units
+auto lod_level_for(float max_error) -> int;
+
+// where the vertices of a way are in the buffers of a `VertexPool`
+struct VertexRange {
+    // per level of detail, the first vertex, or the first index with shared vertices; the
+    // count takes in the two vertices of adjacency of every strip, see `VertexPool`
+    GLuint m_first[lod_levels] = {};
+    GLsizei m_count[lod_levels] = {};
+
+    // per level of detail, the first index of the triangles of an area
+    GLuint m_fill_first[lod_levels] = {};
+    GLsizei m_fill_count[lod_levels] = {};
+
+    // selects the metadata of the way when drawing, that of its fill is the next one
+    GLuint m_draw_id = 0;
+};
+
+// The triangles filling an area at every level of detail, three indices into the
+// coordinates of the way per triangle. Ahead of the triangles are the first and the
+// count of the indices of every level; a level with the vertices of the finer one
+// has its triangles as well. Empty for ways that are not filled.
+class FillSpan {
+public:
+    FillSpan()
+        : m_data(nullptr), m_size(0)
+    {}
+
+    FillSpan(const uint32_t* data, size_t size)
+        : m_data(data), m_size(size)
+    {}
+
+    FillSpan(const std::vector<uint32_t>& fill)
+        : m_data(fill.data()), m_size(fill.size())
+    {}
+
+    inline auto data() const -> const uint32_t* { return m_data; }
+    inline auto size() const -> size_t { return m_size; }
+    inline bool empty() const { return m_size == 0; }
+
+    inline auto first(int lod_level) const -> uint32_t { return m_data[lod_level]; }
+    inline auto count(int lod_level) const -> uint32_t { return m_data[lod_levels + lod_level]; }
+
+    inline auto indices(int lod_level) const -> const uint32_t* {
+        return m_data + 2 * lod_levels + first(lod_level);
+    }
+
+    // every level counted once
+    inline auto index_count() const -> size_t {
+        return empty() ? 0 : m_size - 2 * lod_levels;
+    }
+
+private:
+    const uint32_t* m_data;
+    size_t m_size;
 };
 
 class Way : public BBox {
 public:
     typedef uint64_t Id;
 
-    Way(Id id) : m_nodes(), m_metadata(), m_id(id)
+    Way(Id id) : m_coords(), m_metadata(), m_id(id)
     {}
 
     Way(const Way &) = delete;
 
-    ~Way() {
-        if(m_vao)
-            glDeleteVertexArrays(1, &m_vao);
-        if(m_vbo)
-            glDeleteVertexArrays(1, &m_vbo);
+    Way(Way&& other) noexcept = default;
+    Way& operator=(Way&& other) noexcept = default;
+
+    // where the `VertexPool` put the coordinates the `WayArena` took from this way
+    inline void set_vertex_range(VertexRange range) {
+        m_vertex_range = range;
+    }
+
+    inline auto get_vertex_range() const -> VertexRange {
+        return m_vertex_range;
+    }
+
+    inline void add_coord(glm::vec2 coord) {
+        increase_bbox(coord);
+        m_coords.push_back(coord);
+    }
+
+    // the coarsest level of detail of every coordinate, needs the coordinates and rings;
+    // ways are usually given theirs in parallel before they reach the map
+    void build_lod();
+
+    inline bool has_lod() const {
+        return m_lod.size() == m_coords.size() && !m_coords.empty();
     }
 
-    void create_buffers();
+    inline auto get_lod() const -> const std::vector<uint8_t>& {
+        return m_lod;
+    }
+
+    inline auto take_lod() -> std::vector<uint8_t> {
+        return std::move(m_lod);
+    }
 
-    void draw_buffers();
-    void draw_highlighted_buffers();
+    // the ends of the rings within every level of detail, from the levels `lod` of coordinates
+    // that are kept elsewhere, like in a map cache; `build_lod` does this itself
+    void index_rings(const uint8_t* lod);
 
-    inline void add_node(Node node) {
-        increase_bbox(node.m_coord);
-        m_nodes.push_back(node);
+    // a closed way or a multipolygon of a class that is drawn filled, until a `WayArena` took the coordinates
+    bool is_area() const;
+
+    // triangulates areas at every level of detail, after `build_lod`; see `FillSpan`
+    void build_fill();
+
+    inline auto get_fill() const -> FillSpan {
+        return FillSpan(m_fill);
     }
 
-    inline auto& get_nodes() {
-        return m_nodes;
+    inline auto take_fill() -> std::vector<uint32_t> {
+        return std::move(m_fill);
+    }
+
+    // the coordinates of a way that is being built, empty once a `WayArena` took them
+    inline auto& get_coords() {
+        return m_coords;
+    }
+
+    inline auto& get_coords() const {
+        return m_coords;
+    }
+
+    inline auto take_coords() -> std::vector<glm::vec2> {
+        return std::move(m_coords);
     }
 
     inline auto get_id() const -> Id {
         return m_id;
     }
 
-    inline void add_tag(std::string key, std::string value) {
-        m_tags.insert({key, value});
+    // `tags` is owned by the `TagPool`
+    inline void set_tags(const TagSet* tags) {
+        m_tags = tags;
     }
 
-    inline auto& get_tags() {
-        return m_tags;
+    inline auto get_tags() const -> const TagSet& {
+        return *m_tags;
     }
 
     auto parse_metadata() -> Metadata {
-        return m_metadata = Metadata(m_tags);
+        return m_metadata = Metadata(*m_tags);
     }
 
     inline auto& get_metadata() const {
         return m_metadata;
     }
-    
-private:
-    bool is_area() const;
-    std::optional<std::vector<GLuint>> triangulate_polygon();
 
-    inline size_t relevant_vertices_count() const {
-        return m_nodes.size() > 1 && m_nodes.front() == m_nodes.back() ? m_nodes.size() - 1 : m_nodes.size();
+    inline void set_metadata(Metadata metadata) {
+        m_metadata = metadata;
     }
 
-    inline size_t triangle_count() const {
-        return relevant_vertices_count() - 2;
+    // splits the nodes of an assembled multipolygon into closed rings,
+    // given by their end offsets; the first `outer_rings` are outer rings
+    void set_rings(std::vector<uint32_t> ring_ends, uint32_t outer_rings);
+
+    // empty for plain ways; the ends of the rings within a level of detail above 0 once it was built
+    auto get_ring_ends(int lod_level = 0) const -> const std::vector<uint32_t>&;
+
+    inline auto get_outer_ring_count() const -> uint32_t {
+        return m_rings ? m_rings->m_outer_count : 0;
+    }
+
+    inline bool is_multipolygon() const {
+        return m_rings != nullptr;
     }
+    
+private:
+    // only multipolygons pay for their rings
+    struct Rings {
+        std::vector<uint32_t> m_ends;
+        uint32_t m_outer_count;
+
+        // of levels 1 and up
+        std::vector<uint32_t> m_lod_ends[lod_levels - 1];
+    };
 
-    WindingOrder get_winding_order() const;
+    std::vector<glm::vec2> m_coords;
+    std::vector<uint8_t> m_lod;
+    std::vector<uint32_t> m_fill;
 
-    std::vector<Node> m_nodes;
+    // what drawing a way reads, kept together
     Metadata m_metadata;
-
-    GLuint m_vao = 0, m_vbo = 0, m_ebo = 0;
+    VertexRange m_vertex_range;
+    std::unique_ptr<Rings> m_rings;
 
     Id m_id;
 
-    std::unordered_map<std::string, std::string> m_tags;
-    std::optional<std::vector<GLuint>> m_indices = std::nullopt;
+    const TagSet* m_tags = TagSet::empty_set();
 };
 
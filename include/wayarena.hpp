@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "mappedfile.hpp"
+#include "way.hpp"
+
+// refers to a way in a `WayArena`
+using WayHandle = uint32_t;
+
+constexpr WayHandle no_way = std::numeric_limits<WayHandle>::max();
+
+// The geometry of a way in memory the arena does not own, like a map cache that is
+// mapped into memory; `m_file` keeps that memory alive for as long as the arena
+struct MappedGeometry {
+    CoordSpan m_coords;
+    const uint8_t* m_lod;
+    FillSpan m_fill;
+    std::shared_ptr<const MappedFile> m_file;
+};
+
+// Owns the ways of a map, allocated back to back in fixed-size chunks.
+// A way never moves once it was added, and is referred to by its 32-bit handle,
+// which is its position in the order of `add`. Ways are only freed with the arena.
+//
+// The geometry is kept apart from the ways, in columns indexed by handle: the
+// coordinates of every way, the level of detail of every coordinate, the triangles
+// of the areas and the metadata of every way. The arena stores the geometry it takes
+// from the ways in blocks that never move, and refers to geometry that is mapped in
+// where it is. Traversals that only need those never touch the ways themselves.
+class WayArena {
+public:
+    WayArena();
+    ~WayArena();
+
+    WayArena(const WayArena&) = delete;
+    WayArena& operator=(const WayArena&) = delete;
+
+    // takes the coordinates of `way` into the geometry columns, and its levels of detail
+    // and fill, which are built first if it has no levels of detail
+    auto add(Way&& way) -> WayHandle;
+
+    // for a way without coordinates, whose bounding box and rings are set already
+    auto add(Way&& way, MappedGeometry geometry) -> WayHandle;
+
+    inline auto operator[](WayHandle handle) -> Way& {
+        return m_chunks[handle >> chunk_bits][handle & chunk_mask];
+    }
+
+    inline auto operator[](WayHandle handle) const -> const Way& {
+        return m_chunks[handle >> chunk_bits][handle & chunk_mask];
+    }
+
+    inline auto coords(WayHandle handle) const -> CoordSpan {
+        return CoordSpan(m_geometry[handle].m_coords, m_geometry[handle].m_size);
+    }
+
+    // the coarsest level of detail of each of `coords(handle)`
+    inline auto lod(WayHandle handle) const -> const uint8_t* {
+        return m_geometry[handle].m_lod;
+    }
+
+    // empty unless the way is an area
+    inline auto fill(WayHandle handle) const -> FillSpan {
+        return FillSpan(m_geometry[handle].m_fill, m_geometry[handle].m_fill_size);
+    }
+
+    inline auto metadata(WayHandle handle) const -> Metadata {
+        return m_metadata[handle];
+    }
+
+    inline auto size() const -> size_t {
+        return m_size;
+    }
+
+    inline auto vertex_count() const -> size_t {
+        return m_vertex_count;
+    }
+
+    // bytes held by the geometry columns, without the mapped geometry
+    auto geometry_bytes() const -> size_t;
+
+    inline auto mapped_bytes() const -> size_t {
+        return m_mapped_bytes;
+    }
+
+    // gives back what the columns reserved for further ways
+    void shrink_to_fit();
+
+private:
+    static constexpr unsigned chunk_bits = 12;
+    static constexpr size_t chunk_size = size_t(1) << chunk_bits;
+    static constexpr size_t chunk_mask = chunk_size - 1;
+
+    // where the geometry of a way is
+    struct Geometry {
+        const glm::vec2* m_coords;
+        const uint8_t* m_lod;
+        const uint32_t* m_fill;
+        uint32_t m_size;
+        uint32_t m_fill_size;
+    };
+
+    // storage for the geometry the arena owns, in blocks that never move
+    template<typename T>
+    class Blocks {
+    public:
+        auto append(const std::vector<T>& values) -> const T*;
+
+        inline auto bytes() const -> size_t {
+            return m_capacity * sizeof(T);
+        }
+
+    private:
+        static constexpr size_t block_size = 64 * 1024;
+
+        std::vector<std::unique_ptr<T[]>> m_blocks;
+        size_t m_block_used = block_size;
+        size_t m_capacity = 0;
+    };
+
+    // constructs `way` in the next slot
+    auto emplace(Way&& way) -> WayHandle;
+
+    // uninitialized storage for `chunk_size` ways, only the first `m_size` are constructed
+    std::vector<Way*> m_chunks;
+    size_t m_size = 0;
+
+    Blocks<glm::vec2> m_coords;
+    Blocks<uint8_t> m_lod;
+    Blocks<uint32_t> m_fill;
+    std::vector<Geometry> m_geometry;
+    std::vector<Metadata> m_metadata;
+    size_t m_vertex_count = 0;
+
+    // what the mapped geometry is in
+    std::vector<std::shared_ptr<const MappedFile>> m_mappings;
+    size_t m_mapped_bytes = 0;
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+#include <glm/vec2.hpp>
+
+class Way;
+struct MappedGeometry;
+
+// receives the output of an ingest: the BVH bounds first, then classified
+// ways without GL buffers, which the sink takes over and creates the buffers of
+// on its own thread
+class WaySink {
+public:
+    virtual ~WaySink() = default;
+
+    virtual void init_bvh(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth) = 0;
+    virtual bool has_bvh() const = 0;
+
+    virtual void add_way(Way&& way) = 0;
+
+    // places `way` in the BVH node with the flattened index `bvh_index` instead of descending
+    virtual void add_way_at(size_t bvh_index, Way&& way) = 0;
+
+    // like `add_way_at`, for a way of a map cache whose geometry stays where it was mapped
+    virtual void add_mapped_way_at(size_t bvh_index, Way&& way, MappedGeometry geometry) = 0;
+
+    // all ways are in
+    virtual void finish_loading() {}
+};
@@ -2,15 +2,19 @@
 
 #include <imgui.h>
 
-void Inspector::inspect_ui(std::shared_ptr<Way> way) {
+void Inspector::inspect_ui(const Way& way) {
     ImGui::Begin("Inspector");
 
-    ImGui::Text("id: %lu", way->get_id());
+    if(way.is_multipolygon())
+        ImGui::Text("relation: %lu, %zu rings", way.get_id(), way.get_ring_ends().size());
+    else
+        ImGui::Text("id: %lu", way.get_id());
 
     ImGui::Separator();
 
-    for(auto& [ key, value ] : way->get_tags()) {
-        ImGui::Text("%s := %s", key.c_str(), value.c_str());
+    for(auto& tag : way.get_tags()) {
+        auto key = tag.key(), value = tag.value();
+        ImGui::Text("%.*s := %.*s", int(key.size()), key.data(), int(value.size()), value.data());
     }
 
     ImGui::End();
@@ -0,0 +1,97 @@
+#include "layercache.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+
+#include <glm/common.hpp>
+
+// a pan further than this from whole pixels draws everything again, the cached image
+// can only be shifted by whole pixels
+constexpr float pan_tolerance = 0.05f;
+
+auto LayerCache::update(glm::ivec2 window_size, glm::vec2 scale, glm::vec2 translation) -> const std::vector<Region>& {
+    m_regions.clear();
+
+    if(!m_front || window_size != m_size) {
+        m_front = std::make_unique<Framebuffer>(window_size.x, window_size.y);
+        m_back = std::make_unique<Framebuffer>(window_size.x, window_size.y);
+        m_size = window_size;
+        m_valid = false;
+    }
+
+    // the shift of the image in pixels, translations are in map units
+    const glm::vec2 pixels_per_unit = scale * glm::vec2(m_size) * 0.5f;
+    const glm::vec2 shift = (translation - m_translation) * pixels_per_unit;
+    const glm::vec2 whole = glm::round(shift);
+
+    const bool panned_by_pixels = std::abs(shift.x - whole.x) <= pan_tolerance && std::abs(shift.y - whole.y) <= pan_tolerance
+        && std::abs(whole.x) < m_size.x && std::abs(whole.y) < m_size.y;
+
+    if(!m_valid || scale != m_scale || !panned_by_pixels) {
+        m_regions.push_back({ glm::ivec2(0), m_size });
+        m_valid = true;
+        m_scale = scale;
+        m_translation = translation;
+        m_stats.m_redrawn++;
+        return m_regions;
+    }
+
+    const glm::ivec2 offset(int(whole.x), int(whole.y));
+    if(offset.x == 0 && offset.y == 0) {
+        m_stats.m_reused++;
+        return m_regions;
+    }
+
+    pan(offset);
+    m_stats.m_panned++;
+
+    // what the image shows now, so that the rounding does not add up over many pans
+    m_translation += whole / pixels_per_unit;
+
+    // the strips the image moved away from
+    if(offset.x > 0)
+        m_regions.push_back({ glm::ivec2(0), glm::ivec2(offset.x, m_size.y) });
+    else if(offset.x < 0)
+        m_regions.push_back({ glm::ivec2(m_size.x + offset.x, 0), m_size });
+
+    if(offset.y > 0)
+        m_regions.push_back({ glm::ivec2(0), glm::ivec2(m_size.x, offset.y) });
+    else if(offset.y < 0)
+        m_regions.push_back({ glm::ivec2(0, m_size.y + offset.y), m_size });
+
+    return m_regions;
+}
+
+void LayerCache::pan(glm::ivec2 shift) {
+    const glm::ivec2 src_min(std::max(-shift.x, 0), std::max(-shift.y, 0));
+    const glm::ivec2 src_max(m_size.x - std::max(shift.x, 0), m_size.y - std::max(shift.y, 0));
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_front->id());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_back->id());
+    glBlitFramebuffer(src_min.x, src_min.y, src_max.x, src_max.y,
+        src_min.x + shift.x, src_min.y + shift.y, src_max.x + shift.x, src_max.y + shift.y,
+        GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    std::swap(m_front, m_back);
+}
+
+void LayerCache::begin_region(const Region& region) {
+    m_front->bind();
+
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(region.m_min.x, region.m_min.y, region.m_max.x - region.m_min.x, region.m_max.y - region.m_min.y);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+void LayerCache::present() {
+    // blits are scissored too
+    glDisable(GL_SCISSOR_TEST);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_front->id());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, m_size.x, m_size.y, 0, 0, m_size.x, m_size.y, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
@@ -1,11 +1,16 @@
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <string_view>
 #include <vector>
 #include <memory>
 
+#include "framescheduler.hpp"
 #include "overlay.hpp"
 #include "log.hpp"
 #include "preprocess.hpp"
 #include "map.hpp"
+#include "maploader.hpp"
 #include "rendercontext.hpp"
 #include "renderutil.hpp"
 #include "timer.hpp"
@@ -18,13 +23,57 @@
 
 constexpr glm::vec2 window_size = glm::vec2(1366, 768);
 
+// time per frame spent uploading ways while loading, which keeps the window responsive
+constexpr auto upload_budget = std::chrono::milliseconds(8);
+
 std::unique_ptr<RenderContext> context = nullptr;
+std::unique_ptr<FrameScheduler> scheduler = nullptr;
+
+static void print_usage(const char* argv0) {
+    mlog::logln(mlog::ERROR, "Usage: %s %s [--vram-budget <MiB>] [--cull-threads <n>] [--max-fps <n>] [--vsync on|off|adaptive] <osm file | ->",
+        argv0, ingest_usage);
+}
 
 auto main(int argc, char** argv) -> int {
     mlog::init_from_env("MAP_LOG");
 
-    if(argc != 2) {
-        mlog::logln(mlog::ERROR, "Usage: %s <osm xml file>", argv[0]);
+    IngestOptions ingest_options;
+    size_t vram_budget = 0;
+    unsigned cull_threads = 0;
+    unsigned max_fps = 0;
+    auto vsync = FrameScheduler::VSYNC_OFF;
+    const char* input_path = nullptr;
+
+    for(int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+
+        int parsed = parse_ingest_option(argc, argv, i, ingest_options);
+        if(parsed < 0)
+            return 1;
+        else if(parsed > 0)
+            continue;
+        else if(arg == "--vram-budget" && i + 1 < argc)
+            vram_budget = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+        else if(arg == "--cull-threads" && i + 1 < argc)
+            cull_threads = std::strtoul(argv[++i], nullptr, 10);
+        else if(arg == "--max-fps" && i + 1 < argc)
+            max_fps = std::strtoul(argv[++i], nullptr, 10);
+        else if(arg == "--vsync" && i + 1 < argc && std::string_view(argv[i + 1]) == "on")
+            vsync = FrameScheduler::VSYNC_ON, i++;
+        else if(arg == "--vsync" && i + 1 < argc && std::string_view(argv[i + 1]) == "off")
+            vsync = FrameScheduler::VSYNC_OFF, i++;
+        else if(arg == "--vsync" && i + 1 < argc && std::string_view(argv[i + 1]) == "adaptive")
+            vsync = FrameScheduler::VSYNC_ADAPTIVE, i++;
+        else if(!input_path && (arg[0] != '-' || arg == "-"))
+            input_path = argv[i];
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(!input_path) {
+        print_usage(argv[0]);
         return 1;
     }
 
@@ -43,18 +92,22 @@ auto main(int argc, char** argv) -> int {
         return 1;
     }
 
+    scheduler = std::make_unique<FrameScheduler>(max_fps, vsync);
+
     auto timers = std::vector({
-        Timer(std::chrono::seconds(1), [](auto& frame_time){
-            mlog::logln(mlog::DEBUG, "fps: %ld", std::chrono::seconds(1) / frame_time);
+        Timer(std::chrono::seconds(1), []([[maybe_unused]] auto& elapsed){
+            auto& stats = scheduler->get_stats();
+            mlog::logln(mlog::DEBUG, "fps: %u, wakeups: %u, cpu: %.1f%%, input latency: %.1f ms", stats.m_frames, stats.m_wakeups,
+                stats.m_cpu_load * 100.0, stats.m_max_latency_ms);
         })
     });
 
     auto last_time = std::chrono::steady_clock::now();
-    std::chrono::steady_clock::duration frame_time;
+    std::chrono::steady_clock::duration elapsed;
 
     glfwMakeContextCurrent(window);
-    
-    glfwSwapInterval(0);
+
+    scheduler->apply_vsync();
 
     if(GLenum err = glewInit()) {
         mlog::logln(mlog::ERROR, "OpenGL error: %s", glewGetErrorString(err));
@@ -62,12 +115,10 @@ auto main(int argc, char** argv) -> int {
         return 1;
     }
 
-    auto map = std::make_shared<Map>();
+    auto map = std::make_shared<Map>(ingest_options.shared_vertices, vram_budget, cull_threads);
 
     mlog::logln(mlog::INFO, "Preprocessing data...");
-    if(int err = preprocess_data(argv[1], map)) {
-        return err;
-    };
+    auto loader = std::make_unique<MapLoader>(map, input_path, ingest_options, FrameScheduler::wake);
 
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
@@ -79,10 +130,9 @@ auto main(int argc, char** argv) -> int {
     io.ConfigFlags |= ImGuiConfigFlags_DockingEnable;
     // io.ConfigFlags |= ImGuiConfigFlags_ViewportsEnable;
 
-    context = std::make_unique<RenderContext>(map, window_size);
-    context->add_element(std::make_shared<Overlay>());
-
+    // every input is drawn, whether it goes to the UI or to the map
     glfwSetScrollCallback(window, [](GLFWwindow*, double xoffset, double yoffset){
+        scheduler->request_input_frame();
         auto& io = ImGui::GetIO();
 
         if(io.WantCaptureMouse) {
@@ -90,15 +140,19 @@ auto main(int argc, char** argv) -> int {
             return;
         }
 
+        if(!context)
+            return;
+
         auto& scale = context->get_viewport().get_scale_factor();
         scale += scale * yoffset * 0.1;
     });
 
     glfwSetMouseButtonCallback(window, [](GLFWwindow*, int button, int action, [[maybe_unused]] int mods) {
+        scheduler->request_input_frame();
         auto& io = ImGui::GetIO();
         io.AddMouseButtonEvent(button, action == GLFW_PRESS);
 
-        if(io.WantCaptureMouse)
+        if(io.WantCaptureMouse || !context)
             return;
 
         switch(button) {
@@ -114,10 +168,11 @@ auto main(int argc, char** argv) -> int {
     });
 
     glfwSetCursorPosCallback(window, [](GLFWwindow*, double xpos, double ypos) {
+        scheduler->request_input_frame();
         auto& io = ImGui::GetIO();
         io.AddMousePosEvent(xpos, ypos);
 
-        if(io.WantCaptureMouse)
+        if(io.WantCaptureMouse || !context)
             return;
 
         glm::vec2 pos(xpos, ypos);
@@ -130,21 +185,75 @@ auto main(int argc, char** argv) -> int {
     });
 
     glfwSetWindowSizeCallback(window, [](GLFWwindow*, int width, int height) {
-        context->get_input_state().window_size = glm::vec2(width, height);
+        scheduler->request_input_frame();
+        if(context)
+            context->get_input_state().window_size = glm::vec2(width, height);
+    });
+
+    // the backend installed these for the UI, they only have to ask for frames as well
+    glfwSetKeyCallback(window, [](GLFWwindow* window, int key, int scancode, int action, int mods) {
+        scheduler->request_input_frame();
+        ImGui_ImplGlfw_KeyCallback(window, key, scancode, action, mods);
+    });
+
+    glfwSetCharCallback(window, [](GLFWwindow* window, unsigned int codepoint) {
+        scheduler->request_input_frame();
+        ImGui_ImplGlfw_CharCallback(window, codepoint);
+    });
+
+    glfwSetWindowFocusCallback(window, [](GLFWwindow* window, int focused) {
+        scheduler->request_frame();
+        ImGui_ImplGlfw_WindowFocusCallback(window, focused);
+    });
+
+    glfwSetCursorEnterCallback(window, [](GLFWwindow* window, int entered) {
+        scheduler->request_frame();
+        ImGui_ImplGlfw_CursorEnterCallback(window, entered);
     });
 
+    // uncovered or restored
+    glfwSetWindowRefreshCallback(window, [](GLFWwindow*) {
+        scheduler->request_frame();
+    });
+
+    int exit_code = 0;
+    bool first_map_frame = true;
+
     while(!glfwWindowShouldClose(window)) {
+        // sleeps until a frame is asked for or the next timer is due
+        std::chrono::steady_clock::duration until_timer = std::chrono::hours(1);
+        for(auto& timer : timers)
+            until_timer = std::min(until_timer, timer.until_due());
+
+        bool draw = scheduler->wait(until_timer);
+
+        auto now = std::chrono::steady_clock::now();
+        elapsed = now - last_time;
+        last_time = now;
+
         for(auto& timer : timers) {
-            timer.update(frame_time);
+            timer.update(elapsed);
         }
-        
-        if(glfwGetWindowAttrib(window, GLFW_ICONIFIED)) {
-            ImGui_ImplGlfw_Sleep(10);
-            continue;
+
+        if(loader->upload(upload_budget))
+            scheduler->request_frame();
+        if(auto err = loader->error()) {
+            exit_code = *err;
+            break;
         }
 
-        auto& window_size = context->get_input_state().window_size;
-        glViewport(0, 0, window_size.x, window_size.y);
+        // the viewport starts out fitted to the map bounds, which come first
+        if(!context && map->has_bvh()) {
+            context = std::make_unique<RenderContext>(map, window_size, *scheduler);
+            context->add_element(std::make_shared<Overlay>());
+            scheduler->request_frame();
+        }
+
+        if(!draw || glfwGetWindowAttrib(window, GLFW_ICONIFIED))
+            continue;
+
+        auto current_size = context ? context->get_input_state().window_size : window_size;
+        glViewport(0, 0, current_size.x, current_size.y);
         
         glClearColor(0.0, 0.0, 0.0, 1.0);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); 
@@ -152,9 +261,8 @@ auto main(int argc, char** argv) -> int {
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-        glEnable(GL_LINE_SMOOTH);
-
-        context->draw_scene();
+        if(context)
+            context->draw_scene();
         
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
@@ -162,7 +270,14 @@ auto main(int argc, char** argv) -> int {
         ImGui_ImplGlfw_NewFrame();
         ImGui::NewFrame();
         
-        context->draw_ui();
+        if(context)
+            context->draw_ui();
+
+        if(!loader->done()) {
+            ImGui::Begin("Loading");
+            ImGui::Text("%zu ways loaded (%.1fs)", loader->uploaded(), loader->seconds_elapsed());
+            ImGui::End();
+        }
 
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
@@ -176,13 +291,20 @@ auto main(int argc, char** argv) -> int {
         }
         
         glfwSwapBuffers(window);
-        glfwPollEvents();
+        scheduler->frame_presented();
 
-        auto now = std::chrono::steady_clock::now();
-        frame_time = now - last_time;
-        last_time = now;
+        // tiles in view that did not fit into the frame come with the next
+        if(map->wants_frame())
+            scheduler->request_frame();
+
+        if(first_map_frame && loader->uploaded() > 0) {
+            mlog::logln(mlog::INFO, "First map frame after %.2fs", loader->seconds_elapsed());
+            first_map_frame = false;
+        }
     }
 
+    loader = nullptr;
+
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -190,6 +312,6 @@ auto main(int argc, char** argv) -> int {
     glfwDestroyWindow(window);
     glfwTerminate();
 
-    return 0;
+    return exit_code;
 }
 
@@ -2,41 +2,55 @@
 #include "bvh.hpp"
 #include "way.hpp"
 #include "log.hpp"
+#include "phasetimer.hpp"
 
+#include <chrono>
 #include <cmath>
 #include <fstream>
 
 #include <imgui.h>
 
-Map::Map()
-    : m_bvh(nullptr), m_inspector()
-{
-    auto vertex_source = std::ifstream("shaders/map_vertex.glsl");
-    auto fragment_source = std::ifstream("shaders/map_fragment.glsl");
-    if(vertex_source.bad() || fragment_source.bad()) {
+// pixels around a region to draw, wider than any line reaches beyond its vertices
+constexpr float region_margin = 4.0f;
+
+static auto open_source(const char* path) -> std::ifstream {
+    auto source = std::ifstream(path);
+    if(source.bad()) {
         mlog::logln(mlog::ERROR, "Shader error: Shader file not found");
         std::exit(1);
     }
 
-    m_shader = std::make_unique<Shader>(vertex_source, fragment_source);
-    if(auto err = m_shader->get_error()) {
-        mlog::logln(mlog::ERROR, "Shader error: %s", err->c_str());
-        std::exit(1);
-    }
+    return source;
+}
 
+// exits on errors; without `geometry_path`, the program has no geometry shader
+static auto load_program(const char* vertex_path, const char* geometry_path, const char* fragment_path) -> std::unique_ptr<Shader> {
+    auto vertex_source = open_source(vertex_path);
+    auto fragment_source = open_source(fragment_path);
 
-    auto sel_vertex_source = std::ifstream("shaders/map_selected_vertex.glsl");
-    auto sel_fragment_source = std::ifstream("shaders/map_selected_fragment.glsl");
-    if(sel_vertex_source.bad() || sel_fragment_source.bad()) {
-        mlog::logln(mlog::ERROR, "Shader error: Shader file not found");
-        std::exit(1);
+    std::unique_ptr<Shader> shader;
+    if(geometry_path) {
+        auto geometry_source = open_source(geometry_path);
+        shader = std::make_unique<Shader>(vertex_source, geometry_source, fragment_source);
     }
+    else
+        shader = std::make_unique<Shader>(vertex_source, fragment_source);
 
-    m_selection_shader = std::make_unique<Shader>(sel_vertex_source, sel_fragment_source);
-    if(auto err = m_selection_shader->get_error()) {
+    if(auto err = shader->get_error()) {
         mlog::logln(mlog::ERROR, "Shader error: %s", err->c_str());
         std::exit(1);
     }
+
+    return shader;
+}
+
+Map::Map(bool shared_vertices, size_t vram_budget, unsigned cull_threads)
+    : m_tiles(m_ways, shared_vertices, vram_budget, cull_threads), m_draw_list(shared_vertices), m_bvh(nullptr), m_inspector()
+{
+    m_fill_shader = load_program("shaders/map_vertex.glsl", nullptr, "shaders/map_fragment.glsl");
+    m_shader = load_program("shaders/map_vertex.glsl", "shaders/map_line_geometry.glsl", "shaders/map_line_fragment.glsl");
+    m_selection_shader = load_program("shaders/map_selected_vertex.glsl", "shaders/map_line_geometry.glsl",
+        "shaders/map_selected_fragment.glsl");
 }
 
 void Map::init_bvh(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth) {
@@ -44,37 +58,139 @@ void Map::init_bvh(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_dep
 
     set_minmax_coord(minmax_coords);
     m_max_bvh_depth = max_depth;
-    m_render_bvh_depth = max_depth;
     m_bvh = std::make_unique<BVH>(minmax_coords, max_depth, 0);
+    m_tiles.init(*m_bvh);
+}
+
+void Map::add_way(Way&& way) {
+    assert(m_bvh);
+
+    auto handle = m_ways.add(std::move(way));
+
+    BVH* node;
+    {
+        PhaseTimer timer(PHASE_INDEX);
+        node = m_bvh->find_node(m_ways[handle]);
+        node->insert_way(m_ways, handle);
+    }
+
+    add_to_tile(handle, *node);
+}
+
+void Map::add_way_at(size_t bvh_index, Way&& way) {
+    assert(m_bvh);
+    insert_at(bvh_index, m_ways.add(std::move(way)));
+}
+
+void Map::add_mapped_way_at(size_t bvh_index, Way&& way, MappedGeometry geometry) {
+    assert(m_bvh);
+    insert_at(bvh_index, m_ways.add(std::move(way), std::move(geometry)));
+}
+
+void Map::insert_at(size_t bvh_index, WayHandle handle) {
+    BVH* node;
+    {
+        PhaseTimer timer(PHASE_INDEX);
+        if(m_flat_bvh.empty())
+            m_bvh->flatten(m_flat_bvh);
+
+        assert(bvh_index < m_flat_bvh.size());
+        node = m_flat_bvh[bvh_index];
+        node->insert_way(m_ways, handle);
+    }
+
+    add_to_tile(handle, *node);
+}
+
+void Map::add_to_tile(WayHandle handle, const BVH& node) {
+    PhaseTimer timer(PHASE_GEOMETRY);
+    m_tiles.add_way(handle, node);
+}
+
+void Map::finish_loading() {
+    m_ways.shrink_to_fit();
+    mlog::logln(mlog::INFO, "geometry: %zu vertices of %zu ways in %.1f MiB, %.1f MiB mapped from the cache", m_ways.vertex_count(), m_ways.size(),
+        m_ways.geometry_bytes() / 1024.0 / 1024.0, m_ways.mapped_bytes() / 1024.0 / 1024.0);
+
+    m_tiles.finish_loading();
 }
 
 void Map::draw_scene(Viewport& viewport, InputState& input) {
+    auto view_scale = viewport.get_scale(input.window_size);
     auto view_box = viewport.viewport_bbox();
 
-    m_shader->use();
-    viewport.upload_uniforms(*m_shader, input.window_size);
-
     auto scale = viewport.get_scale_factor();
 
     m_draw_priority = static_cast<DrawPriority>(std::clamp(int(scale * 2 + std::sqrt(scale * 4)), 1, int(DrawPriority::__DRAW_PRIO_LAST)));
 
-    m_bvh->draw(view_box, m_draw_priority, m_render_bvh_depth, 0);
+    if(!m_bvh)
+        return;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    // ways are drawn at the coarsest level of detail that keeps them within a pixel
+    m_draw_list.set_lod_level(lod_level_for(2.0f / (view_scale.x * input.window_size.x)));
+
+    if(m_tiles.update(view_box, m_draw_priority))
+        m_layer.invalidate();
 
-    if(m_selected_way) {
+    m_frame_stats.m_draw_calls = 0;
+    m_frame_stats.m_ways = 0;
+    m_frame_stats.m_commands = 0;
+    m_frame_stats.m_vertices = 0;
+    m_frame_stats.m_triangles = 0;
+    m_frame_stats.m_lod_level = m_draw_list.get_lod_level();
+
+    // from window pixels to the map
+    auto to_map = [&](glm::ivec2 pixel, float margin) {
+        return ((glm::vec2(pixel) + margin) / input.window_size * 2.0f - glm::vec2(1.0f)) / view_scale - viewport.get_translation();
+    };
+
+    // only what the cached image of the map is missing
+    const glm::ivec2 window_size(input.window_size);
+    for(auto& region : m_layer.update(window_size, view_scale, viewport.get_translation())) {
+        m_layer.begin_region(region);
+
+        // with the ways whose lines reach into the region
+        auto region_box = BBox(to_map(region.m_min, -region_margin), to_map(region.m_max, region_margin));
+
+        m_tiles.collect(region_box, m_draw_priority, m_draw_list.get_lod_level());
+
+        m_fill_shader->use();
+        viewport.upload_uniforms(*m_fill_shader, input.window_size);
+        m_frame_stats.m_draw_calls += m_tiles.draw(DRAW_FILLS);
+
+        m_shader->use();
+        m_shader->upload_uniform("u_Resolution", input.window_size);
+        viewport.upload_uniforms(*m_shader, input.window_size);
+        m_frame_stats.m_draw_calls += m_tiles.draw(DRAW_LINES);
+
+        m_frame_stats.m_ways += m_tiles.get_stats().m_drawn_ways;
+        m_frame_stats.m_commands += m_tiles.get_stats().m_drawn_commands;
+        m_frame_stats.m_vertices += m_tiles.get_stats().m_drawn_vertices;
+        m_frame_stats.m_triangles += m_tiles.get_stats().m_drawn_triangles;
+    }
+
+    m_layer.present();
+
+    // follows the cursor, so it is not cached
+    if(m_selected_way != no_way) {
         m_selection_shader->use();
         m_selection_shader->upload_uniform("u_Resolution", input.window_size);
         viewport.upload_uniforms(*m_selection_shader, input.window_size);
 
-        m_selected_way->draw_highlighted_buffers();
+        m_frame_stats.m_draw_calls += m_tiles.draw_way(m_selected_way, m_draw_list);
     }
+
+    m_frame_stats.m_submit_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
 void Map::draw_ui(InputState& input) {
     auto [dist, way] = get_nearest_way(input.mapped_cursor_pos);
     m_selected_way = way;
     
-    if(way != nullptr) {
-        m_inspector.inspect_ui(way);
+    if(way != no_way) {
+        m_inspector.inspect_ui(m_ways[way]);
     }
 }
 
@@ -0,0 +1,190 @@
+#include "maploader.hpp"
+#include "log.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+// ways per batch, and per task within a batch
+constexpr size_t lod_batch_size = 4096;
+constexpr size_t lod_task_size = 256;
+
+MapLoader::MapLoader(std::shared_ptr<Map> map, std::string input_path, IngestOptions options, std::function<void()> wake)
+    : m_map(map), m_input_path(std::move(input_path)), m_options(std::move(options)), m_wake(std::move(wake)), m_start(Clock::now())
+{
+    m_options.stop = &m_stopping;
+    m_thread = std::thread([this]() { load(); });
+}
+
+MapLoader::~MapLoader() {
+    m_stopping = true;
+
+    if(!m_ingest_done)
+        mlog::logln(mlog::INFO, "Stopping the loader thread...");
+
+    m_thread.join();
+}
+
+void MapLoader::load() {
+    m_result = ingest_data(m_input_path.c_str(), *this, m_options, m_cache_target);
+    flush_batch();
+    m_ingest_done.store(true, std::memory_order_release);
+    if(m_wake)
+        m_wake();
+
+    // a stopped ingest may have dropped ways, the writer throws away what it has
+    if(m_cache_writer && m_result == 0 && !m_stopping) {
+        if(m_cache_writer->finish())
+            mlog::logln(mlog::INFO, "Wrote map cache `%s`", m_cache_target->m_path.c_str());
+        else
+            mlog::logln(mlog::WARN, "Could not write map cache `%s`", m_cache_target->m_path.c_str());
+    }
+
+    m_cache_writer = nullptr;
+    m_cache_bvh = nullptr;
+    m_cache_bvh_indices.clear();
+}
+
+void MapLoader::begin_cache(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth) {
+    // only used to place ways, like the BVH of the out-of-core ingest
+    m_cache_bvh = std::make_unique<BVH>(minmax_coords, max_depth, 0);
+
+    std::vector<BVH*> nodes;
+    m_cache_bvh->flatten(nodes);
+    for(size_t i = 0; i < nodes.size(); i++)
+        m_cache_bvh_indices[nodes[i]] = i;
+
+    m_cache_writer = std::make_unique<CacheWriter>(m_cache_target->m_path, m_cache_target->m_source, minmax_coords, max_depth);
+    if(!m_cache_writer->good()) {
+        mlog::logln(mlog::WARN, "Could not create map cache `%s`", m_cache_target->m_path.c_str());
+        m_cache_writer = nullptr;
+    }
+}
+
+void MapLoader::init_bvh(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth) {
+    Item item;
+    item.m_bounds = minmax_coords;
+    item.m_max_depth = max_depth;
+
+    m_queue.push(std::move(item));
+    m_has_bvh = true;
+    if(m_wake)
+        m_wake();
+
+    if(m_cache_target)
+        begin_cache(minmax_coords, max_depth);
+}
+
+bool MapLoader::has_bvh() const {
+    return m_has_bvh;
+}
+
+void MapLoader::add_way(Way&& way) {
+    add_way_at(no_bvh_index, std::move(way));
+}
+
+void MapLoader::add_way_at(size_t bvh_index, Way&& way) {
+    if(m_stopping)
+        return;
+
+    Item item;
+    item.m_way.emplace(std::move(way));
+    item.m_bvh_index = bvh_index;
+
+    m_batch.push_back(std::move(item));
+    if(m_batch.size() >= lod_batch_size)
+        flush_batch();
+}
+
+void MapLoader::add_mapped_way_at(size_t bvh_index, Way&& way, MappedGeometry geometry) {
+    if(m_stopping)
+        return;
+
+    Item item;
+    item.m_way.emplace(std::move(way));
+    item.m_bvh_index = bvh_index;
+    item.m_geometry.emplace(std::move(geometry));
+
+    m_batch.push_back(std::move(item));
+    if(m_batch.size() >= lod_batch_size)
+        flush_batch();
+}
+
+void MapLoader::flush_batch() {
+    const size_t tasks = (m_batch.size() + lod_task_size - 1) / lod_task_size;
+    m_lod_pool.parallel_for(tasks, [&](size_t task) {
+        auto end = std::min(m_batch.size(), (task + 1) * lod_task_size);
+        for(size_t i = task * lod_task_size; i < end; i++) {
+            if(m_batch[i].m_geometry)
+                continue;
+
+            auto& way = *m_batch[i].m_way;
+            way.build_lod();
+            way.build_fill();
+        }
+    });
+
+    if(m_cache_writer) {
+        for(auto& item : m_batch) {
+            auto& way = *item.m_way;
+            const uint32_t bvh_index = item.m_bvh_index != no_bvh_index ? item.m_bvh_index : m_cache_bvh_indices[m_cache_bvh->find_node(way)];
+            if(item.m_geometry)
+                m_cache_writer->add_way(way, item.m_geometry->m_coords, item.m_geometry->m_lod, item.m_geometry->m_fill, bvh_index);
+            else
+                m_cache_writer->add_way(way, way.get_coords(), way.get_lod().data(), way.get_fill(), bvh_index);
+        }
+    }
+
+    for(auto& item : m_batch)
+        m_queue.push(std::move(item));
+
+    m_batch.clear();
+    if(m_wake)
+        m_wake();
+}
+
+bool MapLoader::upload(std::chrono::microseconds budget) {
+    if(m_drained)
+        return false;
+
+    // read before draining, so that an empty queue afterwards really is the end
+    const bool ingest_done = m_ingest_done.load(std::memory_order_acquire);
+    const auto deadline = Clock::now() + budget;
+
+    Item item;
+    size_t count = 0;
+    bool empty = false;
+
+    for(;;) {
+        if(!m_queue.pop(item)) {
+            empty = true;
+            break;
+        }
+
+        if(item.m_bounds) {
+            m_map->init_bvh(*item.m_bounds, item.m_max_depth);
+        }
+        else {
+            if(item.m_geometry)
+                m_map->add_mapped_way_at(item.m_bvh_index, std::move(*item.m_way), std::move(*item.m_geometry));
+            else if(item.m_bvh_index == no_bvh_index)
+                m_map->add_way(std::move(*item.m_way));
+            else
+                m_map->add_way_at(item.m_bvh_index, std::move(*item.m_way));
+            m_uploaded++;
+        }
+
+        // reading the clock for every way would cost more than small ways take to upload
+        if(++count % 64 == 0 && Clock::now() >= deadline)
+            break;
+    }
+
+    if(empty && ingest_done && m_result == 0) {
+        m_map->finish_loading();
+        m_drained = true;
+
+        mlog::logln(mlog::INFO, "Loaded %zu ways in %.2fs", m_uploaded, seconds_elapsed());
+        TagPool::instance().log_stats(m_uploaded);
+    }
+
+    // the end of loading changes the window too
+    return count > 0 || m_drained;
+}
@@ -0,0 +1,43 @@
+#include "mappedfile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+auto MappedFile::open(const char* path) -> std::unique_ptr<MappedFile> {
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0)
+        return nullptr;
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if(data == MAP_FAILED)
+        return nullptr;
+
+    return std::unique_ptr<MappedFile>(new MappedFile(static_cast<const char*>(data), st.st_size));
+}
+
+MappedFile::~MappedFile() {
+    munmap(const_cast<char*>(m_data), m_size);
+}
+
+void MappedFile::advise_sequential() const {
+    madvise(const_cast<char*>(m_data), m_size, MADV_SEQUENTIAL);
+}
+
+void MappedFile::release(size_t begin, size_t end) const {
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+
+    begin = (begin + page_size - 1) / page_size * page_size;
+    end = end / page_size * page_size;
+    if(begin < end)
+        madvise(const_cast<char*>(m_data) + begin, end - begin, MADV_DONTNEED);
+}
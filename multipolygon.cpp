@@ -0,0 +1,226 @@
+#include "multipolygon.hpp"
+#include "log.hpp"
+#include "phasetimer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
+
+using Clock = std::chrono::steady_clock;
+
+// relations at least this large are reported on their own
+static constexpr size_t large_relation_members = 1000;
+
+void MultipolygonAssembler::add_relation(PendingRelation&& relation) {
+    m_relations.push_back(std::move(relation));
+}
+
+void MultipolygonAssembler::index_members() {
+    for(auto& relation : m_relations) {
+        for(auto& member : relation.m_members)
+            m_member_ids.push_back(member.m_way);
+    }
+
+    std::sort(m_member_ids.begin(), m_member_ids.end());
+    m_member_ids.erase(std::unique(m_member_ids.begin(), m_member_ids.end()), m_member_ids.end());
+}
+
+bool MultipolygonAssembler::wants(Way::Id id) const {
+    return std::binary_search(m_member_ids.begin(), m_member_ids.end(), id);
+}
+
+void MultipolygonAssembler::add_way(Way::Id id, CoordSpan coords) {
+    if(!wants(id))
+        return;
+
+    m_ways_sorted = m_ways_sorted && (m_ways.empty() || m_ways.back().m_id < id);
+    m_ways.push_back({id, m_coords.size(), uint32_t(coords.size())});
+    m_coords.insert(m_coords.end(), coords.begin(), coords.end());
+}
+
+auto MultipolygonAssembler::find_way(Way::Id id) const -> const WayGeometry* {
+    auto found = std::lower_bound(m_ways.begin(), m_ways.end(), WayGeometry{id, 0, 0});
+    return found != m_ways.end() && found->m_id == id ? &*found : nullptr;
+}
+
+// identical nodes project to identical coordinates
+static inline auto endpoint_key(glm::vec2 coord) -> uint64_t {
+    uint32_t x, y;
+    std::memcpy(&x, &coord.x, sizeof(x));
+    std::memcpy(&y, &coord.y, sizeof(y));
+    return uint64_t(x) << 32 | y;
+}
+
+// twice the signed area, positive for counter-clockwise rings
+static auto signed_area(const std::vector<glm::vec2>& ring) -> double {
+    double sum = 0.0;
+    for(size_t i = 1; i < ring.size(); i++)
+        sum += double(ring[i - 1].x) * ring[i].y - double(ring[i].x) * ring[i - 1].y;
+    return sum;
+}
+
+auto MultipolygonAssembler::stitch_relation(const PendingRelation& relation, Stats& stats) const -> std::vector<Ring> {
+    struct Segment {
+        const glm::vec2* m_coords;
+        uint32_t m_size;
+        bool m_inner;
+    };
+
+    std::vector<Segment> segments;
+    segments.reserve(relation.m_members.size());
+    for(auto& member : relation.m_members) {
+        auto way = find_way(member.m_way);
+        if(!way || way->m_size < 2) {
+            stats.m_missing_members++;
+            continue;
+        }
+
+        segments.push_back({m_coords.data() + way->m_offset, way->m_size, member.m_inner});
+    }
+
+    // the open ends of every segment, as segment * 2 + (0 for the first node, 1 for the last)
+    std::unordered_multimap<uint64_t, uint32_t> endpoints;
+    endpoints.reserve(segments.size() * 2);
+    for(uint32_t i = 0; i < segments.size(); i++) {
+        auto& segment = segments[i];
+        if(segment.m_coords[0] == segment.m_coords[segment.m_size - 1])
+            continue;
+
+        endpoints.emplace(endpoint_key(segment.m_coords[0]), i * 2);
+        endpoints.emplace(endpoint_key(segment.m_coords[segment.m_size - 1]), i * 2 + 1);
+    }
+
+    std::vector<Ring> rings;
+    std::vector<bool> used(segments.size(), false);
+
+    for(uint32_t i = 0; i < segments.size(); i++) {
+        if(used[i])
+            continue;
+        used[i] = true;
+
+        Ring ring{std::vector<glm::vec2>(segments[i].m_coords, segments[i].m_coords + segments[i].m_size), segments[i].m_inner};
+
+        // follow the chain of unused segments of the same role until it returns to its start
+        while(ring.m_coords.front() != ring.m_coords.back()) {
+            auto [ begin, end ] = endpoints.equal_range(endpoint_key(ring.m_coords.back()));
+            auto next = std::find_if(begin, end, [&](auto& endpoint) {
+                auto& candidate = segments[endpoint.second / 2];
+                return !used[endpoint.second / 2] && candidate.m_inner == ring.m_inner;
+            });
+
+            if(next == end)
+                break;
+
+            const uint32_t index = next->second / 2;
+            auto& segment = segments[index];
+            used[index] = true;
+
+            // the shared endpoint is already in the ring
+            if(next->second % 2 == 0)
+                ring.m_coords.insert(ring.m_coords.end(), segment.m_coords + 1, segment.m_coords + segment.m_size);
+            else
+                ring.m_coords.insert(ring.m_coords.end(), std::make_reverse_iterator(segment.m_coords + segment.m_size - 1),
+                    std::make_reverse_iterator(segment.m_coords));
+        }
+
+        if(ring.m_coords.size() < 4 || ring.m_coords.front() != ring.m_coords.back()) {
+            stats.m_open_rings++;
+            continue;
+        }
+
+        // outer rings counter-clockwise, inner rings clockwise
+        if((signed_area(ring.m_coords) < 0.0) != ring.m_inner)
+            std::reverse(ring.m_coords.begin(), ring.m_coords.end());
+
+        rings.push_back(std::move(ring));
+    }
+
+    // outer rings first
+    std::stable_partition(rings.begin(), rings.end(), [](const Ring& ring) { return !ring.m_inner; });
+    return rings;
+}
+
+auto MultipolygonAssembler::assemble(TagBuilder& tags) -> std::vector<Way> {
+    std::vector<Way> polygons;
+    if(m_relations.empty())
+        return polygons;
+
+    const auto start = Clock::now();
+    PhaseTimer timer(PHASE_GEOMETRY);
+
+    if(!m_ways_sorted)
+        std::sort(m_ways.begin(), m_ways.end());
+
+    Stats stats;
+
+    for(auto& relation : m_relations) {
+        const auto relation_start = Clock::now();
+        Stats relation_stats;
+
+        auto rings = stitch_relation(relation, relation_stats);
+        const uint32_t outer_rings = std::count_if(rings.begin(), rings.end(), [](const Ring& ring) { return !ring.m_inner; });
+
+        if(relation.m_members.size() >= large_relation_members) {
+            size_t vertices = 0;
+            for(auto& ring : rings)
+                vertices += ring.m_coords.size();
+
+            mlog::logln(mlog::INFO, "  relation %lu: %zu members, %u outer / %zu inner rings, %zu open, %zu vertices in %.1fms",
+                relation.m_id, relation.m_members.size(), outer_rings, rings.size() - outer_rings, relation_stats.m_open_rings, vertices,
+                std::chrono::duration<double, std::milli>(Clock::now() - relation_start).count());
+        }
+
+        stats.m_rings += rings.size();
+        stats.m_inner_rings += rings.size() - outer_rings;
+        stats.m_open_rings += relation_stats.m_open_rings;
+        stats.m_missing_members += relation_stats.m_missing_members;
+
+        // holes without anything around them are not an area
+        if(outer_rings == 0)
+            continue;
+
+        Way way(relation.m_id);
+        std::vector<uint32_t> ring_ends;
+        ring_ends.reserve(rings.size());
+
+        for(auto& ring : rings) {
+            for(auto coord : ring.m_coords)
+                way.add_coord(coord);
+            ring_ends.push_back(way.get_coords().size());
+        }
+
+        way.set_rings(std::move(ring_ends), outer_rings);
+        way.set_metadata(relation.m_metadata);
+
+        for(auto& [ key, value ] : relation.m_tags)
+            tags.add(key, value);
+        way.set_tags(tags.build());
+
+        polygons.push_back(std::move(way));
+
+        for(auto& member : relation.m_members)
+            m_consumed_ids.push_back(member.m_way);
+    }
+
+    std::sort(m_consumed_ids.begin(), m_consumed_ids.end());
+    m_consumed_ids.erase(std::unique(m_consumed_ids.begin(), m_consumed_ids.end()), m_consumed_ids.end());
+
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    mlog::logln(mlog::INFO, "multipolygons: %zu of %zu relations assembled in %.2fs, %zu outer / %zu inner rings", polygons.size(), m_relations.size(),
+        elapsed, stats.m_rings - stats.m_inner_rings, stats.m_inner_rings);
+
+    if(stats.m_open_rings || stats.m_missing_members)
+        mlog::logln(mlog::INFO, "  %zu rings left open, %zu members missing from the input", stats.m_open_rings, stats.m_missing_members);
+
+    m_relations = {};
+    m_member_ids = {};
+    m_ways = {};
+    m_coords = {};
+
+    return polygons;
+}
+
+bool MultipolygonAssembler::consumed(Way::Id id) const {
+    return std::binary_search(m_consumed_ids.begin(), m_consumed_ids.end(), id);
+}
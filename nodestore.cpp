@@ -0,0 +1,300 @@
+#include "nodestore.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+void NodeStore::FlatHash::reserve(size_t count) {
+    size_t capacity = 16;
+    unsigned shift = 60;
+    // keep the load factor below 0.7
+    while(capacity * 7 < count * 10) {
+        capacity *= 2;
+        shift--;
+    }
+
+    if(capacity <= m_keys.size())
+        return;
+
+    auto old_keys = std::move(m_keys);
+    auto old_values = std::move(m_values);
+
+    m_keys.assign(capacity, empty_key);
+    m_values.resize(capacity);
+    m_shift = shift;
+    m_size = 0;
+
+    for(size_t i = 0; i < old_keys.size(); i++) {
+        if(old_keys[i] != empty_key)
+            insert(old_keys[i], old_values[i]);
+    }
+}
+
+void NodeStore::FlatHash::insert(Id id, glm::vec2 coord) {
+    assert(id != empty_key);
+
+    if((m_size + 1) * 10 > m_keys.size() * 7)
+        reserve(std::max(m_size * 2, size_t(16)));
+
+    const size_t mask = m_keys.size() - 1;
+    for(size_t i = slot(id);; i = (i + 1) & mask) {
+        if(m_keys[i] == id)
+            return;
+
+        if(m_keys[i] == empty_key) {
+            m_keys[i] = id;
+            m_values[i] = coord;
+            m_size++;
+            return;
+        }
+    }
+}
+
+auto NodeStore::FlatHash::find(Id id) const -> const glm::vec2* {
+    if(m_keys.empty())
+        return nullptr;
+
+    const size_t mask = m_keys.size() - 1;
+    for(size_t i = slot(id);; i = (i + 1) & mask) {
+        if(m_keys[i] == id)
+            return &m_values[i];
+        if(m_keys[i] == empty_key)
+            return nullptr;
+    }
+}
+
+void NodeStore::insert(Id id, glm::vec2 coord) {
+    if(m_frozen) {
+        if(!find_frozen(id)) {
+            m_hash.insert(id, coord);
+            m_size++;
+        }
+        return;
+    }
+
+    m_min_id = std::min(m_min_id, id);
+    m_max_id = std::max(m_max_id, id);
+    m_staging.emplace_back(id, coord);
+    m_size = m_staging.size();
+}
+
+auto NodeStore::choose_mode() const -> Mode {
+    if(m_requested_mode != Mode::AUTO)
+        return m_requested_mode;
+
+    if(m_staging.empty())
+        return Mode::SPARSE;
+
+    // one coordinate plus one presence bit per id in range vs. id and coordinate per node
+    const size_t range = m_max_id - m_min_id + 1;
+    const size_t dense_bytes = range * sizeof(glm::vec2) + range / 8;
+    const size_t sparse_bytes = m_staging.size() * (sizeof(Id) + sizeof(glm::vec2));
+
+    return dense_bytes <= sparse_bytes ? Mode::DENSE : Mode::SPARSE;
+}
+
+void NodeStore::freeze() {
+    if(m_frozen)
+        return;
+
+    m_mode = choose_mode();
+    switch(m_mode) {
+        case Mode::DENSE:
+            build_dense();
+            break;
+        case Mode::SPARSE:
+            build_sparse();
+            break;
+        case Mode::HASH:
+            build_hash();
+            break;
+        default:
+            assert(false);
+    }
+
+    m_staging.clear();
+
+    m_staging.shrink_to_fit();
+    m_frozen = true;
+}
+
+// duplicate ids keep their first occurrence, like `std::unordered_map::insert`
+
+void NodeStore::build_dense() {
+    const size_t range = m_max_id - m_min_id + 1;
+    m_dense_coords.resize(range);
+    m_dense_present.assign((range + 63) / 64, 0);
+
+    size_t unique = 0;
+    for(auto& [ id, coord ] : m_staging) {
+        size_t index = id - m_min_id;
+        uint64_t bit = uint64_t(1) << (index % 64);
+        if(m_dense_present[index / 64] & bit)
+            continue;
+
+        m_dense_present[index / 64] |= bit;
+        m_dense_coords[index] = coord;
+        unique++;
+    }
+
+    m_size = unique;
+}
+
+void NodeStore::build_sparse() {
+    if(!std::is_sorted(m_staging.begin(), m_staging.end(), [](auto& a, auto& b) { return a.first < b.first; }))
+        std::stable_sort(m_staging.begin(), m_staging.end(), [](auto& a, auto& b) { return a.first < b.first; });
+
+    auto last = std::unique(m_staging.begin(), m_staging.end(), [](auto& a, auto& b) { return a.first == b.first; });
+    m_staging.erase(last, m_staging.end());
+
+    m_sparse_ids.reserve(m_staging.size());
+    m_sparse_coords.reserve(m_staging.size());
+    for(auto& [ id, coord ] : m_staging) {
+        m_sparse_ids.push_back(id);
+        m_sparse_coords.push_back(coord);
+    }
+
+    m_size = m_sparse_ids.size();
+}
+
+void NodeStore::build_hash() {
+    m_hash.reserve(m_staging.size());
+    for(auto& [ id, coord ] : m_staging)
+        m_hash.insert(id, coord);
+
+    m_size = m_hash.size();
+}
+
+auto NodeStore::find_frozen(Id id) const -> const glm::vec2* {
+    const glm::vec2* found = nullptr;
+
+    switch(m_mode) {
+        case Mode::DENSE:
+            if(id >= m_min_id && id <= m_max_id) {
+                size_t index = id - m_min_id;
+                if(m_dense_present[index / 64] & (uint64_t(1) << (index % 64)))
+                    found = &m_dense_coords[index];
+            }
+            break;
+        case Mode::SPARSE: {
+            auto it = std::lower_bound(m_sparse_ids.begin(), m_sparse_ids.end(), id);
+            if(it != m_sparse_ids.end() && *it == id)
+                found = &m_sparse_coords[it - m_sparse_ids.begin()];
+        } break;
+        default:
+            break;
+    }
+
+    if(!found && !m_hash.empty())
+        found = m_hash.find(id);
+
+    return found;
+}
+
+auto NodeStore::find(Id id) const -> const glm::vec2* {
+    assert(m_frozen);
+    return find_frozen(id);
+}
+
+// branchless binary search over a group of keys at once: every round issues
+// the next probe of all keys back to back so their memory accesses overlap
+void NodeStore::find_sparse_batch(const Id* ids, size_t count, const glm::vec2** found) const {
+    constexpr size_t group_size = 16;
+
+    const Id* keys = m_sparse_ids.data();
+    const size_t n = m_sparse_ids.size();
+
+    for(size_t group = 0; group < count; group += group_size) {
+        const size_t len = std::min(group_size, count - group);
+        size_t base[group_size] = {};
+
+        size_t remaining = n;
+        while(remaining > 1) {
+            size_t half = remaining / 2;
+            for(size_t k = 0; k < len; k++) {
+                __builtin_prefetch(&keys[base[k] + half / 2]);
+                __builtin_prefetch(&keys[base[k] + half + half / 2]);
+            }
+            for(size_t k = 0; k < len; k++)
+                base[k] = keys[base[k] + half] <= ids[group + k] ? base[k] + half : base[k];
+            remaining -= half;
+        }
+
+        for(size_t k = 0; k < len; k++) {
+            Id id = ids[group + k];
+            found[group + k] = n && keys[base[k]] == id ? &m_sparse_coords[base[k]] : nullptr;
+        }
+    }
+}
+
+bool NodeStore::find_batch(const Id* ids, size_t count, glm::vec2* coords) const {
+    assert(m_frozen);
+
+    if(m_mode != Mode::SPARSE) {
+        if(m_mode == Mode::DENSE) {
+            for(size_t i = 0; i < count; i++) {
+                if(ids[i] >= m_min_id && ids[i] <= m_max_id)
+                    __builtin_prefetch(&m_dense_coords[ids[i] - m_min_id]);
+            }
+        }
+
+        for(size_t i = 0; i < count; i++) {
+            auto found = find_frozen(ids[i]);
+            if(!found)
+                return false;
+            coords[i] = *found;
+        }
+        return true;
+    }
+
+    constexpr size_t block_size = 256;
+    const glm::vec2* found[block_size];
+
+    for(size_t block = 0; block < count; block += block_size) {
+        const size_t len = std::min(block_size, count - block);
+        find_sparse_batch(ids + block, len, found);
+
+        for(size_t i = 0; i < len; i++) {
+            if(!found[i] && !m_hash.empty())
+                found[i] = m_hash.find(ids[block + i]);
+            if(!found[i])
+                return false;
+            coords[block + i] = *found[i];
+        }
+    }
+
+    return true;
+}
+
+auto NodeStore::memory_usage() const -> size_t {
+    return m_staging.capacity() * sizeof(m_staging[0])
+        + m_dense_coords.capacity() * sizeof(glm::vec2)
+        + m_dense_present.capacity() * sizeof(uint64_t)
+        + m_sparse_ids.capacity() * sizeof(Id)
+        + m_sparse_coords.capacity() * sizeof(glm::vec2)
+        + m_hash.memory_usage();
+}
+
+auto NodeStore::mode_name(Mode mode) -> const char* {
+    switch(mode) {
+        case Mode::AUTO:
+            return "auto";
+        case Mode::DENSE:
+            return "dense";
+        case Mode::SPARSE:
+            return "sparse";
+        case Mode::HASH:
+            return "hash";
+    }
+
+    return "?";
+}
+
+auto NodeStore::parse_mode(const char* name) -> std::optional<Mode> {
+    for(auto mode : {Mode::AUTO, Mode::DENSE, Mode::SPARSE, Mode::HASH}) {
+        if(std::strcmp(name, mode_name(mode)) == 0)
+            return mode;
+    }
+
+    return std::nullopt;
+}
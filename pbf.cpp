@@ -0,0 +1,630 @@
+#include "pbf.hpp"
+#include "preprocess.hpp"
+#include "mappedfile.hpp"
+#include "phasetimer.hpp"
+#include "threadpool.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <zlib.h>
+
+using Clock = std::chrono::steady_clock;
+
+bool ProtoReader::next() {
+    if(at_end())
+        return false;
+
+    uint64_t key = varint();
+    if(m_error)
+        return false;
+
+    m_field = key >> 3;
+    m_wire_type = static_cast<WireType>(key & 7);
+    return true;
+}
+
+auto ProtoReader::varint() -> uint64_t {
+    uint64_t value = 0;
+    for(unsigned shift = 0; shift < 64 && m_pos < m_end; shift += 7) {
+        uint8_t byte = *m_pos++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+            return value;
+    }
+
+    m_error = true;
+    return 0;
+}
+
+auto ProtoReader::bytes() -> std::string_view {
+    uint64_t length = varint();
+    if(m_error || length > uint64_t(m_end - m_pos)) {
+        m_error = true;
+        return {};
+    }
+
+    auto data = std::string_view(reinterpret_cast<const char*>(m_pos), length);
+    m_pos += length;
+    return data;
+}
+
+void ProtoReader::skip() {
+    size_t length = 0;
+
+    switch(m_wire_type) {
+        case VARINT:
+            varint();
+            return;
+        case LENGTH_DELIMITED:
+            bytes();
+            return;
+        case FIXED64:
+            length = 8;
+            break;
+        case FIXED32:
+            length = 4;
+            break;
+        default:
+            m_error = true;
+            return;
+    }
+
+    if(length > size_t(m_end - m_pos))
+        m_error = true;
+    else
+        m_pos += length;
+}
+
+// file structure: repeated (big-endian uint32 length, BlobHeader, Blob)
+
+struct BlobRef {
+    std::string_view m_type;
+    std::string_view m_blob;
+};
+
+static auto split_blobs(std::string_view file, std::vector<BlobRef>& blobs) -> bool {
+    constexpr size_t max_header_size = 64 * 1024;
+
+    size_t offset = 0;
+    while(offset < file.size()) {
+        if(file.size() - offset < 4)
+            return false;
+
+        auto size_bytes = reinterpret_cast<const uint8_t*>(file.data() + offset);
+        size_t header_size = uint32_t(size_bytes[0]) << 24 | uint32_t(size_bytes[1]) << 16 | uint32_t(size_bytes[2]) << 8 | size_bytes[3];
+        offset += 4;
+
+        if(header_size > max_header_size || header_size > file.size() - offset)
+            return false;
+
+        BlobRef blob;
+        uint64_t data_size = 0;
+
+        ProtoReader header(file.substr(offset, header_size));
+        while(header.next()) {
+            switch(header.field()) {
+                case 1:
+                    blob.m_type = header.bytes();
+                    break;
+                case 3:
+                    data_size = header.varint();
+                    break;
+                default:
+                    header.skip();
+            }
+        }
+
+        offset += header_size;
+        if(header.has_error() || data_size > file.size() - offset)
+            return false;
+
+        blob.m_blob = file.substr(offset, data_size);
+        blobs.push_back(blob);
+        offset += data_size;
+    }
+
+    return true;
+}
+
+// the format's limit for the uncompressed data of a blob
+constexpr uint64_t max_blob_size = 32 * 1024 * 1024;
+
+// returns the uncompressed blob contents, which may live in `buffer`
+
+static auto inflate_blob(std::string_view blob, std::string& buffer) -> std::optional<std::string_view> {
+    std::string_view raw, zlib_data;
+    uint64_t raw_size = 0;
+    bool has_raw = false;
+
+    ProtoReader reader(blob);
+    while(reader.next()) {
+        switch(reader.field()) {
+            case 1:
+                raw = reader.bytes();
+                has_raw = true;
+                break;
+            case 2:
+                raw_size = reader.varint();
+                break;
+            case 3:
+                zlib_data = reader.bytes();
+                break;
+            case 4:
+            case 5:
+            case 6:
+            case 7:
+                mlog::logln(mlog::ERROR, "Unsupported PBF blob compression (field %u), only zlib is supported", reader.field());
+                return std::nullopt;
+            default:
+                reader.skip();
+        }
+    }
+
+    if(reader.has_error())
+        return std::nullopt;
+
+    if(has_raw)
+        return raw;
+
+    // the size comes from the file, it is checked before anything is allocated for it
+    if(raw_size > max_blob_size) {
+        mlog::logln(mlog::ERROR, "PBF blob inflates to %llu bytes, more than the 32 MiB the format allows", (unsigned long long)raw_size);
+        return std::nullopt;
+    }
+
+    buffer.resize(raw_size);
+    uLongf length = raw_size;
+    if(uncompress(reinterpret_cast<Bytef*>(buffer.data()), &length, reinterpret_cast<const Bytef*>(zlib_data.data()), zlib_data.size()) != Z_OK
+            || length != raw_size)
+        return std::nullopt;
+
+    return std::string_view(buffer);
+}
+
+static auto decode_header(std::string_view data, std::optional<std::pair<glm::vec2, glm::vec2>>& bounds) -> bool {
+    static const std::string_view supported_features[] = {"OsmSchema-V0.6", "DenseNodes"};
+
+    ProtoReader reader(data);
+    while(reader.next()) {
+        switch(reader.field()) {
+            case 1: {
+                // HeaderBBox, in nanodegrees
+                int64_t left = 0, right = 0, top = 0, bottom = 0;
+                ProtoReader bbox(reader.bytes());
+                while(bbox.next()) {
+                    switch(bbox.field()) {
+                        case 1: left = bbox.svarint(); break;
+                        case 2: right = bbox.svarint(); break;
+                        case 3: top = bbox.svarint(); break;
+                        case 4: bottom = bbox.svarint(); break;
+                        default: bbox.skip();
+                    }
+                }
+
+                if(bbox.has_error())
+                    return false;
+
+                bounds = project_bounds(glm::dvec2(left * 1e-9, bottom * 1e-9), glm::dvec2(right * 1e-9, top * 1e-9));
+            } break;
+            case 4: {
+                auto feature = reader.bytes();
+                if(std::find(std::begin(supported_features), std::end(supported_features), feature) == std::end(supported_features)) {
+                    mlog::logln(mlog::ERROR, "Unsupported PBF feature `%.*s`", int(feature.size()), feature.data());
+                    return false;
+                }
+            } break;
+            default:
+                reader.skip();
+        }
+    }
+
+    return !reader.has_error();
+}
+
+struct BlockContext {
+    std::vector<std::string_view> m_strings;
+    const FilterProfile* m_filter = nullptr;
+
+    int64_t m_granularity = 100;
+    int64_t m_lat_offset = 0, m_lon_offset = 0;
+
+    // nanodegrees to the 1e-7 degree fixed point of the XML parser, rounded
+    static inline auto to_fixed(int64_t nano) -> int32_t {
+        return int32_t((nano + (nano < 0 ? -50 : 50)) / 100);
+    }
+
+    inline void add_node(IngestChunk& chunk, int64_t id, int64_t lon, int64_t lat) const {
+        chunk.add_node(id, to_fixed(m_lon_offset + m_granularity * lon), to_fixed(m_lat_offset + m_granularity * lat));
+    }
+};
+
+static auto decode_node(std::string_view data, const BlockContext& context, IngestChunk& chunk) -> bool {
+    int64_t id = 0, lat = 0, lon = 0;
+
+    ProtoReader reader(data);
+    while(reader.next()) {
+        switch(reader.field()) {
+            case 1: id = reader.svarint(); break;
+            case 8: lat = reader.svarint(); break;
+            case 9: lon = reader.svarint(); break;
+            default: reader.skip();
+        }
+    }
+
+    context.add_node(chunk, id, lon, lat);
+    return !reader.has_error();
+}
+
+static auto decode_dense_nodes(std::string_view data, const BlockContext& context, IngestChunk& chunk) -> bool {
+    std::string_view ids, lats, lons;
+
+    ProtoReader reader(data);
+    while(reader.next()) {
+        switch(reader.field()) {
+            case 1: ids = reader.bytes(); break;
+            case 8: lats = reader.bytes(); break;
+            case 9: lons = reader.bytes(); break;
+            default: reader.skip();
+        }
+    }
+
+    if(reader.has_error())
+        return false;
+
+    // all three columns are delta coded
+    ProtoReader id_reader(ids), lat_reader(lats), lon_reader(lons);
+    int64_t id = 0, lat = 0, lon = 0;
+
+    while(!id_reader.at_end()) {
+        id += id_reader.svarint();
+        lat += lat_reader.svarint();
+        lon += lon_reader.svarint();
+
+        if(id_reader.has_error() || lat_reader.has_error() || lon_reader.has_error())
+            return false;
+
+        context.add_node(chunk, id, lon, lat);
+    }
+
+    return !id_reader.has_error();
+}
+
+static auto decode_way(std::string_view data, const BlockContext& context, IngestChunk& chunk) -> bool {
+    std::string_view keys, values, refs;
+    uint64_t id = 0;
+
+    ProtoReader reader(data);
+    while(reader.next()) {
+        switch(reader.field()) {
+            case 1: id = reader.varint(); break;
+            case 2: keys = reader.bytes(); break;
+            case 3: values = reader.bytes(); break;
+            case 8: refs = reader.bytes(); break;
+            default: reader.skip();
+        }
+    }
+
+    if(reader.has_error())
+        return false;
+
+    auto& way = chunk.m_ways.emplace_back(id);
+
+    // tags first, so that the references of a dropped way are never decoded
+    ProtoReader key_reader(keys), value_reader(values);
+    while(!key_reader.at_end()) {
+        uint64_t key = key_reader.varint(), value = value_reader.varint();
+        if(key_reader.has_error() || value_reader.has_error() || key >= context.m_strings.size() || value >= context.m_strings.size())
+            return false;
+
+        way.m_tags.add(context.m_strings[key], context.m_strings[value]);
+    }
+
+    // every packed varint ends in a byte without the continuation bit
+    const size_t ref_count = std::count_if(refs.begin(), refs.end(), [](char byte) { return (uint8_t(byte) & 0x80) == 0; });
+    if(!admit_way(way, ref_count, context.m_filter, chunk.m_filter_stats)) {
+        chunk.m_ways.pop_back();
+        return true;
+    }
+
+    way.m_refs.reserve(ref_count);
+
+    int64_t ref = 0;
+    return ProtoReader::for_each_packed(refs, [&](uint64_t delta) {
+        ref += ProtoReader::zigzag(delta);
+        way.m_refs.push_back(ref);
+    });
+}
+
+static auto decode_relation(std::string_view data, const BlockContext& context, IngestChunk& chunk) -> bool {
+    std::string_view keys, values, roles, member_ids, types;
+    uint64_t id = 0;
+
+    ProtoReader reader(data);
+    while(reader.next()) {
+        switch(reader.field()) {
+            case 1: id = reader.varint(); break;
+            case 2: keys = reader.bytes(); break;
+            case 3: values = reader.bytes(); break;
+            case 8: roles = reader.bytes(); break;
+            case 9: member_ids = reader.bytes(); break;
+            case 10: types = reader.bytes(); break;
+            default: reader.skip();
+        }
+    }
+
+    if(reader.has_error())
+        return false;
+
+    auto& relation = chunk.m_relations.emplace_back(id);
+
+    ProtoReader key_reader(keys), value_reader(values);
+    while(!key_reader.at_end()) {
+        uint64_t key = key_reader.varint(), value = value_reader.varint();
+        if(key_reader.has_error() || value_reader.has_error() || key >= context.m_strings.size() || value >= context.m_strings.size())
+            return false;
+
+        relation.m_tags.add(context.m_strings[key], context.m_strings[value]);
+    }
+
+    if(!admit_relation(relation, context.m_filter, chunk.m_filter_stats)) {
+        chunk.m_relations.pop_back();
+        return true;
+    }
+
+    // three parallel columns, the member ids delta coded
+    ProtoReader role_reader(roles), id_reader(member_ids), type_reader(types);
+    int64_t member = 0;
+
+    while(!id_reader.at_end()) {
+        uint64_t role = role_reader.varint();
+        member += id_reader.svarint();
+        uint64_t type = type_reader.varint();
+
+        if(role_reader.has_error() || id_reader.has_error() || type_reader.has_error() || role >= context.m_strings.size())
+            return false;
+
+        // 1 is MemberType.WAY
+        if(type == 1)
+            relation.m_members.push_back({uint64_t(member), context.m_strings[role] == "inner"});
+    }
+
+    return true;
+}
+
+static auto decode_group(std::string_view data, const BlockContext& context, IngestChunk& chunk) -> bool {
+    bool ok = true;
+
+    ProtoReader reader(data);
+    while(ok && reader.next()) {
+        switch(reader.field()) {
+            case 1: ok = decode_node(reader.bytes(), context, chunk); break;
+            case 2: ok = decode_dense_nodes(reader.bytes(), context, chunk); break;
+            case 3: ok = decode_way(reader.bytes(), context, chunk); break;
+            case 4: ok = decode_relation(reader.bytes(), context, chunk); break;
+            default: reader.skip();
+        }
+    }
+
+    return ok && !reader.has_error();
+}
+
+static auto decode_primitive_block(std::string_view data, const FilterProfile* filter, IngestChunk& chunk) -> bool {
+    BlockContext context;
+    context.m_filter = filter;
+    std::vector<std::string_view> groups;
+
+    // the string table and coordinate parameters may follow the groups
+    ProtoReader reader(data);
+    while(reader.next()) {
+        switch(reader.field()) {
+            case 1: {
+                ProtoReader table(reader.bytes());
+                while(table.next()) {
+                    if(table.field() == 1)
+                        context.m_strings.push_back(table.bytes());
+                    else
+                        table.skip();
+                }
+
+                if(table.has_error())
+                    return false;
+            } break;
+            case 2:
+                groups.push_back(reader.bytes());
+                break;
+            case 17:
+                context.m_granularity = reader.varint();
+                break;
+            case 19:
+                context.m_lat_offset = reader.varint();
+                break;
+            case 20:
+                context.m_lon_offset = reader.varint();
+                break;
+            default:
+                reader.skip();
+        }
+    }
+
+    if(reader.has_error())
+        return false;
+
+    for(auto group : groups) {
+        if(!decode_group(group, context, chunk))
+            return false;
+    }
+
+    chunk.flush_nodes();
+    return true;
+}
+
+bool is_pbf_file(const char* path) {
+    // BlobHeader.type (field 1, length 9) comes right after the header length
+    static const char magic[] = "\x0a\x09OSMHeader";
+    constexpr size_t magic_size = sizeof(magic) - 1;
+
+    // peeking would consume data from pipes
+    struct stat st;
+    if(stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+        return false;
+
+    char header[4 + magic_size];
+    auto input = std::ifstream(path, std::ios::binary);
+    if(!input.read(header, sizeof(header)))
+        return false;
+
+    return header[0] == 0 && header[1] == 0 && std::memcmp(header + 4, magic, magic_size) == 0;
+}
+
+// maps the file, checks its header block and collects the data blobs
+static auto open_pbf(const char* pbf_path, std::unique_ptr<MappedFile>& mapped, std::vector<std::string_view>& data_blobs,
+    std::optional<std::pair<glm::vec2, glm::vec2>>& bounds) -> bool
+{
+    mapped = MappedFile::open(pbf_path);
+    if(!mapped) {
+        mlog::logln(mlog::ERROR, "Could not map `%s`; PBF input has to be a regular file", pbf_path);
+        return false;
+    }
+
+    mapped->advise_sequential();
+
+    std::vector<BlobRef> blobs;
+    if(!split_blobs(mapped->view(), blobs) || blobs.empty() || blobs[0].m_type != "OSMHeader") {
+        mlog::logln(mlog::ERROR, "`%s` is not a valid PBF file", pbf_path);
+        return false;
+    }
+
+    {
+        std::string buffer;
+        auto header = inflate_blob(blobs[0].m_blob, buffer);
+        if(!header || !decode_header(*header, bounds)) {
+            mlog::logln(mlog::ERROR, "Could not decode the PBF header block");
+            return false;
+        }
+    }
+
+    for(auto& blob : blobs) {
+        if(blob.m_type == "OSMData")
+            data_blobs.push_back(blob.m_blob);
+    }
+
+    return true;
+}
+
+auto preprocess_pbf(const char* pbf_path, WaySink& sink, const IngestOptions& options) -> int {
+    const auto start = Clock::now();
+
+    std::unique_ptr<MappedFile> mapped;
+    std::vector<std::string_view> data_blobs;
+    std::optional<std::pair<glm::vec2, glm::vec2>> bounds;
+    if(!open_pbf(pbf_path, mapped, data_blobs, bounds))
+        return 1;
+
+    ThreadPool pool(options.jobs);
+    std::vector<IngestChunk> chunks(data_blobs.size());
+
+    mlog::logln(mlog::INFO, "Decoding %zu MiB in %zu blocks on %u threads...", mapped->size() / 1024 / 1024, data_blobs.size(), pool.size());
+
+    std::atomic<bool> failed(false);
+
+    auto decode_start = Clock::now();
+    double decode_busy = pool.timed_parallel_for(data_blobs.size(), [&](size_t i) {
+        thread_local std::string buffer;
+        PhaseTimer timer(PHASE_PARSE);
+
+        if(stop_requested(options)) {
+            failed = true;
+            return;
+        }
+
+        auto block = inflate_blob(data_blobs[i], buffer);
+        if(!block || !decode_primitive_block(*block, options.filter.get(), chunks[i])) {
+            mlog::logln(mlog::ERROR, "Could not decode PBF block %zu", i);
+            failed = true;
+        }
+    });
+    double decode_wall = std::chrono::duration<double>(Clock::now() - decode_start).count();
+
+    if(failed)
+        return 1;
+
+    ParallelTimes times;
+    log_parallel_stage("decode:", decode_wall, decode_busy, pool.size(), times);
+
+    const size_t input_size = mapped->size();
+    mapped = nullptr;
+
+    if(!chunks.empty())
+        chunks.front().m_bounds = bounds;
+
+    if(!ingest_chunks(chunks, sink, pool, options, times))
+        return 1;
+
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    double serial = times.serial_estimate(elapsed);
+    mlog::logln(mlog::INFO, "done in %.2fs (%.1f MiB/s, %u threads), an estimated %.2fs on one thread (%.1fx).",
+        elapsed, input_size / 1024.0 / 1024.0 / elapsed, pool.size(), serial, serial / elapsed);
+
+    return 0;
+}
+
+auto scan_pbf(const char* pbf_path, const IngestOptions& options, const std::function<void(IngestChunk&)>& consume) -> bool {
+    std::unique_ptr<MappedFile> mapped;
+    std::vector<std::string_view> data_blobs;
+    std::optional<std::pair<glm::vec2, glm::vec2>> bounds;
+    if(!open_pbf(pbf_path, mapped, data_blobs, bounds))
+        return false;
+
+    ThreadPool pool(options.jobs);
+
+    // a few blocks per thread at a time keep the decoded entities small
+    const size_t batch_size = pool.size() * 2;
+    std::vector<IngestChunk> chunks(batch_size);
+
+    if(bounds) {
+        IngestChunk header;
+        header.m_bounds = bounds;
+        consume(header);
+    }
+
+    size_t released = 0;
+    for(size_t batch = 0; batch < data_blobs.size(); batch += batch_size) {
+        const size_t count = std::min(batch_size, data_blobs.size() - batch);
+        std::atomic<bool> failed(false);
+
+        pool.parallel_for(count, [&](size_t i) {
+            thread_local std::string buffer;
+            PhaseTimer timer(PHASE_PARSE);
+
+            auto block = inflate_blob(data_blobs[batch + i], buffer);
+            if(!block || !decode_primitive_block(*block, options.filter.get(), chunks[i])) {
+                mlog::logln(mlog::ERROR, "Could not decode PBF block %zu", batch + i);
+                failed = true;
+            }
+        });
+
+        if(failed)
+            return false;
+
+        for(size_t i = 0; i < count; i++)
+            consume(chunks[i]);
+
+        auto& last = data_blobs[batch + count - 1];
+        const size_t consumed = last.data() + last.size() - mapped->data();
+        mapped->release(released, consumed);
+        released = consumed;
+    }
+
+    log_projection(chunks);
+
+    return true;
+}
@@ -0,0 +1,110 @@
+#include "phasetimer.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<bool> timing_enabled(false);
+static std::atomic<int64_t> phase_nanos[__PHASE_LAST];
+static std::atomic<uint64_t> node_count(0);
+static std::atomic<int64_t> max_thread_nanos(0);
+
+static std::mutex triangulation_mutex;
+static TriangulationStats triangulation;
+
+// the innermost running phase of this thread, `__PHASE_LAST` for none
+static thread_local IngestPhase current_phase = __PHASE_LAST;
+static thread_local Clock::time_point phase_start;
+// everything this thread was charged
+static thread_local int64_t thread_nanos = 0;
+
+static const char* phase_names[__PHASE_LAST] = {
+    "parse",
+    "lookup",
+    "classify",
+    "geometry",
+    "triangulate",
+    "index"
+};
+
+void enable_phase_timing() {
+    timing_enabled = true;
+}
+
+void disable_phase_timing() {
+    timing_enabled = false;
+}
+
+bool phase_timing_enabled() {
+    return timing_enabled.load(std::memory_order_relaxed);
+}
+
+auto phase_name(IngestPhase phase) -> const char* {
+    return phase_names[phase];
+}
+
+auto phase_seconds(IngestPhase phase) -> double {
+    return phase_nanos[phase] / 1e9;
+}
+
+auto max_thread_phase_seconds() -> double {
+    return max_thread_nanos / 1e9;
+}
+
+void count_parsed_nodes(uint64_t count) {
+    if(timing_enabled.load(std::memory_order_relaxed))
+        node_count.fetch_add(count, std::memory_order_relaxed);
+}
+
+auto parsed_node_count() -> uint64_t {
+    return node_count;
+}
+
+void count_triangulated(uint64_t vertices, uint64_t triangles, std::chrono::steady_clock::duration time) {
+    const double seconds = std::chrono::duration<double>(time).count();
+
+    std::lock_guard<std::mutex> lock(triangulation_mutex);
+    triangulation.m_polygons++;
+    triangulation.m_vertices += vertices;
+    triangulation.m_triangles += triangles;
+
+    if(seconds > triangulation.m_worst_seconds) {
+        triangulation.m_worst_seconds = seconds;
+        triangulation.m_worst_vertices = vertices;
+    }
+}
+
+auto triangulation_stats() -> TriangulationStats {
+    std::lock_guard<std::mutex> lock(triangulation_mutex);
+    return triangulation;
+}
+
+// charges the time since the last switch to the current phase
+static void switch_phase(IngestPhase next) {
+    auto now = Clock::now();
+    if(current_phase != __PHASE_LAST) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - phase_start).count();
+        phase_nanos[current_phase].fetch_add(elapsed, std::memory_order_relaxed);
+
+        thread_nanos += elapsed;
+        int64_t max = max_thread_nanos.load(std::memory_order_relaxed);
+        while(thread_nanos > max && !max_thread_nanos.compare_exchange_weak(max, thread_nanos, std::memory_order_relaxed)) {}
+    }
+
+    current_phase = next;
+    phase_start = now;
+}
+
+PhaseTimer::PhaseTimer(IngestPhase phase)
+    : m_active(timing_enabled.load(std::memory_order_relaxed)), m_outer(current_phase)
+{
+    if(m_active)
+        switch_phase(phase);
+}
+
+PhaseTimer::~PhaseTimer() {
+    if(m_active)
+        switch_phase(m_outer);
+}
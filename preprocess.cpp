@@ -1,113 +1,530 @@
 #include "preprocess.hpp"
-#include "renderutil.hpp"
+#include "cache.hpp"
+#include "decompress.hpp"
+#include "external.hpp"
+#include "threadpool.hpp"
 #include "way.hpp"
 #include "log.hpp"
+#include "mappedfile.hpp"
+#include "numparse.hpp"
+#include "pbf.hpp"
+#include "phasetimer.hpp"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cctype>
+#include <chrono>
 #include <cmath>
-#include <fstream>
+#include <functional>
+#include <cstdlib>
 #include <cstring>
 
 #include <expat.h>
 #include <memory>
 #include <string>
+#include <string_view>
+
+#include <unistd.h>
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t bvh_max_depth = 16;
+
+static inline double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+struct ParsedNode {
+    Node::Id m_id;
+    int32_t m_lon, m_lat;
+};
+
+static auto parse_node(const XML_Char** atts) -> std::optional<ParsedNode> {
+    const XML_Char* id = nullptr, *lat = nullptr, *lon = nullptr;
+    for(int i = 0; atts[i]; i += 2) {
+        if(std::memcmp(atts[i], "id", 2) == 0)
+            id = atts[i + 1];
+        else if(std::memcmp(atts[i], "lat", 3) == 0)
+            lat = atts[i + 1];
+        else if(std::memcmp(atts[i], "lon", 3) == 0)
+            lon = atts[i + 1];
+    }
+    
+    assert(id && lat && lon);
+    auto parsed_id = parse_id(id);
+    auto parsed_lon = parse_fixed7(lon), parsed_lat = parse_fixed7(lat);
+    if(!parsed_id || !parsed_lon || !parsed_lat)
+        return std::nullopt;
+
+    return ParsedNode{*parsed_id, *parsed_lon, *parsed_lat};
+}
+
+static auto parse_element_id(const XML_Char** atts) -> std::optional<uint64_t> {
+    const XML_Char* id = nullptr;
+    for(int i = 0; atts[i]; i += 2) {
+        if(std::memcmp(atts[i], "id", 2) == 0)
+            id = atts[i + 1];
+    }
+
+    assert(id);
+    return parse_id(id);
+}
+
+// skips members other than ways; returns false on a malformed reference
+static auto parse_member(const XML_Char** atts, std::vector<PendingRelation::Member>& members) -> bool {
+    const XML_Char *type = nullptr, *ref = nullptr, *role = nullptr;
+    for(int i = 0; atts[i]; i += 2) {
+        if(std::memcmp(atts[i], "type", 4) == 0)
+            type = atts[i + 1];
+        else if(std::memcmp(atts[i], "ref", 3) == 0)
+            ref = atts[i + 1];
+        else if(std::memcmp(atts[i], "role", 4) == 0)
+            role = atts[i + 1];
+    }
+
+    assert(type && ref);
+    if(std::strcmp(type, "way") != 0)
+        return true;
+
+    auto way = parse_id(ref);
+    if(!way)
+        return false;
+
+    members.push_back({*way, role && std::strcmp(role, "inner") == 0});
+    return true;
+}
+
+auto project_bounds(glm::dvec2 min_lonlat, glm::dvec2 max_lonlat) -> std::pair<glm::vec2, glm::vec2> {
+    // the projection keeps longitudes and is monotonic in the latitude
+    return std::make_pair(project_degrees(min_lonlat.x, min_lonlat.y), project_degrees(max_lonlat.x, max_lonlat.y));
+}
+
+static auto parse_bounds(const XML_Char** atts) -> std::optional<std::pair<glm::vec2, glm::vec2>> {
+    const XML_Char *min_lon = nullptr, *max_lon = nullptr, *min_lat = nullptr, *max_lat = nullptr;
+    for(int i = 0; atts[i]; i += 2) {
+        if(std::memcmp(atts[i], "minlon", 6) == 0)
+            min_lon = atts[i + 1];
+        else if(std::memcmp(atts[i], "maxlon", 6) == 0)
+            max_lon = atts[i + 1];
+        else if(std::memcmp(atts[i], "minlat", 6) == 0)
+            min_lat = atts[i + 1];
+        else if(std::memcmp(atts[i], "maxlat", 6) == 0)
+            max_lat = atts[i + 1];
+    }
+
+    assert(min_lon && max_lon && min_lat && max_lat);
+    auto west = parse_fixed7(min_lon), south = parse_fixed7(min_lat), east = parse_fixed7(max_lon), north = parse_fixed7(max_lat);
+    if(!west || !south || !east || !north)
+        return std::nullopt;
+
+    return project_bounds(glm::dvec2(*west * fixed_point_scale, *south * fixed_point_scale),
+        glm::dvec2(*east * fixed_point_scale, *north * fixed_point_scale));
+}
+
+// logs the first malformed value of a parse, which then skips all further elements
+static void report_malformed(bool& malformed, const XML_Char* element) {
+    if(!malformed)
+        mlog::logln(mlog::ERROR, "malformed id or coordinate in <%s>", element);
+    malformed = true;
+}
+
+static void resolve_way(Way& way, const std::vector<Node::Id>& refs, const NodeCache& node_cache, std::vector<glm::vec2>& buffer) {
+    {
+        PhaseTimer timer(PHASE_LOOKUP);
+        node_cache.lookup_batch(refs, buffer);
+    }
+
+    way.get_coords().reserve(buffer.size());
+    for(auto coord : buffer)
+        way.add_coord(coord);
+}
+
+// turns an admitted way into a `Way` with resolved nodes and interned tags
+static auto build_way(const PendingWay& pending, const NodeCache& node_cache, std::vector<glm::vec2>& buffer, TagBuilder& tags) -> Way {
+    PhaseTimer timer(PHASE_GEOMETRY);
+    Way way(pending.m_id);
+
+    resolve_way(way, pending.m_refs, node_cache, buffer);
+
+    for(auto& [ key, value ] : pending.m_tags)
+        tags.add(key, value);
+    way.set_tags(tags.build());
+
+    way.set_metadata(pending.m_metadata);
+
+    return way;
+}
+
+auto admit_way(PendingWay& way, size_t ref_count, const FilterProfile* filter, FilterStats& stats) -> bool {
+    PhaseTimer timer(PHASE_CLASSIFY);
+    way.m_metadata = Metadata(way.m_tags);
+    if(!filter || way.m_tags.empty())
+        return true;
+
+    if(filter->keep(way.m_tags, way.m_metadata)) {
+        stats.m_ways_kept++;
+        return true;
+    }
+
+    stats.m_ways_dropped++;
+    stats.m_refs_dropped += ref_count;
+    return false;
+}
+
+auto admit_untagged_way(size_t ref_count, const FilterProfile* filter, FilterStats& stats) -> bool {
+    static const RawTags no_tags;
+    PhaseTimer timer(PHASE_CLASSIFY);
+    if(!filter)
+        return true;
+
+    if(filter->keep(no_tags, Metadata())) {
+        stats.m_ways_kept++;
+        return true;
+    }
+
+    stats.m_ways_dropped++;
+    stats.m_refs_dropped += ref_count;
+    return false;
+}
+
+auto admit_relation(PendingRelation& relation, const FilterProfile* filter, FilterStats& stats) -> bool {
+    PhaseTimer timer(PHASE_CLASSIFY);
+    auto type = relation.m_tags.find("type");
+    if(!type || (*type != "multipolygon" && *type != "boundary"))
+        return false;
+
+    relation.m_metadata = Metadata(relation.m_tags);
+    if(!filter)
+        return true;
+
+    if(filter->keep(relation.m_tags, relation.m_metadata)) {
+        stats.m_relations_kept++;
+        return true;
+    }
+
+    stats.m_relations_dropped++;
+    return false;
+}
+
+static void log_node_store(const NodeCache& node_cache) {
+    auto& store = node_cache.get_store();
+    mlog::logln(mlog::INFO, "node store: %zu nodes, %s layout, %.1f bytes/node", store.size(),
+        NodeStore::mode_name(store.mode()), store.size() ? double(store.memory_usage()) / store.size() : 0.0);
+}
+
+// files without a <bounds> element get the extent of their nodes
+static void ensure_bvh(WaySink& sink, NodeCache& node_cache) {
+    if(!sink.has_bvh())
+        sink.init_bvh(node_cache.get_minmax_coord(), bvh_max_depth);
+}
+
+// compressed files and stdin go through an `InputPipeline` instead
+static bool is_mappable(const char* path, const IngestOptions& options) {
+    return options.use_mmap && std::strcmp(path, "-") != 0 && InputPipeline::sniff(path) == InputPipeline::NONE;
+}
+
+static void flush_nodes(PreData& data) {
+    data.m_node_batch.flush([&](Node::Id id, glm::vec2 coord) {
+        data.m_node_cache->add_node(id, Node(coord));
+    });
+}
+
+// flushes the last node batch once the first way or the end of the input is reached
+static void finish_nodes(PreData& data) {
+    if(data.m_nodes_done)
+        return;
+
+    flush_nodes(data);
+    data.m_node_seconds = seconds_since(data.m_start);
+    data.m_nodes_done = true;
+}
 
 static void XMLCALL enter_element(void* user_data, const XML_Char* name, const XML_Char** atts) {
     auto data = static_cast<PreData*>(user_data);
+    if(data->m_malformed)
+        return;
 
     if(std::memcmp(name, "node", 4) == 0) {
-        const XML_Char* id = nullptr, *lat = nullptr, *lon = nullptr;
-        for(int i = 0; atts[i]; i += 2) {
-            if(std::memcmp(atts[i], "id", 2) == 0)
-                id = atts[i + 1];
-            else if(std::memcmp(atts[i], "lat", 3) == 0)
-                lat = atts[i + 1];
-            else if(std::memcmp(atts[i], "lon", 3) == 0)
-                lon = atts[i + 1];
-        }
-        
-        assert(id && lat && lon);
-        data->m_node_cache->add_node(std::stoull(id), Node(map_project(glm::vec2(std::stof(lon), std::stof(lat)))));
+        auto node = parse_node(atts);
+        if(!node)
+            return report_malformed(data->m_malformed, name);
+
+        data->m_node_count++;
+        if(data->m_node_batch.add(node->m_id, node->m_lon, node->m_lat))
+            flush_nodes(*data);
     }
     else if(std::memcmp(name, "way", 3) == 0) {
-        const XML_Char* id = nullptr;
-        for(int i = 0; atts[i]; i += 2) {
-            if(std::memcmp(atts[i], "id", 2) == 0)
-                id = atts[i + 1];
-        }
+        assert(!data->m_in_way);
+
+        // nodes precede ways, so the node store layout can be fixed now
+        finish_nodes(*data);
+        data->m_node_cache->freeze();
 
-        assert(id);
-        assert(data->m_current_way == nullptr);
+        auto id = parse_element_id(atts);
+        if(!id)
+            return report_malformed(data->m_malformed, name);
 
-        data->m_current_way = std::make_shared<Way>(std::stoull(id));
+        auto& way = data->m_current_way;
+        way.m_id = *id;
+        way.m_refs.clear();
+        way.m_tags.clear();
+        data->m_in_way = true;
     }
     else if(std::memcmp(name, "nd", 2) == 0) {
         assert(atts[2] == nullptr);
+        auto ref = parse_id(atts[1]);
+        if(!ref)
+            return report_malformed(data->m_malformed, name);
 
-        Node::Id node_ref = std::stoull(atts[1]);
-        auto& node = data->m_node_cache->lookup(node_ref);
+        data->m_current_way.m_refs.push_back(*ref);
+    }
+    else if(std::memcmp(name, "relation", 8) == 0) {
+        auto id = parse_element_id(atts);
+        if(!id)
+            return report_malformed(data->m_malformed, name);
 
-        data->m_current_way->add_node(node);
+        auto& relation = data->m_current_relation;
+        relation.m_id = *id;
+        relation.m_members.clear();
+        relation.m_tags.clear();
+        data->m_in_relation = true;
     }
-    else if(data->m_current_way != nullptr && std::memcmp(name, "tag", 3) == 0) {
+    else if(data->m_in_relation && std::memcmp(name, "member", 6) == 0) {
+        if(!parse_member(atts, data->m_current_relation.m_members))
+            return report_malformed(data->m_malformed, name);
+    }
+    else if((data->m_in_way || data->m_in_relation) && std::memcmp(name, "tag", 3) == 0) {
         assert(atts[4] == nullptr && atts[0][0] == 'k' && atts[2][0] == 'v');
-        data->m_current_way->add_tag(atts[1], atts[3]);
+        auto& tags = data->m_in_way ? data->m_current_way.m_tags : data->m_current_relation.m_tags;
+        tags.add(atts[1], atts[3]);
     }
     else if(std::memcmp(name, "bounds", 5) == 0) {
-        const XML_Char *min_lon = nullptr, *max_lon = nullptr, *min_lat = nullptr, *max_lat = nullptr;
-        for(int i = 0; atts[i]; i += 2) {
-            if(std::memcmp(atts[i], "minlon", 6) == 0)
-                min_lon = atts[i + 1];
-            else if(std::memcmp(atts[i], "maxlon", 6) == 0)
-                max_lon = atts[i + 1];
-            else if(std::memcmp(atts[i], "minlat", 6) == 0)
-                min_lat = atts[i + 1];
-            else if(std::memcmp(atts[i], "maxlat", 6) == 0)
-                max_lat = atts[i + 1];
-        }
-
-        assert(min_lon && max_lon && min_lat && max_lat);
-        auto min_a = map_project(glm::vec2(std::stof(min_lon), std::stof(min_lat)));
-        auto min_b = map_project(glm::vec2(std::stof(min_lon), std::stof(max_lat)));
-        glm::vec2 min(std::min(min_a.x, min_b.x), min_a.y);
+        auto bounds = parse_bounds(atts);
+        if(!bounds)
+            return report_malformed(data->m_malformed, name);
 
-        auto max_a = map_project(glm::vec2(std::stof(max_lon), std::stof(max_lat)));
-        auto max_b = map_project(glm::vec2(std::stof(max_lon), std::stof(min_lat)));
-        glm::vec2 max(std::max(max_a.x, max_b.x), max_a.y);
-
-        data->m_map->init_bvh(std::make_pair(min, max), 16);
+        data->m_sink.init_bvh(*bounds, bvh_max_depth);
     }
 }
 
 static void XMLCALL leave_element(void* user_data, const XML_Char* name) {
     auto data = static_cast<PreData*>(user_data);
+    if(data->m_malformed)
+        return;
 
     if(std::memcmp(name, "way", 3) == 0) {
-        assert(data->m_current_way != nullptr);
+        assert(data->m_in_way);
+        data->m_in_way = false;
+
+        auto& pending = data->m_current_way;
+        if(!admit_way(pending, pending.m_refs.size(), data->m_filter, data->m_filter_stats))
+            return;
 
-        auto metadata = data->m_current_way->parse_metadata();
-/*        if(metadata.m_classification == Metadata::UNKNOWN) {
-            data->m_current_way = nullptr;
+        if(pending.m_tags.empty()) {
+            data->m_untagged_ways.emplace_back(pending.m_id).m_refs = pending.m_refs;
             return;
-        } */
+        }
+
+        auto way = build_way(pending, *data->m_node_cache, data->m_lookup_buffer, data->m_tag_builder);
 
-        for(auto& node : data->m_current_way->get_nodes()) {
-            node.m_metadata = metadata;
+        auto& members = data->m_member_ways;
+        if(!members || std::binary_search(members->begin(), members->end(), way.get_id())) {
+            auto& coords = way.get_coords();
+            data->m_tagged_ways.emplace_back(way.get_id(), coords.size());
+            data->m_tagged_coords.insert(data->m_tagged_coords.end(), coords.begin(), coords.end());
         }
 
-        data->m_current_way->create_buffers();
+        ensure_bvh(data->m_sink, *data->m_node_cache);
+        data->m_sink.add_way(std::move(way));
+    }
+    else if(std::memcmp(name, "relation", 8) == 0) {
+        assert(data->m_in_relation);
+        data->m_in_relation = false;
 
-        data->m_map->add_way(std::move(data->m_current_way));
-        data->m_current_way = nullptr;
+        auto& relation = data->m_current_relation;
+        if(admit_relation(relation, data->m_filter, data->m_filter_stats))
+            data->m_multipolygons.add_relation(std::move(relation));
     }
 }
 
-auto preprocess_data(const char* xml_path, std::shared_ptr<Map> map) -> int {
-    auto input = std::ifstream(xml_path);
-    if(!input.good()) {
-        mlog::logln(mlog::ERROR, "Could not open `%s`", xml_path);
-        return 1;
+// runs once all relations are known: the untagged ways no multipolygon replaced, then the multipolygons;
+// false if the ingest was stopped
+static auto finish_relations(PreData& data, const IngestOptions& options) -> bool {
+    auto& multipolygons = data.m_multipolygons;
+    multipolygons.index_members();
+
+    const glm::vec2* coords = data.m_tagged_coords.data();
+    for(auto [ id, size ] : data.m_tagged_ways) {
+        multipolygons.add_way(id, CoordSpan(coords, size));
+        coords += size;
+    }
+    data.m_tagged_ways = {};
+    data.m_tagged_coords = {};
+    data.m_member_ways.reset();
+
+    for(auto& pending : data.m_untagged_ways) {
+        if(stop_requested(options))
+            return false;
+
+        if(!multipolygons.wants(pending.m_id))
+            continue;
+
+        {
+            PhaseTimer timer(PHASE_LOOKUP);
+            data.m_node_cache->lookup_batch(pending.m_refs, data.m_lookup_buffer);
+        }
+        multipolygons.add_way(pending.m_id, data.m_lookup_buffer);
     }
+
+    auto polygons = multipolygons.assemble(data.m_tag_builder);
+
+    for(auto& pending : data.m_untagged_ways) {
+        if(stop_requested(options))
+            return false;
+
+        if(multipolygons.consumed(pending.m_id) || !admit_untagged_way(pending.m_refs.size(), data.m_filter, data.m_filter_stats))
+            continue;
+
+        ensure_bvh(data.m_sink, *data.m_node_cache);
+        data.m_sink.add_way(build_way(pending, *data.m_node_cache, data.m_lookup_buffer, data.m_tag_builder));
+    }
+    data.m_untagged_ways = {};
+
+    for(auto& polygon : polygons) {
+        ensure_bvh(data.m_sink, *data.m_node_cache);
+        data.m_sink.add_way(std::move(polygon));
+    }
+
+    return true;
+}
+
+// the value of the attribute `name` of `element`, as the OSM writers put it: no space around the `=`
+static auto find_attribute(std::string_view element, std::string_view name) -> std::optional<std::string_view> {
+    for(size_t at = element.find(name); at != std::string_view::npos; at = element.find(name, at + 1)) {
+        const size_t quote = at + name.size() + 1;
+        if(at == 0 || !std::isspace(static_cast<unsigned char>(element[at - 1])) || quote >= element.size() || element[quote - 1] != '=')
+            continue;
+
+        const char mark = element[quote];
+        const size_t close = element.find(mark, quote + 1);
+        if((mark != '"' && mark != '\'') || close == std::string_view::npos)
+            return std::nullopt;
+
+        return element.substr(quote + 1, close - quote - 1);
+    }
+
+    return std::nullopt;
+}
+
+// The ids of the member ways of all relations, sorted, from a scan of the end of the file ahead
+// of the parse. Relations come last, so the scan starts in the last block that still holds a node
+// or way and reads only the <member> elements, which is quick next to the parse. Returns nothing if
+// a member does not read as expected, the parse then keeps the geometry of every tagged way.
+static auto scan_member_ways(std::string_view contents) -> std::optional<std::vector<Way::Id>> {
+    constexpr size_t block_size = 4 * 1024 * 1024;
+    // so that a tag cut by the end of a block is found in the next one
+    constexpr size_t overlap = 16;
+
+    size_t start = contents.size() > block_size ? contents.size() - block_size : 0;
+    for(;;) {
+        auto block = contents.substr(start, block_size + overlap);
+        if(start == 0 || block.find("<way") != std::string_view::npos || block.find("<node") != std::string_view::npos)
+            break;
+
+        start = start > block_size ? start - block_size : 0;
+    }
+
+    std::vector<Way::Id> members;
+    for(size_t at = contents.find("<member", start); at != std::string_view::npos; at = contents.find("<member", at + 1)) {
+        const size_t end = contents.find('>', at);
+        if(end == std::string_view::npos)
+            return std::nullopt;
+
+        auto element = contents.substr(at, end - at);
+        auto type = find_attribute(element, "type");
+        auto ref = find_attribute(element, "ref");
+        if(!type || !ref)
+            return std::nullopt;
+
+        if(*type != "way")
+            continue;
+
+        // `parse_id` reads up to a terminator
+        char text[24];
+        if(ref->size() >= sizeof(text))
+            return std::nullopt;
+        std::memcpy(text, ref->data(), ref->size());
+        text[ref->size()] = '\0';
+
+        auto id = parse_id(text);
+        if(!id)
+            return std::nullopt;
+        members.push_back(*id);
+    }
+
+    std::sort(members.begin(), members.end());
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+    return members;
+}
+
+// hands the mapping to expat without copying, in slices so that progress can be reported;
+// `on_slice` runs after every slice
+static auto parse_mapped(XML_Parser parser, const MappedFile& file, const IngestOptions& options, const std::function<void()>& on_slice = {}) -> bool {
+    constexpr size_t slice_size = 16 * 1024 * 1024;
+
+    file.advise_sequential();
+
+    size_t released = 0;
+    for(size_t offset = 0; offset < file.size(); offset += slice_size) {
+        const size_t length = std::min(slice_size, file.size() - offset);
+        const bool is_final = offset + length == file.size();
+
+        if(XML_Parse(parser, file.data() + offset, length, is_final) == XML_STATUS_ERROR)
+            return false;
+
+        const size_t consumed = XML_GetCurrentByteIndex(parser);
+        mlog::log(mlog::INFO, "\r%zu MiB parsed", consumed / 1024 / 1024);
+
+        file.release(released, consumed);
+        released = consumed;
+
+        if(on_slice)
+            on_slice();
+
+        if(stop_requested(options))
+            return false;
+    }
+
+    return true;
+}
+
+static auto parse_pipeline(XML_Parser parser, InputPipeline& input, const IngestOptions& options, const std::function<void()>& on_slice = {}) -> bool {
+    size_t total_read = 0;
+
+    for(auto buffer = input.next(); !buffer.empty(); buffer = input.next()) {
+        total_read += buffer.size();
+        mlog::log(mlog::INFO, "\r%zu MiB parsed", total_read / 1024 / 1024);
+
+        if(XML_Parse(parser, buffer.data(), buffer.size(), false) == XML_STATUS_ERROR)
+            return false;
+
+        if(on_slice)
+            on_slice();
+
+        if(stop_requested(options))
+            return false;
+    }
+
+    return !input.failed() && XML_Parse(parser, nullptr, 0, true) != XML_STATUS_ERROR;
+}
+
+static auto preprocess_serial(const char* xml_path, WaySink& sink, const IngestOptions& options) -> int {
+    std::unique_ptr<MappedFile> mapped = is_mappable(xml_path, options) ? MappedFile::open(xml_path) : nullptr;
+
+    std::unique_ptr<InputPipeline> input = mapped ? nullptr : InputPipeline::open(xml_path);
+    if(!mapped && !input)
+        return 1;
     
     auto parser = XML_ParserCreate(nullptr);
     if(!parser) {
@@ -115,41 +532,661 @@ auto preprocess_data(const char* xml_path, std::shared_ptr<Map> map) -> int {
         return 1;
     }
 
-    PreData data(map);
+    PreData data(sink, options.node_store, options.filter.get());
 
     XML_SetUserData(parser, static_cast<void*>(&data));
     XML_SetElementHandler(parser, enter_element, leave_element);
 
-    int ret = 0;
-    const auto buffer_size = 1024 * 1024;
+    const auto start = Clock::now();
+    data.m_start = start;
+
+    // a stream cannot be read ahead, there every tagged way keeps its geometry until the relations are in
+    if(mapped) {
+        data.m_member_ways = scan_member_ways(mapped->view());
+        if(data.m_member_ways)
+            mlog::logln(mlog::INFO, "%zu member ways found ahead in %.2fs", data.m_member_ways->size(), seconds_since(start));
+    }
+
+    bool ok = mapped ? parse_mapped(parser, *mapped, options) : parse_pipeline(parser, *input, options);
+    if(!ok && XML_GetErrorCode(parser) != XML_ERROR_NONE)
+        mlog::logln(mlog::ERROR, "Parse error at line %lu:\n%s", XML_GetCurrentLineNumber(parser),
+            XML_ErrorString(XML_GetErrorCode(parser)));
+
+    ok = ok && !data.m_malformed;
+    if(ok) {
+        finish_nodes(data);
+        ok = finish_relations(data, options);
+    }
+
+    if(ok) {
+        const double elapsed = seconds_since(start);
+        const size_t total_size = XML_GetCurrentByteIndex(parser);
+        mlog::logln(mlog::INFO, "done in %.2fs (%.1f MiB/s, serial, %s).", elapsed, total_size / 1024.0 / 1024.0 / elapsed, mapped ? "mmap" : "stream");
+        mlog::logln(mlog::INFO, "  nodes:   %lu in %.2fs (%.1f Mnodes/s)", data.m_node_count, data.m_node_seconds,
+            data.m_node_count / 1e6 / data.m_node_seconds);
+        log_projection(data.m_node_batch.projected(), data.m_node_batch.project_seconds());
+        log_node_store(*data.m_node_cache);
+        if(input)
+            input->log_stats();
+        if(options.filter)
+            options.filter->log_stats(data.m_filter_stats);
+    }
+
+    XML_ParserFree(parser);
+
+    return ok ? 0 : 1;
+}
+
+// chunked parallel parser
+
+struct ChunkState {
+    ChunkState(IngestChunk& chunk, const FilterProfile* filter)
+        : m_chunk(chunk), m_filter(filter)
+    {}
+
+    IngestChunk& m_chunk;
+    const FilterProfile* m_filter;
+    bool m_in_way = false;
+    bool m_in_relation = false;
+    bool m_malformed = false;
+};
+
+void IngestChunk::flush_nodes() {
+    m_node_batch.flush([&](Node::Id id, glm::vec2 coord) {
+        m_nodes.emplace_back(id, Node(coord));
+    });
+}
+
+static void XMLCALL enter_chunk_element(void* user_data, const XML_Char* name, const XML_Char** atts) {
+    auto state = static_cast<ChunkState*>(user_data);
+    auto& chunk = state->m_chunk;
+    if(state->m_malformed)
+        return;
+
+    if(std::memcmp(name, "node", 4) == 0) {
+        auto node = parse_node(atts);
+        if(!node)
+            return report_malformed(state->m_malformed, name);
+
+        chunk.add_node(node->m_id, node->m_lon, node->m_lat);
+    }
+    else if(std::memcmp(name, "way", 3) == 0) {
+        assert(!state->m_in_way);
+
+        auto id = parse_element_id(atts);
+        if(!id)
+            return report_malformed(state->m_malformed, name);
+
+        chunk.m_ways.emplace_back(*id);
+        state->m_in_way = true;
+    }
+    else if(state->m_in_way && std::memcmp(name, "nd", 2) == 0) {
+        assert(atts[2] == nullptr);
+        auto ref = parse_id(atts[1]);
+        if(!ref)
+            return report_malformed(state->m_malformed, name);
+
+        chunk.m_ways.back().m_refs.push_back(*ref);
+    }
+    else if(std::memcmp(name, "relation", 8) == 0) {
+        auto id = parse_element_id(atts);
+        if(!id)
+            return report_malformed(state->m_malformed, name);
+
+        chunk.m_relations.emplace_back(*id);
+        state->m_in_relation = true;
+    }
+    else if(state->m_in_relation && std::memcmp(name, "member", 6) == 0) {
+        if(!parse_member(atts, chunk.m_relations.back().m_members))
+            return report_malformed(state->m_malformed, name);
+    }
+    else if((state->m_in_way || state->m_in_relation) && std::memcmp(name, "tag", 3) == 0) {
+        assert(atts[4] == nullptr && atts[0][0] == 'k' && atts[2][0] == 'v');
+        auto& tags = state->m_in_way ? chunk.m_ways.back().m_tags : chunk.m_relations.back().m_tags;
+        tags.add(atts[1], atts[3]);
+    }
+    else if(std::memcmp(name, "bounds", 5) == 0) {
+        chunk.m_bounds = parse_bounds(atts);
+        if(!chunk.m_bounds)
+            return report_malformed(state->m_malformed, name);
+    }
+}
+
+static void XMLCALL leave_chunk_element(void* user_data, const XML_Char* name) {
+    auto state = static_cast<ChunkState*>(user_data);
+    if(state->m_malformed)
+        return;
 
-    while(!input.eof()) {
-        void* const buf = XML_GetBuffer(parser, buffer_size);
-        if(!buf) {
-            mlog::logln(mlog::ERROR, "Could not allocate buffer of size %d", buffer_size);
-            ret = 1;
-            goto cleanup;
+    if(std::memcmp(name, "way", 3) == 0) {
+        state->m_in_way = false;
+
+        auto& chunk = state->m_chunk;
+        auto& way = chunk.m_ways.back();
+        if(!admit_way(way, way.m_refs.size(), state->m_filter, chunk.m_filter_stats))
+            chunk.m_ways.pop_back();
+    }
+    else if(std::memcmp(name, "relation", 8) == 0) {
+        state->m_in_relation = false;
+
+        auto& chunk = state->m_chunk;
+        if(!admit_relation(chunk.m_relations.back(), state->m_filter, chunk.m_filter_stats))
+            chunk.m_relations.pop_back();
+    }
+}
+
+// `p` points at a `<`; only top-level OSM elements are valid split points
+static bool is_split_point(const char* p, const char* end) {
+    static const std::string_view elements[] = {"<node", "<way", "<relation"};
+
+    for(auto element : elements) {
+        if(size_t(end - p) <= element.size() || std::memcmp(p, element.data(), element.size()) != 0)
+            continue;
+
+        char next = p[element.size()];
+        if(next == ' ' || next == '\t' || next == '\n' || next == '\r' || next == '>' || next == '/')
+            return true;
+    }
+
+    return false;
+}
+
+static auto find_split_point(const char* begin, const char* end) -> const char* {
+    const char* p = begin;
+    while(p < end && (p = static_cast<const char*>(std::memchr(p, '<', end - p)))) {
+        if(is_split_point(p, end))
+            return p;
+        p++;
+    }
+
+    return end;
+}
+
+// splits the contents of the root <osm> element into at most `count` ranges
+static auto split_body(std::string_view body, size_t count) -> std::vector<std::string_view> {
+    std::vector<std::string_view> ranges;
+
+    const char* begin = body.data();
+    const char* end = body.data() + body.size();
+    const size_t target = std::max(body.size() / count, size_t(1));
+
+    while(begin < end) {
+        const char* split = end;
+        if(size_t(end - begin) > target)
+            split = find_split_point(begin + target, end);
+
+        ranges.emplace_back(begin, split - begin);
+        begin = split;
+    }
+
+    return ranges;
+}
+
+static auto parse_chunk(std::string_view range, const IngestOptions& options, IngestChunk& chunk) -> bool {
+    static const std::string_view open = "<osm>", close = "</osm>";
+    // small enough that a stopped ingest does not wait long for the chunks in flight
+    constexpr size_t slice_size = 4 * 1024 * 1024;
+    PhaseTimer timer(PHASE_PARSE);
+
+    auto parser = XML_ParserCreate(nullptr);
+    if(!parser) {
+        mlog::logln(mlog::ERROR, "Could not create XML parser");
+        return false;
+    }
+
+    ChunkState state(chunk, options.filter.get());
+
+    XML_SetUserData(parser, static_cast<void*>(&state));
+    XML_SetElementHandler(parser, enter_chunk_element, leave_chunk_element);
+
+    bool ok = XML_Parse(parser, open.data(), open.size(), false) != XML_STATUS_ERROR;
+    for(size_t offset = 0; ok && offset < range.size(); offset += slice_size) {
+        if(stop_requested(options)) {
+            XML_ParserFree(parser);
+            return false;
         }
-    
-        mlog::log(mlog::INFO, "\r%zu MiB parsed", input.tellg() / 1024 / 1024);
 
-        const auto bytes_read = input.readsome((char*) buf, buffer_size);
-        if(!bytes_read)
+        auto slice = range.substr(offset, slice_size);
+        ok = XML_Parse(parser, slice.data(), slice.size(), false) != XML_STATUS_ERROR;
+    }
+
+    if(ok)
+        ok = XML_Parse(parser, close.data(), close.size(), true) != XML_STATUS_ERROR;
+
+    if(!ok)
+        mlog::logln(mlog::ERROR, "Parse error at line %lu of chunk:\n%s", XML_GetCurrentLineNumber(parser),
+            XML_ErrorString(XML_GetErrorCode(parser)));
+
+    chunk.flush_nodes();
+
+    XML_ParserFree(parser);
+    return ok && !state.m_malformed;
+}
+
+static void resolve_chunk(IngestChunk& chunk, const NodeCache& node_cache, const IngestOptions& options) {
+    chunk.m_resolved_ways.reserve(chunk.m_ways.size());
+    std::vector<glm::vec2> buffer;
+    TagBuilder tags;
+
+    for(auto& pending : chunk.m_ways) {
+        if(stop_requested(options))
             break;
+        chunk.m_resolved_ways.push_back(build_way(pending, node_cache, buffer, tags));
+    }
+
+    chunk.m_ways.clear();
 
-        if(XML_ParseBuffer(parser, bytes_read, input.eof()) == XML_STATUS_ERROR) {
-            mlog::logln(mlog::ERROR, "Parse error at line %lu:\n%s", XML_GetCurrentLineNumber(parser),
-                XML_ErrorString(XML_GetErrorCode(parser)));
-            ret = 1;
-            goto cleanup;
+    chunk.m_ways.shrink_to_fit();
+}
+
+// with a filter, most nodes may belong to dropped ways only; they never reach the node store
+static void drop_unreferenced_nodes(std::vector<IngestChunk>& chunks, FilterStats& stats) {
+    std::vector<Node::Id> referenced;
+    for(auto& chunk : chunks) {
+        for(auto& way : chunk.m_ways)
+            referenced.insert(referenced.end(), way.m_refs.begin(), way.m_refs.end());
+    }
+
+    std::sort(referenced.begin(), referenced.end());
+    referenced.erase(std::unique(referenced.begin(), referenced.end()), referenced.end());
+
+    for(auto& chunk : chunks) {
+        auto kept = std::remove_if(chunk.m_nodes.begin(), chunk.m_nodes.end(), [&](auto& node) {
+            return !std::binary_search(referenced.begin(), referenced.end(), node.first);
+        });
+
+        stats.m_nodes_dropped += chunk.m_nodes.end() - kept;
+        stats.m_nodes_kept += kept - chunk.m_nodes.begin();
+        chunk.m_nodes.erase(kept, chunk.m_nodes.end());
+    }
+}
+
+void log_projection(const std::vector<IngestChunk>& chunks) {
+    uint64_t projected = 0;
+    double project_seconds = 0.0;
+    for(auto& chunk : chunks) {
+        projected += chunk.m_node_batch.projected();
+        project_seconds += chunk.m_node_batch.project_seconds();
+    }
+
+    log_projection(projected, project_seconds);
+}
+
+void log_parallel_stage(const char* name, double wall, double busy, unsigned threads, ParallelTimes& times) {
+    mlog::logln(mlog::INFO, "  %-9s %.2fs wall, %.2fs busy, an estimated %.1fx over one thread (%u threads)", name, wall, busy, wall > 0.0 ? busy / wall : 1.0, threads);
+    times.m_wall += wall;
+    times.m_busy += busy;
+}
+
+auto ingest_chunks(std::vector<IngestChunk>& chunks, WaySink& sink, ThreadPool& pool, const IngestOptions& options, ParallelTimes& times) -> bool {
+    log_projection(chunks);
+
+    // merging and handing over run on one thread, so they bound the speedup of more threads
+    auto merge_start = Clock::now();
+
+    // every relation is known before the first way is resolved
+    MultipolygonAssembler multipolygons;
+    for(auto& chunk : chunks) {
+        for(auto& relation : chunk.m_relations)
+            multipolygons.add_relation(std::move(relation));
+        chunk.m_relations.clear();
+        chunk.m_relations.shrink_to_fit();
+    }
+    multipolygons.index_members();
+
+    FilterStats filter_stats;
+    if(options.filter) {
+        for(auto& chunk : chunks)
+            filter_stats += chunk.m_filter_stats;
+        drop_unreferenced_nodes(chunks, filter_stats);
+    }
+
+    // merging in chunk order keeps the result identical to the serial parser
+    auto node_cache = std::make_unique<NodeCache>(options.node_store);
+    for(auto& chunk : chunks) {
+        if(stop_requested(options))
+            return false;
+
+        if(chunk.m_bounds && !sink.has_bvh())
+            sink.init_bvh(*chunk.m_bounds, bvh_max_depth);
+
+        for(auto& [ id, node ] : chunk.m_nodes)
+            node_cache->add_node(id, node);
+        chunk.m_nodes.clear();
+        chunk.m_nodes.shrink_to_fit();
+    }
+
+    node_cache->freeze();
+    log_node_store(*node_cache);
+
+    ensure_bvh(sink, *node_cache);
+    mlog::logln(mlog::INFO, "  merge:    %.2fs, serial", seconds_since(merge_start));
+
+    auto resolve_start = Clock::now();
+    double resolve_busy = pool.timed_parallel_for(chunks.size(), [&](size_t i) {
+        resolve_chunk(chunks[i], *node_cache, options);
+    });
+    double resolve_wall = seconds_since(resolve_start);
+
+    log_parallel_stage("resolve:", resolve_wall, resolve_busy, pool.size(), times);
+
+    node_cache = nullptr;
+    if(stop_requested(options))
+        return false;
+
+    auto hand_over_start = Clock::now();
+
+    // handed over in the order of the serial parser, which keeps the BVH identical:
+    // tagged ways in chunk order, then the untagged ways no multipolygon replaced, then the multipolygons
+    for(auto& chunk : chunks) {
+        for(auto& way : chunk.m_resolved_ways) {
+            multipolygons.add_way(way.get_id(), way.get_coords());
+            if(!way.get_tags().empty())
+                sink.add_way(std::move(way));
+        }
+    }
+
+    TagBuilder tags;
+    auto polygons = multipolygons.assemble(tags);
+
+    for(auto& chunk : chunks) {
+        // the tagged ones were handed over already
+        for(auto& way : chunk.m_resolved_ways) {
+            if(way.get_tags().empty() && !multipolygons.consumed(way.get_id()) && admit_untagged_way(way.get_coords().size(), options.filter.get(), filter_stats))
+                sink.add_way(std::move(way));
         }
+        chunk.m_resolved_ways.clear();
+        chunk.m_resolved_ways.shrink_to_fit();
     }
 
-    mlog::logln(mlog::INFO, "done.");
+    for(auto& polygon : polygons)
+        sink.add_way(std::move(polygon));
+
+    mlog::logln(mlog::INFO, "  add ways: %.2fs, serial", seconds_since(hand_over_start));
+
+    if(options.filter)
+        options.filter->log_stats(filter_stats);
+
+    return true;
+}
+
+static auto find_body(std::string_view contents) -> std::optional<std::string_view> {
+    size_t open = 0;
+    while((open = contents.find("<osm", open)) != std::string_view::npos) {
+        char next = open + 4 < contents.size() ? contents[open + 4] : '\0';
+        if(next == ' ' || next == '\t' || next == '\n' || next == '\r' || next == '>')
+            break;
+        open++;
+    }
+
+    if(open == std::string_view::npos)
+        return std::nullopt;
+
+    size_t begin = contents.find('>', open);
+    size_t end = contents.rfind("</osm>");
+    if(begin == std::string_view::npos || end == std::string_view::npos || end <= begin)
+        return std::nullopt;
+
+    return contents.substr(begin + 1, end - begin - 1);
+}
+
+static auto preprocess_parallel(const char* xml_path, WaySink& sink, const IngestOptions& options) -> int {
+    const auto start = Clock::now();
+
+    // splitting needs random access to the whole file
+    auto mapped = options.use_mmap ? MappedFile::open(xml_path) : nullptr;
+    if(!mapped) {
+        mlog::logln(mlog::WARN, "`%s` cannot be memory-mapped, falling back to the serial parser", xml_path);
+        return preprocess_serial(xml_path, sink, options);
+    }
+
+    mapped->advise_sequential();
+
+    auto contents = mapped->view();
+    auto body = find_body(contents);
+    if(!body) {
+        mlog::logln(mlog::ERROR, "`%s` has no <osm> root element", xml_path);
+        return 1;
+    }
+
+    const size_t input_size = body->size();
+
+    ThreadPool pool(options.jobs);
+
+    // more chunks than threads so that uneven chunks balance out
+    auto ranges = split_body(*body, pool.size() * 4);
+    std::vector<IngestChunk> chunks(ranges.size());
+
+    mlog::logln(mlog::INFO, "Parsing %zu MiB in %zu chunks on %u threads...", contents.size() / 1024 / 1024, ranges.size(), pool.size());
+
+    std::atomic<bool> failed(false);
+
+    auto parse_start = Clock::now();
+    double parse_busy = pool.timed_parallel_for(ranges.size(), [&](size_t i) {
+        if(!parse_chunk(ranges[i], options, chunks[i]))
+            failed = true;
+    });
+    double parse_wall = seconds_since(parse_start);
+
+    if(failed)
+        return 1;
+
+    ParallelTimes times;
+    log_parallel_stage("parse:", parse_wall, parse_busy, pool.size(), times);
+
+    mapped = nullptr;
+
+    if(!ingest_chunks(chunks, sink, pool, options, times))
+        return 1;
+
+    double elapsed = seconds_since(start);
+    double serial = times.serial_estimate(elapsed);
+    mlog::logln(mlog::INFO, "done in %.2fs (%.1f MiB/s, %u threads), an estimated %.2fs on one thread (%.1fx).",
+        elapsed, input_size / 1024.0 / 1024.0 / elapsed, pool.size(), serial, serial / elapsed);
+
+    return 0;
+}
+
+static auto ingest_source(const char* xml_path, WaySink& sink, const IngestOptions& options) -> int {
+    if(is_pbf_file(xml_path))
+        return preprocess_pbf(xml_path, sink, options);
+
+    if(options.jobs == 1)
+        return preprocess_serial(xml_path, sink, options);
+
+    if(!is_mappable(xml_path, options)) {
+        mlog::logln(mlog::INFO, "`%s` is streamed, parsing it serially", xml_path);
+        return preprocess_serial(xml_path, sink, options);
+    }
+
+    return preprocess_parallel(xml_path, sink, options);
+}
+
+// streams the input through the chunk handlers and drains them into `ingest` after every slice
+static auto scan_xml(const char* xml_path, const IngestOptions& options, ExternalIngest& ingest) -> bool {
+    std::unique_ptr<MappedFile> mapped = is_mappable(xml_path, options) ? MappedFile::open(xml_path) : nullptr;
+
+    std::unique_ptr<InputPipeline> input = mapped ? nullptr : InputPipeline::open(xml_path);
+    if(!mapped && !input)
+        return false;
+
+    auto parser = XML_ParserCreate(nullptr);
+    if(!parser) {
+        mlog::logln(mlog::ERROR, "Could not create XML parser");
+        return false;
+    }
+
+    IngestChunk chunk;
+    ChunkState state(chunk, options.filter.get());
+
+    XML_SetUserData(parser, static_cast<void*>(&state));
+    XML_SetElementHandler(parser, enter_chunk_element, leave_chunk_element);
+
+    // the way that is still being parsed stays behind
+    auto drain = [&]() {
+        std::optional<PendingWay> open_way;
+        if(state.m_in_way) {
+            open_way = std::move(chunk.m_ways.back());
+            chunk.m_ways.pop_back();
+        }
+
+        std::optional<PendingRelation> open_relation;
+        if(state.m_in_relation) {
+            open_relation = std::move(chunk.m_relations.back());
+            chunk.m_relations.pop_back();
+        }
+
+        chunk.flush_nodes();
+        ingest.add_chunk(chunk);
+
+        if(open_way)
+            chunk.m_ways.push_back(std::move(*open_way));
+        if(open_relation)
+            chunk.m_relations.push_back(std::move(*open_relation));
+    };
+
+    bool ok = mapped ? parse_mapped(parser, *mapped, options, drain) : parse_pipeline(parser, *input, options, drain);
+    if(!ok && XML_GetErrorCode(parser) != XML_ERROR_NONE)
+        mlog::logln(mlog::ERROR, "Parse error at line %lu:\n%s", XML_GetCurrentLineNumber(parser),
+            XML_ErrorString(XML_GetErrorCode(parser)));
+
+    ok = ok && !state.m_malformed;
+    if(ok) {
+        // whatever expat held back until the final call
+        drain();
+
+        log_projection(chunk.m_node_batch.projected(), chunk.m_node_batch.project_seconds());
+        if(input)
+            input->log_stats();
+    }
 
-cleanup:
     XML_ParserFree(parser);
-    input.close();
+    return ok;
+}
+
+static auto preprocess_external(const char* xml_path, WaySink& sink, const IngestOptions& options, const std::optional<SourceFingerprint>& fingerprint, std::string cache_path) -> int {
+    const auto start = Clock::now();
+
+    std::string spill_dir = options.spill_dir;
+    if(spill_dir.empty()) {
+        auto tmpdir = std::getenv("TMPDIR");
+        spill_dir = tmpdir && *tmpdir ? tmpdir : "/tmp";
+    }
+
+    mlog::logln(mlog::INFO, "Ingesting with a memory budget of %zu MiB, spilling to `%s`", options.memory_budget / 1024 / 1024, spill_dir.c_str());
+
+    ExternalIngest ingest(options.memory_budget, spill_dir, options.filter.get());
+
+    bool ok = is_pbf_file(xml_path)
+        ? scan_pbf(xml_path, options, [&](IngestChunk& chunk) { ingest.add_chunk(chunk); })
+        : scan_xml(xml_path, options, ingest);
+    if(!ok)
+        return 1;
+
+    mlog::logln(mlog::INFO, "  scan:     %.2fs", seconds_since(start));
+
+    // without a cache to keep, the result goes through a scratch file
+    const bool keep_cache = fingerprint.has_value();
+    if(!keep_cache)
+        cache_path = spill_dir + "/map-" + std::to_string(getpid()) + ".mapcache";
+
+    const SourceFingerprint source = fingerprint.value_or(SourceFingerprint{0, 0, 0});
+    if(!ingest.write_cache(cache_path, source, bvh_max_depth))
+        return 1;
+
+    // untagged ways are only decided on while writing
+    if(options.filter)
+        options.filter->log_stats(ingest.filter_stats());
+
+    auto status = load_map_cache(cache_path, source, sink);
+    if(!keep_cache)
+        std::remove(cache_path.c_str());
+
+    mlog::logln(mlog::INFO, "done in %.2fs (out of core).", seconds_since(start));
+    return status == CACHE_LOADED ? 0 : 1;
+}
+
+auto parse_ingest_option(int argc, char** argv, int& i, IngestOptions& options) -> int {
+    std::string_view arg = argv[i];
+
+    if(arg == "--no-mmap")
+        options.use_mmap = false;
+    else if(arg == "--no-cache")
+        options.use_cache = false;
+    else if(arg == "--shared-vertices")
+        options.shared_vertices = true;
+    // all other flags take a value
+    else if(i + 1 >= argc)
+        return 0;
+    else if(arg == "-j" || arg == "--jobs")
+        options.jobs = std::strtoul(argv[++i], nullptr, 10);
+    else if(arg == "--cache")
+        options.cache_path = argv[++i];
+    else if(arg == "--memory-budget")
+        options.memory_budget = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+    else if(arg == "--spill-dir")
+        options.spill_dir = argv[++i];
+    else if(arg == "--filter") {
+        auto profile = FilterProfile::load(argv[++i]);
+        if(!profile)
+            return -1;
+        options.filter = std::make_shared<const FilterProfile>(std::move(*profile));
+    }
+    else if(arg == "--node-store") {
+        auto mode = NodeStore::parse_mode(argv[++i]);
+        if(!mode) {
+            mlog::logln(mlog::ERROR, "Unknown node store layout `%s`, expect one of [auto,dense,sparse,hash]", argv[i]);
+            return -1;
+        }
+        options.node_store = *mode;
+    }
+    else
+        return 0;
+
+    return 1;
+}
+
+auto ingest_data(const char* xml_path, WaySink& sink, const IngestOptions& options, std::optional<CacheTarget>& cache_target) -> int {
+    // whatever the nested phases do not claim
+    PhaseTimer timer(PHASE_PARSE);
+
+    std::optional<SourceFingerprint> fingerprint;
+    std::string cache_path;
+
+    if(options.use_cache && (fingerprint = SourceFingerprint::of(xml_path))) {
+        cache_path = options.cache_path.empty() ? default_cache_path(xml_path) : options.cache_path;
+
+        // a map ingested with other filter rules is another map
+        if(options.filter)
+            fingerprint->m_filter_hash = options.filter->hash();
+
+        if(load_map_cache(cache_path, *fingerprint, sink) == CACHE_LOADED)
+            return 0;
+    }
+
+    if(options.memory_budget)
+        return preprocess_external(xml_path, sink, options, fingerprint, cache_path);
+
+    if(fingerprint)
+        cache_target = CacheTarget{cache_path, *fingerprint};
+
+    if(int err = ingest_source(xml_path, sink, options)) {
+        cache_target.reset();
+        return err;
+    }
+
+    return 0;
+}
+
+auto preprocess_data(const char* xml_path, std::shared_ptr<Map> map, const IngestOptions& options) -> int {
+    std::optional<CacheTarget> cache_target;
+    if(int err = ingest_data(xml_path, *map, options, cache_target))
+        return err;
+
+    map->finish_loading();
+
+    // a failed write only costs the next start its shortcut
+    if(cache_target)
+        write_map_cache(cache_target->m_path, cache_target->m_source, *map);
 
-    return ret;
+    return 0;
 }
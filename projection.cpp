@@ -0,0 +1,164 @@
+#include "projection.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+static constexpr double rad_per_fixed = fixed_point_scale * M_PI / 180.0;
+static constexpr double half_deg_per_rad = 0.5 * 180.0 / M_PI;
+
+// the poles themselves would project to infinity
+static constexpr double max_lat = 89.9 * M_PI / 180.0;
+
+// ln(tan(pi/4 + lat/2)) == atanh(sin(lat)) == ln((1 + sin(lat)) / (1 - sin(lat))) / 2,
+// which needs only the two functions that have cheap vector versions
+static inline auto mercator_y(double lat) -> double {
+    const double s = std::sin(std::clamp(lat, -max_lat, max_lat));
+    return std::log((1.0 + s) / (1.0 - s)) * half_deg_per_rad;
+}
+
+void project_fixed_scalar(const int32_t* lon, const int32_t* lat, glm::vec2* out, size_t count) {
+    for(size_t i = 0; i < count; i++)
+        out[i] = glm::vec2(lon[i] * fixed_point_scale, mercator_y(lat[i] * rad_per_fixed));
+}
+
+auto project_degrees(double lon, double lat) -> glm::vec2 {
+    return glm::vec2(lon, mercator_y(lat * (M_PI / 180.0)));
+}
+
+#ifdef HAVE_X86_KERNELS
+
+// sin(x) for |x| <= pi/2 as its Taylor series up to x^25, whose remainder is below 1e-20 there
+[[gnu::target("avx2,fma")]]
+static inline auto sin_avx2(__m256d x) -> __m256d {
+    const __m256d x2 = _mm256_mul_pd(x, x);
+
+    __m256d p = _mm256_set1_pd(1.0 / 15511210043330985984000000.0);
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(-1.0 / 25852016738884976640000.0));
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(1.0 / 51090942171709440000.0));
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(-1.0 / 121645100408832000.0));
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(1.0 / 355687428096000.0));
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(-1.0 / 1307674368000.0));
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(1.0 / 6227020800.0));
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(-1.0 / 39916800.0));
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(1.0 / 362880.0));
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(-1.0 / 5040.0));
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(1.0 / 120.0));
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(-1.0 / 6.0));
+    p = _mm256_fmadd_pd(p, x2, _mm256_set1_pd(1.0));
+
+    return _mm256_mul_pd(p, x);
+}
+
+// ln(x) for finite x > 0: x = 2^e * m with m in [sqrt(1/2), sqrt(2)),
+// ln(m) = 2 atanh(f) with f = (m - 1) / (m + 1), |f| <= 0.172, summed up to f^21
+[[gnu::target("avx2,fma")]]
+static inline auto log_avx2(__m256d x) -> __m256d {
+    const __m256i bits = _mm256_castpd_si256(x);
+
+    // the biased exponent as a double, via the 2^52 trick since AVX2 cannot convert int64
+    const __m256i exponent_bits = _mm256_or_si256(_mm256_srli_epi64(bits, 52), _mm256_castpd_si256(_mm256_set1_pd(4503599627370496.0)));
+    __m256d e = _mm256_sub_pd(_mm256_castsi256_pd(exponent_bits), _mm256_set1_pd(4503599627370496.0 + 1023.0));
+
+    // mantissa with the exponent of 1.0, in [1, 2)
+    __m256d m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x000fffffffffffffll)),
+        _mm256_set1_epi64x(0x3ff0000000000000ll)));
+
+    const __m256d large = _mm256_cmp_pd(m, _mm256_set1_pd(M_SQRT2), _CMP_GT_OQ);
+    m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), large);
+    e = _mm256_add_pd(e, _mm256_and_pd(large, _mm256_set1_pd(1.0)));
+
+    const __m256d f = _mm256_div_pd(_mm256_sub_pd(m, _mm256_set1_pd(1.0)), _mm256_add_pd(m, _mm256_set1_pd(1.0)));
+    const __m256d f2 = _mm256_mul_pd(f, f);
+
+    __m256d p = _mm256_set1_pd(1.0 / 21.0);
+    p = _mm256_fmadd_pd(p, f2, _mm256_set1_pd(1.0 / 19.0));
+    p = _mm256_fmadd_pd(p, f2, _mm256_set1_pd(1.0 / 17.0));
+    p = _mm256_fmadd_pd(p, f2, _mm256_set1_pd(1.0 / 15.0));
+    p = _mm256_fmadd_pd(p, f2, _mm256_set1_pd(1.0 / 13.0));
+    p = _mm256_fmadd_pd(p, f2, _mm256_set1_pd(1.0 / 11.0));
+    p = _mm256_fmadd_pd(p, f2, _mm256_set1_pd(1.0 / 9.0));
+    p = _mm256_fmadd_pd(p, f2, _mm256_set1_pd(1.0 / 7.0));
+    p = _mm256_fmadd_pd(p, f2, _mm256_set1_pd(1.0 / 5.0));
+    p = _mm256_fmadd_pd(p, f2, _mm256_set1_pd(1.0 / 3.0));
+    p = _mm256_fmadd_pd(p, f2, _mm256_set1_pd(1.0));
+
+    const __m256d log_m = _mm256_mul_pd(_mm256_mul_pd(p, f), _mm256_set1_pd(2.0));
+    return _mm256_fmadd_pd(e, _mm256_set1_pd(M_LN2), log_m);
+}
+
+// projects four coordinates into `out`, interleaved as x0 y0 x1 y1 ...
+[[gnu::target("avx2,fma")]]
+static inline void project4_avx2(const int32_t* lon, const int32_t* lat, float* out) {
+    const __m256d one = _mm256_set1_pd(1.0);
+
+    const __m256d x = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lon))),
+        _mm256_set1_pd(fixed_point_scale));
+    __m256d phi = _mm256_mul_pd(_mm256_cvtepi32_pd(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lat))),
+        _mm256_set1_pd(rad_per_fixed));
+    phi = _mm256_min_pd(_mm256_max_pd(phi, _mm256_set1_pd(-max_lat)), _mm256_set1_pd(max_lat));
+
+    const __m256d s = sin_avx2(phi);
+    const __m256d y = _mm256_mul_pd(log_avx2(_mm256_div_pd(_mm256_add_pd(one, s), _mm256_sub_pd(one, s))),
+        _mm256_set1_pd(half_deg_per_rad));
+
+    const __m128 xf = _mm256_cvtpd_ps(x), yf = _mm256_cvtpd_ps(y);
+    _mm_storeu_ps(out, _mm_unpacklo_ps(xf, yf));
+    _mm_storeu_ps(out + 4, _mm_unpackhi_ps(xf, yf));
+}
+
+[[gnu::target("avx2,fma")]]
+static void project_fixed_avx2(const int32_t* lon, const int32_t* lat, glm::vec2* out, size_t count) {
+    static_assert(sizeof(glm::vec2) == 2 * sizeof(float));
+
+    size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+        project4_avx2(lon + i, lat + i, reinterpret_cast<float*>(out + i));
+
+    // the tail goes through the same kernel, so results do not depend on the batch position
+    if(i < count) {
+        int32_t lon4[4] = {}, lat4[4] = {};
+        float out8[8];
+        for(size_t j = i; j < count; j++) {
+            lon4[j - i] = lon[j];
+            lat4[j - i] = lat[j];
+        }
+
+        project4_avx2(lon4, lat4, out8);
+        for(size_t j = i; j < count; j++)
+            out[j] = glm::vec2(out8[2 * (j - i)], out8[2 * (j - i) + 1]);
+    }
+}
+
+static bool has_avx2() {
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return supported;
+}
+
+#endif
+
+auto projection_kernel() -> const char* {
+#ifdef HAVE_X86_KERNELS
+    if(has_avx2())
+        return "avx2";
+#endif
+    return "scalar";
+}
+
+void project_fixed(const int32_t* lon, const int32_t* lat, glm::vec2* out, size_t count) {
+#ifdef HAVE_X86_KERNELS
+    if(has_avx2())
+        return project_fixed_avx2(lon, lat, out, count);
+#endif
+    project_fixed_scalar(lon, lat, out, count);
+}
+
+void log_projection(uint64_t count, double seconds) {
+    if(count)
+        mlog::logln(mlog::INFO, "  project: %lu nodes in %.3fs (%.1f Mnodes/s, %s)", count, seconds, count / 1e6 / seconds, projection_kernel());
+}
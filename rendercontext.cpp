@@ -47,7 +47,39 @@ void RenderContext::draw_debug_info() {
 
     ImGui::Separator();
 
-    ImGui::Checkbox("Show mesh", &m_disable_fill);
+    auto& stats = m_map->get_frame_stats();
+    ImGui::Text("draw calls: %zu (%zu ways, %zu commands)", stats.m_draw_calls, stats.m_ways, stats.m_commands);
+    ImGui::Text("vertices: %zu, fill triangles: %zu (level of detail %d)", stats.m_vertices, stats.m_triangles, stats.m_lod_level);
+    ImGui::Text("CPU submit time: %.3f ms", stats.m_submit_ms);
+
+    auto& layer = m_map->get_layer_stats();
+    ImGui::Text("map frames: %llu cached, %llu panned, %llu drawn", (unsigned long long)layer.m_reused,
+        (unsigned long long)layer.m_panned, (unsigned long long)layer.m_redrawn);
+    ImGui::Text("frame time: %.2f ms (%.0f fps)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+
+    auto& frames = m_scheduler.get_stats();
+    ImGui::Text("last second: %u frames, %u wakeups, CPU %.1f%%", frames.m_frames, frames.m_wakeups, frames.m_cpu_load * 100.0);
+    ImGui::Text("input latency: %.1f ms (%.1f ms at most in the last second)", frames.m_latency_ms, frames.m_max_latency_ms);
+
+    auto& tiles = m_map->get_tile_stats();
+    auto budget = m_map->get_vram_budget();
+    ImGui::Text("tiles: %zu in view, %zu of %zu resident", tiles.m_visible_tiles, tiles.m_resident_tiles, tiles.m_tiles);
+    ImGui::Text("culling: %.3f ms on %u threads (%.1fx)", tiles.m_cull_ms, m_map->get_cull_threads(),
+        tiles.m_cull_ms > 0.0 ? tiles.m_cull_busy_ms / tiles.m_cull_ms : 1.0);
+    if(budget)
+        ImGui::Text("resident: %.1f of %.1f MiB", tiles.m_resident_bytes / 1024.0 / 1024.0, budget / 1024.0 / 1024.0);
+    else
+        ImGui::Text("resident: %.1f MiB (no budget)", tiles.m_resident_bytes / 1024.0 / 1024.0);
+
+    auto lookups = tiles.m_hits + tiles.m_misses;
+    ImGui::Text("tile hit rate: %.1f%%", lookups ? 100.0 * tiles.m_hits / lookups : 100.0);
+    ImGui::Text("stall frames: %llu", (unsigned long long)tiles.m_stall_frames);
+    ImGui::Text("prefetched: %llu, evicted: %llu", (unsigned long long)tiles.m_prefetches, (unsigned long long)tiles.m_evictions);
+
+    ImGui::Separator();
+
+    if(ImGui::Checkbox("Show mesh", &m_disable_fill))
+        m_map->invalidate_layer();
 
     ImGui::End();
 }
@@ -115,18 +147,36 @@ Shader::Shader(std::istream& vertex_input, std::istream& fragment_input) {
         assert(false);
     }
 
-    int vertex = load_shader(GL_VERTEX_SHADER, vertex_input, m_err);
-    int fragment = load_shader(GL_FRAGMENT_SHADER, fragment_input, m_err);
+    GLuint vertex = load_shader(GL_VERTEX_SHADER, vertex_input, m_err);
+    GLuint fragment = load_shader(GL_FRAGMENT_SHADER, fragment_input, m_err);
     if(!fragment || !vertex)
         return;
 
-    glAttachShader(m_id, vertex);
-    glAttachShader(m_id, fragment);
+    link({ vertex, fragment });
+}
+
+Shader::Shader(std::istream& vertex_input, std::istream& geometry_input, std::istream& fragment_input) {
+    if(!(m_id = glCreateProgram())) {
+        assert(false);
+    }
+
+    GLuint vertex = load_shader(GL_VERTEX_SHADER, vertex_input, m_err);
+    GLuint geometry = load_shader(GL_GEOMETRY_SHADER, geometry_input, m_err);
+    GLuint fragment = load_shader(GL_FRAGMENT_SHADER, fragment_input, m_err);
+    if(!fragment || !geometry || !vertex)
+        return;
+
+    link({ vertex, geometry, fragment });
+}
+
+void Shader::link(std::initializer_list<GLuint> stages) {
+    for(auto stage : stages)
+        glAttachShader(m_id, stage);
 
     glLinkProgram(m_id);
 
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+    for(auto stage : stages)
+        glDeleteShader(stage);
 
     GLint success;
     glGetProgramiv(m_id, GL_LINK_STATUS, &success);
@@ -1,6 +1,7 @@
 #include "renderutil.hpp"
 #include "log.hpp"
 
+#include <algorithm>
 #include <cmath>
 
 Texture::Texture(GLuint width, GLuint height, GLenum format, GLenum data_type) 
@@ -37,6 +38,48 @@ Framebuffer::~Framebuffer() {
     glDeleteFramebuffers(1, &m_id);
 }
 
+GrowableBuffer::~GrowableBuffer() {
+    if(m_id)
+        glDeleteBuffers(1, &m_id);
+}
+
+bool GrowableBuffer::append(const void* data, GLsizeiptr bytes) {
+    if(bytes == 0)
+        return false;
+
+    bool reallocated = false;
+
+    // the copy targets leave the bindings of the current vertex array alone
+    if(m_size + bytes > m_capacity) {
+        // the first append is often all there is, a tile is built in one piece
+        GLsizeiptr capacity = std::max(m_capacity * 2, m_size + bytes);
+
+        GLuint id;
+        glGenBuffers(1, &id);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STATIC_DRAW);
+
+        if(m_id) {
+            glBindBuffer(GL_COPY_READ_BUFFER, m_id);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, m_size);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &m_id);
+        }
+
+        m_id = id;
+        m_capacity = capacity;
+        reallocated = true;
+    }
+    else
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_id);
+
+    glBufferSubData(GL_COPY_WRITE_BUFFER, m_size, bytes, data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    m_size += bytes;
+    return reallocated;
+}
+
 static const double EARTH_R = 6378.137;
 
 double measure_latlon_dist(glm::vec2 from, glm::vec2 to) {
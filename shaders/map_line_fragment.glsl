@@ -0,0 +1,13 @@
+#version 450 core
+
+in vec4 g_Color;
+in float g_Across;
+flat in float g_HalfWidth;
+
+layout (location = 0) out vec4 frag_Color;
+
+void main() {
+    // the share of the pixel the line covers
+    float coverage = clamp(g_HalfWidth + 0.5 - abs(g_Across), 0.0, 1.0);
+    frag_Color = vec4(g_Color.rgb, g_Color.a * coverage);
+}
@@ -0,0 +1,98 @@
+#version 450 core
+
+// Expands every segment of a line strip into a quad in screen space, as wide as the
+// way wants plus a pixel for the antialiased edge, so that ways of any width are
+// drawn by the same call.
+//
+// Strips are drawn with adjacency, see `VertexPool`. Where two segments meet, both quads
+// end on the line halfway between their directions, a miter join, so that no pixel of a
+// way is covered twice and translucent ways blend once; the ends of a strip get square caps.
+
+layout (lines_adjacency) in;
+layout (triangle_strip, max_vertices = 4) out;
+
+in vec4 v_Color[];
+in float v_Width[];
+
+uniform vec2 u_Resolution;
+
+out vec4 g_Color;
+// in pixels, from the middle of the line and along it from the start of the segment
+out float g_Across;
+out float g_Along;
+flat out float g_HalfWidth;
+
+// the antialiased edge, in pixels
+const float c_Feather = 1.0;
+
+// a join sharper than this is cut short instead of running out to its point, as the
+// cosine of half the angle between the segments
+const float c_MiterLimit = 0.25;
+
+vec2 to_pixels(int i) {
+    return gl_in[i].gl_Position.xy * u_Resolution * 0.5;
+}
+
+// from a joint to the corner of the quad on the side of `normal`, where the segment
+// on the other side of the joint runs along `other`
+vec2 miter(vec2 normal, vec2 other, float extent) {
+    vec2 other_normal = normalize(vec2(-other.y, other.x));
+    vec2 bisector = normal + other_normal;
+
+    // a way that turns back on itself
+    if(dot(bisector, bisector) < 1e-6)
+        return normal * extent;
+
+    bisector = normalize(bisector);
+    return bisector * extent / max(dot(bisector, normal), c_MiterLimit);
+}
+
+void emit(vec2 pixel, vec2 start, vec2 dir, vec2 normal) {
+    g_Color = v_Color[1];
+    g_Across = dot(pixel - start, normal);
+    g_Along = dot(pixel - start, dir);
+    g_HalfWidth = v_Width[1] * 0.5;
+
+    gl_Position = vec4(pixel / (u_Resolution * 0.5), gl_in[1].gl_Position.zw);
+    EmitVertex();
+}
+
+void main() {
+    vec2 start = to_pixels(1);
+    vec2 end = to_pixels(2);
+
+    // a repeated vertex has no direction, the segments around it get caps instead
+    float len = length(end - start);
+    if(len == 0.0)
+        return;
+
+    vec2 dir = (end - start) / len;
+    vec2 normal = vec2(-dir.y, dir.x);
+
+    float half_width = v_Width[1] * 0.5;
+    float extent = half_width + c_Feather;
+
+    // the adjacency of the first and last segment of an open strip repeats their end
+    vec2 before = start - to_pixels(0);
+    vec2 after = to_pixels(3) - end;
+
+    vec2 first = start;
+    vec2 first_side = normal * extent;
+    if(dot(before, before) > 0.0)
+        first_side = miter(normal, before, extent);
+    else
+        first -= dir * half_width;
+
+    vec2 last = end;
+    vec2 last_side = normal * extent;
+    if(dot(after, after) > 0.0)
+        last_side = miter(normal, after, extent);
+    else
+        last += dir * half_width;
+
+    emit(first + first_side, start, dir, normal);
+    emit(first - first_side, start, dir, normal);
+    emit(last + last_side, start, dir, normal);
+    emit(last - last_side, start, dir, normal);
+    EndPrimitive();
+}
@@ -2,21 +2,17 @@
 
 layout (location = 0) out vec4 frag_Color;
 
-flat in vec2 v_StartPos;
-in vec2 v_VertPos;
-
-uniform vec2 u_Resolution;
+in vec4 g_Color;
+in float g_Across;
+in float g_Along;
+flat in float g_HalfWidth;
 
 const float c_DashSize = 20;
-const vec4 c_SelColor = vec4(0.0, 1.0, 1.0, 1.0);
 
 void main() {
-    vec2 dir = (v_VertPos - v_StartPos) * u_Resolution / 2.0;
-    float dist = length(dir);
-
-    if(fract(dist / c_DashSize * 2.0) > c_DashSize / (c_DashSize * 2.0))
+    if(fract(g_Along / c_DashSize * 2.0) > c_DashSize / (c_DashSize * 2.0))
         discard;
 
-    frag_Color = c_SelColor;
+    float coverage = clamp(g_HalfWidth + 0.5 - abs(g_Across), 0.0, 1.0);
+    frag_Color = vec4(g_Color.rgb, g_Color.a * coverage);
 }
-
@@ -6,16 +6,19 @@ layout (location = 1) in uint a_Metadata;
 uniform vec2 u_Scale;
 uniform vec2 u_Translation;
 
-flat out vec2 v_StartPos;
-out vec2 v_VertPos;
+out vec4 v_Color;
+out float v_Width;
+
+const vec4 c_SelColor = vec4(0.0, 1.0, 1.0, 1.0);
+const float c_SelWidth = 4.0;
 
 void main() {
-    v_VertPos = (a_Position + u_Translation) * u_Scale;
-    v_StartPos = v_VertPos;
+    v_Color = c_SelColor;
+    v_Width = c_SelWidth;
+
     gl_Position = vec4(
-        v_VertPos, 
+        (a_Position + u_Translation) * u_Scale,
         1.0,
         1.0
     );
 }
-
@@ -7,6 +7,8 @@ uniform vec2 u_Scale;
 uniform vec2 u_Translation;
 
 out vec4 v_Color;
+// in pixels, see `map_line_geometry.glsl`
+out float v_Width;
 
 const vec4 c_Colormap[] = vec4[](
     vec4(0.3, 0.3, 0.3, 0.5), // unknown
@@ -45,8 +47,16 @@ const vec4 c_Colormap[] = vec4[](
     vec4(1.0, 0.0, 1.0, 1.0)
 );
 
+// set on the metadata of the triangles of areas, see `VertexPool::fill_flag`
+const uint c_FillFlag = 0x10000u;
+const float c_FillAlpha = 0.35;
+
 void main() {
     v_Color = c_Colormap[a_Metadata & 0xff];
+    if((a_Metadata & c_FillFlag) != 0u)
+        v_Color.a *= c_FillAlpha;
+
+    v_Width = float((a_Metadata >> 8) & 0xffu);
 
     gl_Position = vec4(
         ((a_Position + u_Translation) * u_Scale), 
@@ -0,0 +1,211 @@
+#include "tags.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+
+auto Tag::key() const -> std::string_view {
+    return TagPool::instance().string(m_key);
+}
+
+auto Tag::value() const -> std::string_view {
+    return TagPool::instance().string(m_value);
+}
+
+auto TagSet::find(Tag::Id key) const -> std::optional<std::string_view> {
+    auto tag = std::lower_bound(m_tags.begin(), m_tags.end(), key, [](const Tag& tag, Tag::Id key) {
+        return tag.m_key < key;
+    });
+
+    if(tag == m_tags.end() || tag->m_key != key)
+        return std::nullopt;
+    return tag->value();
+}
+
+auto TagSet::find(std::string_view key) const -> std::optional<std::string_view> {
+    // a key that was never interned cannot be in any set
+    auto id = TagPool::instance().lookup(key);
+    return id ? find(*id) : std::nullopt;
+}
+
+auto TagSet::empty_set() -> const TagSet* {
+    static const TagSet empty;
+    return &empty;
+}
+
+auto TagPool::instance() -> TagPool& {
+    static TagPool pool;
+    return pool;
+}
+
+auto TagPool::intern(std::string_view string) -> Tag::Id {
+    const size_t shard_index = std::hash<std::string_view>()(string) & (shard_count - 1);
+    auto& shard = m_string_shards[shard_index];
+
+    {
+        std::shared_lock<std::shared_mutex> lock(shard.m_mutex);
+        auto it = shard.m_ids.find(string);
+        if(it != shard.m_ids.end())
+            return it->second;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(shard.m_mutex);
+    auto it = shard.m_ids.find(string);
+    if(it != shard.m_ids.end())
+        return it->second;
+
+    char* data;
+    if(string.size() > block_size / 4) {
+        // long strings get a block of their own instead of wasting the rest of the current one;
+        // it goes in front so that the last block stays the one being filled
+        shard.m_blocks.insert(shard.m_blocks.begin(), std::make_unique<char[]>(string.size()));
+        data = shard.m_blocks.front().get();
+    }
+    else {
+        if(shard.m_block_used + string.size() > block_size) {
+            shard.m_blocks.push_back(std::make_unique<char[]>(block_size));
+            shard.m_block_used = 0;
+        }
+
+        data = shard.m_blocks.back().get() + shard.m_block_used;
+        shard.m_block_used += string.size();
+    }
+
+    std::memcpy(data, string.data(), string.size());
+    shard.m_bytes += string.size();
+
+    const std::string_view stored(data, string.size());
+    const Tag::Id id = Tag::Id(shard.m_strings.size() << shard_bits | shard_index);
+    shard.m_strings.push_back(stored);
+    shard.m_ids.emplace(stored, id);
+
+    return id;
+}
+
+auto TagPool::lookup(std::string_view string) const -> std::optional<Tag::Id> {
+    auto& shard = m_string_shards[std::hash<std::string_view>()(string) & (shard_count - 1)];
+
+    std::shared_lock<std::shared_mutex> lock(shard.m_mutex);
+    auto it = shard.m_ids.find(string);
+    if(it == shard.m_ids.end())
+        return std::nullopt;
+    return it->second;
+}
+
+auto TagPool::string(Tag::Id id) const -> std::string_view {
+    auto& shard = m_string_shards[id & (shard_count - 1)];
+
+    std::shared_lock<std::shared_mutex> lock(shard.m_mutex);
+    return shard.m_strings[id >> shard_bits];
+}
+
+auto TagPool::intern_set(std::vector<Tag>& tags) -> const TagSet* {
+    if(tags.empty())
+        return TagSet::empty_set();
+
+    // stable, so that the first of repeated keys survives like it did with `std::unordered_map::insert`
+    std::stable_sort(tags.begin(), tags.end(), [](const Tag& a, const Tag& b) {
+        return a.m_key < b.m_key;
+    });
+    tags.erase(std::unique(tags.begin(), tags.end(), [](const Tag& a, const Tag& b) {
+        return a.m_key == b.m_key;
+    }), tags.end());
+
+    TagSet candidate;
+    candidate.m_tags = std::move(tags);
+
+    size_t hash = candidate.m_tags.size();
+    for(auto& tag : candidate.m_tags)
+        hash = (hash ^ (uint64_t(tag.m_key) << 32 | tag.m_value)) * 0x100000001b3ull;
+    candidate.m_hash = hash;
+
+    auto& shard = m_set_shards[(hash >> 7) & (shard_count - 1)];
+    std::lock_guard<std::mutex> lock(shard.m_mutex);
+
+    auto it = shard.m_sets.find(&candidate);
+    if(it != shard.m_sets.end()) {
+        tags = std::move(candidate.m_tags);
+        tags.clear();
+        return *it;
+    }
+
+    candidate.m_tags.shrink_to_fit();
+    auto& stored = shard.m_storage.emplace_back(std::move(candidate));
+    shard.m_sets.insert(&stored);
+    return &stored;
+}
+
+void TagPool::log_stats(size_t way_count) const {
+    if(way_count == 0)
+        return;
+
+    size_t string_count = 0, string_bytes = 0, set_count = 0, set_tags = 0;
+
+    for(auto& shard : m_string_shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.m_mutex);
+        string_count += shard.m_strings.size();
+        string_bytes += shard.m_bytes;
+    }
+
+    for(auto& shard : m_set_shards) {
+        std::lock_guard<std::mutex> lock(shard.m_mutex);
+        set_count += shard.m_storage.size();
+        for(auto& set : shard.m_storage)
+            set_tags += set.size();
+    }
+
+    // rough: hash map nodes and bucket slots for the strings and sets, plus the set pointer in every way
+    const size_t pool_bytes = string_bytes + string_count * 64 + set_count * (sizeof(TagSet) + 48) + set_tags * sizeof(Tag)
+        + way_count * sizeof(const TagSet*);
+
+    const uint64_t sets_built = m_sets_built.load();
+    const double map_bytes_per_way = sets_built ? double(m_map_bytes.load()) / sets_built : 0.0;
+
+    mlog::logln(mlog::INFO, "tags: %zu strings (%.1f MiB), %zu distinct tag sets for %zu ways", string_count,
+        string_bytes / 1024.0 / 1024.0, set_count, way_count);
+    mlog::logln(mlog::INFO, "  %.1f bytes/way interned, ~%.1f bytes/way as per-way hash maps", double(pool_bytes) / way_count,
+        map_bytes_per_way);
+}
+
+void RawTags::add(std::string_view key, std::string_view value) {
+    if(m_size == m_tags.size())
+        m_tags.emplace_back();
+
+    m_tags[m_size].first.assign(key);
+    m_tags[m_size].second.assign(value);
+    m_size++;
+}
+
+auto RawTags::find(std::string_view key) const -> std::optional<std::string_view> {
+    for(auto it = begin(); it != end(); ++it) {
+        if(it->first == key)
+            return std::string_view(it->second);
+    }
+
+    return std::nullopt;
+}
+
+// heap bytes of a `std::string`, which keeps up to 15 characters inline
+static auto string_heap_bytes(size_t length) -> size_t {
+    return length > 15 ? (length + 1 + 15) / 16 * 16 : 0;
+}
+
+void TagBuilder::add(std::string_view key, std::string_view value) {
+    auto& pool = TagPool::instance();
+    m_tags.push_back({pool.intern(key), pool.intern(value)});
+
+    // a node with the key/value pair, its cached hash and the next pointer, plus a bucket slot
+    m_map_bytes += 96 + 8 + string_heap_bytes(key.size()) + string_heap_bytes(value.size());
+}
+
+auto TagBuilder::build() -> const TagSet* {
+    auto& pool = TagPool::instance();
+
+    pool.m_sets_built.fetch_add(1, std::memory_order_relaxed);
+    pool.m_map_bytes.fetch_add(sizeof(std::unordered_map<std::string, std::string>) + m_map_bytes, std::memory_order_relaxed);
+    m_map_bytes = 0;
+
+    return pool.intern_set(m_tags);
+}
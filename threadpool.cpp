@@ -0,0 +1,72 @@
+#include "threadpool.hpp"
+#include "phasetimer.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned num_threads) {
+    if(!num_threads)
+        num_threads = default_size();
+
+    for(unsigned i = 0; i < num_threads; i++)
+        m_workers.emplace_back([this]() { work(); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+
+    m_task_cond.notify_all();
+
+    for(auto& worker : m_workers)
+        worker.join();
+}
+
+auto ThreadPool::default_size() -> unsigned {
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push(std::move(task));
+    }
+
+    m_task_cond.notify_one();
+}
+
+void ThreadPool::wait() {
+    // the workers charge their own phases, the time would be counted twice
+    PhasePause pause;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle_cond.wait(lock, [this]() { return m_tasks.empty() && m_active == 0; });
+}
+
+void ThreadPool::work() {
+    for(;;) {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_task_cond.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+
+            if(m_stopping && m_tasks.empty())
+                return;
+
+            task = std::move(m_tasks.front());
+            m_tasks.pop();
+            m_active++;
+        }
+
+        task();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_active--;
+            if(m_tasks.empty() && m_active == 0)
+                m_idle_cond.notify_all();
+        }
+    }
+}
@@ -0,0 +1,329 @@
+#include "tilecache.hpp"
+#include "log.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#include <glm/common.hpp>
+
+// building tiles stops for the frame once this is used up, but at least one tile in view is built every frame
+constexpr auto build_budget = std::chrono::milliseconds(4);
+
+// how far ahead prefetching looks, in seconds
+constexpr float prefetch_lookahead = 0.5f;
+
+// the share of the latest frame in the smoothed velocity
+constexpr float velocity_smoothing = 0.3f;
+
+TileCache::TileCache(WayArena& ways, bool shared_vertices, size_t vram_budget, unsigned cull_threads)
+    : m_ways(ways), m_shared_vertices(shared_vertices), m_budget(vram_budget)
+{
+    if(cull_threads == 0)
+        cull_threads = ThreadPool::default_size();
+    if(cull_threads > 1)
+        m_cull_pool = std::make_unique<ThreadPool>(cull_threads);
+}
+
+void TileCache::init(BVH& bvh) {
+    assert(m_tiles.empty());
+
+    std::vector<BVH*> roots;
+    bvh.assign_tiles(tile_depth, 0, 0, roots);
+
+    m_tiles.resize(roots.size());
+    for(size_t i = 0; i < roots.size(); i++) {
+        m_tiles[i].m_root = roots[i];
+        m_tiles[i].m_bounds = *roots[i];
+    }
+
+    // the root keeps the ways that reach out of the map, it is drawn whatever the view
+    const float inf = std::numeric_limits<float>::infinity();
+    m_tiles[0].m_bounds = BBox(glm::vec2(-inf), glm::vec2(inf));
+
+    m_stats.m_tiles = m_tiles.size();
+}
+
+void TileCache::add_way(WayHandle handle, const BVH& node) {
+    auto index = node.get_tile();
+    auto& tile = m_tiles[index];
+    tile.m_ways.push_back(handle);
+
+    if(m_way_tiles.size() <= handle)
+        m_way_tiles.resize(handle + 1);
+    m_way_tiles[handle] = index;
+
+    tile.m_top_priority = std::min<int>(tile.m_top_priority, m_ways.metadata(handle).draw_priority());
+    tile.m_estimated_bytes += estimate_bytes(handle);
+
+    // resident tiles grow with the map, the pool uploads the way with the next frame
+    if(tile.m_pool)
+        m_ways[handle].set_vertex_range(tile.m_pool->add(m_ways.coords(handle), m_ways.lod(handle), m_ways.fill(handle), m_ways.metadata(handle), m_ways[handle].get_ring_ends()));
+}
+
+auto TileCache::estimate_bytes(WayHandle handle) const -> size_t {
+    auto coords = m_ways.coords(handle);
+    auto lod = m_ways.lod(handle);
+
+    size_t in_level[lod_levels] = {};
+    for(size_t i = 0; i < coords.size(); i++)
+        in_level[lod[i]]++;
+
+    for(int level = lod_levels - 2; level >= 0; level--)
+        in_level[level] += in_level[level + 1];
+
+    // the vertices of adjacency of every strip
+    const size_t strips = std::max<size_t>(m_ways[handle].get_ring_ends().size(), 1);
+    for(auto& count : in_level)
+        count += 2 * strips;
+
+    // the levels above 0 are indices; one as big as the finer level shares its indices, see `VertexPool`
+    size_t indices = m_shared_vertices ? in_level[0] : 0;
+    for(int level = 1; level < lod_levels; level++) {
+        if(in_level[level] != in_level[level - 1] || (level == 1 && !m_shared_vertices))
+            indices += in_level[level];
+    }
+
+    // the triangles of an area, with a metadata value of their own
+    auto fill = m_ways.fill(handle);
+    if(!fill.empty())
+        indices += fill.index_count() + 1;
+
+    // shared vertices are counted as if every one was distinct
+    return (coords.size() + 2 * strips) * sizeof(glm::vec2) + indices * sizeof(GLuint) + sizeof(GLuint);
+}
+
+void TileCache::finish_loading() {
+    m_loaded = true;
+
+    for(auto index : m_resident)
+        m_tiles[index].m_pool->finish();
+
+    size_t total = 0, used = 0;
+    for(auto& tile : m_tiles) {
+        total += tile.m_estimated_bytes;
+        used += !tile.m_ways.empty();
+    }
+
+    mlog::logln(mlog::INFO, "tiles: %zu of %zu hold ways, about %.1f MiB of buffers in all", used, m_tiles.size(),
+        total / 1024.0 / 1024.0);
+}
+
+bool TileCache::update(const BBox& view, DrawPriority priority) {
+    const auto start = Clock::now();
+    m_frame++;
+
+    bool changed = false;
+    m_stats.m_resident_bytes = 0;
+    for(auto index : m_resident) {
+        // everything added since the last frame goes up in one piece
+        auto& pool = *m_tiles[index].m_pool;
+        changed |= pool.upload();
+        m_stats.m_resident_bytes += pool.gpu_bytes();
+    }
+
+    m_visible.clear();
+    m_pending.clear();
+    for(uint32_t i = 0; i < m_tiles.size(); i++) {
+        auto& tile = m_tiles[i];
+        if(!is_wanted(tile, view, priority))
+            continue;
+
+        tile.m_last_used = m_frame;
+        if(tile.m_pool) {
+            m_visible.push_back(i);
+            m_stats.m_hits++;
+        }
+        else {
+            m_pending.push_back(i);
+            m_stats.m_misses++;
+        }
+    }
+
+    // tiles in view are built over the budget if they have to be
+    size_t built = 0;
+    for(; built < m_pending.size(); built++) {
+        if(built > 0 && Clock::now() - start > build_budget)
+            break;
+
+        make_room(m_tiles[m_pending[built]].m_estimated_bytes);
+        build(m_pending[built]);
+        m_visible.push_back(m_pending[built]);
+    }
+
+    m_stats.m_complete = built == m_pending.size();
+    if(!m_stats.m_complete)
+        m_stats.m_stall_frames++;
+    changed |= built > 0;
+
+    // zooming in brings in the next draw priority
+    auto predicted = predict(view);
+    int predicted_priority = m_zoom_rate < 0.0f ? std::min(priority + 1, int(__DRAW_PRIO_LAST)) : priority;
+
+    m_pending.clear();
+    for(uint32_t i = 0; i < m_tiles.size(); i++) {
+        auto& tile = m_tiles[i];
+        if(tile.m_last_used == m_frame || !is_wanted(tile, predicted, predicted_priority))
+            continue;
+
+        // a tile the view is heading for is as good as used
+        tile.m_last_used = m_frame;
+        if(!tile.m_pool)
+            m_pending.push_back(i);
+    }
+
+    // nearest first
+    const auto center = (view.min_coord() + view.max_coord()) * 0.5f;
+    std::sort(m_pending.begin(), m_pending.end(), [&](uint32_t a, uint32_t b) {
+        return m_tiles[a].m_bounds.distance2(center) < m_tiles[b].m_bounds.distance2(center);
+    });
+
+    for(auto index : m_pending) {
+        if(Clock::now() - start > build_budget)
+            break;
+        if(!make_room(m_tiles[index].m_estimated_bytes))
+            continue;
+
+        build(index);
+        m_stats.m_prefetches++;
+    }
+
+    // resident tiles grow while loading
+    make_room(0);
+
+    m_stats.m_resident_tiles = m_resident.size();
+    m_stats.m_visible_tiles = m_visible.size();
+    return changed;
+}
+
+auto TileCache::predict(const BBox& view) -> BBox {
+    const auto now = Clock::now();
+    const auto center = (view.min_coord() + view.max_coord()) * 0.5f;
+    const auto size = view.bbox_size();
+
+    const float dt = std::chrono::duration<float>(now - m_last_time).count();
+    if(m_last_size.x > 0.0f && size.x > 0.0f && dt > 0.0f) {
+        m_velocity += ((center - m_last_center) / dt - m_velocity) * velocity_smoothing;
+        m_zoom_rate += (std::log(size.x / m_last_size.x) / dt - m_zoom_rate) * velocity_smoothing;
+    }
+
+    m_last_time = now;
+    m_last_center = center;
+    m_last_size = size;
+
+    // zooming in keeps within the view
+    auto ahead_center = center + m_velocity * prefetch_lookahead;
+    auto ahead_size = size * std::exp(std::max(m_zoom_rate, 0.0f) * prefetch_lookahead);
+
+    return BBox(glm::min(view.min_coord(), ahead_center - ahead_size * 0.5f),
+        glm::max(view.max_coord(), ahead_center + ahead_size * 0.5f));
+}
+
+void TileCache::build(uint32_t index) {
+    auto& tile = m_tiles[index];
+    assert(!tile.m_pool);
+
+    tile.m_pool = std::make_unique<VertexPool>(m_shared_vertices);
+    for(auto handle : tile.m_ways)
+        m_ways[handle].set_vertex_range(tile.m_pool->add(m_ways.coords(handle), m_ways.lod(handle), m_ways.fill(handle), m_ways.metadata(handle), m_ways[handle].get_ring_ends()));
+
+    if(m_loaded)
+        tile.m_pool->finish();
+
+    tile.m_pool->upload();
+
+    m_resident.push_back(index);
+    m_stats.m_resident_bytes += tile.m_pool->gpu_bytes();
+}
+
+void TileCache::evict(size_t resident_index) {
+    auto& tile = m_tiles[m_resident[resident_index]];
+
+    // the vertex ranges of its ways are stale until it is built again
+    m_stats.m_resident_bytes -= tile.m_pool->gpu_bytes();
+    tile.m_pool.reset();
+
+    m_resident[resident_index] = m_resident.back();
+    m_resident.pop_back();
+    m_stats.m_evictions++;
+}
+
+bool TileCache::make_room(size_t bytes) {
+    if(m_budget == 0)
+        return true;
+
+    while(m_stats.m_resident_bytes + bytes > m_budget) {
+        size_t lru = m_resident.size();
+        for(size_t i = 0; i < m_resident.size(); i++) {
+            auto last_used = m_tiles[m_resident[i]].m_last_used;
+            if(last_used < m_frame && (lru == m_resident.size() || last_used < m_tiles[m_resident[lru]].m_last_used))
+                lru = i;
+        }
+
+        if(lru == m_resident.size())
+            return false;
+
+        evict(lru);
+    }
+
+    return true;
+}
+
+void TileCache::collect(const BBox& view, DrawPriority priority, int lod_level) {
+    const auto start = Clock::now();
+
+    while(m_lists.size() < m_visible.size())
+        m_lists.emplace_back(m_shared_vertices);
+
+    // tiles share nothing but the arena, which is not written to while drawing
+    auto cull_tile = [&](size_t i) {
+        auto& tile_list = m_lists[i];
+        tile_list.clear();
+        tile_list.set_lod_level(lod_level);
+        m_tiles[m_visible[i]].m_root->collect(m_ways, view, priority, tile_list);
+    };
+
+    double busy_seconds = -1.0;
+    if(m_cull_pool && m_visible.size() > 1)
+        busy_seconds = m_cull_pool->timed_parallel_for(m_visible.size(), cull_tile);
+    else {
+        for(size_t i = 0; i < m_visible.size(); i++)
+            cull_tile(i);
+    }
+
+    m_stats.m_cull_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    m_stats.m_cull_busy_ms = busy_seconds < 0.0 ? m_stats.m_cull_ms : busy_seconds * 1000.0;
+
+    m_stats.m_drawn_ways = 0;
+    m_stats.m_drawn_commands = 0;
+    m_stats.m_drawn_vertices = 0;
+    m_stats.m_drawn_triangles = 0;
+
+    for(size_t i = 0; i < m_visible.size(); i++) {
+        auto& tile_list = m_lists[i];
+        m_stats.m_drawn_ways += tile_list.way_count();
+        m_stats.m_drawn_commands += tile_list.command_count();
+        m_stats.m_drawn_vertices += tile_list.vertex_count();
+        m_stats.m_drawn_triangles += tile_list.triangle_count();
+    }
+}
+
+auto TileCache::draw(DrawPass pass) -> size_t {
+    size_t calls = 0;
+    for(size_t i = 0; i < m_visible.size(); i++)
+        calls += m_tiles[m_visible[i]].m_pool->draw(m_lists[i], pass);
+
+    return calls;
+}
+
+auto TileCache::draw_way(WayHandle handle, DrawList& list) -> size_t {
+    auto& tile = m_tiles[m_way_tiles[handle]];
+    if(!tile.m_pool)
+        return 0;
+
+    // only outlined
+    list.clear();
+    list.add(m_ways[handle], false);
+    return tile.m_pool->draw(list, DRAW_LINES);
+}
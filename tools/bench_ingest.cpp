@@ -0,0 +1,268 @@
+// Headless ingest benchmark: runs the full ingest of an OSM file without a window
+// or GL context and prints throughput, peak memory and per-phase times as JSON,
+// so that builds can be compared against each other.
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "bvh.hpp"
+#include "log.hpp"
+#include "pbf.hpp"
+#include "phasetimer.hpp"
+#include "preprocess.hpp"
+#include "threadpool.hpp"
+#include "vertexpool.hpp"
+#include "wayarena.hpp"
+#include "waysink.hpp"
+
+// places ways in a BVH like `Map` does, but never creates their GL buffers;
+// shared vertices are pooled without being uploaded
+class BenchSink : public WaySink {
+public:
+    BenchSink(bool shared_vertices) {
+        if(shared_vertices)
+            m_vertex_pool = std::make_unique<VertexPool>(true);
+    }
+
+    void init_bvh(std::pair<glm::vec2, glm::vec2> minmax_coords, size_t max_depth) override {
+        m_bvh = std::make_unique<BVH>(minmax_coords, max_depth, 0);
+    }
+
+    bool has_bvh() const override {
+        return m_bvh != nullptr;
+    }
+
+    void add_way(Way&& way) override {
+        auto handle = pool_vertices(m_ways.add(std::move(way)));
+
+        PhaseTimer timer(PHASE_INDEX);
+        m_bvh->add_way(m_ways, handle);
+    }
+
+    void add_way_at(size_t bvh_index, Way&& way) override {
+        insert_at(bvh_index, pool_vertices(m_ways.add(std::move(way))));
+    }
+
+    void add_mapped_way_at(size_t bvh_index, Way&& way, MappedGeometry geometry) override {
+        insert_at(bvh_index, pool_vertices(m_ways.add(std::move(way), std::move(geometry))));
+    }
+
+    inline auto way_count() const -> uint64_t {
+        return m_ways.size();
+    }
+
+    inline auto vertex_count() const -> uint64_t {
+        return m_ways.vertex_count();
+    }
+
+    inline auto geometry_bytes() const -> uint64_t {
+        return m_ways.geometry_bytes();
+    }
+
+    inline auto vertex_pool() const -> const VertexPool* {
+        return m_vertex_pool.get();
+    }
+
+private:
+    void insert_at(size_t bvh_index, WayHandle handle) {
+        PhaseTimer timer(PHASE_INDEX);
+        if(m_flat_bvh.empty())
+            m_bvh->flatten(m_flat_bvh);
+
+        m_flat_bvh[bvh_index]->insert_way(m_ways, handle);
+    }
+
+    // the vertices of a way the arena holds now
+    auto pool_vertices(WayHandle handle) -> WayHandle {
+        if(m_vertex_pool) {
+            PhaseTimer timer(PHASE_GEOMETRY);
+            m_vertex_pool->add(m_ways.coords(handle), m_ways.lod(handle), m_ways.fill(handle), m_ways.metadata(handle), m_ways[handle].get_ring_ends());
+        }
+
+        return handle;
+    }
+
+    WayArena m_ways;
+    std::unique_ptr<VertexPool> m_vertex_pool;
+    std::unique_ptr<BVH> m_bvh;
+    std::vector<BVH*> m_flat_bvh;
+};
+
+static void print_usage(const char* argv0) {
+    mlog::logln(mlog::ERROR, "Usage: %s %s [--output <json file>] [--serial-baseline] <osm file | ->", argv0, ingest_usage);
+}
+
+static auto json_string(std::string_view text) -> std::string {
+    std::string escaped = "\"";
+    for(char c : text) {
+        if(c == '"' || c == '\\')
+            escaped += '\\';
+
+        if(static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        }
+        else
+            escaped += c;
+    }
+
+    return escaped + '"';
+}
+
+static auto per_second(double count, double seconds) -> double {
+    return seconds > 0.0 ? count / seconds : 0.0;
+}
+
+auto main(int argc, char** argv) -> int {
+    // the report goes to stdout as well, so only problems are logged by default
+    mlog::init(mlog::WARN);
+    mlog::init_from_env("MAP_LOG");
+
+    IngestOptions options;
+    const char* input_path = nullptr;
+    const char* output_path = nullptr;
+    bool serial_baseline = false;
+
+    for(int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+
+        int parsed = parse_ingest_option(argc, argv, i, options);
+        if(parsed < 0)
+            return 1;
+        else if(parsed > 0)
+            continue;
+        else if(arg == "--output" && i + 1 < argc)
+            output_path = argv[++i];
+        else if(arg == "--serial-baseline")
+            serial_baseline = true;
+        else if(!input_path && (arg[0] != '-' || arg == "-"))
+            input_path = argv[i];
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(!input_path) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if(serial_baseline && std::string_view(input_path) == "-") {
+        mlog::logln(mlog::ERROR, "--serial-baseline reads the input twice, it cannot be stdin");
+        return 1;
+    }
+
+    // a warm start would only measure the cache
+    options.use_cache = false;
+
+    struct stat input_stat;
+    const uint64_t input_size = std::string_view(input_path) != "-" && stat(input_path, &input_stat) == 0 ? input_stat.st_size : 0;
+
+    enable_phase_timing();
+
+    BenchSink sink(options.shared_vertices);
+    std::optional<CacheTarget> cache_target;
+
+    const auto start = std::chrono::steady_clock::now();
+    const int status = ingest_data(input_path, sink, options, cache_target);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    // run after the timed ingest, so that it counts towards neither its phases nor its peak memory
+    std::optional<double> serial_seconds;
+    if(serial_baseline && status == 0) {
+        disable_phase_timing();
+
+        IngestOptions serial_options = options;
+        serial_options.jobs = 1;
+        BenchSink serial_sink(options.shared_vertices);
+        std::optional<CacheTarget> serial_target;
+
+        const auto serial_start = std::chrono::steady_clock::now();
+        if(ingest_data(input_path, serial_sink, serial_options, serial_target) == 0)
+            serial_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - serial_start).count();
+    }
+
+    FILE* output = output_path ? std::fopen(output_path, "w") : stdout;
+    if(!output) {
+        mlog::logln(mlog::ERROR, "Could not open `%s`", output_path);
+        return 1;
+    }
+
+    const uint64_t nodes = parsed_node_count();
+
+    std::fprintf(output, "{\n");
+    std::fprintf(output, "  \"input\": %s,\n", json_string(input_path).c_str());
+    std::fprintf(output, "  \"format\": \"%s\",\n", is_pbf_file(input_path) ? "pbf" : "xml");
+    std::fprintf(output, "  \"input_bytes\": %lu,\n", input_size);
+    std::fprintf(output, "  \"threads\": %u,\n", options.jobs ? options.jobs : ThreadPool::default_size());
+    std::fprintf(output, "  \"node_store\": \"%s\",\n", NodeStore::mode_name(options.node_store));
+    std::fprintf(output, "  \"memory_budget_mib\": %zu,\n", options.memory_budget / 1024 / 1024);
+    std::fprintf(output, "  \"filter\": %s,\n", options.filter ? json_string(options.filter->name()).c_str() : "null");
+    std::fprintf(output, "  \"status\": %d,\n", status);
+    std::fprintf(output, "  \"seconds\": %.4f,\n", seconds);
+    if(serial_seconds) {
+        std::fprintf(output, "  \"serial_seconds\": %.4f,\n", *serial_seconds);
+        std::fprintf(output, "  \"speedup\": %.2f,\n", per_second(*serial_seconds, seconds));
+    }
+    std::fprintf(output, "  \"mib_per_s\": %.2f,\n", per_second(input_size / 1024.0 / 1024.0, seconds));
+    std::fprintf(output, "  \"nodes\": %lu,\n", nodes);
+    std::fprintf(output, "  \"nodes_per_s\": %.0f,\n", per_second(nodes, seconds));
+    std::fprintf(output, "  \"ways\": %lu,\n", sink.way_count());
+    std::fprintf(output, "  \"ways_per_s\": %.0f,\n", per_second(sink.way_count(), seconds));
+    std::fprintf(output, "  \"vertices\": %lu,\n", sink.vertex_count());
+    std::fprintf(output, "  \"geometry_bytes\": %lu,\n", sink.geometry_bytes());
+    if(auto pool = sink.vertex_pool()) {
+        std::fprintf(output, "  \"shared_vertices\": %zu,\n", pool->vertex_count());
+        std::fprintf(output, "  \"shared_buffer_bytes\": %zu,\n", pool->vertex_bytes());
+        std::fprintf(output, "  \"unshared_buffer_bytes\": %zu,\n", pool->unshared_vertex_bytes());
+    }
+
+    // at every level of detail, on however many threads built them
+    const auto areas = triangulation_stats();
+    std::fprintf(output, "  \"areas\": %lu,\n", areas.m_polygons);
+    std::fprintf(output, "  \"area_vertices\": %lu,\n", areas.m_vertices);
+    std::fprintf(output, "  \"triangles\": %lu,\n", areas.m_triangles);
+    std::fprintf(output, "  \"triangles_per_s\": %.0f,\n", per_second(areas.m_triangles, phase_seconds(PHASE_TRIANGULATE)));
+    std::fprintf(output, "  \"worst_area_ms\": %.3f,\n", areas.m_worst_seconds * 1000.0);
+    std::fprintf(output, "  \"worst_area_vertices\": %lu,\n", areas.m_worst_vertices);
+
+    std::fprintf(output, "  \"peak_rss_bytes\": %ld,\n", usage.ru_maxrss * 1024);
+
+    // summed over all threads
+    double phase_total = 0.0;
+    std::fprintf(output, "  \"phase_seconds\": {");
+    for(int phase = 0; phase < __PHASE_LAST; phase++) {
+        std::fprintf(output, "%s\n    \"%s\": %.4f", phase ? "," : "", phase_name(IngestPhase(phase)),
+            phase_seconds(IngestPhase(phase)));
+        phase_total += phase_seconds(IngestPhase(phase));
+    }
+    std::fprintf(output, "\n  },\n");
+    std::fprintf(output, "  \"max_thread_phase_seconds\": %.4f\n}\n", max_thread_phase_seconds());
+
+    if(output != stdout)
+        std::fclose(output);
+
+    // no thread can spend more time in phases than the ingest took, nor can all of them
+    // together on a single thread; more means that some time was charged twice
+    const double limit = seconds * 1.01 + 0.001;
+    if(max_thread_phase_seconds() > limit || (options.jobs == 1 && phase_total > limit)) {
+        mlog::logln(mlog::ERROR, "Phase times add up to %.2fs, %.2fs on one thread, in %.2fs", phase_total,
+            max_thread_phase_seconds(), seconds);
+        return status ? status : 1;
+    }
+
+    return status;
+}
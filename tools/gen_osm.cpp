@@ -0,0 +1,1107 @@
+// Synthetic OSM data for scale tests.
+//
+// Writes a seeded map of roads, areas and tagged points as OSM XML or PBF. The same
+// seed and settings always give the same elements, in either format, so a file can be
+// regenerated anywhere instead of being shipped around. Elements are generated in
+// sequential passes from per-element random streams, which keeps the memory use
+// constant from a few MiB up to tens of GiB of output.
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+
+#include "log.hpp"
+
+// random numbers
+
+// the std distributions differ between standard libraries, so everything is derived from splitmix64
+static inline auto mix64(uint64_t x) -> uint64_t {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// independent streams per purpose and element, so that every pass can regenerate any element
+enum Stream : uint64_t {
+    STREAM_PLAN = 1,
+    STREAM_GEOMETRY,
+    STREAM_TAGS,
+    STREAM_POINTS,
+    STREAM_IDS,
+};
+
+class Random {
+public:
+    Random(uint64_t seed, Stream stream, uint64_t index)
+        : m_state(mix64(mix64(seed) ^ mix64(uint64_t(stream) << 56 ^ index)))
+    {}
+
+    inline auto next() -> uint64_t {
+        m_state += 0x9e3779b97f4a7c15ull;
+        return mix64(m_state);
+    }
+
+    // in [0, 1)
+    inline auto uniform() -> double {
+        return (next() >> 11) * 0x1.0p-53;
+    }
+
+    // in [min, max]
+    inline auto range(uint64_t min, uint64_t max) -> uint64_t {
+        return min + next() % (max - min + 1);
+    }
+
+    inline bool chance(double probability) {
+        return uniform() < probability;
+    }
+
+private:
+    uint64_t m_state;
+};
+
+// what the generated ways are
+
+struct FeatureClass {
+    const char* m_key;
+    const char* m_value;
+    // a second tag, like footway=sidewalk
+    const char* m_sub_key;
+    const char* m_sub_value;
+
+    double m_weight;
+    // segment length of lines, radius of areas, in meters
+    double m_size;
+};
+
+// the values of `highway_classifications` in way.cpp, weighted roughly like in real extracts
+static const FeatureClass line_classes[] = {
+    {"highway", "residential", nullptr, nullptr, 260, 40},
+    {"highway", "service", nullptr, nullptr, 220, 25},
+    {"highway", "footway", nullptr, nullptr, 100, 15},
+    {"highway", "footway", "footway", "sidewalk", 35, 15},
+    {"highway", "footway", "footway", "crossing", 15, 8},
+    {"highway", "track", nullptr, nullptr, 110, 60},
+    {"highway", "unclassified", nullptr, nullptr, 60, 60},
+    {"highway", "tertiary", nullptr, nullptr, 40, 80},
+    {"highway", "tertiary_link", nullptr, nullptr, 1, 30},
+    {"highway", "secondary", nullptr, nullptr, 28, 80},
+    {"highway", "secondary_link", nullptr, nullptr, 1, 30},
+    {"highway", "primary", nullptr, nullptr, 22, 100},
+    {"highway", "primary_link", nullptr, nullptr, 2, 30},
+    {"highway", "trunk", nullptr, nullptr, 8, 120},
+    {"highway", "trunk_link", nullptr, nullptr, 2, 40},
+    {"highway", "motorway", nullptr, nullptr, 6, 150},
+    {"highway", "motorway_link", nullptr, nullptr, 4, 50},
+    {"highway", "motorway_junction", nullptr, nullptr, 0.1, 20},
+    {"highway", "cycleway", nullptr, nullptr, 20, 30},
+    {"highway", "living_street", nullptr, nullptr, 10, 30},
+    {"highway", "pedestrian", nullptr, nullptr, 5, 20},
+    {"highway", "busway", nullptr, nullptr, 0.2, 60},
+    {"highway", "bus_guideway", nullptr, nullptr, 0.1, 60},
+    {"highway", "crossing", nullptr, nullptr, 0.5, 8},
+    {"railway", "rail", nullptr, nullptr, 10, 150},
+    {"waterway", "stream", nullptr, nullptr, 12, 40},
+    {"waterway", "river", nullptr, nullptr, 2, 80},
+    {"power", "line", nullptr, nullptr, 4, 200},
+    {"power", "minor_line", nullptr, nullptr, 3, 80},
+};
+
+static const FeatureClass area_classes[] = {
+    {"building", "yes", nullptr, nullptr, 700, 12},
+    {"landuse", "residential", nullptr, nullptr, 40, 150},
+    {"landuse", "farmland", nullptr, nullptr, 30, 250},
+    {"landuse", "meadow", nullptr, nullptr, 30, 150},
+    {"landuse", "forest", nullptr, nullptr, 40, 250},
+    {"landuse", "grass", nullptr, nullptr, 40, 40},
+    {"landuse", "industrial", nullptr, nullptr, 15, 150},
+    {"landuse", "commercial", nullptr, nullptr, 10, 80},
+    {"landuse", "retail", nullptr, nullptr, 8, 60},
+    {"landuse", "park", nullptr, nullptr, 10, 100},
+    {"landuse", "garden", nullptr, nullptr, 5, 20},
+    {"landuse", "orchard", nullptr, nullptr, 4, 80},
+    {"landuse", "vineyard", nullptr, nullptr, 2, 100},
+    {"landuse", "farmyard", nullptr, nullptr, 10, 60},
+    {"landuse", "scrub", nullptr, nullptr, 8, 60},
+    {"landuse", "wood", nullptr, nullptr, 8, 150},
+    {"landuse", "quarry", nullptr, nullptr, 2, 150},
+    {"landuse", "railway", nullptr, nullptr, 2, 100},
+    {"landuse", "depot", nullptr, nullptr, 1, 60},
+    {"landuse", "recreation_ground", nullptr, nullptr, 3, 80},
+    {"landuse", "reservoir", nullptr, nullptr, 3, 100},
+    {"natural", "water", "water", "lake", 20, 100},
+    {"power", "substation", nullptr, nullptr, 3, 30},
+};
+
+static const FeatureClass point_classes[] = {
+    {"amenity", "bench", nullptr, nullptr, 30, 0},
+    {"highway", "street_lamp", nullptr, nullptr, 25, 0},
+    {"natural", "tree", nullptr, nullptr, 40, 0},
+    {"shop", "bakery", nullptr, nullptr, 3, 0},
+    {"power", "tower", nullptr, nullptr, 5, 0},
+};
+
+// extra tags per way, whose number and cardinality are tunable
+static const char* extra_tag_keys[] = {
+    "name", "surface", "maxspeed", "lanes", "oneway", "lit", "ref", "source", "addr:street", "width", "access", "note"
+};
+
+template<size_t N>
+static auto pick_class(const FeatureClass (&classes)[N], Random& random) -> const FeatureClass* {
+    double total = 0.0;
+    for(auto& feature : classes)
+        total += feature.m_weight;
+
+    double target = random.uniform() * total;
+    for(auto& feature : classes) {
+        if(target < feature.m_weight)
+            return &feature;
+        target -= feature.m_weight;
+    }
+
+    return &classes[N - 1];
+}
+
+// settings
+
+enum class IdOrder {
+    SORTED,
+    // sorted, but with large gaps like in real extracts
+    SPARSE,
+    // in file order, a permutation of the sorted ids
+    SHUFFLED,
+};
+
+enum class Format {
+    XML,
+    PBF,
+};
+
+struct Range {
+    uint64_t m_min, m_max;
+};
+
+struct Settings {
+    uint64_t seed = 1;
+    uint64_t ways = 100000;
+    // total nodes; whatever the ways do not use becomes tagged points
+    uint64_t nodes = 0;
+    // approximate output size, replaces `ways`
+    uint64_t target_size = 0;
+
+    Range road_nodes{2, 20};
+    Range polygon_nodes{4, 12};
+    double polygon_share = 0.45;
+    // lines that continue the previous line instead of starting somewhere else
+    double connected_share = 0.5;
+
+    double extra_tags = 1.0;
+    uint64_t tag_values = 1000;
+
+    IdOrder ids = IdOrder::SORTED;
+
+    double min_lon = 11.36, min_lat = 48.06, max_lon = 11.72, max_lat = 48.25;
+
+    std::optional<Format> format;
+    const char* output_path = nullptr;
+};
+
+// element ids
+
+// maps element indices to ids according to the id order; a bijection within [1, count]
+// for sorted and shuffled ids
+class IdMapper {
+public:
+    IdMapper(IdOrder order, uint64_t count, uint64_t seed)
+        : m_order(order), m_count(count), m_key(mix64(seed ^ STREAM_IDS))
+    {
+        while((uint64_t(1) << m_half_bits * 2) < count)
+            m_half_bits++;
+    }
+
+    inline auto operator()(uint64_t index) const -> uint64_t {
+        switch(m_order) {
+            case IdOrder::SORTED:
+                return index + 1;
+            case IdOrder::SPARSE:
+                return index * sparse_spread + 1 + mix64(m_key ^ index) % sparse_spread;
+            case IdOrder::SHUFFLED:
+                break;
+        }
+
+        // cycle walking keeps the permutation of the enclosing power of four within `m_count`
+        uint64_t id = feistel(index);
+        while(id >= m_count)
+            id = feistel(id);
+        return id + 1;
+    }
+
+private:
+    static constexpr uint64_t sparse_spread = 64;
+
+    inline auto feistel(uint64_t x) const -> uint64_t {
+        const uint64_t mask = (uint64_t(1) << m_half_bits) - 1;
+        uint64_t left = x >> m_half_bits, right = x & mask;
+
+        for(uint64_t round = 0; round < 4; round++) {
+            uint64_t next = left ^ (mix64(m_key ^ (round << 60) ^ right) & mask);
+            left = right;
+            right = next;
+        }
+
+        return left << m_half_bits | right;
+    }
+
+    IdOrder m_order;
+    uint64_t m_count;
+    uint64_t m_key;
+    unsigned m_half_bits = 1;
+};
+
+// way layout
+
+struct WayPlan {
+    uint64_t m_index;
+    const FeatureClass* m_class;
+    bool m_area;
+    // nodes this way adds, starting at `m_first_node`
+    uint32_t m_new_nodes;
+    uint64_t m_first_node;
+    // starts at the last node of the previous way
+    bool m_connected;
+};
+
+// decides class and size of every way in order; all passes walk the ways through one of these
+class WayPlanner {
+public:
+    WayPlanner(const Settings& settings)
+        : m_settings(settings)
+    {}
+
+    auto next() -> WayPlan {
+        Random random(m_settings.seed, STREAM_PLAN, m_index);
+
+        WayPlan plan;
+        plan.m_index = m_index++;
+        plan.m_area = random.chance(m_settings.polygon_share);
+        plan.m_class = plan.m_area ? pick_class(area_classes, random) : pick_class(line_classes, random);
+        plan.m_first_node = m_next_node;
+
+        if(plan.m_area) {
+            plan.m_connected = false;
+            plan.m_new_nodes = random.range(m_settings.polygon_nodes.m_min, m_settings.polygon_nodes.m_max);
+        }
+        else {
+            plan.m_connected = m_previous_line && random.chance(m_settings.connected_share);
+            plan.m_new_nodes = random.range(m_settings.road_nodes.m_min, m_settings.road_nodes.m_max) - plan.m_connected;
+        }
+
+        m_next_node += plan.m_new_nodes;
+        m_previous_line = !plan.m_area;
+        return plan;
+    }
+
+    // nodes used by the ways planned so far
+    inline auto node_count() const -> uint64_t {
+        return m_next_node;
+    }
+
+private:
+    const Settings& m_settings;
+    uint64_t m_index = 0;
+    uint64_t m_next_node = 0;
+    bool m_previous_line = false;
+};
+
+struct Coord {
+    int32_t m_lon, m_lat;
+};
+
+static inline auto to_fixed(double degrees) -> int32_t {
+    return int32_t(std::lround(degrees * 1e7));
+}
+
+static constexpr double meters_per_degree = 111320.0;
+
+// the coordinates of the nodes `plan` adds; lines continue from `last`
+static void generate_geometry(const Settings& settings, const WayPlan& plan, Coord last, std::vector<Coord>& coords) {
+    Random random(settings.seed, STREAM_GEOMETRY, plan.m_index);
+    coords.clear();
+
+    const double lat_scale = 1.0 / meters_per_degree;
+    const double lon_scale = lat_scale / std::cos((settings.min_lat + settings.max_lat) * 0.5 * M_PI / 180.0);
+
+    auto clamp = [&](double& lon, double& lat) {
+        lon = std::clamp(lon, settings.min_lon, settings.max_lon);
+        lat = std::clamp(lat, settings.min_lat, settings.max_lat);
+    };
+
+    double lon = settings.min_lon + random.uniform() * (settings.max_lon - settings.min_lon);
+    double lat = settings.min_lat + random.uniform() * (settings.max_lat - settings.min_lat);
+
+    if(plan.m_area) {
+        // a jittered circle, counter-clockwise
+        const double radius = plan.m_class->m_size * (0.5 + random.uniform());
+        const double phase = random.uniform() * 2.0 * M_PI;
+
+        for(uint32_t i = 0; i < plan.m_new_nodes; i++) {
+            double angle = phase + 2.0 * M_PI * (i + 0.4 * random.uniform()) / plan.m_new_nodes;
+            double r = radius * (0.7 + 0.3 * random.uniform());
+            double x = lon + std::cos(angle) * r * lon_scale, y = lat + std::sin(angle) * r * lat_scale;
+            clamp(x, y);
+            coords.push_back({to_fixed(x), to_fixed(y)});
+        }
+        return;
+    }
+
+    if(plan.m_connected) {
+        lon = last.m_lon * 1e-7;
+        lat = last.m_lat * 1e-7;
+    }
+    else {
+        // the first node is one of the new ones
+        coords.push_back({to_fixed(lon), to_fixed(lat)});
+    }
+
+    double heading = random.uniform() * 2.0 * M_PI;
+    while(coords.size() < plan.m_new_nodes) {
+        heading += (random.uniform() - 0.5) * 0.6;
+        const double step = plan.m_class->m_size * (0.5 + random.uniform());
+        lon += std::cos(heading) * step * lon_scale;
+        lat += std::sin(heading) * step * lat_scale;
+
+        // turn around at the edges
+        if(lon <= settings.min_lon || lon >= settings.max_lon || lat <= settings.min_lat || lat >= settings.max_lat)
+            heading += M_PI;
+        clamp(lon, lat);
+
+        coords.push_back({to_fixed(lon), to_fixed(lat)});
+    }
+}
+
+// output
+
+typedef std::pair<std::string_view, std::string_view> Tag;
+
+// where encoded bytes go; without a file it only counts them
+class Output {
+public:
+    Output(FILE* file)
+        : m_file(file)
+    {}
+
+    ~Output() {
+        if(m_file && m_file != stdout)
+            std::fclose(m_file);
+    }
+
+    inline void write(const void* data, size_t size) {
+        if(m_file && std::fwrite(data, 1, size, m_file) != size)
+            m_failed = true;
+        m_written += size;
+    }
+
+    inline auto written() const -> uint64_t {
+        return m_written;
+    }
+
+    bool finish() {
+        if(m_file && std::fflush(m_file) != 0)
+            m_failed = true;
+        return !m_failed;
+    }
+
+private:
+    FILE* m_file;
+    uint64_t m_written = 0;
+    bool m_failed = false;
+};
+
+class OsmWriter {
+public:
+    virtual ~OsmWriter() = default;
+
+    virtual void begin(const Settings& settings) = 0;
+    virtual void node(uint64_t id, Coord coord, const std::vector<Tag>& tags) = 0;
+    virtual void way(uint64_t id, const std::vector<uint64_t>& refs, const std::vector<Tag>& tags) = 0;
+    virtual void finish() = 0;
+};
+
+static void append_int(std::string& buffer, int64_t value) {
+    char digits[24];
+    auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+    buffer.append(digits, end);
+}
+
+static void append_fixed(std::string& buffer, int32_t value) {
+    if(value < 0)
+        buffer += '-';
+
+    const uint32_t magnitude = value < 0 ? -uint32_t(value) : value;
+    append_int(buffer, magnitude / 10000000);
+
+    char fraction[8];
+    uint32_t rest = magnitude % 10000000;
+    for(int i = 6; i >= 0; i--, rest /= 10)
+        fraction[i] = '0' + rest % 10;
+    fraction[7] = '\0';
+
+    buffer += '.';
+    buffer += fraction;
+}
+
+// generated names and values never need escaping
+class XmlWriter : public OsmWriter {
+public:
+    XmlWriter(Output& output)
+        : m_output(output)
+    {}
+
+    void begin(const Settings& settings) override {
+        m_buffer += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<osm version=\"0.6\" generator=\"gen-osm\">\n <bounds minlat=\"";
+        append_fixed(m_buffer, to_fixed(settings.min_lat));
+        m_buffer += "\" minlon=\"";
+        append_fixed(m_buffer, to_fixed(settings.min_lon));
+        m_buffer += "\" maxlat=\"";
+        append_fixed(m_buffer, to_fixed(settings.max_lat));
+        m_buffer += "\" maxlon=\"";
+        append_fixed(m_buffer, to_fixed(settings.max_lon));
+        m_buffer += "\"/>\n";
+    }
+
+    void node(uint64_t id, Coord coord, const std::vector<Tag>& tags) override {
+        m_buffer += " <node id=\"";
+        append_int(m_buffer, id);
+        m_buffer += "\" lat=\"";
+        append_fixed(m_buffer, coord.m_lat);
+        m_buffer += "\" lon=\"";
+        append_fixed(m_buffer, coord.m_lon);
+
+        if(tags.empty())
+            m_buffer += "\"/>\n";
+        else {
+            m_buffer += "\">\n";
+            append_tags(tags);
+            m_buffer += " </node>\n";
+        }
+
+        flush_if_full();
+    }
+
+    void way(uint64_t id, const std::vector<uint64_t>& refs, const std::vector<Tag>& tags) override {
+        m_buffer += " <way id=\"";
+        append_int(m_buffer, id);
+        m_buffer += "\">\n";
+
+        for(auto ref : refs) {
+            m_buffer += "  <nd ref=\"";
+            append_int(m_buffer, ref);
+            m_buffer += "\"/>\n";
+        }
+
+        append_tags(tags);
+        m_buffer += " </way>\n";
+
+        flush_if_full();
+    }
+
+    void finish() override {
+        m_buffer += "</osm>\n";
+        m_output.write(m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+    }
+
+private:
+    void append_tags(const std::vector<Tag>& tags) {
+        for(auto& [ key, value ] : tags) {
+            m_buffer += "  <tag k=\"";
+            m_buffer += key;
+            m_buffer += "\" v=\"";
+            m_buffer += value;
+            m_buffer += "\"/>\n";
+        }
+    }
+
+    inline void flush_if_full() {
+        if(m_buffer.size() < 1024 * 1024)
+            return;
+
+        m_output.write(m_buffer.data(), m_buffer.size());
+        m_buffer.clear();
+    }
+
+    Output& m_output;
+    std::string m_buffer;
+};
+
+// protobuf encoding, just what the PBF format needs
+
+static void put_varint(std::string& buffer, uint64_t value) {
+    while(value >= 0x80) {
+        buffer += char(value | 0x80);
+        value >>= 7;
+    }
+    buffer += char(value);
+}
+
+static inline auto zigzag(int64_t value) -> uint64_t {
+    return (uint64_t(value) << 1) ^ uint64_t(value >> 63);
+}
+
+static void put_key(std::string& buffer, uint32_t field, uint32_t wire_type) {
+    put_varint(buffer, field << 3 | wire_type);
+}
+
+static void put_uint(std::string& buffer, uint32_t field, uint64_t value) {
+    put_key(buffer, field, 0);
+    put_varint(buffer, value);
+}
+
+static void put_sint(std::string& buffer, uint32_t field, int64_t value) {
+    put_key(buffer, field, 0);
+    put_varint(buffer, zigzag(value));
+}
+
+static void put_bytes(std::string& buffer, uint32_t field, std::string_view bytes) {
+    put_key(buffer, field, 2);
+    put_varint(buffer, bytes.size());
+    buffer += bytes;
+}
+
+// nodes go into DenseNodes, ways into plain Way messages; a block holds one kind only
+class PbfWriter : public OsmWriter {
+public:
+    PbfWriter(Output& output)
+        : m_output(output)
+    {}
+
+    void begin(const Settings& settings) override {
+        std::string bbox;
+        put_sint(bbox, 1, std::llround(settings.min_lon * 1e9));
+        put_sint(bbox, 2, std::llround(settings.max_lon * 1e9));
+        put_sint(bbox, 3, std::llround(settings.max_lat * 1e9));
+        put_sint(bbox, 4, std::llround(settings.min_lat * 1e9));
+
+        std::string header;
+        put_bytes(header, 1, bbox);
+        put_bytes(header, 4, "OsmSchema-V0.6");
+        put_bytes(header, 4, "DenseNodes");
+        put_bytes(header, 16, "gen-osm");
+
+        write_blob("OSMHeader", header);
+    }
+
+    void node(uint64_t id, Coord coord, const std::vector<Tag>& tags) override {
+        if(!m_ways.empty())
+            flush();
+
+        // delta coded, with the default granularity of 100 nanodegrees
+        put_varint(m_ids, zigzag(int64_t(id) - m_last_id));
+        put_varint(m_lats, zigzag(int64_t(coord.m_lat) - m_last_lat));
+        put_varint(m_lons, zigzag(int64_t(coord.m_lon) - m_last_lon));
+        m_last_id = id;
+        m_last_lat = coord.m_lat;
+        m_last_lon = coord.m_lon;
+
+        for(auto& [ key, value ] : tags) {
+            put_varint(m_keys_vals, string_index(key));
+            put_varint(m_keys_vals, string_index(value));
+        }
+        put_varint(m_keys_vals, 0);
+        m_has_node_tags = m_has_node_tags || !tags.empty();
+
+        if(++m_entities == block_size)
+            flush();
+    }
+
+    void way(uint64_t id, const std::vector<uint64_t>& refs, const std::vector<Tag>& tags) override {
+        if(!m_ids.empty())
+            flush();
+
+        std::string keys, values, deltas;
+        for(auto& [ key, value ] : tags) {
+            put_varint(keys, string_index(key));
+            put_varint(values, string_index(value));
+        }
+
+        int64_t last = 0;
+        for(auto ref : refs) {
+            put_varint(deltas, zigzag(int64_t(ref) - last));
+            last = ref;
+        }
+
+        std::string way;
+        put_uint(way, 1, id);
+        put_bytes(way, 2, keys);
+        put_bytes(way, 3, values);
+        put_bytes(way, 8, deltas);
+        put_bytes(m_ways, 3, way);
+
+        if(++m_entities == block_size)
+            flush();
+    }
+
+    void finish() override {
+        flush();
+    }
+
+private:
+    static constexpr size_t block_size = 8000;
+
+    auto string_index(std::string_view text) -> uint32_t {
+        auto found = m_string_indices.find(std::string(text));
+        if(found != m_string_indices.end())
+            return found->second;
+
+        const uint32_t index = m_strings.size();
+        m_strings.emplace_back(text);
+        m_string_indices.emplace(text, index);
+        return index;
+    }
+
+    void flush() {
+        if(m_entities == 0)
+            return;
+
+        std::string group;
+        if(!m_ids.empty()) {
+            std::string dense;
+            put_bytes(dense, 1, m_ids);
+            put_bytes(dense, 8, m_lats);
+            put_bytes(dense, 9, m_lons);
+            if(m_has_node_tags)
+                put_bytes(dense, 10, m_keys_vals);
+            put_bytes(group, 2, dense);
+        }
+        else
+            group = std::move(m_ways);
+
+        std::string table;
+        for(auto& text : m_strings)
+            put_bytes(table, 1, text);
+
+        std::string block;
+        put_bytes(block, 1, table);
+        put_bytes(block, 2, group);
+
+        write_blob("OSMData", block);
+
+        m_ids.clear();
+        m_lats.clear();
+        m_lons.clear();
+        m_keys_vals.clear();
+        m_ways.clear();
+        m_last_id = m_last_lat = m_last_lon = 0;
+        m_has_node_tags = false;
+        m_entities = 0;
+
+        // index 0 is the empty string, which ends the tags of a dense node
+        m_strings.assign(1, std::string());
+        m_string_indices.clear();
+        m_string_indices.emplace("", 0);
+    }
+
+    void write_blob(std::string_view type, const std::string& data) {
+        uLongf compressed_size = compressBound(data.size());
+        m_compressed.resize(compressed_size);
+        if(compress2(reinterpret_cast<Bytef*>(m_compressed.data()), &compressed_size, reinterpret_cast<const Bytef*>(data.data()), data.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+            mlog::logln(mlog::ERROR, "Could not compress a PBF block");
+            std::exit(1);
+        }
+        m_compressed.resize(compressed_size);
+
+        std::string blob;
+        put_uint(blob, 2, data.size());
+        put_bytes(blob, 3, m_compressed);
+
+        std::string header;
+        put_bytes(header, 1, type);
+        put_uint(header, 3, blob.size());
+
+        const uint32_t length = header.size();
+        const unsigned char prefix[4] = {
+            static_cast<unsigned char>(length >> 24), static_cast<unsigned char>(length >> 16),
+            static_cast<unsigned char>(length >> 8), static_cast<unsigned char>(length)
+        };
+
+        m_output.write(prefix, sizeof(prefix));
+        m_output.write(header.data(), header.size());
+        m_output.write(blob.data(), blob.size());
+    }
+
+    Output& m_output;
+
+    std::vector<std::string> m_strings{std::string()};
+    std::unordered_map<std::string, uint32_t> m_string_indices{{"", 0}};
+
+    std::string m_ids, m_lats, m_lons, m_keys_vals;
+    int64_t m_last_id = 0, m_last_lat = 0, m_last_lon = 0;
+    bool m_has_node_tags = false;
+
+    std::string m_ways;
+    size_t m_entities = 0;
+
+    std::string m_compressed;
+};
+
+// generation
+
+static void feature_tags(const FeatureClass& feature, std::vector<Tag>& tags) {
+    tags.emplace_back(feature.m_key, feature.m_value);
+    if(feature.m_sub_key)
+        tags.emplace_back(feature.m_sub_key, feature.m_sub_value);
+}
+
+// the extra tags of way `index`; `values` backs the returned views
+static void extra_tags(const Settings& settings, uint64_t index, std::vector<std::string>& keys, std::vector<std::string>& values, std::vector<Tag>& tags) {
+    Random random(settings.seed, STREAM_TAGS, index);
+
+    const size_t count = random.uniform() * (2.0 * settings.extra_tags + 1.0);
+    while(keys.size() < count)
+        keys.push_back(keys.size() < std::size(extra_tag_keys) ? extra_tag_keys[keys.size()] : "key_" + std::to_string(keys.size()));
+
+    values.resize(std::max(values.size(), count));
+    for(size_t i = 0; i < count; i++) {
+        values[i] = "value ";
+        append_int(values[i], random.range(0, settings.tag_values - 1));
+    }
+
+    for(size_t i = 0; i < count; i++)
+        tags.emplace_back(keys[i], values[i]);
+}
+
+struct GenerateStats {
+    uint64_t m_ways = 0, m_way_nodes = 0, m_points = 0;
+};
+
+static constexpr uint64_t progress_interval = 256 * 1024 * 1024;
+
+static void log_progress(const Output& output, uint64_t& next_report) {
+    if(output.written() < next_report)
+        return;
+
+    mlog::log(mlog::INFO, "\r%lu MiB written", output.written() / 1024 / 1024);
+    next_report = output.written() + progress_interval;
+}
+
+static auto generate(const Settings& settings, OsmWriter& writer, const Output& output) -> GenerateStats {
+    GenerateStats stats;
+    stats.m_ways = settings.ways;
+
+    // the id permutation needs the node count up front
+    {
+        WayPlanner planner(settings);
+        for(uint64_t i = 0; i < settings.ways; i++)
+            planner.next();
+        stats.m_way_nodes = planner.node_count();
+    }
+
+    stats.m_points = settings.nodes > stats.m_way_nodes ? settings.nodes - stats.m_way_nodes : 0;
+    if(settings.nodes && settings.nodes < stats.m_way_nodes)
+        mlog::logln(mlog::WARN, "The ways need %lu nodes, more than the requested %lu", stats.m_way_nodes, settings.nodes);
+
+    const IdMapper node_ids(settings.ids, stats.m_way_nodes + stats.m_points, settings.seed);
+    const IdMapper way_ids(settings.ids, settings.ways, settings.seed + 1);
+
+    uint64_t next_report = progress_interval;
+    writer.begin(settings);
+
+    std::vector<Coord> coords;
+    std::vector<Tag> tags;
+
+    {
+        WayPlanner planner(settings);
+        Coord last = {0, 0};
+
+        for(uint64_t i = 0; i < settings.ways; i++) {
+            auto plan = planner.next();
+            generate_geometry(settings, plan, last, coords);
+
+            for(uint32_t j = 0; j < plan.m_new_nodes; j++)
+                writer.node(node_ids(plan.m_first_node + j), coords[j], tags);
+
+            if(!coords.empty())
+                last = coords.back();
+
+            log_progress(output, next_report);
+        }
+    }
+
+    for(uint64_t i = 0; i < stats.m_points; i++) {
+        Random random(settings.seed, STREAM_POINTS, i);
+        Coord coord = {
+            to_fixed(settings.min_lon + random.uniform() * (settings.max_lon - settings.min_lon)),
+            to_fixed(settings.min_lat + random.uniform() * (settings.max_lat - settings.min_lat))
+        };
+
+        tags.clear();
+        feature_tags(*pick_class(point_classes, random), tags);
+        writer.node(node_ids(stats.m_way_nodes + i), coord, tags);
+
+        log_progress(output, next_report);
+    }
+
+    {
+        WayPlanner planner(settings);
+        std::vector<uint64_t> refs;
+        std::vector<std::string> keys, values;
+
+        for(uint64_t i = 0; i < settings.ways; i++) {
+            auto plan = planner.next();
+
+            refs.clear();
+            if(plan.m_connected)
+                refs.push_back(node_ids(plan.m_first_node - 1));
+            for(uint32_t j = 0; j < plan.m_new_nodes; j++)
+                refs.push_back(node_ids(plan.m_first_node + j));
+            if(plan.m_area)
+                refs.push_back(refs.front());
+
+            tags.clear();
+            feature_tags(*plan.m_class, tags);
+            extra_tags(settings, plan.m_index, keys, values, tags);
+
+            writer.way(way_ids(plan.m_index), refs, tags);
+
+            log_progress(output, next_report);
+        }
+    }
+
+    writer.finish();
+    return stats;
+}
+
+static auto make_writer(Format format, Output& output) -> std::unique_ptr<OsmWriter> {
+    if(format == Format::PBF)
+        return std::make_unique<PbfWriter>(output);
+    return std::make_unique<XmlWriter>(output);
+}
+
+// ways for `settings.target_size`, from the output size of a sample
+static auto calibrate_ways(Settings settings, Format format) -> uint64_t {
+    constexpr uint64_t sample_ways = 20000;
+
+    settings.ways = sample_ways;
+    settings.nodes = 0;
+
+    Output counter(nullptr);
+    auto writer = make_writer(format, counter);
+    generate(settings, *writer, counter);
+
+    return std::max<uint64_t>(1, settings.target_size * sample_ways / counter.written());
+}
+
+// command line
+
+static void print_usage(const char* argv0) {
+    mlog::logln(mlog::ERROR, "Usage: %s [--seed <n>] [--ways <n> | --size <bytes>[K|M|G|T]] [--nodes <n>] [--road-nodes <min>-<max>] "
+        "[--polygon-nodes <min>-<max>] [--polygon-share <0..1>] [--connected-share <0..1>] [--tags <n>] [--tag-values <n>] "
+        "[--ids sorted|sparse|shuffled] [--bbox <minlon>,<minlat>,<maxlon>,<maxlat>] [--format xml|pbf] -o <file | ->", argv0);
+}
+
+static auto parse_uint(const char* text) -> std::optional<uint64_t> {
+    uint64_t value;
+    auto [ end, error ] = std::from_chars(text, text + std::strlen(text), value);
+    if(error != std::errc() || *end)
+        return std::nullopt;
+    return value;
+}
+
+static auto parse_size(const char* text) -> std::optional<uint64_t> {
+    char* end;
+    double value = std::strtod(text, &end);
+
+    uint64_t unit = 1;
+    switch(*end) {
+        case 'K': unit = uint64_t(1) << 10; end++; break;
+        case 'M': unit = uint64_t(1) << 20; end++; break;
+        case 'G': unit = uint64_t(1) << 30; end++; break;
+        case 'T': unit = uint64_t(1) << 40; end++; break;
+        default: break;
+    }
+
+    if(end == text || *end || value <= 0.0)
+        return std::nullopt;
+    return uint64_t(value * unit);
+}
+
+static auto parse_fraction(const char* text) -> std::optional<double> {
+    char* end;
+    double value = std::strtod(text, &end);
+    if(end == text || *end || value < 0.0 || value > 1.0)
+        return std::nullopt;
+    return value;
+}
+
+static auto parse_range(const char* text, uint64_t min) -> std::optional<Range> {
+    const char* dash = std::strchr(text, '-');
+    if(!dash)
+        return std::nullopt;
+
+    auto low = parse_uint(std::string(text, dash).c_str()), high = parse_uint(dash + 1);
+    if(!low || !high || *low < min || *high < *low)
+        return std::nullopt;
+    return Range{*low, *high};
+}
+
+static auto parse_bbox(const char* text, Settings& settings) -> bool {
+    char* end;
+    double values[4];
+    for(int i = 0; i < 4; i++) {
+        values[i] = std::strtod(text, &end);
+        if(end == text || *end != (i < 3 ? ',' : '\0'))
+            return false;
+        text = end + 1;
+    }
+
+    if(values[0] >= values[2] || values[1] >= values[3] || values[0] < -180.0 || values[2] > 180.0 || values[1] < -85.0 || values[3] > 85.0)
+        return false;
+
+    settings.min_lon = values[0];
+    settings.min_lat = values[1];
+    settings.max_lon = values[2];
+    settings.max_lat = values[3];
+    return true;
+}
+
+auto main(int argc, char** argv) -> int {
+    mlog::init_from_env("MAP_LOG");
+
+    Settings settings;
+    bool ways_given = false;
+
+    for(int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool valid = value != nullptr;
+
+        if(arg == "-o" || arg == "--output")
+            settings.output_path = value;
+        else if(arg == "--seed") {
+            auto seed = value ? parse_uint(value) : std::nullopt;
+            valid = seed.has_value();
+            settings.seed = seed.value_or(0);
+        }
+        else if(arg == "--ways") {
+            auto ways = value ? parse_uint(value) : std::nullopt;
+            valid = ways && *ways > 0;
+            settings.ways = ways.value_or(0);
+            ways_given = true;
+        }
+        else if(arg == "--size") {
+            auto size = value ? parse_size(value) : std::nullopt;
+            valid = size.has_value();
+            settings.target_size = size.value_or(0);
+        }
+        else if(arg == "--nodes") {
+            auto nodes = value ? parse_uint(value) : std::nullopt;
+            valid = nodes.has_value();
+            settings.nodes = nodes.value_or(0);
+        }
+        else if(arg == "--road-nodes") {
+            auto range = value ? parse_range(value, 2) : std::nullopt;
+            valid = range.has_value();
+            settings.road_nodes = range.value_or(settings.road_nodes);
+        }
+        else if(arg == "--polygon-nodes") {
+            auto range = value ? parse_range(value, 3) : std::nullopt;
+            valid = range.has_value();
+            settings.polygon_nodes = range.value_or(settings.polygon_nodes);
+        }
+        else if(arg == "--polygon-share" || arg == "--connected-share") {
+            auto fraction = value ? parse_fraction(value) : std::nullopt;
+            valid = fraction.has_value();
+            (arg == "--polygon-share" ? settings.polygon_share : settings.connected_share) = fraction.value_or(0.0);
+        }
+        else if(arg == "--tags") {
+            char* end = nullptr;
+            settings.extra_tags = value ? std::strtod(value, &end) : 0.0;
+            valid = value && end != value && !*end && settings.extra_tags >= 0.0 && settings.extra_tags <= 1000.0;
+        }
+        else if(arg == "--tag-values") {
+            auto count = value ? parse_uint(value) : std::nullopt;
+            valid = count && *count > 0;
+            settings.tag_values = count.value_or(1);
+        }
+        else if(arg == "--ids") {
+            std::string_view order = value ? value : "";
+            if(order == "sorted")
+                settings.ids = IdOrder::SORTED;
+            else if(order == "sparse")
+                settings.ids = IdOrder::SPARSE;
+            else if(order == "shuffled")
+                settings.ids = IdOrder::SHUFFLED;
+            else
+                valid = false;
+        }
+        else if(arg == "--bbox")
+            valid = valid && parse_bbox(value, settings);
+        else if(arg == "--format") {
+            std::string_view format = value ? value : "";
+            if(format == "xml")
+                settings.format = Format::XML;
+            else if(format == "pbf")
+                settings.format = Format::PBF;
+            else
+                valid = false;
+        }
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        if(!valid) {
+            mlog::logln(mlog::ERROR, "Invalid value for `%s`", argv[i]);
+            return 1;
+        }
+        i++;
+    }
+
+    if(!settings.output_path || (settings.target_size && (ways_given || settings.nodes))) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const std::string_view path = settings.output_path;
+    const bool to_stdout = path == "-";
+    const Format format = settings.format.value_or(path.size() >= 4 && path.substr(path.size() - 4) == ".pbf" ? Format::PBF : Format::XML);
+
+    // the log would end up in the data
+    if(to_stdout)
+        mlog::init(mlog::ERROR);
+
+    if(settings.target_size)
+        settings.ways = calibrate_ways(settings, format);
+
+    FILE* file = to_stdout ? stdout : std::fopen(settings.output_path, "wb");
+    if(!file) {
+        mlog::logln(mlog::ERROR, "Could not create `%s`", settings.output_path);
+        return 1;
+    }
+
+    Output output(file);
+    auto writer = make_writer(format, output);
+    auto stats = generate(settings, *writer, output);
+
+    if(!output.finish()) {
+        mlog::logln(mlog::ERROR, "Could not write `%s`", settings.output_path);
+        return 1;
+    }
+
+    mlog::logln(mlog::INFO, "\rWrote %lu ways, %lu way nodes and %lu points (%.1f MiB) to `%s`", stats.m_ways, stats.m_way_nodes, stats.m_points,
+        output.written() / 1024.0 / 1024.0, settings.output_path);
+    return 0;
+}
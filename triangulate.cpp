@@ -0,0 +1,654 @@
+#include "triangulate.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <glm/common.hpp>
+
+// rings with fewer vertices are clipped without the z-order hash
+constexpr size_t hash_threshold = 80;
+
+template<typename Node>
+static inline double area(const Node* p, const Node* q, const Node* r) {
+    return (q->m_y - p->m_y) * (r->m_x - q->m_x) - (q->m_x - p->m_x) * (r->m_y - q->m_y);
+}
+
+template<typename Node>
+static inline bool equals(const Node* a, const Node* b) {
+    return a->m_x == b->m_x && a->m_y == b->m_y;
+}
+
+static inline int sign(double value) {
+    return (value > 0.0) - (value < 0.0);
+}
+
+static inline bool point_in_triangle(double ax, double ay, double bx, double by, double cx, double cy, double px, double py) {
+    return (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+        (ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+        (bx - px) * (cy - py) >= (cx - px) * (by - py);
+}
+
+// `q` on the segment from `p` to `r`, given that the three are collinear
+template<typename Node>
+static inline bool on_segment(const Node* p, const Node* q, const Node* r) {
+    return q->m_x <= std::max(p->m_x, r->m_x) && q->m_x >= std::min(p->m_x, r->m_x) &&
+        q->m_y <= std::max(p->m_y, r->m_y) && q->m_y >= std::min(p->m_y, r->m_y);
+}
+
+template<typename Node>
+static bool intersects(const Node* p1, const Node* q1, const Node* p2, const Node* q2) {
+    const int o1 = sign(area(p1, q1, p2));
+    const int o2 = sign(area(p1, q1, q2));
+    const int o3 = sign(area(p2, q2, p1));
+    const int o4 = sign(area(p2, q2, q1));
+
+    if(o1 != o2 && o3 != o4)
+        return true;
+
+    return (o1 == 0 && on_segment(p1, p2, q1)) || (o2 == 0 && on_segment(p1, q2, q1)) ||
+        (o3 == 0 && on_segment(p2, p1, q2)) || (o4 == 0 && on_segment(p2, q1, q2));
+}
+
+// the diagonal from `a` to `b` crosses an edge of the ring
+template<typename Node>
+static bool intersects_polygon(const Node* a, const Node* b) {
+    auto p = a;
+    do {
+        if(p->m_index != a->m_index && p->m_next->m_index != a->m_index && p->m_index != b->m_index &&
+            p->m_next->m_index != b->m_index && intersects(p, p->m_next, a, b))
+            return true;
+
+        p = p->m_next;
+    } while(p != a);
+
+    return false;
+}
+
+// the diagonal from `a` to `b` starts into the inside of the ring at `a`
+template<typename Node>
+static inline bool locally_inside(const Node* a, const Node* b) {
+    return area(a->m_prev, a, a->m_next) < 0.0 ?
+        area(a, b, a->m_next) >= 0.0 && area(a, a->m_prev, b) >= 0.0 :
+        area(a, b, a->m_prev) < 0.0 || area(a, a->m_next, b) < 0.0;
+}
+
+// the middle of the diagonal from `a` to `b` is inside the ring
+template<typename Node>
+static bool middle_inside(const Node* a, const Node* b) {
+    const double px = (a->m_x + b->m_x) / 2.0, py = (a->m_y + b->m_y) / 2.0;
+
+    bool inside = false;
+    auto p = a;
+    do {
+        if((p->m_y > py) != (p->m_next->m_y > py) && p->m_next->m_y != p->m_y &&
+            px < (p->m_next->m_x - p->m_x) * (py - p->m_y) / (p->m_next->m_y - p->m_y) + p->m_x)
+            inside = !inside;
+
+        p = p->m_next;
+    } while(p != a);
+
+    return inside;
+}
+
+template<typename Node>
+static bool is_valid_diagonal(const Node* a, const Node* b) {
+    if(a->m_next->m_index == b->m_index || a->m_prev->m_index == b->m_index || intersects_polygon(a, b))
+        return false;
+
+    // the diagonal does not make degenerate triangles, or it joins two touching vertices
+    return (locally_inside(a, b) && locally_inside(b, a) && middle_inside(a, b) &&
+        (area(a->m_prev, a, b->m_prev) != 0.0 || area(a, b->m_prev, b) != 0.0)) ||
+        (equals(a, b) && area(a->m_prev, a, a->m_next) > 0.0 && area(b->m_prev, b, b->m_next) > 0.0);
+}
+
+// twice the signed area of a ring, positive for clockwise rings in map coordinates
+static double signed_area(CoordSpan coords, uint32_t first, uint32_t end) {
+    double sum = 0.0;
+    for(uint32_t i = first, j = end - 1; i < end; j = i++)
+        sum += (double(coords[j].x) - coords[i].x) * (double(coords[i].y) + coords[j].y);
+
+    return sum;
+}
+
+// even-odd test
+static bool point_in_ring(glm::vec2 point, CoordSpan coords, uint32_t first, uint32_t end) {
+    bool inside = false;
+    for(uint32_t i = first, j = end - 1; i < end; j = i++) {
+        auto a = coords[i], b = coords[j];
+        if((a.y > point.y) != (b.y > point.y) && point.x < (b.x - a.x) * (point.y - a.y) / (b.y - a.y) + a.x)
+            inside = !inside;
+    }
+
+    return inside;
+}
+
+void Triangulator::triangulate(CoordSpan coords, const std::vector<uint32_t>& ring_ends, uint32_t outer_rings, std::vector<uint32_t>& triangles) {
+    m_triangles = &triangles;
+
+    auto& rings = m_rings;
+    rings.clear();
+    uint32_t first = 0;
+    for(auto end : ring_ends) {
+        rings.push_back({ first, end });
+        first = end;
+    }
+
+    if(outer_rings == 0 || rings.empty())
+        return;
+
+    if(outer_rings == 1) {
+        triangulate_polygon(coords, rings.data() + 1, rings.size() - 1, rings[0]);
+        return;
+    }
+
+    // every hole goes to the smallest outer ring that holds its first vertex, so that
+    // islands in a lake in a forest end up in the right place
+    struct Outer {
+        glm::vec2 m_min{std::numeric_limits<float>::infinity()};
+        glm::vec2 m_max{-std::numeric_limits<float>::infinity()};
+        double m_area;
+    };
+
+    std::vector<Outer> outers(outer_rings);
+    for(uint32_t i = 0; i < outer_rings; i++) {
+        for(uint32_t j = rings[i].m_first; j < rings[i].m_end; j++) {
+            outers[i].m_min = glm::min(outers[i].m_min, coords[j]);
+            outers[i].m_max = glm::max(outers[i].m_max, coords[j]);
+        }
+        outers[i].m_area = std::abs(signed_area(coords, rings[i].m_first, rings[i].m_end));
+    }
+
+    std::vector<uint32_t> owners(rings.size(), outer_rings);
+    for(size_t hole = outer_rings; hole < rings.size(); hole++) {
+        if(rings[hole].m_first == rings[hole].m_end)
+            continue;
+
+        auto point = coords[rings[hole].m_first];
+        for(uint32_t i = 0; i < outer_rings; i++) {
+            auto& bounds = outers[i];
+            if(point.x < bounds.m_min.x || point.y < bounds.m_min.y || point.x > bounds.m_max.x || point.y > bounds.m_max.y)
+                continue;
+            if(!point_in_ring(point, coords, rings[i].m_first, rings[i].m_end))
+                continue;
+
+            if(owners[hole] == outer_rings || outers[i].m_area < outers[owners[hole]].m_area)
+                owners[hole] = i;
+        }
+    }
+
+    for(uint32_t i = 0; i < outer_rings; i++) {
+        m_holes.clear();
+        for(size_t hole = outer_rings; hole < rings.size(); hole++) {
+            if(owners[hole] == i)
+                m_holes.push_back(rings[hole]);
+        }
+
+        // `m_holes` is not touched by the polygon
+        triangulate_polygon(coords, m_holes.data(), m_holes.size(), rings[i]);
+    }
+}
+
+void Triangulator::triangulate_polygon(CoordSpan coords, const Ring* holes, size_t hole_count, Ring outer) {
+    m_nodes.clear();
+
+    Node* outer_node = link_ring(coords, outer, true);
+    if(!outer_node || outer_node->m_next == outer_node->m_prev)
+        return;
+
+    if(hole_count > 0)
+        outer_node = eliminate_holes(coords, holes, hole_count, outer_node);
+
+    m_inv_size = 0.0;
+
+    size_t vertex_count = outer.m_end - outer.m_first;
+    for(size_t i = 0; i < hole_count; i++)
+        vertex_count += holes[i].m_end - holes[i].m_first;
+
+    if(vertex_count > hash_threshold) {
+        // over the holes as well, so that every vertex falls into the hash
+        double max_x = -std::numeric_limits<double>::infinity(), max_y = max_x;
+        m_min_x = m_min_y = std::numeric_limits<double>::infinity();
+
+        for(auto& node : m_nodes) {
+            m_min_x = std::min(m_min_x, node.m_x);
+            m_min_y = std::min(m_min_y, node.m_y);
+            max_x = std::max(max_x, node.m_x);
+            max_y = std::max(max_y, node.m_y);
+        }
+
+        const double size = std::max(max_x - m_min_x, max_y - m_min_y);
+        m_inv_size = size > 0.0 ? 32767.0 / size : 0.0;
+    }
+
+    clip_ears(outer_node, 0);
+}
+
+auto Triangulator::link_ring(CoordSpan coords, Ring ring, bool clockwise) -> Node* {
+    if(ring.m_end - ring.m_first < 3)
+        return nullptr;
+
+    Node* last = nullptr;
+    if(clockwise == (signed_area(coords, ring.m_first, ring.m_end) > 0.0)) {
+        for(uint32_t i = ring.m_first; i < ring.m_end; i++)
+            last = insert_node(i, coords[i], last);
+    }
+    else {
+        for(uint32_t i = ring.m_end; i-- > ring.m_first;)
+            last = insert_node(i, coords[i], last);
+    }
+
+    // the closing vertex of a closed ring
+    if(last && equals(last, last->m_next)) {
+        remove_node(last);
+        last = last->m_next;
+    }
+
+    return last;
+}
+
+auto Triangulator::insert_node(uint32_t index, glm::vec2 coord, Node* last) -> Node* {
+    Node* node = &m_nodes.emplace_back();
+    node->m_index = index;
+    node->m_x = coord.x;
+    node->m_y = coord.y;
+
+    if(!last) {
+        node->m_prev = node;
+        node->m_next = node;
+    }
+    else {
+        node->m_next = last->m_next;
+        node->m_prev = last;
+        last->m_next->m_prev = node;
+        last->m_next = node;
+    }
+
+    return node;
+}
+
+void Triangulator::remove_node(Node* node) {
+    node->m_next->m_prev = node->m_prev;
+    node->m_prev->m_next = node->m_next;
+
+    if(node->m_prev_z)
+        node->m_prev_z->m_next_z = node->m_next_z;
+    if(node->m_next_z)
+        node->m_next_z->m_prev_z = node->m_prev_z;
+}
+
+auto Triangulator::filter_points(Node* start, Node* end) -> Node* {
+    if(!start)
+        return start;
+    if(!end)
+        end = start;
+
+    Node* p = start;
+    bool again;
+    do {
+        again = false;
+
+        if(equals(p, p->m_next) || area(p->m_prev, p, p->m_next) == 0.0) {
+            remove_node(p);
+            p = end = p->m_prev;
+            if(p == p->m_next)
+                break;
+            again = true;
+        }
+        else {
+            p = p->m_next;
+        }
+    } while(again || p != end);
+
+    return end;
+}
+
+auto Triangulator::eliminate_holes(CoordSpan coords, const Ring* holes, size_t hole_count, Node* outer) -> Node* {
+    m_hole_queue.clear();
+    for(size_t i = 0; i < hole_count; i++) {
+        Node* list = link_ring(coords, holes[i], false);
+        if(!list)
+            continue;
+
+        // the leftmost vertex of each hole
+        Node* leftmost = list;
+        Node* p = list;
+        do {
+            if(p->m_x < leftmost->m_x || (p->m_x == leftmost->m_x && p->m_y < leftmost->m_y))
+                leftmost = p;
+            p = p->m_next;
+        } while(p != list);
+
+        m_hole_queue.push_back(leftmost);
+    }
+
+    // from left to right, so that every hole bridges to the outer ring or a hole already bridged
+    std::sort(m_hole_queue.begin(), m_hole_queue.end(), [](const Node* a, const Node* b) {
+        return a->m_x < b->m_x;
+    });
+
+    for(auto hole : m_hole_queue) {
+        Node* bridge = find_hole_bridge(hole, outer);
+        if(!bridge)
+            continue;
+
+        Node* bridge_reverse = split_polygon(bridge, hole);
+        filter_points(bridge_reverse, bridge_reverse->m_next);
+        outer = filter_points(bridge, bridge->m_next);
+    }
+
+    return outer;
+}
+
+// David Eberly's algorithm: the nearest edge to the left of the hole, and from there the
+// vertex that the hole can see with the smallest angle to the horizontal
+auto Triangulator::find_hole_bridge(Node* hole, Node* outer) -> Node* {
+    const double hx = hole->m_x, hy = hole->m_y;
+    double qx = -std::numeric_limits<double>::infinity();
+    Node* m = nullptr;
+
+    Node* p = outer;
+    do {
+        if(hy <= p->m_y && hy >= p->m_next->m_y && p->m_next->m_y != p->m_y) {
+            const double x = p->m_x + (hy - p->m_y) * (p->m_next->m_x - p->m_x) / (p->m_next->m_y - p->m_y);
+            if(x <= hx && x > qx) {
+                qx = x;
+                m = p->m_x < p->m_next->m_x ? p : p->m_next;
+                if(x == hx)
+                    return m;
+            }
+        }
+
+        p = p->m_next;
+    } while(p != outer);
+
+    if(!m)
+        return nullptr;
+
+    // vertices inside the triangle of the hole, the hit on the edge and `m` may block the view
+    Node* stop = m;
+    const double mx = m->m_x, my = m->m_y;
+    double tan_min = std::numeric_limits<double>::infinity();
+
+    p = m;
+    do {
+        if(hx >= p->m_x && p->m_x >= mx && hx != p->m_x &&
+            point_in_triangle(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, p->m_x, p->m_y)) {
+            const double tan = std::abs(hy - p->m_y) / (hx - p->m_x);
+
+            if(locally_inside(p, hole) && (tan < tan_min || (tan == tan_min && (p->m_x > m->m_x ||
+                (p->m_x == m->m_x && area(m->m_prev, m, p->m_prev) < 0.0 && area(p->m_next, m, m->m_next) < 0.0))))) {
+                m = p;
+                tan_min = tan;
+            }
+        }
+
+        p = p->m_next;
+    } while(p != stop);
+
+    return m;
+}
+
+auto Triangulator::split_polygon(Node* a, Node* b) -> Node* {
+    Node* a2 = &m_nodes.emplace_back();
+    a2->m_index = a->m_index;
+    a2->m_x = a->m_x;
+    a2->m_y = a->m_y;
+
+    Node* b2 = &m_nodes.emplace_back();
+    b2->m_index = b->m_index;
+    b2->m_x = b->m_x;
+    b2->m_y = b->m_y;
+
+    Node* an = a->m_next;
+    Node* bp = b->m_prev;
+
+    a->m_next = b;
+    b->m_prev = a;
+
+    a2->m_next = an;
+    an->m_prev = a2;
+
+    b2->m_next = a2;
+    a2->m_prev = b2;
+
+    bp->m_next = b2;
+    b2->m_prev = bp;
+
+    return b2;
+}
+
+void Triangulator::clip_ears(Node* ear, int pass) {
+    if(!ear)
+        return;
+
+    if(pass == 0 && m_inv_size > 0.0)
+        index_curve(ear);
+
+    Node* stop = ear;
+    while(ear->m_prev != ear->m_next) {
+        Node* prev = ear->m_prev;
+        Node* next = ear->m_next;
+
+        if(m_inv_size > 0.0 ? is_ear_hashed(ear) : is_ear(ear)) {
+            emit(prev, ear, next);
+            remove_node(ear);
+
+            // skipping the next vertex leaves fewer sliver triangles
+            ear = next->m_next;
+            stop = next->m_next;
+            continue;
+        }
+
+        ear = next;
+
+        // a whole round without an ear
+        if(ear == stop) {
+            if(pass == 0)
+                clip_ears(filter_points(ear), 1);
+            else if(pass == 1)
+                clip_ears(cure_local_intersections(filter_points(ear)), 2);
+            else
+                split_clip_ears(ear);
+
+            break;
+        }
+    }
+}
+
+bool Triangulator::is_ear(const Node* ear) const {
+    const Node* a = ear->m_prev;
+    const Node* b = ear;
+    const Node* c = ear->m_next;
+
+    // reflex
+    if(area(a, b, c) >= 0.0)
+        return false;
+
+    const double x0 = std::min({ a->m_x, b->m_x, c->m_x }), y0 = std::min({ a->m_y, b->m_y, c->m_y });
+    const double x1 = std::max({ a->m_x, b->m_x, c->m_x }), y1 = std::max({ a->m_y, b->m_y, c->m_y });
+
+    for(const Node* p = c->m_next; p != a; p = p->m_next) {
+        if(p->m_x >= x0 && p->m_x <= x1 && p->m_y >= y0 && p->m_y <= y1 &&
+            point_in_triangle(a->m_x, a->m_y, b->m_x, b->m_y, c->m_x, c->m_y, p->m_x, p->m_y) &&
+            area(p->m_prev, p, p->m_next) >= 0.0)
+            return false;
+    }
+
+    return true;
+}
+
+bool Triangulator::is_ear_hashed(const Node* ear) const {
+    const Node* a = ear->m_prev;
+    const Node* b = ear;
+    const Node* c = ear->m_next;
+
+    if(area(a, b, c) >= 0.0)
+        return false;
+
+    const double x0 = std::min({ a->m_x, b->m_x, c->m_x }), y0 = std::min({ a->m_y, b->m_y, c->m_y });
+    const double x1 = std::max({ a->m_x, b->m_x, c->m_x }), y1 = std::max({ a->m_y, b->m_y, c->m_y });
+
+    // only vertices between the z-orders of the corners of the bounding box can be in it
+    const uint32_t min_z = z_order(x0, y0);
+    const uint32_t max_z = z_order(x1, y1);
+
+    auto blocks = [&](const Node* p) {
+        return p->m_x >= x0 && p->m_x <= x1 && p->m_y >= y0 && p->m_y <= y1 && p != a && p != c &&
+            point_in_triangle(a->m_x, a->m_y, b->m_x, b->m_y, c->m_x, c->m_y, p->m_x, p->m_y) &&
+            area(p->m_prev, p, p->m_next) >= 0.0;
+    };
+
+    // both directions at once, the ear is usually rejected by a near neighbour
+    const Node* p = ear->m_prev_z;
+    const Node* n = ear->m_next_z;
+    while(p && p->m_z >= min_z && n && n->m_z <= max_z) {
+        if(blocks(p) || blocks(n))
+            return false;
+
+        p = p->m_prev_z;
+        n = n->m_next_z;
+    }
+
+    for(; p && p->m_z >= min_z; p = p->m_prev_z) {
+        if(blocks(p))
+            return false;
+    }
+
+    for(; n && n->m_z <= max_z; n = n->m_next_z) {
+        if(blocks(n))
+            return false;
+    }
+
+    return true;
+}
+
+auto Triangulator::cure_local_intersections(Node* start) -> Node* {
+    Node* p = start;
+    do {
+        Node* a = p->m_prev;
+        Node* b = p->m_next->m_next;
+
+        if(!equals(a, b) && intersects(a, p, p->m_next, b) && locally_inside(a, b) && locally_inside(b, a)) {
+            emit(a, p, b);
+
+            remove_node(p);
+            remove_node(p->m_next);
+
+            p = start = b;
+        }
+
+        p = p->m_next;
+    } while(p != start);
+
+    return filter_points(p);
+}
+
+void Triangulator::split_clip_ears(Node* start) {
+    Node* a = start;
+    do {
+        for(Node* b = a->m_next->m_next; b != a->m_prev; b = b->m_next) {
+            if(a->m_index != b->m_index && is_valid_diagonal(a, b)) {
+                Node* c = split_polygon(a, b);
+
+                a = filter_points(a, a->m_next);
+                c = filter_points(c, c->m_next);
+
+                clip_ears(a, 0);
+                clip_ears(c, 0);
+                return;
+            }
+        }
+
+        a = a->m_next;
+    } while(a != start);
+}
+
+// links the ring in z-order through `m_prev_z` and `m_next_z`, by a merge sort of the list
+void Triangulator::index_curve(Node* start) {
+    Node* p = start;
+    do {
+        if(p->m_z == 0)
+            p->m_z = z_order(p->m_x, p->m_y);
+
+        p->m_prev_z = p->m_prev;
+        p->m_next_z = p->m_next;
+        p = p->m_next;
+    } while(p != start);
+
+    p->m_prev_z->m_next_z = nullptr;
+    p->m_prev_z = nullptr;
+
+    Node* list = p;
+    size_t in_size = 1;
+    size_t merges;
+    do {
+        p = list;
+        list = nullptr;
+        Node* tail = nullptr;
+        merges = 0;
+
+        while(p) {
+            merges++;
+
+            Node* q = p;
+            size_t p_size = 0;
+            for(size_t i = 0; i < in_size && q; i++) {
+                p_size++;
+                q = q->m_next_z;
+            }
+
+            size_t q_size = in_size;
+            while(p_size > 0 || (q_size > 0 && q)) {
+                Node* e;
+                if(p_size != 0 && (q_size == 0 || !q || p->m_z <= q->m_z)) {
+                    e = p;
+                    p = p->m_next_z;
+                    p_size--;
+                }
+                else {
+                    e = q;
+                    q = q->m_next_z;
+                    q_size--;
+                }
+
+                if(tail)
+                    tail->m_next_z = e;
+                else
+                    list = e;
+
+                e->m_prev_z = tail;
+                tail = e;
+            }
+
+            p = q;
+        }
+
+        tail->m_next_z = nullptr;
+        in_size *= 2;
+    } while(merges > 1);
+}
+
+// interleaves the bits of 15-bit coordinates within the bounds of the polygon
+auto Triangulator::z_order(double x, double y) const -> uint32_t {
+    uint32_t ix = uint32_t((x - m_min_x) * m_inv_size);
+    uint32_t iy = uint32_t((y - m_min_y) * m_inv_size);
+
+    ix = (ix | (ix << 8)) & 0x00FF00FF;
+    ix = (ix | (ix << 4)) & 0x0F0F0F0F;
+    ix = (ix | (ix << 2)) & 0x33333333;
+    ix = (ix | (ix << 1)) & 0x55555555;
+
+    iy = (iy | (iy << 8)) & 0x00FF00FF;
+    iy = (iy | (iy << 4)) & 0x0F0F0F0F;
+    iy = (iy | (iy << 2)) & 0x33333333;
+    iy = (iy | (iy << 1)) & 0x55555555;
+
+    return ix | (iy << 1);
+}
+
+void Triangulator::emit(const Node* a, const Node* b, const Node* c) {
+    m_triangles->push_back(a->m_index);
+    m_triangles->push_back(b->m_index);
+    m_triangles->push_back(c->m_index);
+}
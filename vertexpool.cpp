@@ -0,0 +1,288 @@
+#include "vertexpool.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+VertexPool::VertexPool(bool share_vertices)
+    : m_share_vertices(share_vertices)
+{}
+
+VertexPool::~VertexPool() {
+    if(m_vao)
+        glDeleteVertexArrays(1, &m_vao);
+    if(m_indirect_buffer)
+        glDeleteBuffers(1, &m_indirect_buffer);
+}
+
+template<typename F>
+void VertexPool::for_each_strip(CoordSpan coords, const uint8_t* lod, int level, const uint32_t* ends, size_t strip_count, F emit) {
+    uint32_t first = 0;
+    for(size_t strip = 0; strip < strip_count; strip++) {
+        m_strip.clear();
+        for(uint32_t i = first; i < ends[strip]; i++) {
+            if(lod[i] >= level)
+                m_strip.push_back(i);
+        }
+        first = ends[strip];
+
+        if(m_strip.empty()) {
+            emit(no_coord, no_coord);
+            continue;
+        }
+
+        // a closed ring joins up where it starts, an open strip ends in its first and last vertex
+        const size_t size = m_strip.size();
+        if(size >= 3 && coords[m_strip.front()] == coords[m_strip.back()])
+            emit(m_strip[size - 2], m_strip[1]);
+        else
+            emit(m_strip.front(), m_strip.back());
+    }
+}
+
+auto VertexPool::add(CoordSpan coords, const uint8_t* lod, FillSpan fill, Metadata metadata, const std::vector<uint32_t>& ring_ends) -> VertexRange {
+    VertexRange range;
+    range.m_draw_id = m_draw_count++;
+
+    // a plain way is a single strip
+    const uint32_t whole_way = coords.size();
+    const uint32_t* ends = ring_ends.empty() ? &whole_way : ring_ends.data();
+    const size_t strip_count = ring_ends.empty() ? 1 : ring_ends.size();
+
+    // the vertex of every coordinate at level 0, which the coarser levels and the triangles pick from
+    m_coord_vertices.resize(coords.size());
+
+    GLsizei previous_count = 0;
+    for(int level = 0; level < lod_levels; level++) {
+        GLsizei count = level == 0 ? coords.size() : std::count_if(lod, lod + coords.size(), [&](uint8_t l) { return l >= level; });
+
+        // what the level takes without sharing: its own vertices at level 0, then the
+        // indices of every level that the finer one cannot stand in for
+        if(level == 0)
+            m_unshared_vertex_count += count + 2 * strip_count;
+        else if(level == 1 || count != previous_count)
+            m_unshared_index_count += count + 2 * strip_count;
+
+        // only a range of indices can stand in for another one
+        const bool same_kind = m_share_vertices || level > 1;
+        if(level > 0 && same_kind && count == previous_count) {
+            range.m_first[level] = range.m_first[level - 1];
+            range.m_count[level] = range.m_count[level - 1];
+            continue;
+        }
+
+        previous_count = count;
+        range.m_count[level] = count + 2 * strip_count;
+
+        if(level == 0 && !m_share_vertices) {
+            range.m_first[level] = m_vertex_count;
+            for_each_strip(coords, lod, level, ends, strip_count, [&](uint32_t before, uint32_t after) {
+                push_vertex(before == no_coord ? glm::vec2(0.0f) : coords[before]);
+                for(auto i : m_strip)
+                    m_coord_vertices[i] = push_vertex(coords[i]);
+                push_vertex(after == no_coord ? glm::vec2(0.0f) : coords[after]);
+            });
+            continue;
+        }
+
+        if(level == 0) {
+            for(size_t i = 0; i < coords.size(); i++)
+                m_coord_vertices[i] = intern(coords[i]);
+        }
+
+        range.m_first[level] = m_index_count;
+        for_each_strip(coords, lod, level, ends, strip_count, [&](uint32_t before, uint32_t after) {
+            m_pending_indices.push_back(before == no_coord ? 0 : m_coord_vertices[before]);
+            for(auto i : m_strip)
+                m_pending_indices.push_back(m_coord_vertices[i]);
+            m_pending_indices.push_back(after == no_coord ? 0 : m_coord_vertices[after]);
+        });
+
+        m_index_count += range.m_count[level];
+    }
+
+    GLuint packed;
+    std::memcpy(&packed, &metadata, sizeof(packed));
+    m_pending_metadata.push_back(packed);
+
+    if(fill.empty())
+        return range;
+
+    // the triangles index into level 0 like the coarser levels do
+    for(int level = 0; level < lod_levels; level++) {
+        if(level > 0 && fill.first(level) == fill.first(level - 1)) {
+            range.m_fill_first[level] = range.m_fill_first[level - 1];
+            range.m_fill_count[level] = range.m_fill_count[level - 1];
+            continue;
+        }
+
+        range.m_fill_first[level] = m_index_count;
+        range.m_fill_count[level] = fill.count(level);
+
+        auto indices = fill.indices(level);
+        for(uint32_t i = 0; i < fill.count(level); i++)
+            m_pending_indices.push_back(m_coord_vertices[indices[i]]);
+
+        m_index_count += fill.count(level);
+        m_unshared_index_count += fill.count(level);
+    }
+
+    // drawn with a metadata value of its own, the next draw id
+    m_draw_count++;
+    m_pending_metadata.push_back(packed | fill_flag);
+
+    return range;
+}
+
+void VertexPool::finish() {
+    m_keys = std::vector<uint64_t>();
+    m_values = std::vector<GLuint>();
+    m_lookup_size = 0;
+    m_shift = 64;
+}
+
+auto VertexPool::intern(glm::vec2 coord) -> GLuint {
+    uint64_t key;
+    static_assert(sizeof(key) == sizeof(coord));
+    std::memcpy(&key, &coord, sizeof(key));
+
+    // both halves would have to be NaN
+    assert(key != empty_key);
+
+    // keep the load factor below 0.7
+    if((m_lookup_size + 1) * 10 > m_keys.size() * 7)
+        grow_lookup();
+
+    const size_t mask = m_keys.size() - 1;
+    for(size_t i = slot(key);; i = (i + 1) & mask) {
+        if(m_keys[i] == key)
+            return m_values[i];
+
+        if(m_keys[i] == empty_key) {
+            m_keys[i] = key;
+            m_values[i] = m_vertex_count++;
+            m_lookup_size++;
+
+            m_pending_vertices.push_back(coord);
+            return m_values[i];
+        }
+    }
+}
+
+void VertexPool::grow_lookup() {
+    auto old_keys = std::move(m_keys);
+    auto old_values = std::move(m_values);
+
+    const size_t capacity = std::max(old_keys.size() * 2, size_t(1024));
+    m_keys.assign(capacity, empty_key);
+    m_values.resize(capacity);
+    m_shift = 64;
+    for(size_t c = capacity; c > 1; c >>= 1)
+        m_shift--;
+
+    const size_t mask = capacity - 1;
+    for(size_t j = 0; j < old_keys.size(); j++) {
+        if(old_keys[j] == empty_key)
+            continue;
+
+        size_t i = slot(old_keys[j]);
+        while(m_keys[i] != empty_key)
+            i = (i + 1) & mask;
+
+        m_keys[i] = old_keys[j];
+        m_values[i] = old_values[j];
+    }
+}
+
+bool VertexPool::upload() {
+    if(m_pending_metadata.empty())
+        return false;
+
+    bool reallocated = m_vertices.append(m_pending_vertices.data(), m_pending_vertices.size() * sizeof(glm::vec2));
+    reallocated |= m_indices.append(m_pending_indices.data(), m_pending_indices.size() * sizeof(GLuint));
+    reallocated |= m_metadata.append(m_pending_metadata.data(), m_pending_metadata.size() * sizeof(GLuint));
+
+    m_pending_vertices.clear();
+    m_pending_indices.clear();
+    m_pending_metadata.clear();
+
+    if(!reallocated)
+        return true;
+
+    // a grown buffer has a new name, which the vertex array has to pick up
+    if(!m_vao)
+        glGenVertexArrays(1, &m_vao);
+
+    glBindVertexArray(m_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertices.id());
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), nullptr);
+    glEnableVertexAttribArray(0);
+
+    // one metadata value per way, the draw id of a command is its base instance
+    glBindBuffer(GL_ARRAY_BUFFER, m_metadata.id());
+    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(GLuint), nullptr);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(1);
+
+    if(m_indices.id())
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indices.id());
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+auto VertexPool::draw(const DrawList& list, DrawPass pass) -> size_t {
+    const bool indexed = list.is_indexed();
+    assert(indexed || !m_share_vertices);
+
+    const size_t command_count = pass == DRAW_FILLS ? list.fill_command_count() : list.command_count() - list.fill_command_count();
+    if(!m_vao || command_count == 0)
+        return 0;
+
+    if(!m_indirect_buffer)
+        glGenBuffers(1, &m_indirect_buffer);
+
+    // all batches of the pass back to back
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirect_buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, command_count * sizeof(DrawList::Command), nullptr, GL_STREAM_DRAW);
+
+    size_t offset = 0;
+    auto upload_batch = [&](const std::vector<DrawList::Command>& batch) {
+        glBufferSubData(GL_DRAW_INDIRECT_BUFFER, offset, batch.size() * sizeof(DrawList::Command), batch.data());
+        offset += batch.size() * sizeof(DrawList::Command);
+    };
+
+    for(int priority = 0; priority < __DRAW_PRIO_LAST; priority++) {
+        auto& batch = pass == DRAW_FILLS ? list.fill_batch(priority) : list.batch(priority);
+        if(!batch.empty())
+            upload_batch(batch);
+    }
+
+    glBindVertexArray(m_vao);
+
+    offset = 0;
+    size_t calls = 0;
+    const GLsizei stride = sizeof(DrawList::Command);
+
+    for(int priority = 0; priority < __DRAW_PRIO_LAST; priority++) {
+        auto& batch = pass == DRAW_FILLS ? list.fill_batch(priority) : list.batch(priority);
+        if(batch.empty())
+            continue;
+
+        auto commands = reinterpret_cast<const void*>(offset);
+
+        if(pass == DRAW_FILLS)
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, commands, batch.size(), stride);
+        else if(indexed)
+            glMultiDrawElementsIndirect(GL_LINE_STRIP_ADJACENCY, GL_UNSIGNED_INT, commands, batch.size(), stride);
+        else
+            glMultiDrawArraysIndirect(GL_LINE_STRIP_ADJACENCY, commands, batch.size(), stride);
+
+        offset += batch.size() * stride;
+        calls++;
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    return calls;
+}
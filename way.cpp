@@ -1,15 +1,19 @@
 #include "way.hpp"
 #include "log.hpp"
+#include "phasetimer.hpp"
+#include "triangulate.hpp"
 
 #include <GL/glew.h>
 
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/norm.hpp>
+
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
-#include <iomanip>
-#include <numeric>
 #include <string>
 #include <unordered_map>
-#include <fstream>
+#include <utility>
 
 const DrawPriority classification_draw_priorities[] {
     DrawPriority::BUILDING, // UNKNOWN
@@ -118,213 +122,248 @@ static std::unordered_map<std::string, Metadata::Classification> power_classific
     {"substation", Metadata::Classification::POWER_DISTRIBUTION}
 });
 
-Metadata::Metadata(std::unordered_map<std::string, std::string>& tags) {
-    m_classification = Metadata::UNKNOWN;
+// `Tags` has `find(std::string_view key) -> std::optional<std::string_view>`
+template<typename Tags>
+static auto classify(const Tags& tags) -> Metadata {
+    Metadata metadata;
+    if(tags.empty())
+        return metadata;
 
-    auto highway = tags.find("highway");
-    if(highway != tags.end()) {
-        auto classification = highway_classifications.find(highway->second);
+    if(auto highway = tags.find("highway")) {
+        auto classification = highway_classifications.find(std::string(*highway));
         if(classification == highway_classifications.end())
-            m_classification = Metadata::Classification::HIGHWAY_UNCLASSIFIED;
+            metadata.m_classification = Metadata::Classification::HIGHWAY_UNCLASSIFIED;
         else
-            m_classification = classification->second;
+            metadata.m_classification = classification->second;
 
-        m_line_width = std::max(highway_widths[m_classification], GLbyte(1));
+        // no `operator[]`, ways are classified on several threads at once
+        auto width = highway_widths.find(metadata.m_classification);
+        metadata.m_line_width = width == highway_widths.end() ? 1 : std::max(width->second, GLbyte(1));
     }
 
-    auto footway = tags.find("footway");
-    if(footway != tags.end()) {
-        auto classification = footway_classification.find(footway->second);
+    if(auto footway = tags.find("footway")) {
+        auto classification = footway_classification.find(std::string(*footway));
         if(classification != footway_classification.end())
-            m_classification = classification->second;
+            metadata.m_classification = classification->second;
     }
 
-    auto railway = tags.find("railway");
-    if(railway != tags.end())
-        m_classification = Metadata::Classification::RAILWAY;
+    if(tags.find("railway"))
+        metadata.m_classification = Metadata::Classification::RAILWAY;
 
-    auto landuse = tags.find("landuse");
-    if(landuse != tags.end()) {
-        auto classification = landuse_classification.find(landuse->second);
+    if(auto landuse = tags.find("landuse")) {
+        auto classification = landuse_classification.find(std::string(*landuse));
         if(classification != landuse_classification.end())
-            m_classification = classification->second;
+            metadata.m_classification = classification->second;
     }
 
-    auto waterway = tags.find("waterway");
-    if(waterway != tags.end())
-        m_classification = Metadata::Classification::WATERWAY;
+    if(tags.find("waterway"))
+        metadata.m_classification = Metadata::Classification::WATERWAY;
 
-    auto water = tags.find("water");
-    if(water != tags.end())
-        m_classification = Metadata::Classification::LAKE;
+    if(tags.find("water"))
+        metadata.m_classification = Metadata::Classification::LAKE;
 
-    auto power = tags.find("power");
-    if(power != tags.end()) {
-        auto classification = power_classification.find(power->second);
+    if(auto power = tags.find("power")) {
+        auto classification = power_classification.find(std::string(*power));
         if(classification != power_classification.end())
-            m_classification = classification->second;
+            metadata.m_classification = classification->second;
         else
-            m_classification = Metadata::Classification::POWER_DISTRIBUTION;
+            metadata.m_classification = Metadata::Classification::POWER_DISTRIBUTION;
     }
+
+    return metadata;
 }
 
-void Way::create_buffers() {
-    glGenVertexArrays(1, &m_vao);
-    glGenBuffers(1, &m_vbo);
+Metadata::Metadata(const TagSet& tags)
+    : Metadata(classify(tags))
+{}
 
-    assert(m_vao != 0);
-    assert(m_vbo != 0);
+Metadata::Metadata(const RawTags& tags)
+    : Metadata(classify(tags))
+{}
 
-//    if((m_indices = triangulate_polygon())) {
-    if(false) {
-        glGenBuffers(1, &m_ebo);
-        assert(m_ebo != 0);
+void Way::set_rings(std::vector<uint32_t> ring_ends, uint32_t outer_rings) {
+    m_rings = std::make_unique<Rings>();
+    m_rings->m_ends = std::move(ring_ends);
+    m_rings->m_outer_count = outer_rings;
+}
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices->size() * sizeof(GLint), &(*m_indices)[0], GL_STATIC_DRAW);
-    }
+auto Way::get_ring_ends(int lod_level) const -> const std::vector<uint32_t>& {
+    static const std::vector<uint32_t> no_rings;
+    if(!m_rings)
+        return no_rings;
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_vbo);
-    glBufferData(GL_ARRAY_BUFFER, m_nodes.size() * sizeof(Node), &m_nodes[0], GL_STATIC_DRAW);
+    return lod_level == 0 ? m_rings->m_ends : m_rings->m_lod_ends[lod_level - 1];
+}
 
-    glBindVertexArray(m_vao);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Node), nullptr);
-    glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(Node), (void*) offsetof(Node, m_metadata));
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+// roughly 1 m, 8 m and 60 m at the equator
+const float lod_tolerances[lod_levels] = { 0.0f, 4e-5f, 3.2e-4f, 2.56e-3f };
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    if(m_ebo)
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+auto lod_level_for(float max_error) -> int {
+    int level = 0;
+    while(level + 1 < lod_levels && lod_tolerances[level + 1] <= max_error)
+        level++;
 
-    glBindVertexArray(0);
+    return level;
+}
+
+static inline float distance2_to_segment(glm::vec2 coord, glm::vec2 v, glm::vec2 w) {
+    auto segment = w - v;
+    float length2 = glm::length2(segment);
+    float t = length2 > 0.0f ? std::clamp(glm::dot(coord - v, segment) / length2, 0.0f, 1.0f) : 0.0f;
 
-  /*  if(m_id == 119742686) {
+    return glm::distance2(coord, v + t * segment);
+}
 
-        std::ofstream output("extract.txt");
-        
-        for(auto& node : m_nodes) {
-            output << std::setprecision(9) << node.m_coord.x << "," << node.m_coord.y << std::endl;
+// Douglas-Peucker from `first` to `last`, but instead of dropping the vertices within a tolerance
+// it records the level each one is dropped at. A vertex never gets a coarser level than the one
+// that split its span, so that the levels nest.
+static void simplify_span(const std::vector<glm::vec2>& coords, size_t first, size_t last, uint8_t* lod) {
+    struct Span {
+        size_t m_first, m_last;
+        uint8_t m_max_level;
+    };
+
+    constexpr uint8_t top_level = lod_levels - 1;
+    lod[first] = top_level;
+    lod[last] = top_level;
+
+    static thread_local std::vector<Span> stack;
+    stack.clear();
+    stack.push_back({ first, last, top_level });
+
+    while(!stack.empty()) {
+        auto span = stack.back();
+        stack.pop_back();
+
+        if(span.m_last - span.m_first < 2)
+            continue;
+
+        float max_distance2 = -1.0f;
+        size_t split = span.m_first + 1;
+        for(size_t i = span.m_first + 1; i < span.m_last; i++) {
+            float distance2 = distance2_to_segment(coords[i], coords[span.m_first], coords[span.m_last]);
+            if(distance2 > max_distance2) {
+                max_distance2 = distance2;
+                split = i;
+            }
         }
 
-        output.close();
-    } */
-}
+        uint8_t level = 0;
+        while(level < span.m_max_level && max_distance2 >= lod_tolerances[level + 1] * lod_tolerances[level + 1])
+            level++;
 
-void Way::draw_buffers() {
-    glBindVertexArray(m_vao);
-    glLineWidth(m_metadata.m_line_width);
-    
-    if(m_ebo)
-        glDrawElements(GL_TRIANGLES, m_indices->size(), GL_UNSIGNED_INT, &(*m_indices)[0]);
-    else
-        glDrawArrays(GL_LINE_STRIP, 0, m_nodes.size());
+        lod[split] = level;
+        stack.push_back({ span.m_first, split, level });
+        stack.push_back({ split, span.m_last, level });
+    }
 }
 
-void Way::draw_highlighted_buffers() {
-    glBindVertexArray(m_vao);
-    glLineWidth(4);
-    glDrawArrays(GL_LINE_STRIP, 0, m_nodes.size());
-}
+void Way::build_lod() {
+    m_lod.assign(m_coords.size(), 0);
+    if(m_coords.empty())
+        return;
 
-bool Way::is_area() const {
-    return (
-        m_tags.find("area") != m_tags.end() || 
-        m_metadata.m_classification == Metadata::Classification::LANDUSE_FOREST ||
-//        m_metadata.m_classification == Metadata::Classification::LANDUSE_AGRICULTURAL ||
-        m_metadata.m_classification == Metadata::Classification::LAKE
-    ) && m_nodes.front() == m_nodes.back();
-}
+    if(!m_rings) {
+        simplify_span(m_coords, 0, m_coords.size() - 1, m_lod.data());
+        return;
+    }
+
+    uint32_t first = 0;
+    for(auto end : m_rings->m_ends) {
+        if(end > first)
+            simplify_span(m_coords, first, end - 1, m_lod.data());
+        first = end;
+    }
 
-static inline float cross_product_z(glm::vec2 a, glm::vec2 b) {
-    return a.x * b.y - a.y * b.x;
+    index_rings(m_lod.data());
 }
 
-static inline bool is_point_in_triangle(glm::vec2 p, glm::vec2 a, glm::vec2 b, glm::vec2 c) {
-    glm::vec2 ab = b - a, bc = c - b, ca = a - c;
-    glm::vec2 ap = p - a, bp = p - b, cp = p - c;
+void Way::index_rings(const uint8_t* lod) {
+    if(!m_rings)
+        return;
 
-    return cross_product_z(ab, ap) <= 0.0f && cross_product_z(bc, bp) <= 0.0f && cross_product_z(ca, cp) <= 0.0f;
-}
+    for(int level = 1; level < lod_levels; level++) {
+        auto& ends = m_rings->m_lod_ends[level - 1];
+        ends.clear();
 
-static inline GLuint get_index(const std::vector<GLuint>& indices, std::int64_t i) {
-    return indices[(i + indices.size()) % indices.size()];
+        uint32_t count = 0, i = 0;
+        for(auto end : m_rings->m_ends) {
+            for(; i < end; i++)
+                count += lod[i] >= level;
+            ends.push_back(count);
+        }
+    }
 }
 
-std::optional<std::vector<GLuint>> Way::triangulate_polygon() {
-    if(!is_area() || triangle_count() < 3)
-        return std::nullopt;
+bool Way::is_area() const {
+    // every ring of a multipolygon is closed
+    return m_metadata.is_filled() && m_coords.size() > 3 && (is_multipolygon() || m_coords.front() == m_coords.back());
+}
 
-    if(get_winding_order() != WindingOrder::CLOCKWISE)
-        std::reverse(m_nodes.begin(), m_nodes.end());
+void Way::build_fill() {
+    m_fill.clear();
+    if(!is_area())
+        return;
 
-    std::vector<GLuint> remaining_indices(relevant_vertices_count()); // TODO: maybe set<int>?
-    std::iota(remaining_indices.begin(), remaining_indices.end(), 0);
+    PhaseTimer timer(PHASE_TRIANGULATE);
 
-    std::vector<GLuint> indices(triangle_count() * 3);
-    
-    while(remaining_indices.size() > 3) {
-        bool ear_found = false;
+    static thread_local Triangulator triangulator;
+    static thread_local std::vector<glm::vec2> level_coords;
+    static thread_local std::vector<uint32_t> level_indices, level_triangles, single_ring;
 
-        for(std::int64_t i = 0; i < static_cast<std::int64_t>(remaining_indices.size()); i++) {
-            GLuint a = get_index(remaining_indices, i);
-            GLuint b = get_index(remaining_indices, i - 1);
-            GLuint c = get_index(remaining_indices, i + 1);
+    const bool timed = phase_timing_enabled();
+    const auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
 
-            glm::vec2 va = m_nodes[a].m_coord;
-            glm::vec2 vb = m_nodes[b].m_coord;
-            glm::vec2 vc = m_nodes[c].m_coord;
+    // the first and the count of every level, ahead of the triangles
+    m_fill.assign(2 * lod_levels, 0);
 
-            if(cross_product_z(vb - va, vc - va) < 0.0f)
-                continue;
+    size_t finer_count = 0;
+    for(int level = 0; level < lod_levels; level++) {
+        const size_t count = level == 0 ? m_coords.size() : std::count_if(m_lod.begin(), m_lod.end(), [&](uint8_t l) { return l >= level; });
 
-            bool is_ear = true;
+        // the same vertices as the finer level, so the same triangles
+        if(level > 0 && count == finer_count) {
+            m_fill[level] = m_fill[level - 1];
+            m_fill[lod_levels + level] = m_fill[lod_levels + level - 1];
+            continue;
+        }
 
-            for(GLuint j = 0; j < relevant_vertices_count(); j++) {
-                if(j == a || j == b || j == c)
-                    continue;
+        finer_count = count;
+        const uint32_t first = m_fill.size() - 2 * lod_levels;
 
-                glm::vec2 p = m_nodes[j].m_coord;
+        // a plain way is a single ring
+        single_ring.assign(1, count);
+        const auto& ring_ends = m_rings ? get_ring_ends(level) : single_ring;
+        const uint32_t outer_rings = m_rings ? m_rings->m_outer_count : 1;
 
-                if(is_point_in_triangle(p, vb, va, vc)) {
-                    is_ear = false;
-                    break;
+        if(level == 0) {
+            triangulator.triangulate(m_coords, ring_ends, outer_rings, m_fill);
+        }
+        else {
+            // the vertices of the level, and where each of them is in level 0
+            level_coords.clear();
+            level_indices.clear();
+            for(size_t i = 0; i < m_coords.size(); i++) {
+                if(m_lod[i] >= level) {
+                    level_coords.push_back(m_coords[i]);
+                    level_indices.push_back(i);
                 }
             }
 
-            if(is_ear) {
-                indices.push_back(b);
-                indices.push_back(a);
-                indices.push_back(c);
-
-                remaining_indices.erase(remaining_indices.begin() + i);
-                ear_found = true;
-                break;
-            }
+            level_triangles.clear();
+            triangulator.triangulate(level_coords, ring_ends, outer_rings, level_triangles);
+            for(auto index : level_triangles)
+                m_fill.push_back(level_indices[index]);
         }
 
-        if(!ear_found) {
-            mlog::logln(mlog::WARN, "Way %lu: no suitable polygon", m_id);
-            return std::nullopt;
-        }
+        m_fill[level] = first;
+        m_fill[lod_levels + level] = m_fill.size() - 2 * lod_levels - first;
     }
 
-    indices.push_back(remaining_indices[0]);
-    indices.push_back(remaining_indices[1]);
-    indices.push_back(remaining_indices[2]);
-
-    return indices;
-}
-
-WindingOrder Way::get_winding_order() const {
-    double sum = 0.0f;
-    for(size_t i = 0; i < m_nodes.size(); i++) {
-        glm::vec2 cur = m_nodes[i].m_coord;
-        glm::vec2 next = m_nodes[(i + 1) % m_nodes.size()].m_coord;
-
-        sum += (next.x - cur.x) * (next.y - cur.y);
-    }
+    if(timed)
+        count_triangulated(m_coords.size(), (m_fill.size() - 2 * lod_levels) / 3, std::chrono::steady_clock::now() - start);
 
-    return sum > 0.0 ? WindingOrder::CLOCKWISE : WindingOrder::COUNTER_CLOCKWISE;
+    // nothing but degenerate rings
+    if(m_fill.size() == 2 * lod_levels)
+        m_fill.clear();
 }
-
@@ -0,0 +1,110 @@
+#include "wayarena.hpp"
+#include "phasetimer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <new>
+#include <utility>
+
+WayArena::WayArena() = default;
+
+WayArena::~WayArena() {
+    for(size_t i = 0; i < m_size; i++)
+        (*this)[i].~Way();
+
+    std::allocator<Way> allocator;
+    for(auto chunk : m_chunks)
+        allocator.deallocate(chunk, chunk_size);
+}
+
+template<typename T>
+auto WayArena::Blocks<T>::append(const std::vector<T>& values) -> const T* {
+    if(values.empty())
+        return nullptr;
+
+    T* data;
+    if(values.size() > block_size / 4) {
+        // long ways get a block of their own instead of wasting the rest of the current one;
+        // it goes in front so that the last block stays the one being filled
+        m_blocks.insert(m_blocks.begin(), std::make_unique<T[]>(values.size()));
+        m_capacity += values.size();
+        data = m_blocks.front().get();
+    }
+    else {
+        if(m_block_used + values.size() > block_size) {
+            m_blocks.push_back(std::make_unique<T[]>(block_size));
+            m_capacity += block_size;
+            m_block_used = 0;
+        }
+
+        data = m_blocks.back().get() + m_block_used;
+        m_block_used += values.size();
+    }
+
+    std::copy(values.begin(), values.end(), data);
+    return data;
+}
+
+auto WayArena::emplace(Way&& way) -> WayHandle {
+    assert(m_size < no_way);
+
+    if(m_size == m_chunks.size() * chunk_size)
+        m_chunks.push_back(std::allocator<Way>().allocate(chunk_size));
+
+    m_metadata.push_back(way.get_metadata());
+
+    new (&m_chunks.back()[m_size & chunk_mask]) Way(std::move(way));
+    return m_size++;
+}
+
+auto WayArena::add(Way&& way) -> WayHandle {
+    if(!way.has_lod()) {
+        PhaseTimer timer(PHASE_GEOMETRY);
+        way.build_lod();
+        way.build_fill();
+    }
+
+    auto coords = way.take_coords();
+    auto lod = way.take_lod();
+    auto fill = way.take_fill();
+
+    Geometry geometry;
+    geometry.m_coords = m_coords.append(coords);
+    geometry.m_lod = m_lod.append(lod);
+    geometry.m_fill = m_fill.append(fill);
+    geometry.m_size = coords.size();
+    geometry.m_fill_size = fill.size();
+
+    m_geometry.push_back(geometry);
+    m_vertex_count += geometry.m_size;
+    return emplace(std::move(way));
+}
+
+auto WayArena::add(Way&& way, MappedGeometry mapped) -> WayHandle {
+    assert(way.get_coords().empty());
+
+    Geometry geometry;
+    geometry.m_coords = mapped.m_coords.begin();
+    geometry.m_lod = mapped.m_lod;
+    geometry.m_size = mapped.m_coords.size();
+    geometry.m_fill = mapped.m_fill.data();
+    geometry.m_fill_size = mapped.m_fill.size();
+
+    // the ways of one mapping come one after the other
+    if(m_mappings.empty() || m_mappings.back() != mapped.m_file)
+        m_mappings.push_back(std::move(mapped.m_file));
+
+    m_geometry.push_back(geometry);
+    m_vertex_count += geometry.m_size;
+    m_mapped_bytes += geometry.m_size * (sizeof(glm::vec2) + sizeof(uint8_t)) + geometry.m_fill_size * sizeof(uint32_t);
+    return emplace(std::move(way));
+}
+
+void WayArena::shrink_to_fit() {
+    m_geometry.shrink_to_fit();
+    m_metadata.shrink_to_fit();
+}
+
+auto WayArena::geometry_bytes() const -> size_t {
+    return m_coords.bytes() + m_lod.bytes() + m_fill.bytes() + m_geometry.capacity() * sizeof(Geometry) + m_metadata.capacity() * sizeof(Metadata);
+}